@@ -99,6 +99,107 @@ bool            Free(void* pointer)
     return true;
 }
 
+#ifdef ZHLT_NOZEROALLOC
+// =====================================================================================
+//  AllocBlockNoZero
+// =====================================================================================
+void*           AllocBlockNoZero(const unsigned long size)
+{
+    HANDLE          h;
+
+    if (!size)
+    {
+        Warning("Attempting to allocate 0 bytes");
+    }
+
+    h = GlobalAlloc(GMEM_FIXED, size);
+#ifdef HLRAD_HLASSUMENOMEMORY
+	hlassume (h != NULL, assume_NoMemory);
+#endif
+
+    if (h)
+    {
+        return GlobalLock(h);
+    }
+    else
+    {
+        return NULL;
+    }
+}
+
+// =====================================================================================
+//  AllocNoZero
+// =====================================================================================
+void*           AllocNoZero(const unsigned long size)
+{
+    HeapCheck();
+    return malloc(size);
+}
+
+// =====================================================================================
+//  AllocHuge
+//      Large pages need SeLockMemoryPrivilege, which a compile tool doesn't have, so this
+//      is plain VirtualAlloc; committed pages are zero and only touched when first used.
+// =====================================================================================
+typedef struct
+{
+    void*           base;
+    bool            onheap;
+} hugeheader_t;
+#define HUGE_HEADER_SIZE 64 // keeps the returned pointer cache line aligned
+#define HUGE_MIN_SIZE (1 << 20)
+
+void*           AllocHuge(const unsigned long size)
+{
+    char*           base;
+    hugeheader_t*   header;
+    bool            onheap = size < HUGE_MIN_SIZE;
+
+    if (!size)
+    {
+        Warning("Attempting to allocate 0 bytes");
+    }
+
+    if (onheap)
+    {
+        base = (char*)calloc(1, size + HUGE_HEADER_SIZE);
+    }
+    else
+    {
+        base = (char*)VirtualAlloc(NULL, size + HUGE_HEADER_SIZE, MEM_COMMIT | MEM_RESERVE, PAGE_READWRITE);
+    }
+    if (!base)
+    {
+        return NULL;
+    }
+    header = (hugeheader_t*)base;
+    header->base = base;
+    header->onheap = onheap;
+    return base + HUGE_HEADER_SIZE;
+}
+
+// =====================================================================================
+//  FreeHuge
+// =====================================================================================
+bool            FreeHuge(void* pointer)
+{
+    hugeheader_t*   header;
+
+    if (!pointer)
+    {
+        Warning("Freeing a null pointer");
+        return false;
+    }
+    header = (hugeheader_t*)((char*)pointer - HUGE_HEADER_SIZE);
+    if (header->onheap)
+    {
+        free(header->base);
+        return true;
+    }
+    return VirtualFree(header->base, 0, MEM_RELEASE) != 0;
+}
+#endif
+
 #endif /// ********* WIN32 **********
 
 
@@ -116,6 +217,9 @@ bool            Free(void* pointer)
 #include "cmdlib.h"
 #include "messages.h"
 #include "log.h"
+#ifdef ZHLT_NOZEROALLOC
+#include <sys/mman.h>
+#endif
 
 // =====================================================================================
 //  AllocBlock
@@ -158,4 +262,101 @@ bool            Free(void* pointer)
     return FreeBlock(pointer);
 }
 
+#ifdef ZHLT_NOZEROALLOC
+// =====================================================================================
+//  AllocBlockNoZero
+// =====================================================================================
+void*           AllocBlockNoZero(const unsigned long size)
+{
+    if (!size)
+    {
+        Warning("Attempting to allocate 0 bytes");
+    }
+    return malloc(size);
+}
+
+// =====================================================================================
+//  AllocNoZero
+// =====================================================================================
+void*           AllocNoZero(const unsigned long size)
+{
+    return AllocBlockNoZero(size);
+}
+
+// =====================================================================================
+//  AllocHuge
+//      Anonymous mappings are zero and only touched when first used. The returned block
+//      starts on a huge page boundary so that transparent huge pages can back all of it.
+// =====================================================================================
+typedef struct
+{
+    void*           base;
+    size_t          length;     // 0 when the block came from the heap
+} hugeheader_t;
+#define HUGE_HEADER_SIZE 64 // keeps the returned pointer cache line aligned
+#define HUGE_MIN_SIZE (1 << 20)
+#define HUGE_PAGE_SIZE (2 << 20)
+
+void*           AllocHuge(const unsigned long size)
+{
+    char*           base;
+    char*           pointer;
+    hugeheader_t*   header;
+
+    if (!size)
+    {
+        Warning("Attempting to allocate 0 bytes");
+    }
+
+    if (size < HUGE_MIN_SIZE)
+    {
+        base = (char*)calloc(1, size + HUGE_HEADER_SIZE);
+        if (!base)
+        {
+            return NULL;
+        }
+        header = (hugeheader_t*)base;
+        header->base = base;
+        header->length = 0;
+        return base + HUGE_HEADER_SIZE;
+    }
+
+    size_t          length = (size_t)size + HUGE_HEADER_SIZE + HUGE_PAGE_SIZE;
+    base = (char*)mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (base == (char*)MAP_FAILED)
+    {
+        return NULL;
+    }
+    pointer = (char*)(((size_t)base + HUGE_HEADER_SIZE + HUGE_PAGE_SIZE - 1) & ~(size_t)(HUGE_PAGE_SIZE - 1));
+#ifdef MADV_HUGEPAGE
+    madvise(pointer, size, MADV_HUGEPAGE); // only a hint; ignore kernels without THP
+#endif
+    header = (hugeheader_t*)(pointer - HUGE_HEADER_SIZE);
+    header->base = base;
+    header->length = length;
+    return pointer;
+}
+
+// =====================================================================================
+//  FreeHuge
+// =====================================================================================
+bool            FreeHuge(void* pointer)
+{
+    hugeheader_t*   header;
+
+    if (!pointer)
+    {
+        Warning("Freeing a null pointer");
+        return false;
+    }
+    header = (hugeheader_t*)((char*)pointer - HUGE_HEADER_SIZE);
+    if (!header->length)
+    {
+        free(header->base);
+        return true;
+    }
+    return munmap(header->base, header->length) == 0;
+}
+#endif
+
 #endif /// ********* POSIX **********
@@ -12,6 +12,23 @@ extern bool     FreeBlock(void* pointer);
 extern void*    Alloc(unsigned long size);
 extern bool     Free(void* pointer);
 
+#ifdef ZHLT_NOZEROALLOC
+// Same as AllocBlock/Alloc but the contents are undefined; for buffers that are written before they are read.
+// Release with FreeBlock/Free.
+extern void*    AllocBlockNoZero(unsigned long size);
+extern void*    AllocNoZero(unsigned long size);
+
+// Zero-filled allocation straight from the OS pages, asking for huge pages where they are available.
+// Small sizes fall back to the heap. Release with FreeHuge only.
+extern void*    AllocHuge(unsigned long size);
+extern bool     FreeHuge(void* pointer);
+#else
+#define AllocBlockNoZero AllocBlock
+#define AllocNoZero Alloc
+#define AllocHuge AllocBlock
+#define FreeHuge FreeBlock
+#endif
+
 #if defined(CHECK_HEAP)
 extern void     HeapCheck();
 #else
@@ -8,6 +8,7 @@
 #include "scriplib.h"
 #include "blockmem.h"
 #include "checksum.h"
+#include "threads.h"
 #include "texturecollection.h"
 #include "texturecollectionreader.h"
 #include "texturecollectionwriter.h"
@@ -21,11 +22,11 @@ int		g_max_map_lightdata = DEFAULT_MAX_MAP_LIGHTDATA;
 bool		g_found_extradata = false;
 
 int		g_nummodels;
-dmodel_t		g_dmodels[MAX_MAP_MODELS];
+dmodel_t*		g_dmodels;
 int		g_dmodels_checksum;
 
 int		g_visdatasize;
-byte		g_dvisdata[MAX_MAP_VISIBILITY];
+byte*		g_dvisdata;
 int		g_dvisdata_checksum;
 
 int		g_lightdatasize;
@@ -41,57 +42,53 @@ int g_TextureCollectionChecksum;
 TextureDirectoryListing g_TexDirListing;
 
 int		g_entdatasize;
-char		g_dentdata[MAX_MAP_ENTSTRING];
+char*		g_dentdata;
 int		g_dentdata_checksum;
 
 int		g_numleafs;
-dleaf_t		g_dleafs[MAX_MAP_LEAFS];
+dleaf_t*		g_dleafs;
 int		g_dleafs_checksum;
 
 int		g_numplanes;
-dplane_t		g_dplanes[MAX_INTERNAL_MAP_PLANES];
+dplane_t*		g_dplanes;
 int		g_dplanes_checksum;
 
 int		g_numvertexes;
-dvertex_t		g_dvertexes[MAX_MAP_VERTS];
+dvertex_t*		g_dvertexes;
 int		g_dvertexes_checksum;
 
 int		g_numnodes;
-dnode_t		g_dnodes[MAX_MAP_NODES];
+dnode_t*		g_dnodes;
 int		g_dnodes_checksum;
 
 int		g_numtexinfo;
-#ifdef HLCSG_HLBSP_REDUCETEXTURE
-texinfo_t		g_texinfo[MAX_INTERNAL_MAP_TEXINFO];
-#else
-texinfo_t		g_texinfo[MAX_MAP_TEXINFO];
-#endif
+texinfo_t*		g_texinfo;
 int		g_texinfo_checksum;
 
 int		g_numfaces;
-dface_t		g_dfaces[MAX_MAP_FACES];
+dface_t*		g_dfaces;
 int		g_dfaces_checksum;
 
 #ifdef ZHLT_XASH2
 int		g_numclipnodes[MAX_MAP_HULLS - 1];
-dclipnode_t	g_dclipnodes[MAX_MAP_HULLS - 1][MAX_MAP_CLIPNODES];
+dclipnode_t*	g_dclipnodes[MAX_MAP_HULLS - 1];
 int		g_dclipnodes_checksum[MAX_MAP_HULLS - 1];
 #else
 int		g_numclipnodes;
-dclipnode_t	g_dclipnodes[MAX_MAP_CLIPNODES];
+dclipnode_t*	g_dclipnodes;
 int		g_dclipnodes_checksum;
 #endif
 
 int		g_numedges;
-dedge_t		g_dedges[MAX_MAP_EDGES];
+dedge_t*		g_dedges;
 int		g_dedges_checksum;
 
 int		g_nummarksurfaces;
-unsigned short	g_dmarksurfaces[MAX_MAP_MARKSURFACES];
+unsigned short*	g_dmarksurfaces;
 int		g_dmarksurfaces_checksum;
 
 int		g_numsurfedges;
-int		g_dsurfedges[MAX_MAP_SURFEDGES];
+int*		g_dsurfedges;
 int		g_dsurfedges_checksum;
 
 int		g_numentities;
@@ -99,26 +96,229 @@ entity_t		g_entities[MAX_MAP_ENTITIES];
 
 #ifdef ZHLT_PARANOIA_BSP
 int		g_numfaceinfo;
-dfaceinfo_t	g_dfaceinfo[MAX_MAP_FACEINFO];
+dfaceinfo_t*	g_dfaceinfo;
 int		g_dfaceinfo_checksum;
 
 int		g_numnormals;
-dnormal_t		g_dnormals[MAX_MAP_VERTS];
+dnormal_t*		g_dnormals;
 int		g_dnormals_checksum;
 
 int		g_numcubemaps;
-dcubemap_t	g_dcubemaps[MAX_MAP_CUBEMAPS];
+dcubemap_t*	g_dcubemaps;
 int		g_dcubemaps_checksum;
 
 int		g_numleaflights;
-dleafsample_t	g_dleaflights[MAX_MAP_LEAFLIGHTS];
+dleafsample_t*	g_dleaflights;
 int		g_dleaflights_checksum;
 
 int		g_numworldlights;
-dworldlight_t	g_dworldlights[MAX_MAP_WORLDLIGHTS];
+dworldlight_t*	g_dworldlights;
 int		g_dworldlights_checksum;
 #endif
 
+// =====================================================================================
+//  BSP lump storage
+//      A lump the tool builds lives in a heap block that dtexdata_init sizes to the lump's
+//      limit, because hlcsg and hlbsp emit entries through pointers they keep while
+//      emitting more (WriteDrawNodes_r), so the block can never move. A lump listed in
+//      g_bspfixedlumps keeps the count it was loaded with and gets a block of exactly
+//      that size from LoadBSPFile. LoadBSPFile maps the bsp copy-on-write and points the
+//      fixed lumps listed in g_bspmappedlumps straight into it, so pages nobody reads
+//      are never loaded.
+// =====================================================================================
+typedef struct
+{
+	int		lump;		// LUMP_ or extra LUMP_ index
+	bool		extra;
+	void**		data;
+	int*		count;
+	int		entrysize;
+	int		maxentries;	// 0 means g_max_map_lightdata
+	void*		storage;	// NULL while *data points into g_bspimage or nothing is loaded
+}
+bsplump_t;
+
+unsigned int	g_bspfixedlumps = 0;
+unsigned int	g_bspmappedlumps = 0;
+
+static mappedfile_t	g_bspimage = { NULL, 0, false };
+
+static bsplump_t	g_bsplumps[] =
+{
+	{ LUMP_MODELS,         false, (void**)&g_dmodels,       &g_nummodels,       sizeof( dmodel_t ),       MAX_MAP_MODELS,           NULL },
+	{ LUMP_VERTEXES,       false, (void**)&g_dvertexes,     &g_numvertexes,     sizeof( dvertex_t ),      MAX_MAP_VERTS,            NULL },
+	{ LUMP_PLANES,         false, (void**)&g_dplanes,       &g_numplanes,       sizeof( dplane_t ),       MAX_INTERNAL_MAP_PLANES,  NULL },
+	{ LUMP_LEAFS,          false, (void**)&g_dleafs,        &g_numleafs,        sizeof( dleaf_t ),        MAX_MAP_LEAFS,            NULL },
+	{ LUMP_NODES,          false, (void**)&g_dnodes,        &g_numnodes,        sizeof( dnode_t ),        MAX_MAP_NODES,            NULL },
+#ifdef HLCSG_HLBSP_REDUCETEXTURE
+	{ LUMP_TEXINFO,        false, (void**)&g_texinfo,       &g_numtexinfo,      sizeof( texinfo_t ),      MAX_INTERNAL_MAP_TEXINFO, NULL },
+#else
+	{ LUMP_TEXINFO,        false, (void**)&g_texinfo,       &g_numtexinfo,      sizeof( texinfo_t ),      MAX_MAP_TEXINFO,          NULL },
+#endif
+#ifdef ZHLT_XASH2
+	{ LUMP_CLIPNODES,      false, (void**)&g_dclipnodes[0], &g_numclipnodes[0], sizeof( dclipnode_t ),    MAX_MAP_CLIPNODES,        NULL },
+	{ LUMP_CLIPNODES2,     false, (void**)&g_dclipnodes[1], &g_numclipnodes[1], sizeof( dclipnode_t ),    MAX_MAP_CLIPNODES,        NULL },
+	{ LUMP_CLIPNODES3,     false, (void**)&g_dclipnodes[2], &g_numclipnodes[2], sizeof( dclipnode_t ),    MAX_MAP_CLIPNODES,        NULL },
+#else
+	{ LUMP_CLIPNODES,      false, (void**)&g_dclipnodes,    &g_numclipnodes,    sizeof( dclipnode_t ),    MAX_MAP_CLIPNODES,        NULL },
+#endif
+	{ LUMP_FACES,          false, (void**)&g_dfaces,        &g_numfaces,        sizeof( dface_t ),        MAX_MAP_FACES,            NULL },
+	{ LUMP_MARKSURFACES,   false, (void**)&g_dmarksurfaces, &g_nummarksurfaces, sizeof( unsigned short ), MAX_MAP_MARKSURFACES,     NULL },
+	{ LUMP_SURFEDGES,      false, (void**)&g_dsurfedges,    &g_numsurfedges,    sizeof( int ),            MAX_MAP_SURFEDGES,        NULL },
+	{ LUMP_EDGES,          false, (void**)&g_dedges,        &g_numedges,        sizeof( dedge_t ),        MAX_MAP_EDGES,            NULL },
+	{ LUMP_VISIBILITY,     false, (void**)&g_dvisdata,      &g_visdatasize,     1,                        MAX_MAP_VISIBILITY,       NULL },
+	{ LUMP_LIGHTING,       false, (void**)&g_dlightdata,    &g_lightdatasize,   1,                        0,                        NULL },
+	{ LUMP_ENTITIES,       false, (void**)&g_dentdata,      &g_entdatasize,     1,                        MAX_MAP_ENTSTRING,        NULL },
+#ifdef ZHLT_PARANOIA_BSP
+	{ LUMP_VERTNORMALS,    true,  (void**)&g_dnormals,      &g_numnormals,      sizeof( dnormal_t ),      MAX_MAP_VERTS,            NULL },
+	{ LUMP_LIGHTVECS,      true,  (void**)&g_ddeluxdata,    &g_deluxdatasize,   1,                        0,                        NULL },
+	{ LUMP_CUBEMAPS,       true,  (void**)&g_dcubemaps,     &g_numcubemaps,     sizeof( dcubemap_t ),     MAX_MAP_CUBEMAPS,         NULL },
+	{ LUMP_FACEINFO,       true,  (void**)&g_dfaceinfo,     &g_numfaceinfo,     sizeof( dfaceinfo_t ),    MAX_MAP_FACEINFO,         NULL },
+	{ LUMP_LEAF_LIGHTING,  true,  (void**)&g_dleaflights,   &g_numleaflights,   sizeof( dleafsample_t ),  MAX_MAP_LEAFLIGHTS,       NULL },
+	{ LUMP_WORLDLIGHTS,    true,  (void**)&g_dworldlights,  &g_numworldlights,  sizeof( dworldlight_t ),  MAX_MAP_WORLDLIGHTS,      NULL },
+#endif
+};
+
+#define NUM_BSPLUMPS	(sizeof( g_bsplumps ) / sizeof( g_bsplumps[0] ))
+
+static int LumpCapacity( const bsplump_t* const l )
+{
+	return l->maxentries ? l->maxentries : g_max_map_lightdata;
+}
+
+static bool LumpIsMapped( const bsplump_t* const l )
+{
+	return l->storage == NULL && *l->data != NULL;
+}
+
+static bool LumpIsFixed( const bsplump_t* const l )
+{
+	return !l->extra && ( g_bspfixedlumps & ( 1u << l->lump ));
+}
+
+// replaces the lump's storage with a zeroed block for numentries entries
+static void AllocLumpStorage( bsplump_t* const l, const int numentries )
+{
+	if( l->storage )
+	{
+		FreeBlock( l->storage );
+	}
+	l->storage = AllocBlock( qmax( numentries, 1 ) * l->entrysize );
+	hlassume( l->storage != NULL, assume_NoMemory );
+	*l->data = l->storage;
+}
+
+static int LumpHashIndex( const bsplump_t* const l )
+{
+	return l->extra ? HEADER_LUMPS + l->lump : l->lump;
+}
+
+// =====================================================================================
+//  BSP lump hashes
+//      A lump is hashed in LUMPHASH_BLOCK pieces whose hashes are folded in order, so the
+//      pieces of every lump can go through the thread pool together. The hashes are not
+//      stored in the file: a tool that does not know about them can rewrite a lump without
+//      changing its length or the lump directory, so LoadBSPFile always hashes what it loaded.
+// =====================================================================================
+#define LUMPHASH_BLOCK	0x10000
+
+uint64_t	g_bsplumphashes[BSP_HASHED_LUMPS];
+
+typedef struct
+{
+	const byte*	data;
+	int		length;
+	uint64_t	hash;
+}
+lumphashblock_t;
+
+static lumphashblock_t*	g_lumphashblocks;
+
+static uint64_t LumpHashStart( const int length )
+{
+	return HashMix64( (uint64_t)length + HASH64_PRIME3 );
+}
+
+static uint64_t LumpHashFold( const uint64_t hash, const uint64_t blockhash )
+{
+	return HashRotl64( hash ^ blockhash, 29 ) * HASH64_PRIME1 + HASH64_PRIME3;
+}
+
+uint64_t HashBSPLump( const void* const data, const int length )
+{
+	uint64_t	hash = LumpHashStart( length );
+
+	for( int ofs = 0; ofs < length; ofs += LUMPHASH_BLOCK )
+	{
+		hash = LumpHashFold( hash, HashBytes64( (const byte *)data + ofs, qmin( length - ofs, LUMPHASH_BLOCK ), 0 ));
+	}
+
+	return hash;
+}
+
+static void HashLumpBlock( int blocknum )
+{
+	lumphashblock_t*	block = &g_lumphashblocks[blocknum];
+
+	block->hash = HashBytes64( block->data, block->length, 0 );
+}
+
+// =====================================================================================
+//  HashBSPLumps
+//      HashBSPLump of every lump with a non-negative length, blocks spread over the threads
+// =====================================================================================
+static void HashBSPLumps( const void* const data[], const int length[], uint64_t hashes[] )
+{
+	int		numblocks = 0;
+	int		i, ofs;
+
+	for( i = 0; i < BSP_HASHED_LUMPS; i++ )
+	{
+		if( length[i] > 0 )
+		{
+			numblocks += ( length[i] + LUMPHASH_BLOCK - 1 ) / LUMPHASH_BLOCK;
+		}
+	}
+
+	g_lumphashblocks = (lumphashblock_t *)malloc( qmax( numblocks, 1 ) * sizeof( lumphashblock_t ));
+	hlassume( g_lumphashblocks != NULL, assume_NoMemory );
+
+	numblocks = 0;
+	for( i = 0; i < BSP_HASHED_LUMPS; i++ )
+	{
+		for( ofs = 0; ofs < length[i]; ofs += LUMPHASH_BLOCK )
+		{
+			g_lumphashblocks[numblocks].data = (const byte *)data[i] + ofs;
+			g_lumphashblocks[numblocks].length = qmin( length[i] - ofs, LUMPHASH_BLOCK );
+			numblocks++;
+		}
+	}
+
+	if( numblocks )
+	{
+		NamedRunThreadsOnIndividual( numblocks, false, HashLumpBlock );
+	}
+
+	numblocks = 0;
+	for( i = 0; i < BSP_HASHED_LUMPS; i++ )
+	{
+		if( length[i] < 0 )
+		{
+			continue;
+		}
+
+		hashes[i] = LumpHashStart( length[i] );
+		for( ofs = 0; ofs < length[i]; ofs += LUMPHASH_BLOCK )
+		{
+			hashes[i] = LumpHashFold( hashes[i], g_lumphashblocks[numblocks++].hash );
+		}
+	}
+
+	free( g_lumphashblocks );
+	g_lumphashblocks = NULL;
+}
+
+
 // can be overrided from hlcsg
 vec3_t g_hull_size[MAX_MAP_HULLS][2] =
 {
@@ -259,6 +459,10 @@ static void SwapBSPFile( const bool todisk )
 	dmodel_t*		d;
 	dmiptexlump_t*	mtl;
 
+#ifndef WORDS_BIGENDIAN
+	return;	// every swap is a no-op, and skipping them keeps mapped lumps' pages clean
+#endif
+
 	// models
 	for( i = 0; i < g_nummodels; i++ )
 	{
@@ -496,74 +700,98 @@ static void SwapBSPFile( const bool todisk )
 }
 
 // =====================================================================================
-//  CopyLump
-//      balh
+//  LoadLump
+//      points a lump into the mapped image, or copies it into the lump's storage
 // =====================================================================================
-static int CopyLump( int lump, void *dest, int size, const dheader_t *header )
+static void LoadLump( bsplump_t* const l, const lump_t* const info, const byte* const image, const int imagelength, const bool canmap )
 {
-	int	length, ofs;
-
-	length = header->lumps[lump].filelen;
-	ofs = header->lumps[lump].fileofs;
+	const int	length = info->filelen;
+	const int	ofs = info->fileofs;
 
-	if( length % size )
+	if( length % l->entrysize )
 	{
-		Error( "LoadBSPFile: Lump size %d was expected to be multiple of %d", length, size );
+		Error( "LoadBSPFile: Lump size %d was expected to be multiple of %d", length, l->entrysize );
 	}
 
-	// special handling for tex and lightdata to keep things from exploding - KGP
-	if( lump == LUMP_LIGHTING && dest == (void*)g_dlightdata )
-		hlassume( g_max_map_lightdata > length, assume_MAX_MAP_LIGHTING );
-
-	memcpy( dest, (byte *)header + ofs, length );
-
-	return length / size;
-}
-
-#ifdef ZHLT_PARANOIA_BSP
-static int CopyExtraLump( int lump, void* dest, int size, const dheader_t* const header )
-{
-
-	dextrahdr_t*	extrahdr = (dextrahdr_t *)((byte *)header + sizeof( dheader_t ));
-	int		length, ofs;
+	if( imagelength >= 0 && ( ofs < 0 || length < 0 || ofs > imagelength || length > imagelength - ofs ))
+	{
+		Error( "LoadBSPFile: Lump %d runs past the end of the file", l->lump );
+	}
 
-	length = extrahdr->lumps[lump].filelen;
-	ofs = extrahdr->lumps[lump].fileofs;
+	*l->count = length / l->entrysize;
 
-	if( length % size )
+#ifndef WORDS_BIGENDIAN
+	// the file's byte order is the host's, so an aligned lump can be used where it lies
+	if( canmap && LumpIsFixed( l ) && ( g_bspmappedlumps & ( 1u << l->lump )) && ofs % qmin( l->entrysize, 4 ) == 0 )
 	{
-		Error( "LoadBSPFile: odd lump size" );
+		if( l->storage )
+		{
+			FreeBlock( l->storage );
+			l->storage = NULL;
+		}
+		*l->data = (void*)( image + ofs );
+		return;
 	}
+#endif
 
-	// special handling for lightvectors to keep things from exploding - G-cont
-	if( lump == LUMP_LIGHTVECS && dest == (void*)g_ddeluxdata )
+	// special handling for tex and lightdata to keep things from exploding - KGP
+	if( !l->maxentries )
+	{
 		hlassume( g_max_map_lightdata > length, assume_MAX_MAP_LIGHTING );
+	}
+	else if( *l->count > l->maxentries )
+	{
+		Error( "LoadBSPFile: Lump %d holds %d entries, the limit is %d", l->lump, *l->count, l->maxentries );
+	}
 
-	memcpy( dest, (byte *)header + ofs, length );
-
-	return length / size;
+	if( LumpIsFixed( l ))
+	{
+		AllocLumpStorage( l, *l->count );
+	}
+	else if( !l->storage )
+	{
+		AllocLumpStorage( l, LumpCapacity( l ));
+	}
+	memcpy( *l->data, image + ofs, length );
 }
-#endif
 
 // =====================================================================================
-//  LoadBSPFile
-//      balh
+//  ReleaseBSPImage
+//      moves the lumps that still point into the mapped bsp back to the heap and unmaps it
 // =====================================================================================
-void LoadBSPFile( const char *filename )
+void ReleaseBSPImage( void )
 {
-	dheader_t	*header;
+	for( unsigned int i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		bsplump_t*	l = &g_bsplumps[i];
+
+		if( !LumpIsMapped( l ))
+		{
+			continue;
+		}
+
+		// only fixed lumps are mapped
+		const void*	mapped = *l->data;
+		AllocLumpStorage( l, *l->count );
+		memcpy( l->storage, mapped, *l->count * l->entrysize );
+	}
 
-	LoadFile( filename, (char **)&header );
-	LoadBSPImage( header );
+	UnmapFile( &g_bspimage );
 }
 
 // =====================================================================================
-//  LoadBSPImage
-//      balh
+//  LoadBSPLumps
+//      imagelength is -1 when the caller can't tell, canmap only for g_bspimage
 // =====================================================================================
-void LoadBSPImage( dheader_t* const header )
+static void LoadBSPLumps( dheader_t* const header, const int imagelength, const bool canmap )
 {
-	unsigned int     i, hull;
+	const byte*	image = (const byte *)header;
+	unsigned int     i;
+
+	if( imagelength >= 0 && imagelength < (int)sizeof( dheader_t ))
+	{
+		Error( "LoadBSPFile: file is too small to be a bsp" );
+	}
 
 	// swap the header
 	for( i = 0; i < sizeof( dheader_t ) / 4; i++ )
@@ -576,47 +804,12 @@ void LoadBSPImage( dheader_t* const header )
 		Error( "BSP is version %i, not %i", header->version, BSPVERSION );
 	}
 
-	g_nummodels = CopyLump( LUMP_MODELS, g_dmodels, sizeof( dmodel_t ), header );
-	g_numvertexes = CopyLump( LUMP_VERTEXES, g_dvertexes, sizeof( dvertex_t ), header );
-	g_numplanes = CopyLump( LUMP_PLANES, g_dplanes, sizeof( dplane_t ), header );
-	g_numleafs = CopyLump( LUMP_LEAFS, g_dleafs, sizeof( dleaf_t ), header );
-	g_numnodes = CopyLump( LUMP_NODES, g_dnodes, sizeof( dnode_t ), header );
-	g_numtexinfo = CopyLump( LUMP_TEXINFO, g_texinfo, sizeof( texinfo_t ), header );
-
-#ifdef ZHLT_XASH2
-	for( hull = 1; hull < MAX_MAP_HULLS; hull++ )
-	{
-		int lump;
-
-		switch( hull )
-		{
-		case 1: lump = LUMP_CLIPNODES; break;
-		case 2: lump = LUMP_CLIPNODES2; break;
-		case 3: lump = LUMP_CLIPNODES3; break;
-		default:
-			Error( "bad hull number %d", hull );
-			break;
-		}
-
-		g_numclipnodes[hull - 1] = CopyLump( lump, g_dclipnodes[hull - 1], sizeof( dclipnode_t ), header );
-	}
-#else
-	g_numclipnodes = CopyLump( LUMP_CLIPNODES, g_dclipnodes, sizeof( dclipnode_t ), header );
-#endif
-	g_numfaces = CopyLump( LUMP_FACES, g_dfaces, sizeof( dface_t ), header );
-	g_nummarksurfaces = CopyLump( LUMP_MARKSURFACES, g_dmarksurfaces, sizeof( g_dmarksurfaces[0] ), header );
-	g_numsurfedges = CopyLump( LUMP_SURFEDGES, g_dsurfedges, sizeof( g_dsurfedges[0] ), header );
-	g_numedges = CopyLump( LUMP_EDGES, g_dedges, sizeof( dedge_t ), header );
-	TextureCollectionReader(g_TextureCollection, g_TexDirListing)
-		.load(reinterpret_cast<const byte*>(header) + header->lumps[LUMP_TEXTURES].fileofs,
-			  header->lumps[LUMP_TEXTURES].filelen);
-	g_visdatasize = CopyLump( LUMP_VISIBILITY, g_dvisdata, 1, header );
-	g_lightdatasize = CopyLump( LUMP_LIGHTING, g_dlightdata, 1, header );
-	g_entdatasize = CopyLump( LUMP_ENTITIES, g_dentdata, 1, header );
 #ifdef ZHLT_PARANOIA_BSP
 	dextrahdr_t*    extrahdr = (dextrahdr_t *)((byte *)header + sizeof( dheader_t ));
+	bool		hasextra = false;
 
-	if( LittleLong( extrahdr->id ) == IDEXTRAHEADER )
+	if(( imagelength < 0 || imagelength >= (int)( sizeof( dheader_t ) + sizeof( dextrahdr_t )))
+		&& LittleLong( extrahdr->id ) == IDEXTRAHEADER )
 	{
 		if( LittleLong( extrahdr->version ) != EXTRA_VERSION )
 		{
@@ -624,95 +817,188 @@ void LoadBSPImage( dheader_t* const header )
 		}
 
 		g_found_extradata = true;
+		hasextra = true;
 
 		// swap the header
 		for( i = 0; i < sizeof( dextrahdr_t ) / 4; i++ )
 		{
 			((int*)extrahdr)[i] = LittleLong(((int *)extrahdr)[i] );
 		}
+	}
+#endif
+
+	for( i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		bsplump_t*	l = &g_bsplumps[i];
 
-		// g-cont. copy the extra lumps
-		g_numnormals = CopyExtraLump( LUMP_VERTNORMALS, g_dnormals, sizeof( dnormal_t ), header );
-		g_deluxdatasize = CopyExtraLump( LUMP_LIGHTVECS, g_ddeluxdata, 1, header );
-		g_numcubemaps = CopyExtraLump( LUMP_CUBEMAPS, g_dcubemaps, sizeof( dcubemap_t ), header );
-		g_numfaceinfo = CopyExtraLump( LUMP_FACEINFO, g_dfaceinfo, sizeof( dfaceinfo_t ), header );
-		g_numleaflights = CopyExtraLump( LUMP_LEAF_LIGHTING, g_dleaflights, sizeof( dleafsample_t ), header );
-		g_numworldlights = CopyExtraLump( LUMP_WORLDLIGHTS, g_dworldlights, sizeof( dworldlight_t ), header );
+		if( !l->extra )
+		{
+			LoadLump( l, &header->lumps[l->lump], image, imagelength, canmap );
+		}
+#ifdef ZHLT_PARANOIA_BSP
+		else if( hasextra )
+		{
+			// g-cont. copy the extra lumps
+			LoadLump( l, &extrahdr->lumps[l->lump], image, imagelength, canmap );
+		}
+#endif
 	}
+
+	TextureCollectionReader(g_TextureCollection, g_TexDirListing)
+		.load(image + header->lumps[LUMP_TEXTURES].fileofs,
+			  header->lumps[LUMP_TEXTURES].filelen);
+
+	//
+	// hash the lumps as stored
+	//
+	const void*	hashdata[BSP_HASHED_LUMPS];
+	int		hashlength[BSP_HASHED_LUMPS];
+
+	for( i = 0; i < BSP_HASHED_LUMPS; i++ )
+	{
+		hashdata[i] = NULL;
+		hashlength[i] = -1;
+		g_bsplumphashes[i] = 0;	// lumps this build does not load
+	}
+	for( i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		const bsplump_t*	l = &g_bsplumps[i];
+
+		if( !l->extra
+#ifdef ZHLT_PARANOIA_BSP
+			|| hasextra
 #endif
-	Free( header );	// everything has been copied out
+			)
+		{
+			hashdata[LumpHashIndex( l )] = *l->data;
+			hashlength[LumpHashIndex( l )] = *l->count * l->entrysize;
+		}
+	}
+	hashdata[LUMP_TEXTURES] = image + header->lumps[LUMP_TEXTURES].fileofs;
+	hashlength[LUMP_TEXTURES] = header->lumps[LUMP_TEXTURES].filelen;
+
+	HashBSPLumps( hashdata, hashlength, g_bsplumphashes );
 
 	//
 	// swap everything
 	//
 	SwapBSPFile( false );
 
-	g_dmodels_checksum = FastChecksum( g_dmodels, g_nummodels * sizeof( g_dmodels[0] ));
-	g_dvertexes_checksum = FastChecksum( g_dvertexes, g_numvertexes * sizeof( g_dvertexes[0] ));
-	g_dplanes_checksum = FastChecksum( g_dplanes, g_numplanes * sizeof( g_dplanes[0] ));
-	g_dleafs_checksum = FastChecksum( g_dleafs, g_numleafs * sizeof( g_dleafs[0] ));
-	g_dnodes_checksum = FastChecksum( g_dnodes, g_numnodes * sizeof( g_dnodes[0] ));
-	g_texinfo_checksum = FastChecksum( g_texinfo, g_numtexinfo * sizeof( g_texinfo[0] ));
+	g_dmodels_checksum = (int)g_bsplumphashes[LUMP_MODELS];
+	g_dvertexes_checksum = (int)g_bsplumphashes[LUMP_VERTEXES];
+	g_dplanes_checksum = (int)g_bsplumphashes[LUMP_PLANES];
+	g_dleafs_checksum = (int)g_bsplumphashes[LUMP_LEAFS];
+	g_dnodes_checksum = (int)g_bsplumphashes[LUMP_NODES];
+	g_texinfo_checksum = (int)g_bsplumphashes[LUMP_TEXINFO];
 
 #ifdef ZHLT_XASH2
-	for( hull = 1; hull < MAX_MAP_HULLS; hull++ )
-	{
-		g_dclipnodes_checksum[hull - 1] = FastChecksum( g_dclipnodes[hull - 1], g_numclipnodes[hull - 1] * sizeof( g_dclipnodes[hull - 1][0] ));
-	}
+	g_dclipnodes_checksum[0] = (int)g_bsplumphashes[LUMP_CLIPNODES];
+	g_dclipnodes_checksum[1] = (int)g_bsplumphashes[LUMP_CLIPNODES2];
+	g_dclipnodes_checksum[2] = (int)g_bsplumphashes[LUMP_CLIPNODES3];
 #else
-	g_dclipnodes_checksum = FastChecksum( g_dclipnodes, g_numclipnodes * sizeof( g_dclipnodes[0] ));
+	g_dclipnodes_checksum = (int)g_bsplumphashes[LUMP_CLIPNODES];
 #endif
-	g_dfaces_checksum = FastChecksum( g_dfaces, g_numfaces * sizeof( g_dfaces[0] ));
-	g_dmarksurfaces_checksum = FastChecksum( g_dmarksurfaces, g_nummarksurfaces * sizeof( g_dmarksurfaces[0] ));
-	g_dsurfedges_checksum = FastChecksum( g_dsurfedges, g_numsurfedges * sizeof( g_dsurfedges[0] ));
-	g_dedges_checksum = FastChecksum( g_dedges, g_numedges * sizeof( g_dedges[0] ));
+	g_dfaces_checksum = (int)g_bsplumphashes[LUMP_FACES];
+	g_dmarksurfaces_checksum = (int)g_bsplumphashes[LUMP_MARKSURFACES];
+	g_dsurfedges_checksum = (int)g_bsplumphashes[LUMP_SURFEDGES];
+	g_dedges_checksum = (int)g_bsplumphashes[LUMP_EDGES];
 	g_TextureCollectionChecksum = TextureCollectionWriter(g_TextureCollection).calculateChecksum();
-	g_dvisdata_checksum = FastChecksum( g_dvisdata, g_visdatasize * sizeof( g_dvisdata[0] ));
-	g_dlightdata_checksum = FastChecksum( g_dlightdata, g_lightdatasize * sizeof( g_dlightdata[0] ));
-	g_dentdata_checksum = FastChecksum( g_dentdata, g_entdatasize * sizeof( g_dentdata[0] ));
+	g_dvisdata_checksum = (int)g_bsplumphashes[LUMP_VISIBILITY];
+	g_dlightdata_checksum = (int)g_bsplumphashes[LUMP_LIGHTING];
+	g_dentdata_checksum = (int)g_bsplumphashes[LUMP_ENTITIES];
 
 #ifdef ZHLT_PARANOIA_BSP
 	if( g_found_extradata )
 	{
-		g_dnormals_checksum = FastChecksum( g_dnormals, g_numnormals * sizeof( g_dnormals[0] ));
-		g_ddeluxdata_checksum = FastChecksum( g_ddeluxdata, g_deluxdatasize * sizeof( g_ddeluxdata[0] ));
-		g_dcubemaps_checksum = FastChecksum( g_dcubemaps, g_numcubemaps * sizeof( g_dcubemaps[0] ));
-		g_dfaceinfo_checksum = FastChecksum( g_dfaceinfo, g_numfaceinfo * sizeof( g_dfaceinfo[0] ));
-		g_dleaflights_checksum = FastChecksum( g_dleaflights, g_numleaflights * sizeof( g_dleaflights[0] ));
-		g_dworldlights_checksum = FastChecksum( g_dworldlights, g_numworldlights * sizeof( g_dworldlights[0] ));
+		g_dnormals_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_VERTNORMALS];
+		g_ddeluxdata_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_LIGHTVECS];
+		g_dcubemaps_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_CUBEMAPS];
+		g_dfaceinfo_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_FACEINFO];
+		g_dleaflights_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_LEAF_LIGHTING];
+		g_dworldlights_checksum = (int)g_bsplumphashes[HEADER_LUMPS + LUMP_WORLDLIGHTS];
 	}
 #endif
 }
 
+// =====================================================================================
+//  LoadBSPFile
+//      maps the file and keeps the mapping while any lump in g_bspmappedlumps uses it
+// =====================================================================================
+void LoadBSPFile( const char *filename )
+{
+	ReleaseBSPImage();
+	MapFile( filename, &g_bspimage, true );
+	LoadBSPLumps( (dheader_t *)g_bspimage.data, g_bspimage.length, g_bspimage.mapped );
+
+	for( unsigned int i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		if( LumpIsMapped( &g_bsplumps[i] ))
+		{
+			return;
+		}
+	}
+	UnmapFile( &g_bspimage );	// everything has been copied out
+}
+
+// =====================================================================================
+//  LoadBSPImage
+//      balh
+// =====================================================================================
+void LoadBSPImage( dheader_t* const header )
+{
+	ReleaseBSPImage();
+	LoadBSPLumps( header, -1, false );
+	Free( header );	// everything has been copied out
+}
+
 //
 // =====================================================================================
 //
 
+// =====================================================================================
+//  bspwriter_t
+//      lumps queued for WriteBSPFile, which lays out the whole file before writing any of it
+// =====================================================================================
+typedef struct
+{
+	int		fileofs;			// where the next lump goes
+	const void*	data[BSP_HASHED_LUMPS];
+	int		length[BSP_HASHED_LUMPS];	// -1 for lumps that aren't written
+	int		order[BSP_HASHED_LUMPS];
+	int		numlumps;
+}
+bspwriter_t;
+
+static void QueueLump( int index, const void* data, int len, lump_t* lump, bspwriter_t* writer )
+{
+	lump->fileofs = LittleLong( writer->fileofs );
+	lump->filelen = LittleLong( len );
+	writer->data[index] = data;
+	writer->length[index] = len;
+	writer->order[writer->numlumps++] = index;
+	writer->fileofs += (len + 3) & ~3;
+}
+
 // =====================================================================================
 //  AddLump
 //      balh
 // =====================================================================================
-static void AddLump( int lumpnum, const void* data, int len, dheader_t* header, FILE* bspfile )
+static void AddLump( int lumpnum, const void* data, int len, dheader_t* header, bspwriter_t* writer )
 {
-	lump_t* lump = &header->lumps[lumpnum];
-	lump->fileofs = LittleLong( ftell( bspfile ));
-	lump->filelen = LittleLong( len );
-	SafeWrite( bspfile, data, (len + 3) & ~3 );
+	QueueLump( lumpnum, data, len, &header->lumps[lumpnum], writer );
 }
 
 #ifdef ZHLT_PARANOIA_BSP
-static void AddExtraLump( int lumpnum, const void* data, int len, dextrahdr_t* header, FILE* bspfile )
+static void AddExtraLump( int lumpnum, const void* data, int len, dextrahdr_t* header, bspwriter_t* writer )
 {
-	lump_t* lump = &header->lumps[lumpnum];
-	lump->fileofs = LittleLong( ftell( bspfile ));
-	lump->filelen = LittleLong( len );
-	SafeWrite( bspfile, data, (len + 3) & ~3 );
+	QueueLump( HEADER_LUMPS + lumpnum, data, len, &header->lumps[lumpnum], writer );
 }
 #endif
 
 // =====================================================================================
 //  WriteBSPFile
-//      Swaps the bsp file in place, so it should not be referenced again
+//      Remaps texinfo miptex numbers to the exported texture order and, on big-endian hosts,
+//      byte-swaps every lump in place, so the bsp data should not be used again afterwards
 // =====================================================================================
 void WriteBSPFile( const char* const filename )
 {
@@ -722,7 +1008,14 @@ void WriteBSPFile( const char* const filename )
 	dextrahdr_t	outextrahdr;
 	dextrahdr_t*	extrahdr;
 #endif
-	FILE*		bspfile;
+	bspwriter_t	lumps;
+	static const byte	padding[4] = { 0, 0, 0, 0 };
+	filechunk_t	chunks[2 + 2 * BSP_HASHED_LUMPS];
+	int		numchunks = 0;
+	int		i;
+
+	// the output usually replaces the mapped input, so take the lumps off it first
+	ReleaseBSPImage();
 
 	// Do this here, before the file gets byte-swapped.
 	TextureCollectionWriter writer(g_TextureCollection);
@@ -755,19 +1048,24 @@ void WriteBSPFile( const char* const filename )
 	extrahdr->version = LittleLong( EXTRA_VERSION );
 #endif
 
-	bspfile = SafeOpenWrite( filename );
-	SafeWrite( bspfile, header, sizeof( dheader_t ));		// overwritten later
+	lumps.fileofs = sizeof( dheader_t );
 #ifdef ZHLT_PARANOIA_BSP
-	SafeWrite( bspfile, extrahdr, sizeof( dextrahdr_t ));	// overwritten later
+	lumps.fileofs += sizeof( dextrahdr_t );
 #endif
+	lumps.numlumps = 0;
+	for( i = 0; i < BSP_HASHED_LUMPS; i++ )
+	{
+		lumps.data[i] = NULL;
+		lumps.length[i] = -1;
+	}
 
-	//       LUMP TYPE          DATA             LENGTH                                  HEADER  BSPFILE
-	AddLump( LUMP_PLANES,       g_dplanes,       g_numplanes * sizeof( dplane_t ),       header, bspfile );
-	AddLump( LUMP_LEAFS,        g_dleafs,        g_numleafs * sizeof( dleaf_t),          header, bspfile );
-	AddLump( LUMP_VERTEXES,     g_dvertexes,     g_numvertexes * sizeof( dvertex_t ),    header, bspfile );
-	AddLump( LUMP_NODES,        g_dnodes,        g_numnodes * sizeof( dnode_t ),         header, bspfile );
-	AddLump( LUMP_TEXINFO,      g_texinfo,       g_numtexinfo * sizeof( texinfo_t ),     header, bspfile );
-	AddLump( LUMP_FACES,        g_dfaces,        g_numfaces * sizeof( dface_t ),         header, bspfile );
+	//       LUMP TYPE          DATA             LENGTH                                  HEADER  WRITER
+	AddLump( LUMP_PLANES,       g_dplanes,       g_numplanes * sizeof( dplane_t ),       header, &lumps );
+	AddLump( LUMP_LEAFS,        g_dleafs,        g_numleafs * sizeof( dleaf_t),          header, &lumps );
+	AddLump( LUMP_VERTEXES,     g_dvertexes,     g_numvertexes * sizeof( dvertex_t ),    header, &lumps );
+	AddLump( LUMP_NODES,        g_dnodes,        g_numnodes * sizeof( dnode_t ),         header, &lumps );
+	AddLump( LUMP_TEXINFO,      g_texinfo,       g_numtexinfo * sizeof( texinfo_t ),     header, &lumps );
+	AddLump( LUMP_FACES,        g_dfaces,        g_numfaces * sizeof( dface_t ),         header, &lumps );
 #ifdef ZHLT_XASH2
 	for( int hull = 1; hull < MAX_MAP_HULLS; hull++ )
 	{
@@ -782,40 +1080,53 @@ void WriteBSPFile( const char* const filename )
 			Error( "bad hull number %d", hull );
 			break;
 		}
-		AddLump( lump, g_dclipnodes[hull - 1], g_numclipnodes[hull - 1] * sizeof( dclipnode_t ), header, bspfile );
+		AddLump( lump, g_dclipnodes[hull - 1], g_numclipnodes[hull - 1] * sizeof( dclipnode_t ), header, &lumps );
 	}
 #else
-	AddLump( LUMP_CLIPNODES,    g_dclipnodes,    g_numclipnodes * sizeof( dclipnode_t ), header, bspfile );
+	AddLump( LUMP_CLIPNODES,    g_dclipnodes,    g_numclipnodes * sizeof( dclipnode_t ), header, &lumps );
 #endif
-	AddLump( LUMP_MARKSURFACES, g_dmarksurfaces, g_nummarksurfaces * sizeof( short ),    header, bspfile );
-	AddLump( LUMP_SURFEDGES,    g_dsurfedges,    g_numsurfedges * sizeof( int ),         header, bspfile );
-	AddLump( LUMP_EDGES,        g_dedges,        g_numedges * sizeof( dedge_t ),         header, bspfile );
-	AddLump( LUMP_MODELS,       g_dmodels,       g_nummodels * sizeof (dmodel_t ),       header, bspfile );
+	AddLump( LUMP_MARKSURFACES, g_dmarksurfaces, g_nummarksurfaces * sizeof( short ),    header, &lumps );
+	AddLump( LUMP_SURFEDGES,    g_dsurfedges,    g_numsurfedges * sizeof( int ),         header, &lumps );
+	AddLump( LUMP_EDGES,        g_dedges,        g_numedges * sizeof( dedge_t ),         header, &lumps );
+	AddLump( LUMP_MODELS,       g_dmodels,       g_nummodels * sizeof (dmodel_t ),       header, &lumps );
 
-	AddLump( LUMP_LIGHTING,     g_dlightdata,    g_lightdatasize,                        header, bspfile );
-	AddLump( LUMP_VISIBILITY,   g_dvisdata,      g_visdatasize,                          header, bspfile );
-	AddLump( LUMP_ENTITIES,     g_dentdata,      g_entdatasize,                          header, bspfile );
-	AddLump( LUMP_TEXTURES, writer.exportedData().data(), writer.exportedData().size(),  header, bspfile );
+	AddLump( LUMP_LIGHTING,     g_dlightdata,    g_lightdatasize,                        header, &lumps );
+	AddLump( LUMP_VISIBILITY,   g_dvisdata,      g_visdatasize,                          header, &lumps );
+	AddLump( LUMP_ENTITIES,     g_dentdata,      g_entdatasize,                          header, &lumps );
+	AddLump( LUMP_TEXTURES, writer.exportedData().data(), writer.exportedData().size(),  header, &lumps );
 
 #ifdef ZHLT_PARANOIA_BSP
 //    Log( "num extra faces %i, num faces %i, num worldlights %i, num ambient lights %i, num extra leafs %i, num leafs %i\n",
 //    g_numfaces_extra, g_numfaces, g_numworldlights, g_numleaflights, g_numleafdata, g_numleafs );
 
-	//            LUMP TYPE          DATA             LENGTH                                      EXTRAHDR  BSPFILE
-	AddExtraLump( LUMP_VERTNORMALS,  g_dnormals,      g_numnormals * sizeof( dnormal_t ),         extrahdr, bspfile );
-	AddExtraLump( LUMP_LIGHTVECS,    g_ddeluxdata,    g_deluxdatasize,                            extrahdr, bspfile );
-	AddExtraLump( LUMP_CUBEMAPS,     g_dcubemaps,     g_numcubemaps * sizeof( dcubemap_t ),       extrahdr, bspfile );
-	AddExtraLump( LUMP_FACEINFO,     g_dfaceinfo,     g_numfaceinfo * sizeof( dfaceinfo_t ),      extrahdr, bspfile );
-	AddExtraLump( LUMP_LEAF_LIGHTING,g_dleaflights,   g_numleaflights * sizeof( dleafsample_t ),  extrahdr, bspfile );
-	AddExtraLump( LUMP_WORLDLIGHTS,  g_dworldlights,  g_numworldlights * sizeof( dworldlight_t ), extrahdr, bspfile );
+	//            LUMP TYPE          DATA             LENGTH                                      EXTRAHDR  WRITER
+	AddExtraLump( LUMP_VERTNORMALS,  g_dnormals,      g_numnormals * sizeof( dnormal_t ),         extrahdr, &lumps );
+	AddExtraLump( LUMP_LIGHTVECS,    g_ddeluxdata,    g_deluxdatasize,                            extrahdr, &lumps );
+	AddExtraLump( LUMP_CUBEMAPS,     g_dcubemaps,     g_numcubemaps * sizeof( dcubemap_t ),       extrahdr, &lumps );
+	AddExtraLump( LUMP_FACEINFO,     g_dfaceinfo,     g_numfaceinfo * sizeof( dfaceinfo_t ),      extrahdr, &lumps );
+	AddExtraLump( LUMP_LEAF_LIGHTING,g_dleaflights,   g_numleaflights * sizeof( dleafsample_t ),  extrahdr, &lumps );
+	AddExtraLump( LUMP_WORLDLIGHTS,  g_dworldlights,  g_numworldlights * sizeof( dworldlight_t ), extrahdr, &lumps );
 #endif
-	fseek( bspfile, 0, SEEK_SET );
-	SafeWrite( bspfile, header, sizeof( dheader_t ));
 
+	// hash everything as it goes to disk
+	HashBSPLumps( lumps.data, lumps.length, g_bsplumphashes );
+
+	chunks[numchunks].data = header;
+	chunks[numchunks++].length = sizeof( dheader_t );
 #ifdef ZHLT_PARANOIA_BSP
-	SafeWrite( bspfile, extrahdr, sizeof( dextrahdr_t ));
+	chunks[numchunks].data = extrahdr;
+	chunks[numchunks++].length = sizeof( dextrahdr_t );
 #endif
-	fclose( bspfile );
+	for( i = 0; i < lumps.numlumps; i++ )
+	{
+		const int	index = lumps.order[i];
+
+		chunks[numchunks].data = lumps.data[index];
+		chunks[numchunks++].length = lumps.length[index];
+		chunks[numchunks].data = padding;
+		chunks[numchunks++].length = -lumps.length[index] & 3;
+	}
+	SaveFileChunks( filename, chunks, numchunks );
 }
 
 #ifdef ZHLT_64BIT_FIX
@@ -1271,7 +1582,6 @@ int CountBlocks ()
 }
 #endif
 
-#define ENTRIES(a)		(sizeof(a)/sizeof(*(a)))
 #define ENTRYSIZE(a)	(sizeof(*(a)))
 
 // =====================================================================================
@@ -1318,16 +1628,12 @@ void PrintBSPFileSizes( void )
 	Log( "Object names  Objects/Maxobjs  Memory / Maxmem  Fullness\n" );
 	Log( "------------  ---------------  ---------------  --------\n" );
 
-	totalmemory += ArrayUsage( "models", g_nummodels, ENTRIES( g_dmodels ), ENTRYSIZE( g_dmodels ));
+	totalmemory += ArrayUsage( "models", g_nummodels, MAX_MAP_MODELS, ENTRYSIZE( g_dmodels ));
 	totalmemory += ArrayUsage( "planes", g_numplanes, MAX_MAP_PLANES, ENTRYSIZE( g_dplanes ));
-	totalmemory += ArrayUsage( "vertexes", g_numvertexes, ENTRIES(g_dvertexes), ENTRYSIZE( g_dvertexes ));
-	totalmemory += ArrayUsage( "nodes", g_numnodes, ENTRIES(g_dnodes), ENTRYSIZE( g_dnodes ));
-#ifdef HLCSG_HLBSP_REDUCETEXTURE
+	totalmemory += ArrayUsage( "vertexes", g_numvertexes, MAX_MAP_VERTS, ENTRYSIZE( g_dvertexes ));
+	totalmemory += ArrayUsage( "nodes", g_numnodes, MAX_MAP_NODES, ENTRYSIZE( g_dnodes ));
 	totalmemory += ArrayUsage( "texinfos", g_numtexinfo, MAX_MAP_TEXINFO, ENTRYSIZE( g_texinfo ));
-#else
-	totalmemory += ArrayUsage( "texinfos", g_numtexinfo, ENTRIES( g_texinfo ), ENTRYSIZE( g_texinfo ));
-#endif
-	totalmemory += ArrayUsage( "faces", g_numfaces, ENTRIES( g_dfaces ), ENTRYSIZE( g_dfaces ));
+	totalmemory += ArrayUsage( "faces", g_numfaces, MAX_MAP_FACES, ENTRYSIZE( g_dfaces ));
 #ifdef ZHLT_WARNWORLDFACES
 	totalmemory += ArrayUsage( "* worldfaces", (g_nummodels > 0 ? g_dmodels[0].numfaces: 0 ), MAX_MAP_WORLDFACES, 0 );
 #endif
@@ -1336,25 +1642,25 @@ void PrintBSPFileSizes( void )
 	{
 		char buffer[32];
 		sprintf( buffer, "clipnodes%d", hull );
-		totalmemory += ArrayUsage( buffer, g_numclipnodes[hull - 1], ENTRIES( g_dclipnodes[hull - 1] ), ENTRYSIZE( g_dclipnodes[hull - 1] ));
+		totalmemory += ArrayUsage( buffer, g_numclipnodes[hull - 1], MAX_MAP_CLIPNODES, ENTRYSIZE( g_dclipnodes[hull - 1] ));
 	}
 #else
-	totalmemory += ArrayUsage( "clipnodes", g_numclipnodes, ENTRIES( g_dclipnodes ), ENTRYSIZE( g_dclipnodes ));
+	totalmemory += ArrayUsage( "clipnodes", g_numclipnodes, MAX_MAP_CLIPNODES, ENTRYSIZE( g_dclipnodes ));
 #endif
 #ifdef ZHLT_MAX_MAP_LEAFS
 	totalmemory += ArrayUsage( "leaves", g_numleafs, MAX_MAP_LEAFS, ENTRYSIZE( g_dleafs ));
 	totalmemory += ArrayUsage( "* worldleaves", ( g_nummodels > 0 ? g_dmodels[0].visleafs : 0 ), MAX_MAP_LEAFS_ENGINE, 0 );
 #else
-	totalmemory += ArrayUsage( "leaves", g_numleafs, ENTRIES( g_dleafs ), ENTRYSIZE( g_dleafs ));
+	totalmemory += ArrayUsage( "leaves", g_numleafs, MAX_MAP_LEAFS, ENTRYSIZE( g_dleafs ));
 #endif
-	totalmemory += ArrayUsage( "marksurfaces", g_nummarksurfaces, ENTRIES( g_dmarksurfaces ), ENTRYSIZE( g_dmarksurfaces ));
-	totalmemory += ArrayUsage( "surfedges", g_numsurfedges, ENTRIES( g_dsurfedges ), ENTRYSIZE( g_dsurfedges ));
-	totalmemory += ArrayUsage( "edges", g_numedges, ENTRIES( g_dedges ), ENTRYSIZE( g_dedges ));
+	totalmemory += ArrayUsage( "marksurfaces", g_nummarksurfaces, MAX_MAP_MARKSURFACES, ENTRYSIZE( g_dmarksurfaces ));
+	totalmemory += ArrayUsage( "surfedges", g_numsurfedges, MAX_MAP_SURFEDGES, ENTRYSIZE( g_dsurfedges ));
+	totalmemory += ArrayUsage( "edges", g_numedges, MAX_MAP_EDGES, ENTRYSIZE( g_dedges ));
 
 	totalmemory += GlobUsage( "texdata", g_TextureCollection.totalBytesInUse(), g_max_map_miptex );
 	totalmemory += GlobUsage( "lightdata", g_lightdatasize, g_max_map_lightdata );
-	totalmemory += GlobUsage( "visdata", g_visdatasize, sizeof( g_dvisdata ));
-	totalmemory += GlobUsage( "entdata", g_entdatasize, sizeof( g_dentdata ));
+	totalmemory += GlobUsage( "visdata", g_visdatasize, MAX_MAP_VISIBILITY );
+	totalmemory += GlobUsage( "entdata", g_entdatasize, MAX_MAP_ENTSTRING );
 #ifdef ZHLT_CHART_AllocBlock
 #ifdef ZHLT_64BIT_FIX
 	if( numallocblocks == -1 )
@@ -1373,12 +1679,12 @@ void PrintBSPFileSizes( void )
 #ifdef ZHLT_PARANOIA_BSP
 	if( g_found_extradata )
 	{
-		totalmemory += ArrayUsage( "normals", g_numnormals, ENTRIES( g_dnormals ), ENTRYSIZE( g_dnormals ));
+		totalmemory += ArrayUsage( "normals", g_numnormals, MAX_MAP_VERTS, ENTRYSIZE( g_dnormals ));
 		totalmemory += GlobUsage( "deluxdata", g_deluxdatasize, g_max_map_lightdata );
-		totalmemory += ArrayUsage( "cubemaps", g_numcubemaps, ENTRIES( g_dcubemaps ), ENTRYSIZE( g_dcubemaps ));
-		totalmemory += ArrayUsage( "faceinfo", g_numfaceinfo, ENTRIES( g_dfaceinfo ), ENTRYSIZE( g_dfaceinfo ));
-		totalmemory += ArrayUsage( "ambient cubes", g_numleaflights, ENTRIES( g_dleaflights ), ENTRYSIZE( g_dleaflights ));
-		totalmemory += ArrayUsage( "direct lights", g_numworldlights, ENTRIES( g_dworldlights ), ENTRYSIZE( g_dworldlights ));
+		totalmemory += ArrayUsage( "cubemaps", g_numcubemaps, MAX_MAP_CUBEMAPS, ENTRYSIZE( g_dcubemaps ));
+		totalmemory += ArrayUsage( "faceinfo", g_numfaceinfo, MAX_MAP_FACEINFO, ENTRYSIZE( g_dfaceinfo ));
+		totalmemory += ArrayUsage( "ambient cubes", g_numleaflights, MAX_MAP_LEAFLIGHTS, ENTRYSIZE( g_dleaflights ));
+		totalmemory += ArrayUsage( "direct lights", g_numworldlights, MAX_MAP_WORLDLIGHTS, ENTRYSIZE( g_dworldlights ));
 	}
 #endif
 	Log( "%i textures referenced\n", numtextures );
@@ -2138,19 +2444,33 @@ entity_t *FindTargetEntity(const char* const target)
 void dtexdata_init( void )
 {
 	g_TextureCollection.clear();
-	g_dlightdata = (byte *)AllocBlock( g_max_map_lightdata );
-	hlassume( g_dlightdata != NULL, assume_NoMemory );
-	g_ddeluxdata = (byte *)AllocBlock( g_max_map_lightdata );
-	hlassume( g_ddeluxdata != NULL, assume_NoMemory );
+	for( unsigned int i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		bsplump_t*	l = &g_bsplumps[i];
+
+		if( LumpIsFixed( l ))
+		{
+			continue;	// sized by LoadBSPFile
+		}
+		AllocLumpStorage( l, LumpCapacity( l ));
+	}
 }
 
 void CDECL dtexdata_free( void )
 {
 	g_TextureCollection.clear();
-	FreeBlock( g_dlightdata );
-	g_dlightdata = NULL;
-	FreeBlock( g_ddeluxdata );
-	g_ddeluxdata = NULL;
+	UnmapFile( &g_bspimage );
+	for( unsigned int i = 0; i < NUM_BSPLUMPS; i++ )
+	{
+		bsplump_t*	l = &g_bsplumps[i];
+
+		if( l->storage )
+		{
+			FreeBlock( l->storage );
+			l->storage = NULL;
+		}
+		*l->data = NULL;
+	}
 }
 
 std::string GetTextureByNumber(int texturenumber)
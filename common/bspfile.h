@@ -229,6 +229,10 @@ typedef struct
 	int		version;
 	lump_t		lumps[EXTRA_LUMPS];
 } dextrahdr_t;
+
+#define BSP_HASHED_LUMPS	(HEADER_LUMPS + EXTRA_LUMPS)
+#else
+#define BSP_HASHED_LUMPS	HEADER_LUMPS
 #endif
 
 typedef struct
@@ -459,6 +463,30 @@ typedef struct
 } dworldlight_t;
 #endif
 
+#ifdef ZHLT_BINARYPORTALS
+// binary portal file, written by hlbsp -binaryportals in place of the PRT1-AB text
+// all fields are little endian, offsets are from the start of the file and 4 byte aligned
+#define PRT_BINARY_IDENT	"PRT1-BIN"
+
+typedef struct
+{
+	char		ident[8];	// PRT_BINARY_IDENT, not terminated
+	int		numleafs;	// portal leafs
+	int		numportals;
+	int		numpoints;	// points of all portal windings
+	int		leafcountofs;	// int[numleafs], bsp leafs in each portal leaf; 0 without detail brushes
+	int		portalofs;	// dprtportal_t[numportals]
+	int		pointofs;	// float[3][numpoints], every x, then every y, then every z
+} dprtheader_t;
+
+typedef struct
+{
+	int		numpoints;
+	int		firstpoint;
+	int		leafs[2];	// the portal normal points into leafs[1]
+} dprtportal_t;
+#endif
+
 //============================================================================
 
 #define ANGLE_UP		-1.0 //#define ANGLE_UP    -1 //--vluzacn
@@ -469,11 +497,11 @@ typedef struct
 //
 
 extern int      g_nummodels;
-extern dmodel_t g_dmodels[MAX_MAP_MODELS];
+extern dmodel_t* g_dmodels;
 extern int      g_dmodels_checksum;
 
 extern int      g_visdatasize;
-extern byte     g_dvisdata[MAX_MAP_VISIBILITY];
+extern byte*    g_dvisdata;
 extern int      g_dvisdata_checksum;
 
 extern int      g_lightdatasize;
@@ -489,78 +517,74 @@ extern int g_TextureCollectionChecksum;
 extern TextureDirectoryListing g_TexDirListing;
 
 extern int      g_entdatasize;
-extern char     g_dentdata[MAX_MAP_ENTSTRING];
+extern char*    g_dentdata;
 extern int      g_dentdata_checksum;
 
 extern int      g_numleafs;
-extern dleaf_t  g_dleafs[MAX_MAP_LEAFS];
+extern dleaf_t* g_dleafs;
 extern int      g_dleafs_checksum;
 
 extern int      g_numplanes;
-extern dplane_t g_dplanes[MAX_INTERNAL_MAP_PLANES];
+extern dplane_t* g_dplanes;
 extern int      g_dplanes_checksum;
 
 extern int      g_numvertexes;
-extern dvertex_t g_dvertexes[MAX_MAP_VERTS];
+extern dvertex_t* g_dvertexes;
 extern int      g_dvertexes_checksum;
 
 extern int      g_numnodes;
-extern dnode_t  g_dnodes[MAX_MAP_NODES];
+extern dnode_t* g_dnodes;
 extern int      g_dnodes_checksum;
 
 extern int      g_numtexinfo;
-#ifdef HLCSG_HLBSP_REDUCETEXTURE
-extern texinfo_t g_texinfo[MAX_INTERNAL_MAP_TEXINFO];
-#else
-extern texinfo_t g_texinfo[MAX_MAP_TEXINFO];
-#endif
+extern texinfo_t* g_texinfo;
 extern int      g_texinfo_checksum;
 
 extern int      g_numfaces;
-extern dface_t  g_dfaces[MAX_MAP_FACES];
+extern dface_t* g_dfaces;
 extern int      g_dfaces_checksum;
 
 #ifdef ZHLT_XASH2
 extern int      g_numclipnodes[MAX_MAP_HULLS - 1];
-extern dclipnode_t g_dclipnodes[MAX_MAP_HULLS - 1][MAX_MAP_CLIPNODES];
+extern dclipnode_t* g_dclipnodes[MAX_MAP_HULLS - 1];
 extern int      g_dclipnodes_checksum[MAX_MAP_HULLS - 1];
 #else
 extern int      g_numclipnodes;
-extern dclipnode_t g_dclipnodes[MAX_MAP_CLIPNODES];
+extern dclipnode_t* g_dclipnodes;
 extern int      g_dclipnodes_checksum;
 #endif
 
 extern int      g_numedges;
-extern dedge_t  g_dedges[MAX_MAP_EDGES];
+extern dedge_t* g_dedges;
 extern int      g_dedges_checksum;
 
 extern int      g_nummarksurfaces;
-extern unsigned short g_dmarksurfaces[MAX_MAP_MARKSURFACES];
+extern unsigned short* g_dmarksurfaces;
 extern int      g_dmarksurfaces_checksum;
 
 extern int      g_numsurfedges;
-extern int      g_dsurfedges[MAX_MAP_SURFEDGES];
+extern int*     g_dsurfedges;
 extern int      g_dsurfedges_checksum;
 
 #ifdef ZHLT_PARANOIA_BSP
 extern int      g_numfaceinfo;
-extern dfaceinfo_t g_dfaceinfo[MAX_MAP_FACEINFO];
+extern dfaceinfo_t* g_dfaceinfo;
 extern int      g_dfaceinfo_checksum;
 
 extern int      g_numnormals;
-extern dnormal_t g_dnormals[MAX_MAP_VERTS];
+extern dnormal_t* g_dnormals;
 extern int      g_normals_checksum;
 
 extern int      g_numcubemaps;
-extern dcubemap_t g_dcubemaps[MAX_MAP_CUBEMAPS];
+extern dcubemap_t* g_dcubemaps;
 extern int      g_cubemaps_checksum;
 
 extern int      g_numleaflights;
-extern dleafsample_t g_dleaflights[MAX_MAP_LEAFLIGHTS];
+extern dleafsample_t* g_dleaflights;
 extern int      g_dleaflights_checksum;
 
 extern int      g_numworldlights;
-extern dworldlight_t g_dworldlights[MAX_MAP_WORLDLIGHTS];
+extern dworldlight_t* g_dworldlights;
 extern int      g_dworldlights_checksum;
 #endif
 
@@ -569,7 +593,21 @@ extern vec3_t   g_hull_size[MAX_MAP_HULLS][2];
 extern void DecompressVis(const byte* src, byte* const dest, const unsigned int dest_length);
 extern int CompressVis(const byte* const src, const unsigned int src_length, byte* dest, unsigned int dest_length);
 
+// bits (1 << LUMP_*) of lumps whose count a tool never changes; LoadBSPFile sizes their
+// storage from the file instead of the lump limit. A tool sets it before dtexdata_init.
+extern unsigned int g_bspfixedlumps;
+// the fixed lumps LoadBSPFile may leave in a copy-on-write mapping of the file; only for
+// lumps the tool never writes, since a written page gets copied anyway
+extern unsigned int g_bspmappedlumps;
+
+// HashBSPLump of every lump as stored on disk (extra lumps after the header ones), set by
+// LoadBSPFile and WriteBSPFile
+extern uint64_t g_bsplumphashes[BSP_HASHED_LUMPS];
+extern uint64_t HashBSPLump(const void* const data, const int length);
+
 extern void LoadBSPImage(dheader_t* header);
+// moves any lumps still in the mapped file to the heap and unmaps it; LoadBSPFile's file can then be replaced
+extern void ReleaseBSPImage();
 extern void LoadBSPFile(const char* const filename);
 extern void WriteBSPFile(const char* const filename);
 extern void PrintBSPFileSizes();
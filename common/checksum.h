@@ -1,6 +1,8 @@
 #ifndef CHECKSUM_H
 #define CHECKSUM_H
 
+#include <string.h>
+#include <stdint.h>
 #include "mathlib.h"
 
 static inline int FastChecksum( const void *const buffer, int bytes )
@@ -17,4 +19,80 @@ static inline int FastChecksum( const void *const buffer, int bytes )
 	return checksum;
 }
 
+// =====================================================================================
+//  HashBytes64
+//      four independent 64-bit lanes (xxhash64-style rounds) so the loop pipelines and
+//      vectorizes; words are read little-endian so a hash is the same on every host
+// =====================================================================================
+#define HASH64_PRIME1	0x9E3779B185EBCA87ULL
+#define HASH64_PRIME2	0xC2B2AE3D27D4EB4FULL
+#define HASH64_PRIME3	0x165667B19E3779F9ULL
+
+static inline uint64_t HashRotl64( const uint64_t value, const int amt )
+{
+	return ( value << amt ) | ( value >> ( 64 - amt ));
+}
+
+static inline uint64_t HashRead64( const unsigned char* const p )
+{
+	uint64_t	word;
+
+	memcpy( &word, p, sizeof( word ));
+#ifdef WORDS_BIGENDIAN
+	word = (( word & 0x00000000000000FFULL ) << 56 ) | (( word & 0x000000000000FF00ULL ) << 40 )
+		| (( word & 0x0000000000FF0000ULL ) << 24 ) | (( word & 0x00000000FF000000ULL ) << 8 )
+		| (( word & 0x000000FF00000000ULL ) >> 8 ) | (( word & 0x0000FF0000000000ULL ) >> 24 )
+		| (( word & 0x00FF000000000000ULL ) >> 40 ) | (( word & 0xFF00000000000000ULL ) >> 56 );
+#endif
+	return word;
+}
+
+static inline uint64_t HashRound64( const uint64_t lane, const uint64_t word )
+{
+	return HashRotl64( lane + word * HASH64_PRIME2, 31 ) * HASH64_PRIME1;
+}
+
+static inline uint64_t HashMix64( uint64_t hash )
+{
+	hash ^= hash >> 33;
+	hash *= HASH64_PRIME2;
+	hash ^= hash >> 29;
+	hash *= HASH64_PRIME3;
+	hash ^= hash >> 32;
+	return hash;
+}
+
+static inline uint64_t HashBytes64( const void* const buffer, const int bytes, const uint64_t seed )
+{
+	const unsigned char*	p = (const unsigned char*)buffer;
+	const unsigned char*	end = p + bytes;
+	uint64_t	lane0 = seed + HASH64_PRIME1 + HASH64_PRIME2;
+	uint64_t	lane1 = seed + HASH64_PRIME2;
+	uint64_t	lane2 = seed;
+	uint64_t	lane3 = seed - HASH64_PRIME1;
+	uint64_t	hash;
+
+	for( ; end - p >= 32; p += 32 )
+	{
+		lane0 = HashRound64( lane0, HashRead64( p ));
+		lane1 = HashRound64( lane1, HashRead64( p + 8 ));
+		lane2 = HashRound64( lane2, HashRead64( p + 16 ));
+		lane3 = HashRound64( lane3, HashRead64( p + 24 ));
+	}
+
+	hash = HashRotl64( lane0, 1 ) + HashRotl64( lane1, 7 ) + HashRotl64( lane2, 12 ) + HashRotl64( lane3, 18 );
+	hash += (uint64_t)bytes;
+
+	for( ; end - p >= 8; p += 8 )
+	{
+		hash = HashRotl64( hash ^ HashRound64( 0, HashRead64( p )), 27 ) * HASH64_PRIME1 + HASH64_PRIME3;
+	}
+	for( ; p < end; p++ )
+	{
+		hash = HashRotl64( hash ^ ( *p * HASH64_PRIME3 ), 11 ) * HASH64_PRIME1;
+	}
+
+	return HashMix64( hash );
+}
+
 #endif // CHECKSUM_H
@@ -95,6 +95,9 @@
 #define ZHLT_CALC_AMBIENT_SOUNDS // g-cont. calc auto-ambient sounds like Quake1
 //#define ZHLT_TRANSLUCENT_WORLD_WATER // g-cont. allow to make world water is translucency (disabled because invoke crash somewhere into TestLine_r)
 #define ZHLT_NEW_PACIFIER	// g-cont. new pacifier style like in Source
+	#ifndef SINGLE_THREADED
+#define ZHLT_ASYNCLOG // ALL TOOLS - RunThreadsOn workers hand their messages to a log thread instead of writing them
+	#endif
 #define ZHLT_DEFAULTEXTENSION_FIX //--vluzacn
 #define ZHLT_FREETEXTUREAXIS //--vluzacn
 #define ZHLT_WARNWORLDFACES //--vluzacn
@@ -107,8 +110,13 @@
 #define ZHLT_EMBEDLIGHTMAP // this feature requires HLRAD_TEXTURE and RIPENT_TEXTURE //--vluzacn
 	#endif
 //#define ZHLT_HIDDENSOUNDTEXTURE //--vluzacn
+#define ZHLT_STAGECACHE // HLCSG, HLBSP, HLVIS, HLRAD - -stagecache <dir> restores a tool's outputs when its inputs match an earlier run
+#define ZHLT_FSINDEX // HLRAD - the filesystem layer hashes pak entries once per FS_Rescan instead of binary searching every pak per lookup
+#define ZHLT_BINARYPORTALS // HLBSP, HLVIS - hlbsp -binaryportals writes an indexed PRT1-BIN portal file that hlvis maps
 
 #define COMMON_HULLU // winding optimisations by hullu
+#define ZHLT_WINDING_INLINE // ALL TOOLS - windings of up to WINDING_INLINE_POINTS points keep them inside the object instead of on the heap
+#define ZHLT_NOZEROALLOC // ALL TOOLS - operator new and scratch buffers skip the zero fill; large per-patch arrays come from page allocations
 
 	#ifdef SYSTEM_WIN32
 #define RIPENT_PAUSE //--vluzacn
@@ -249,6 +257,7 @@
 #define HLBSP_BRINKHACK //--vluzacn
 	#endif
 #define HLBSP_MERGECLIPNODE // Will this break the BSP file format? //--vluzacn
+#define HLBSP_OBJECTPOOL // faces, surfaces, portals, nodes, sides and brushes come from per-thread slabs and free lists
 #define HLCSG_CLIPTYPEPRECISE_EPSILON_FIX //--vluzacn
 	#ifdef HLBSP_BRINKHACK
 #define HLBSP_BRINKNOTUSEDBYLEAF_FIX //--vluzacn
@@ -297,6 +306,10 @@
 	#ifdef HLVIS_OVERVIEW
 #define HLVIS_SKYBOXMODEL //--vluzacn
 	#endif
+	#if defined (SYSTEM_POSIX) && !defined (ZHLT_NETVIS)
+#define HLVIS_NETVIS // -listen/-worker: PortalFlow on worker processes over sockets
+	#endif
+#define HLVIS_BASEVIS_LAZY // BasePortalVis only tests the portals its flood reaches, instead of every portal in the map
 
 
 #define HLRAD_INFO_TEXLIGHTS
@@ -587,6 +600,32 @@
 #define HLRAD_FARPATCH_FIX //--vluzacn
 	#endif
 #define HLRAD_TRANSPARENCY_FAST //--vluzacn
+	#ifdef HLRAD_HULLU
+	#ifdef HLRAD_OPAQUE_STYLE
+	#ifdef HLRAD_OPAQUEINSKY_FIX
+	#ifdef HLRAD_MULTISKYLIGHT
+#define HLRAD_LIGHTCACHE // reuse shadow ray results between runs
+	#endif
+	#endif
+	#endif
+	#endif
+	#ifdef ZHLT_PARANOIA_BSP
+#define HLRAD_LEAFAMBIENT_CULL // leaf ambient cubes only trace the emit_surface lights that can reach the leaf, and keep per-face lightmap data
+	#endif
+	#ifdef ZHLT_STUDIOSHADOWS
+#define HLRAD_STUDIOMESH_SHARE // studio shadow meshes are built once per model/body/skin/shadow mode in object space, on all threads, and placed by a transform
+#define HLRAD_MESH_BVH // studio shadow meshes (normal and slow modes) are traced through an SAH bvh with 4 triangles per leaf instead of the areanode lists
+	#endif
+	#ifdef HLRAD_TRANSPARENCY_FAST
+	#ifdef HLRAD_TRANSPARENCY_CPP
+#define HLRAD_TRANSPARENCY_CSR // custom shadow and dynamic shadow style pairs are collected per thread and looked up in per-receiver rows; colours go to a palette
+	#endif
+	#endif
+	#ifdef HLRAD_CUSTOMTEXLIGHT
+	#ifdef HLRAD_ACCURATEBOUNCE_TEXLIGHT
+#define HLRAD_FACELIGHT_CULL // spotlights and texlights are classified once per face against a sphere around it: lights that miss it are skipped and lights that cover it skip the cone tests
+	#endif
+	#endif
 
 #if defined (ZHLT_XASH) || defined (ZHLT_XASH2)
 #if !defined (ZHLT_TEXLIGHT) || !defined (HLRAD_LERP_VL) || !defined (HLRAD_AUTOCORING) || !defined (HLRAD_MULTISKYLIGHT) || !defined (HLRAD_FinalLightFace_VL) || !defined (HLRAD_AVOIDNORMALFLIP)
@@ -6,7 +6,7 @@
 
 void* operator new(size_t size)
 {
-	void* mem = Alloc(size);
+	void* mem = AllocNoZero(size); // constructors initialize what they use
 	hlassume(mem != NULL, assume_NoMemory);
 
 	if ( !mem )
@@ -3,6 +3,8 @@
 #endif
 
 #ifdef SYSTEM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
 #include <sys/stat.h>
 #include <io.h>
 #include <fcntl.h>
@@ -20,6 +22,9 @@
 #ifdef HAVE_UNISTD_H
 #include <unistd.h>
 #endif
+
+#include <sys/mman.h>
+#include <sys/uio.h>
 #endif
 
 #include "cmdlib.h"
@@ -28,6 +33,7 @@
 #include "mathtypes.h"
 #include "mathlib.h"
 #include "blockmem.h"
+#include "filelib.h"
 
 /*
  * ==============
@@ -201,6 +207,105 @@ int             LoadFile(const char* const filename, char** bufferptr)
     return length;
 }
 
+/*
+ * ==============
+ * MapFile
+ *      Maps a file read only instead of copying it into memory; falls back to
+ *      LoadFile where the file can't be mapped. Release with UnmapFile.
+ * ==============
+ */
+// copyonwrite views may be written through; the changes stay private to the process
+void            MapFile(const char* const filename, mappedfile_t* const file, const bool copyonwrite)
+{
+    char*           buffer;
+
+    file->data = NULL;
+    file->length = 0;
+    file->mapped = false;
+#if defined (SYSTEM_POSIX)
+    {
+        struct stat     filestat;
+        const int       fd = open(filename, O_RDONLY);
+        void*           view;
+
+        if (fd == -1)
+        {
+            Error("Error opening %s: %s", filename, strerror(errno));
+        }
+        if (fstat(fd, &filestat) == 0 && filestat.st_size > 0 && filestat.st_size <= INT_MAX)
+        {
+            view = mmap(NULL, filestat.st_size, copyonwrite ? PROT_READ | PROT_WRITE : PROT_READ, MAP_PRIVATE, fd, 0);
+            if (view != MAP_FAILED)
+            {
+                file->data = (const char*)view;
+                file->length = filestat.st_size;
+                file->mapped = true;
+            }
+        }
+        close(fd);
+    }
+#elif defined (SYSTEM_WIN32)
+    {
+        HANDLE          f = CreateFileA(filename, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        HANDLE          mapping;
+        DWORD           high;
+        DWORD           low;
+
+        if (f == INVALID_HANDLE_VALUE)
+        {
+            Error("Error opening %s: error %lu", filename, GetLastError());
+        }
+        low = GetFileSize(f, &high);
+        if (low != INVALID_FILE_SIZE && high == 0 && low > 0 && low <= INT_MAX)
+        {
+            mapping = CreateFileMappingA(f, NULL, copyonwrite ? PAGE_WRITECOPY : PAGE_READONLY, 0, 0, NULL);
+            if (mapping)
+            {
+                file->data = (const char*)MapViewOfFile(mapping, copyonwrite ? FILE_MAP_COPY : FILE_MAP_READ, 0, 0, 0);
+                if (file->data)
+                {
+                    file->length = low;
+                    file->mapped = true;
+                }
+                CloseHandle(mapping);                      // the view keeps the mapping alive
+            }
+        }
+        CloseHandle(f);
+    }
+#endif
+    if (!file->mapped)
+    {
+        file->length = LoadFile(filename, &buffer);
+        file->data = buffer;
+    }
+}
+
+void            UnmapFile(mappedfile_t* const file)
+{
+    if (!file->data)
+    {
+        return;
+    }
+    if (!file->mapped)
+    {
+        free((void*)file->data);
+    }
+#if defined (SYSTEM_POSIX)
+    else
+    {
+        munmap((void*)file->data, file->length);
+    }
+#elif defined (SYSTEM_WIN32)
+    else
+    {
+        UnmapViewOfFile(file->data);
+    }
+#endif
+    file->data = NULL;
+    file->length = 0;
+    file->mapped = false;
+}
+
 /*
  * ==============
  * SaveFile
@@ -214,3 +319,75 @@ void            SaveFile(const char* const filename, const void* const buffer, i
     SafeWrite(f, buffer, count);
     fclose(f);
 }
+
+/*
+ * ==============
+ * SaveFileChunks
+ * writes the chunks back to back, with batched writev calls where there are any
+ * ==============
+ */
+#define SAVEFILE_IOVECS 64
+
+void            SaveFileChunks(const char* const filename, const filechunk_t* const chunks, const int numchunks)
+{
+#if defined (SYSTEM_POSIX)
+    struct iovec    iov[SAVEFILE_IOVECS];
+    const int       fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0666);
+    int             i;
+    int             n;
+
+    if (fd == -1)
+    {
+        Error("Error opening %s: %s", filename, strerror(errno));
+    }
+    for (i = 0; i < numchunks; i += n)
+    {
+        struct iovec*   v = iov;
+        int             left;
+
+        for (n = 0; n < SAVEFILE_IOVECS && i + n < numchunks; n++)
+        {
+            iov[n].iov_base = (void*)chunks[i + n].data;
+            iov[n].iov_len = chunks[i + n].length;
+        }
+        for (left = n; left > 0;)
+        {
+            ssize_t         written = writev(fd, v, left);
+
+            if (written < 0)
+            {
+                if (errno == EINTR)
+                {
+                    continue;
+                }
+                Error("File write failure: %s", strerror(errno));
+            }
+            // a short write resumes inside the vector it stopped in
+            while (left > 0 && (size_t)written >= v->iov_len)
+            {
+                written -= v->iov_len;
+                v++;
+                left--;
+            }
+            if (left > 0)
+            {
+                v->iov_base = (char*)v->iov_base + written;
+                v->iov_len -= written;
+            }
+        }
+    }
+    if (close(fd) == -1)
+    {
+        Error("File write failure: %s", strerror(errno));
+    }
+#else
+    FILE*           f;
+
+    f = SafeOpenWrite(filename);
+    for (int i = 0; i < numchunks; i++)
+    {
+        SafeWrite(f, chunks[i].data, chunks[i].length);
+    }
+    fclose(f);
+#endif
+}
@@ -27,8 +27,28 @@ extern void     SafeRead(FILE* f, void* buffer, int count);
 extern void     SafeWrite(FILE* f, const void* const buffer, int count);
 
 extern int      LoadFile(const char* const filename, char** bufferptr);
+
+typedef struct
+{
+    const char*     data;
+    int             length;
+    bool            mapped;                                // false for a LoadFile copy
+}
+mappedfile_t;
+
+extern void     MapFile(const char* const filename, mappedfile_t* const file, const bool copyonwrite);
+extern void     UnmapFile(mappedfile_t* const file);
 extern void     SaveFile(const char* const filename, const void* const buffer, int count);
 
+typedef struct
+{
+    const void*     data;
+    int             length;
+}
+filechunk_t;
+
+extern void     SaveFileChunks(const char* const filename, const filechunk_t* const chunks, const int numchunks);
+
 // new filesystem funcs
 void FS_Init( void );
 void FS_Shutdown( void );
@@ -134,6 +134,10 @@ static bool FS_SysFileExists( const char *path );
 static bool FS_SysFolderExists( const char *path );
 static long FS_SysFileTime( const char *filename );
 static void FS_Purge( file_t* file );
+#ifdef ZHLT_FSINDEX
+static void FS_BuildIndex( void );
+static void FS_FreeIndex( void );
+#endif
 
 /*
 =============================================================================
@@ -654,6 +658,9 @@ void FS_AddGameDirectory( const char *dir, int flags )
 	search->next = fs_searchpaths;
 	search->flags = flags;
 	fs_searchpaths = search;
+#ifdef ZHLT_FSINDEX
+	FS_FreeIndex(); // stale until the next FS_Rescan
+#endif
 
 
 }
@@ -748,6 +755,9 @@ FS_ClearSearchPath
 */
 void FS_ClearSearchPath( void )
 {
+#ifdef ZHLT_FSINDEX
+	FS_FreeIndex();
+#endif
 	while( fs_searchpaths )
 	{
 		searchpath_t	*search = fs_searchpaths;
@@ -881,6 +891,9 @@ void FS_Rescan( void )
 	if( Q_stricmp( fs_basedir, fs_falldir ) && Q_stricmp( fs_gamedir, fs_falldir ))
 		FS_AddGameHierarchy( fs_falldir, 0 );
 	FS_AddGameHierarchy( fs_gamedir, FS_GAMEDIR_PATH );
+#ifdef ZHLT_FSINDEX
+	FS_BuildIndex();
+#endif
 }
 
 /*
@@ -926,12 +939,12 @@ void FS_Init( void )
 {
 	char	workdir[_MAX_PATH];
 	char	mapdir[_MAX_PATH];
-	char	*pathend;
+	char	*pathend, *c;
 
 	fs_searchpaths = NULL;
 
 	// skip the unneeded separator
-	if( g_Mapname[0] == '.' && g_Mapname[1] == '/' || g_Mapname[1] == '\\' )
+	if( g_Mapname[0] == '.' && ( g_Mapname[1] == '/' || g_Mapname[1] == '\\' ))
 		Q_snprintf( mapdir, sizeof( mapdir ), "%s.map", g_Mapname + 2 );
 	else Q_snprintf( mapdir, sizeof( mapdir ), "%s.map", g_Mapname );
 
@@ -939,8 +952,14 @@ void FS_Init( void )
 	char* mapDirExpanded = FS_ExpandArg( mapdir );
 	Q_strncpy( workdir, mapDirExpanded, sizeof( workdir ));
 
-	// search for 'maps' in path
-	pathend = Q_stristr( workdir, "maps" );
+	// search for the last 'maps' folder in path; a plain substring search used to stop
+	// at any earlier 'maps' (like c:\mapsrc\) and build the search path from garbage
+	pathend = NULL;
+	for( c = workdir; *c; c++ )
+	{
+		if(( c == workdir || c[-1] == '/' || c[-1] == '\\' ) && !Q_strnicmp( c, "maps", 4 ) && ( c[4] == '/' || c[4] == '\\' ))
+			pathend = c;
+	}
 
 	if( !pathend )
 	{
@@ -953,14 +972,19 @@ void FS_Init( void )
 
 	Log( "workdir: %s\n", fs_rootdir );
 
-	FS_AddGameDirectory( va( "%s\\", fs_rootdir ), 0 );
+	// a game without gameinfo.txt or liblist.gam is searched in its own folder
+	Q_strncpy( fs_basedir, "valve", sizeof( fs_basedir ));
+	FS_FileBase( fs_rootdir, fs_gamedir );
+
+	// '/' works as a separator on every host
+	FS_AddGameDirectory( va( "%s/", fs_rootdir ), 0 );
 	FS_ReadGameInfo( fs_rootdir );
 
 	Log( "gamedir: %s, basedir %s, falldir %s\n", fs_gamedir, fs_basedir, fs_falldir );
 	ExtractFilePath( fs_rootdir, fs_rootdir );
 
 	if( !Q_strcmp( fs_rootdir, "" ))
-		Q_strncpy( fs_rootdir, "..\\", sizeof( fs_rootdir ));
+		Q_strncpy( fs_rootdir, "../", sizeof( fs_rootdir ));
 
 	Log( "rootdir %s\n", fs_rootdir );
 	FS_Rescan(); // create new filesystem
@@ -1161,6 +1185,148 @@ bool FS_SysFolderExists( const char *path )
 #endif
 }
 
+#ifdef ZHLT_FSINDEX
+/*
+=============================================================================
+
+PAK INDEX
+
+Every pak entry in the search path, hashed once by FS_Rescan so a pak
+lookup (and above all a miss) costs a probe instead of a binary search
+per pak. Loose files are still looked up on disk: that keeps folders
+counting as found and sees files created after the scan, and a full
+scan of the game folders costs more than the few lookups a tool makes.
+=============================================================================
+*/
+typedef struct fsindexentry_s
+{
+	const char	*name;		// pak entry name
+	unsigned int	hash;
+	searchpath_t	*search;
+	int		index;		// pak entry
+} fsindexentry_t;
+
+static fsindexentry_t	*fs_index = NULL;	// open addressing, entries of one name in search path order
+static unsigned int	fs_indexmask;
+
+/*
+====================
+FS_IndexHash
+
+case and slash insensitive
+====================
+*/
+static unsigned int FS_IndexHash( const char *name )
+{
+	unsigned int	hash = 2166136261u;
+	int		c;
+
+	for( ; *name; name++ )
+	{
+		c = (unsigned char)*name;
+		if( c >= 'A' && c <= 'Z' ) c += 'a' - 'A';
+		else if( c == '\\' ) c = '/';
+		hash = ( hash ^ c ) * 16777619u;
+	}
+	return hash;
+}
+
+/*
+====================
+FS_IndexInsert
+====================
+*/
+static void FS_IndexInsert( const char *name, searchpath_t *search, int index )
+{
+	unsigned int	hash = FS_IndexHash( name );
+	unsigned int	slot;
+
+	// entries of one name land in insertion (= search path) order along the probe
+	for( slot = hash & fs_indexmask; fs_index[slot].name; slot = ( slot + 1 ) & fs_indexmask );
+
+	fs_index[slot].name = name;
+	fs_index[slot].hash = hash;
+	fs_index[slot].search = search;
+	fs_index[slot].index = index;
+}
+
+/*
+====================
+FS_FreeIndex
+====================
+*/
+static void FS_FreeIndex( void )
+{
+	if( fs_index )
+		Free( fs_index );
+	fs_index = NULL;
+}
+
+/*
+====================
+FS_BuildIndex
+====================
+*/
+static void FS_BuildIndex( void )
+{
+	searchpath_t	*search;
+	int		total, j;
+	unsigned int	size;
+
+	FS_FreeIndex();
+
+	total = 0;
+	for( search = fs_searchpaths; search; search = search->next )
+	{
+		if( search->pack ) total += search->pack->numfiles;
+	}
+
+	for( size = 64; size < (unsigned int)total * 2; size <<= 1 );
+	fs_index = (fsindexentry_t *)Alloc( size * sizeof( fsindexentry_t ));
+	fs_indexmask = size - 1;
+
+	for( search = fs_searchpaths; search; search = search->next )
+	{
+		if( !search->pack )
+			continue;
+		for( j = 0; j < search->pack->numfiles; j++ )
+			FS_IndexInsert( search->pack->files[j].name, search, j );
+	}
+
+	Developer( DEVELOPER_LEVEL_MESSAGE, "FS_BuildIndex: %i pak entries\n", total );
+}
+
+/*
+====================
+FS_IndexFindFile
+
+the first pak in search path order holding name, compared like the old binary search
+====================
+*/
+static searchpath_t *FS_IndexFindFile( const char *name, int *index, bool gamedironly )
+{
+	unsigned int	hash = FS_IndexHash( name );
+	unsigned int	slot;
+
+	for( slot = hash & fs_indexmask; fs_index[slot].name; slot = ( slot + 1 ) & fs_indexmask )
+	{
+		const fsindexentry_t	*e = &fs_index[slot];
+
+		if( e->hash != hash || Q_stricmp( e->name, name ))
+			continue;
+		if( gamedironly && !( e->search->flags & FS_GAMEDIR_PATH ))
+			continue;
+
+		*index = e->index;
+		return e->search;
+	}
+
+	// a miss ends at the first empty slot
+	*index = -1;
+	return NULL;
+}
+#endif
+
 /*
 ====================
 FS_FindFile
@@ -1177,12 +1343,30 @@ static searchpath_t *FS_FindFile( const char *name, int* index, bool gamedironly
 	char		*pEnvPath;
 	pack_t		*pak;
 
+#ifdef ZHLT_FSINDEX
+	searchpath_t	*packsearch = NULL;
+	int		packindex = -1;
+
+	if( fs_index )
+		packsearch = FS_IndexFindFile( name, &packindex, gamedironly );
+#endif
+
 	// search through the path, one element at a time
 	for( search = fs_searchpaths; search; search = search->next )
 	{
 		if( gamedironly & !( search->flags & FS_GAMEDIR_PATH ))
 			continue;
 
+#ifdef ZHLT_FSINDEX
+		// a pak before the first one holding the name can't have it
+		if( search->pack && fs_index )
+		{
+			if( search != packsearch )
+				continue;
+			if( index ) *index = packindex;
+			return search;
+		}
+#endif
 		// is the element a pak file?
 		if( search->pack )
 		{
@@ -42,6 +42,22 @@
 
 #include "stringlib.h"
 
+#ifdef ZHLT_ASYNCLOG
+#include <atomic>
+#ifdef SYSTEM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#endif
+#endif
+
+// the functions themselves, not log.h's filtering wrappers
+#undef Developer
+#undef Verbose
+
 const char*           g_Program = "Uninitialized variable ::g_Program";
 char            g_Mapname[_MAX_PATH] = "Uninitialized variable ::g_Mapname";
 
@@ -55,6 +71,10 @@ unsigned long   g_nextclientid = 0;
 static FILE*    CompileLog = NULL;
 static bool     fatal = false;
 
+#define MAX_ERROR   2048
+#define MAX_WARNING 2048
+#define MAX_MESSAGE 2048
+
 #ifdef ZHLT_CONSOLE
 bool twice = false;
 bool useconsole = false;
@@ -180,8 +200,15 @@ void  CheckForErrorLog()
 
 ///////
 
+#ifdef ZHLT_ASYNCLOG
+static void     FlushAsyncLog();
+#endif
+
 void            LogError(const char* const message)
 {
+#ifdef ZHLT_ASYNCLOG
+	FlushAsyncLog();                                       // the message before the error file, and before any exit
+#endif
 	if (g_log && CompileLog)
 	{
 		char            logfilename[_MAX_PATH];
@@ -328,30 +355,264 @@ void            Safe_WriteLog(const char* const message)
 }
 #endif
 
-void            WriteLog(const char* const message)
+static void     WriteLogText(const char* const message)
 {
-
 #ifndef SYSTEM_WIN32
 	if (CompileLog)
 	{
 		fprintf(CompileLog, "%s", message); //fprintf(CompileLog, message); //--vluzacn
-		fflush(CompileLog);
 	}
 #else
 	Safe_WriteLog(message);
 #endif
 
 	fprintf(stdout, "%s", message); //fprintf(stdout, message); //--vluzacn
-	fflush(stdout);
 #ifdef ZHLT_CONSOLE
 	if (twice)
 	{
 		fprintf (conout, "%s", message);
+	}
+#endif
+}
+
+static void     FlushLogText()
+{
+	if (CompileLog)
+	{
+		fflush(CompileLog);
+	}
+	fflush(stdout);
+#ifdef ZHLT_CONSOLE
+	if (twice)
+	{
 		fflush (conout);
 	}
 #endif
 }
 
+#ifdef ZHLT_ASYNCLOG
+// =====================================================================================
+//  Asynchronous log
+//      s_logring is a bounded multi-producer queue: a worker claims the next slot with a
+//      compare-exchange on s_logqueued, copies its message in and publishes it through the
+//      slot's sequence number. The log thread writes the slots in claim order and flushes
+//      once per batch, so workers never wait on stdio locks or on each other's flushes.
+//      The log thread sleeps on a semaphore that a worker posts only when it finds
+//      s_logidle set.
+// =====================================================================================
+#define LOGRING_SIZE    256                                // power of 2
+#define LOGRING_MASK    (LOGRING_SIZE - 1)
+
+typedef struct
+{
+	std::atomic<unsigned int> sequence;                    // == position: free, == position + 1: holds a message
+	char            text[MAX_MESSAGE];
+}
+logslot_t;
+
+static logslot_t s_logring[LOGRING_SIZE];
+static std::atomic<unsigned int> s_logqueued(0);           // slots claimed by workers
+static std::atomic<unsigned int> s_logwritten(0);          // slots the log thread has written
+static std::atomic<bool> s_logidle(false);
+static std::atomic<bool> s_logasync(false);
+static bool     s_logthread = false;
+#ifdef SYSTEM_WIN32
+static HANDLE   s_logwake;
+#else
+static sem_t    s_logwake;
+#endif
+
+static void     WakeLogThread()
+{
+	if (s_logidle.load() && s_logidle.exchange(false))
+	{
+#ifdef SYSTEM_WIN32
+		ReleaseSemaphore(s_logwake, 1, NULL);
+#else
+		sem_post(&s_logwake);
+#endif
+	}
+}
+
+static void     WaitLogThread()
+{
+#ifdef SYSTEM_WIN32
+	WaitForSingleObject(s_logwake, INFINITE);
+#else
+	while (sem_wait(&s_logwake) == -1 && errno == EINTR)
+		;
+#endif
+}
+
+static void     YieldLog()
+{
+#ifdef SYSTEM_WIN32
+	Sleep(0);
+#else
+	sched_yield();
+#endif
+}
+
+static bool     LogSlotReady()
+{
+	const unsigned int pos = s_logwritten.load(std::memory_order_relaxed);
+
+	return s_logring[pos & LOGRING_MASK].sequence.load(std::memory_order_acquire) == pos + 1;
+}
+
+static void     QueueLog(const char* const message)
+{
+	unsigned int    pos = s_logqueued.load(std::memory_order_relaxed);
+	logslot_t*      slot;
+	int             diff;
+
+	for (;;)
+	{
+		slot = &s_logring[pos & LOGRING_MASK];
+		diff = (int)(slot->sequence.load(std::memory_order_acquire) - pos);
+		if (diff == 0)
+		{
+			if (s_logqueued.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+			{
+				break;
+			}
+		}
+		else
+		{
+			if (diff < 0)
+			{
+				// ring full, the log thread is a whole ring behind
+				WakeLogThread();
+				YieldLog();
+			}
+			pos = s_logqueued.load(std::memory_order_relaxed);
+		}
+	}
+
+	safe_strncpy(slot->text, message, MAX_MESSAGE);
+	slot->sequence.store(pos + 1, std::memory_order_release);
+	WakeLogThread();
+}
+
+static void     WriteQueuedLog()
+{
+	unsigned int    pos;
+	logslot_t*      slot;
+	bool            wrote = false;
+
+	while (LogSlotReady())
+	{
+		pos = s_logwritten.load(std::memory_order_relaxed);
+		slot = &s_logring[pos & LOGRING_MASK];
+		WriteLogText(slot->text);
+		slot->sequence.store(pos + LOGRING_SIZE, std::memory_order_release);
+		s_logwritten.store(pos + 1, std::memory_order_release);
+		wrote = true;
+	}
+	if (wrote)
+	{
+		FlushLogText();
+	}
+}
+
+#ifdef SYSTEM_WIN32
+static DWORD WINAPI LogThread(LPVOID unused)
+#else
+static void*    LogThread(void* unused)
+#endif
+{
+	for (;;)
+	{
+		WriteQueuedLog();
+		s_logidle.store(true);
+		if (LogSlotReady() && s_logidle.exchange(false))
+		{
+			continue;                                      // nobody posted for this one
+		}
+		WaitLogThread();
+	}
+	return 0;
+}
+
+// waits until the log thread has written every message queued so far
+static void     FlushAsyncLog()
+{
+	const unsigned int queued = s_logqueued.load();
+
+	if (!s_logthread)
+	{
+		return;
+	}
+	while ((int)(s_logwritten.load(std::memory_order_acquire) - queued) < 0)
+	{
+		WakeLogThread();
+		YieldLog();
+	}
+}
+
+void            LogBeginThreads()
+{
+	unsigned int    i;
+
+	if (!s_logthread)
+	{
+		for (i = 0; i < LOGRING_SIZE; i++)
+		{
+			s_logring[i].sequence.store(i, std::memory_order_relaxed);
+		}
+#ifdef SYSTEM_WIN32
+		s_logwake = CreateSemaphore(NULL, 0, LOGRING_SIZE, NULL);
+		if (!s_logwake)
+		{
+			return;
+		}
+		HANDLE          thread = CreateThread(NULL, 0, LogThread, NULL, 0, NULL);
+
+		if (!thread)
+		{
+			CloseHandle(s_logwake);
+			return;
+		}
+		CloseHandle(thread);
+#else
+		pthread_t       thread;
+
+		if (sem_init(&s_logwake, 0, 0) == -1)
+		{
+			return;
+		}
+		if (pthread_create(&thread, NULL, LogThread, NULL))
+		{
+			sem_destroy(&s_logwake);
+			return;
+		}
+		pthread_detach(thread);
+#endif
+		s_logthread = true;                                // if it can't be started, logging just stays synchronous
+	}
+	s_logasync.store(true);
+}
+
+void            LogEndThreads()
+{
+	s_logasync.store(false);
+	FlushAsyncLog();
+}
+#endif
+
+void            WriteLog(const char* const message)
+{
+#ifdef ZHLT_ASYNCLOG
+	if (s_logasync.load(std::memory_order_relaxed) && s_logthread)
+	{
+		QueueLog(message);
+		return;
+	}
+#endif
+	WriteLogText(message);
+	FlushLogText();
+}
+
 // =====================================================================================
 //  CheckFatal
 // =====================================================================================
@@ -364,10 +625,6 @@ void            CheckFatal()
 	}
 }
 
-#define MAX_ERROR   2048
-#define MAX_WARNING 2048
-#define MAX_MESSAGE 2048
-
 // =====================================================================================
 //  Error
 //      for formatted error messages, fatals out
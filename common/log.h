@@ -50,6 +50,11 @@ extern void     CheckForErrorLog();
 extern void CDECL OpenLog(int clientid);
 extern void CDECL CloseLog();
 extern void     WriteLog(const char* const message);
+#ifdef ZHLT_ASYNCLOG
+// RunThreadsOn brackets its workers with these; in between WriteLog only queues the message
+extern void     LogBeginThreads();
+extern void     LogEndThreads();
+#endif
 
 extern void     CheckFatal();
 
@@ -77,6 +82,15 @@ extern void CDECL FORMAT_PRINTF(1,2) Warning(const char* const warning, ...);
 
 extern void CDECL FORMAT_PRINTF(1,2) PrintOnce(const char* const message, ...);
 
+// Developer messages above MAX_DEVELOPER_LEVEL are compiled out (build with, say,
+// -DMAX_DEVELOPER_LEVEL=DEVELOPER_LEVEL_MESSAGE to drop the spam levels), and the level
+// and verbose checks are made before the arguments are evaluated or the call is made
+#ifndef MAX_DEVELOPER_LEVEL
+#define MAX_DEVELOPER_LEVEL DEVELOPER_LEVEL_MEGASPAM
+#endif
+#define Developer(level, ...) ((level) <= MAX_DEVELOPER_LEVEL && (level) <= g_developer ? Developer((level), __VA_ARGS__) : (void)0)
+#define Verbose(...) (g_verbose ? Verbose(__VA_ARGS__) : (void)0)
+
 extern void     LogStart(const int argc, char** argv);
 extern void     LogEnd();
 extern void     Banner();
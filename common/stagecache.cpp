@@ -0,0 +1,499 @@
+#ifdef SYSTEM_WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#include <direct.h>
+#include <process.h>
+#endif
+
+#ifdef SYSTEM_POSIX
+#ifdef HAVE_SYS_STAT_H
+#include <sys/stat.h>
+#endif
+#endif
+
+#include "cmdlib.h"
+#include "messages.h"
+#include "log.h"
+#include "blockmem.h"
+#include "filelib.h"
+#include "bspfile.h"
+#include "checksum.h"
+
+#include "stagecache.h"
+
+#ifdef ZHLT_STAGECACHE
+
+#include <atomic>
+
+// The cache directory holds one manifest per tool run, <tool>-<key>.stage, naming the
+// content hash of every file the run wrote, and the files themselves under objects/,
+// named by that hash so runs that write the same file share it.
+
+#define STAGE_MANIFEST_ID   "STAGE1"
+#define MAX_STAGE_OUTPUTS   32
+#define MAX_STAGE_SUFFIX    32
+
+typedef struct
+{
+    char            suffix[MAX_STAGE_SUFFIX];
+    int             length;                                // -1 when the run didn't leave the file
+    uint64_t        hash;                                  // HashBSPLump of the contents
+}
+stageoutput_t;
+
+typedef struct
+{
+    const char*     name;
+    int             values;
+}
+stageoption_t;
+
+char*           g_stagecache = NULL;
+
+static char     s_stagetool[MAX_STAGE_SUFFIX];
+static uint64_t s_stagekey = 0;
+static stageoutput_t s_stageoutputs[MAX_STAGE_OUTPUTS];
+static int      s_numstageoutputs = 0;
+static std::atomic<unsigned int> s_stagetempfiles(0);     // numbers the temporary files of this process
+
+// options that change how a tool runs but not what it writes, with the number of values they take
+static const stageoption_t s_stageneutraloptions[] =
+{
+    {"-stagecache", 1},
+    {"-threads", 1},
+    {"-estimate", 0},
+    {"-noestimate", 0},
+    {"-verbose", 0},
+    {"-chart", 0},
+    {"-nolog", 0},
+    {"-low", 0},
+    {"-high", 0},
+};
+
+static void     StageKey(const void* const data, const int length)
+{
+    s_stagekey = HashBytes64(data, length, s_stagekey);
+}
+
+static void     StageKeyString(const char* const string)
+{
+    StageKey(string, strlen(string) + 1);
+}
+
+static void     StageKeyName(char* const name, const int size)
+{
+    safe_snprintf(name, size, "%s-%08x%08x", s_stagetool, (unsigned int)(s_stagekey >> 32), (unsigned int)s_stagekey);
+}
+
+static void     StagePath(char* const path, const char* const dir, const char* const name)
+{
+    safe_snprintf(path, _MAX_PATH, "%s" SYSTEM_SLASH_STR "%s", dir, name);
+}
+
+static void     StageObjectPath(char* const path, const uint64_t hash)
+{
+    safe_snprintf(path, _MAX_PATH, "%s" SYSTEM_SLASH_STR "objects" SYSTEM_SLASH_STR "%08x%08x",
+                  g_stagecache, (unsigned int)(hash >> 32), (unsigned int)hash);
+}
+
+static void     StageNamedObjectPath(char* const path, const char* const kind, const uint64_t key)
+{
+    safe_snprintf(path, _MAX_PATH, "%s" SYSTEM_SLASH_STR "objects" SYSTEM_SLASH_STR "%s-%08x%08x",
+                  g_stagecache, kind, (unsigned int)(key >> 32), (unsigned int)key);
+}
+
+static void     StageMakeDir(const char* const path)
+{
+#ifdef SYSTEM_WIN32
+    _mkdir(path);
+#else
+    mkdir(path, 0777);
+#endif
+}
+
+// =====================================================================================
+//  StageWriteFile
+//      writes a temporary file next to filename and renames it over filename, so readers
+//      (and a mapped copy of the old file) never see a half written one; the temporary name
+//      carries the process id and a per-process number, since threads store objects too
+// =====================================================================================
+static bool     StageWriteFile(const char* const filename, const void* const data, const int length)
+{
+    char            temp[_MAX_PATH];
+    FILE*           f;
+    bool            ok;
+    const unsigned int tempnum = s_stagetempfiles++;
+
+#ifdef SYSTEM_WIN32
+    safe_snprintf(temp, _MAX_PATH, "%s.%d.%u.tmp", filename, _getpid(), tempnum);
+#else
+    safe_snprintf(temp, _MAX_PATH, "%s.%d.%u.tmp", filename, (int)getpid(), tempnum);
+#endif
+    f = fopen(temp, "wb");
+    if (!f)
+    {
+        return false;
+    }
+    ok = length == 0 || fwrite(data, length, 1, f) == 1;
+    ok = fclose(f) == 0 && ok;
+#ifdef SYSTEM_WIN32
+    if (ok)
+    {
+        unlink(filename);                                  // rename won't replace a file on windows
+    }
+#endif
+    if (!ok || rename(temp, filename))
+    {
+        unlink(temp);
+        return false;
+    }
+    return true;
+}
+
+// =====================================================================================
+//  StageCacheBegin
+//      the key starts with the tool and a hash of its own executable, so a rebuilt tool
+//      never reuses an older build's output
+// =====================================================================================
+void            StageCacheBegin(const char* const tool, const int argc, char** argv, const char* const mapname)
+{
+    char            exe[_MAX_PATH];
+    int             i;
+    int             j;
+
+    if (!g_stagecache)
+    {
+        return;
+    }
+    safe_strncpy(s_stagetool, tool, MAX_STAGE_SUFFIX);
+    s_stagekey = 0;
+    s_numstageoutputs = 0;
+
+    StageKeyString(tool);
+    StageKeyString(ZHLT_VERSIONSTRING " " HACK_VERSIONSTRING " " PLATFORM_VERSIONSTRING);
+#ifdef SYSTEM_WIN32
+    GetModuleFileNameA(NULL, exe, _MAX_PATH);
+#else
+    safe_strncpy(exe, "/proc/self/exe", _MAX_PATH);
+    if (!q_exists(exe))
+    {
+        safe_strncpy(exe, argv[0], _MAX_PATH);
+    }
+#endif
+    StageCacheInputFile(exe);
+
+    for (i = 1; i < argc; i++)
+    {
+        if (argv[i] == mapname)
+        {
+            continue;
+        }
+        for (j = 0; j < (int)(sizeof(s_stageneutraloptions) / sizeof(s_stageneutraloptions[0])); j++)
+        {
+            if (!strcasecmp(argv[i], s_stageneutraloptions[j].name))
+            {
+                break;
+            }
+        }
+        if (j < (int)(sizeof(s_stageneutraloptions) / sizeof(s_stageneutraloptions[0])))
+        {
+            i += s_stageneutraloptions[j].values;
+            continue;
+        }
+        StageKeyString(argv[i]);
+    }
+}
+
+void            StageCacheInputFile(const char* const filename)
+{
+    mappedfile_t    file;
+    uint64_t        hash;
+
+    if (!g_stagecache)
+    {
+        return;
+    }
+    if (!q_exists(filename))
+    {
+        StageKeyString("<missing>");
+        return;
+    }
+    MapFile(filename, &file, false);
+    hash = HashBSPLump(file.data, file.length);
+    UnmapFile(&file);
+    StageKey(&hash, sizeof(hash));
+}
+
+void            StageCacheInputBSP()
+{
+    if (!g_stagecache)
+    {
+        return;
+    }
+    StageKey(g_bsplumphashes, sizeof(g_bsplumphashes));
+}
+
+void            StageCacheInputData(const void* const data, const int length)
+{
+    if (!g_stagecache)
+    {
+        return;
+    }
+    StageKey(data, length);
+}
+
+// textures are keyed by path, size and time rather than read, since a tool only loads the
+// ones the map uses; an edit that keeps a texture's size and time goes unnoticed
+void            StageCacheInputTextures()
+{
+    std::vector<std::string> textures;
+    std::vector<std::string>::const_iterator it;
+    std::string     path;
+    long            size;
+    time_t          filetime;
+
+    if (!g_stagecache)
+    {
+        return;
+    }
+    g_TexDirListing.textureList(textures);
+    for (it = textures.begin(); it != textures.end(); ++it)
+    {
+        path = g_TexDirListing.makeFullTexturePath(*it);
+        size = getfilesize(path.c_str());
+        filetime = getfiletime(path.c_str());
+        StageKeyString(it->c_str());
+        StageKey(&size, sizeof(size));
+        StageKey(&filetime, sizeof(filetime));
+    }
+}
+
+void            StageCacheOutput(const char* const suffix)
+{
+    if (!g_stagecache)
+    {
+        return;
+    }
+    if (s_numstageoutputs >= MAX_STAGE_OUTPUTS)
+    {
+        Error("StageCacheOutput: too many outputs (%d)", MAX_STAGE_OUTPUTS);
+    }
+    safe_strncpy(s_stageoutputs[s_numstageoutputs].suffix, suffix, MAX_STAGE_SUFFIX);
+    s_stageoutputs[s_numstageoutputs].length = -1;
+    s_stageoutputs[s_numstageoutputs].hash = 0;
+    s_numstageoutputs++;
+}
+
+// =====================================================================================
+//  StageCacheRestore
+//      every object is checked against the manifest before any output is replaced, so a
+//      damaged cache falls back to compiling instead of leaving a mix of old and new files
+// =====================================================================================
+bool            StageCacheRestore()
+{
+    char            name[_MAX_PATH];
+    char            path[_MAX_PATH];
+    char            target[_MAX_PATH];
+    char*           text;
+    char*           line;
+    char*           next;
+    int             length;
+    int             numoutputs;
+    unsigned int    hashhigh;
+    unsigned int    hashlow;
+    stageoutput_t   outputs[MAX_STAGE_OUTPUTS];
+    mappedfile_t    objects[MAX_STAGE_OUTPUTS];
+    bool            valid;
+    int             i;
+
+    if (!g_stagecache)
+    {
+        return false;
+    }
+    StageKeyName(name, _MAX_PATH);
+    safe_strncat(name, ".stage", _MAX_PATH);
+    StagePath(path, g_stagecache, name);
+    if (!q_exists(path))
+    {
+        Log("Stage cache miss (%s)\n", name);
+        return false;
+    }
+
+    length = LoadFile(path, &text);
+    text[length] = '\0';
+    valid = !strncmp(text, STAGE_MANIFEST_ID "\n", strlen(STAGE_MANIFEST_ID "\n"));
+    numoutputs = 0;
+    for (line = text + strlen(STAGE_MANIFEST_ID "\n"); valid && *line; line = next)
+    {
+        next = strchr(line, '\n');
+        if (!next || numoutputs == MAX_STAGE_OUTPUTS)
+        {
+            valid = false;
+            break;
+        }
+        *next++ = '\0';
+        if (sscanf(line, "%31s %d %8x%8x", outputs[numoutputs].suffix, &outputs[numoutputs].length, &hashhigh, &hashlow) != 4)
+        {
+            valid = false;
+            break;
+        }
+        outputs[numoutputs].hash = ((uint64_t)hashhigh << 32) | hashlow;
+        numoutputs++;
+    }
+    Free(text);
+
+    memset(objects, 0, sizeof(objects));
+    for (i = 0; valid && i < numoutputs; i++)
+    {
+        if (outputs[i].length < 0)
+        {
+            continue;
+        }
+        StageObjectPath(path, outputs[i].hash);
+        if (!q_exists(path))
+        {
+            valid = false;
+            break;
+        }
+        MapFile(path, &objects[i], false);
+        valid = objects[i].length == outputs[i].length && HashBSPLump(objects[i].data, objects[i].length) == outputs[i].hash;
+        if (!valid)
+        {
+            UnmapFile(&objects[i]);
+            unlink(path);                                  // so the next store writes it again
+        }
+    }
+    if (!valid)
+    {
+        Warning("Stage cache entry %s is incomplete or damaged; recompiling", name);
+        for (i = 0; i < numoutputs; i++)
+        {
+            UnmapFile(&objects[i]);
+        }
+        return false;
+    }
+
+#ifdef SYSTEM_WIN32
+    ReleaseBSPImage();                                     // the loaded bsp is usually an output, and a mapped file can't be replaced
+#endif
+    for (i = 0; i < numoutputs; i++)
+    {
+        safe_snprintf(target, _MAX_PATH, "%s%s", g_Mapname, outputs[i].suffix);
+        if (outputs[i].length < 0)
+        {
+            unlink(target);
+            continue;
+        }
+        if (!StageWriteFile(target, objects[i].data, objects[i].length))
+        {
+            Error("Stage cache: couldn't write %s: %s", target, strerror(errno));
+        }
+        UnmapFile(&objects[i]);
+    }
+    Log("Stage cache hit (%s): %d files restored\n", name, numoutputs);
+    return true;
+}
+
+// =====================================================================================
+//  StageCacheStore
+//      a cache that can't be written only costs the next run its hit, so failures warn
+// =====================================================================================
+void            StageCacheStore()
+{
+    char            name[_MAX_PATH];
+    char            path[_MAX_PATH];
+    char            target[_MAX_PATH];
+    char            text[MAX_STAGE_OUTPUTS * (MAX_STAGE_SUFFIX + 32) + sizeof(STAGE_MANIFEST_ID "\n")];
+    size_t          textlength;
+    mappedfile_t    file;
+    stageoutput_t*  output;
+    int             i;
+
+    if (!g_stagecache)
+    {
+        return;
+    }
+    StageMakeDir(g_stagecache);
+    StagePath(path, g_stagecache, "objects");
+    StageMakeDir(path);
+
+    safe_snprintf(text, sizeof(text), "%s\n", STAGE_MANIFEST_ID);
+    for (i = 0; i < s_numstageoutputs; i++)
+    {
+        output = &s_stageoutputs[i];
+        safe_snprintf(target, _MAX_PATH, "%s%s", g_Mapname, output->suffix);
+        if (q_exists(target))
+        {
+            MapFile(target, &file, false);
+            output->length = file.length;
+            output->hash = HashBSPLump(file.data, file.length);
+            StageObjectPath(path, output->hash);
+            if ((!q_exists(path) || getfilesize(path) != output->length) && !StageWriteFile(path, file.data, file.length))
+            {
+                Warning("Stage cache: couldn't write %s: %s", path, strerror(errno));
+                UnmapFile(&file);
+                return;
+            }
+            UnmapFile(&file);
+        }
+        textlength = strlen(text);
+        safe_snprintf(text + textlength, sizeof(text) - textlength, "%s %d %08x%08x\n",
+                      output->suffix, output->length, (unsigned int)(output->hash >> 32), (unsigned int)output->hash);
+    }
+
+    StageKeyName(name, _MAX_PATH);
+    safe_strncat(name, ".stage", _MAX_PATH);
+    StagePath(path, g_stagecache, name);
+    if (!StageWriteFile(path, text, strlen(text)))
+    {
+        Warning("Stage cache: couldn't write %s: %s", path, strerror(errno));
+        return;
+    }
+    Log("Stage cache stored (%s): %d files\n", name, s_numstageoutputs);
+}
+
+// =====================================================================================
+//  StageCacheLoadObject
+// =====================================================================================
+byte*           StageCacheLoadObject(const char* const kind, const uint64_t key, int* const length)
+{
+    char            path[_MAX_PATH];
+    char*           data;
+
+    if (!g_stagecache)
+    {
+        return NULL;
+    }
+    StageNamedObjectPath(path, kind, key);
+    if (!q_exists(path))
+    {
+        return NULL;
+    }
+    *length = LoadFile(path, &data);
+    return (byte*)data;
+}
+
+// =====================================================================================
+//  StageCacheStoreObject
+//      StageWriteFile renames a complete file into place, so a reader on another thread
+//      or in another run never loads a partial object
+// =====================================================================================
+void            StageCacheStoreObject(const char* const kind, const uint64_t key, const void* const data, const int length)
+{
+    char            path[_MAX_PATH];
+
+    if (!g_stagecache)
+    {
+        return;
+    }
+    StageMakeDir(g_stagecache);
+    StagePath(path, g_stagecache, "objects");
+    StageMakeDir(path);
+    StageNamedObjectPath(path, kind, key);
+    if (!StageWriteFile(path, data, length))
+    {
+        Warning("Stage cache: couldn't write %s: %s", path, strerror(errno));
+    }
+}
+
+#endif
@@ -0,0 +1,35 @@
+#ifndef STAGECACHE_H__
+#define STAGECACHE_H__
+#include "cmdlib.h" //--vluzacn
+
+#if _MSC_VER >= 1000
+#pragma once
+#endif
+
+#ifdef ZHLT_STAGECACHE
+
+// -stagecache <dir>: a tool keys its run on everything it reads (tool binary, arguments,
+// input lumps and files) and, when a previous run with the same key left its output files
+// in <dir>, copies them back instead of compiling. NULL when the cache is off.
+extern char*    g_stagecache;
+
+// starts the key; mapname is the argv entry naming the map, which is keyed by content instead
+extern void     StageCacheBegin(const char* const tool, const int argc, char** argv, const char* const mapname);
+extern void     StageCacheInputFile(const char* const filename);    // a missing file is keyed too
+extern void     StageCacheInputBSP();                               // g_bsplumphashes of the loaded bsp
+extern void     StageCacheInputTextures();                          // the -texturedir listing, by path, size and time
+extern void     StageCacheInputData(const void* const data, const int length); // a hash of anything else the run reads
+extern void     StageCacheOutput(const char* const suffix);        // g_Mapname + suffix is written by the tool
+
+// true when every output was restored from the cache and the tool can stop
+extern bool     StageCacheRestore();
+extern void     StageCacheStore();
+
+// blobs a tool keeps between runs for part of its work (hlrad's studio meshes); the key has to
+// cover everything the blob was made from. Load returns NULL on a miss, else a buffer to Free
+extern byte*    StageCacheLoadObject(const char* const kind, const uint64_t key, int* const length);
+extern void     StageCacheStoreObject(const char* const kind, const uint64_t key, const void* const data, const int length);
+
+#endif
+
+#endif // STAGECACHE_H__
@@ -456,6 +456,9 @@ void            RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction fu
     }
     CheckFatal();
 
+#ifdef ZHLT_ASYNCLOG
+    LogBeginThreads();
+#endif
     // Start all the threads
     for (i = 0; i < g_numthreads; i++)
     {
@@ -484,6 +487,9 @@ void            RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction fu
         Developer(DEVELOPER_LEVEL_MESSAGE, "WaitForSingleObject on thread #%d [%08X]\n", i, threadhandle[i]);
         WaitForSingleObject(threadhandle[i], INFINITE);
     }
+#ifdef ZHLT_ASYNCLOG
+    LogEndThreads();
+#endif
     threads_UninitCrit();
 
     q_entry = NULL;
@@ -650,6 +656,9 @@ void            RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction fu
     }
 #endif
 
+#ifdef ZHLT_ASYNCLOG
+    LogBeginThreads();
+#endif
     for (i = 0; i < g_numthreads; i++)
     {
         // This shuts up "Cast to pointer from integer of different size" warning.
@@ -675,6 +684,9 @@ void            RunThreadsOn(int workcnt, bool showpacifier, q_threadfunction fu
             Error("pthread_join failed");
         }
     }
+#ifdef ZHLT_ASYNCLOG
+    LogEndThreads();
+#endif
 
     threads_UninitCrit();
 
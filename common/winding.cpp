@@ -260,9 +260,7 @@ Winding::Winding(vec3_t *points, UINT32 numpoints)
 {
 	hlassert(numpoints >= 3);
 	m_NumPoints = numpoints;
-	m_MaxPoints = (m_NumPoints + 3) & ~3;	// groups of 4
-
-	m_Points = new vec3_t[m_MaxPoints];
+	allocPoints((m_NumPoints + 3) & ~3);	// groups of 4
 	memcpy(m_Points, points, sizeof(vec3_t) * m_NumPoints);
 }
 
@@ -273,19 +271,19 @@ void			Winding::initFromPoints(vec3_t *points, UINT32 numpoints)
 	Reset();
 
 	m_NumPoints = numpoints;
-	m_MaxPoints = (m_NumPoints + 3) & ~3;	// groups of 4
-
-	m_Points = new vec3_t[m_MaxPoints];
+	allocPoints((m_NumPoints + 3) & ~3);	// groups of 4
 	memcpy(m_Points, points, sizeof(vec3_t) * m_NumPoints);
 }
 
 Winding&      Winding::operator=(const Winding& other)
 {
-    delete[] m_Points;
+    if (this == &other)
+    {
+        return *this;
+    }
+    freePoints();
     m_NumPoints = other.m_NumPoints;
-    m_MaxPoints = (m_NumPoints + 3) & ~3;   // groups of 4
-
-    m_Points = new vec3_t[m_MaxPoints];
+    allocPoints((m_NumPoints + 3) & ~3);   // groups of 4
     memcpy(m_Points, other.m_Points, sizeof(vec3_t) * m_NumPoints);
     return *this;
 }
@@ -295,27 +293,73 @@ Winding::Winding(UINT32 numpoints)
 {
     hlassert(numpoints >= 3);
     m_NumPoints = numpoints;
-    m_MaxPoints = (m_NumPoints + 3) & ~3;   // groups of 4
+    UINT32 maxpoints = (m_NumPoints + 3) & ~3;   // groups of 4
 
     // Slight hack: apparently, sometimes we do get numpoints
     // in here as 0. Make sure at least something is allocated,
     //to avoid AllocBlock() warnings.
-    m_Points = new vec3_t[m_MaxPoints > 0 ? m_MaxPoints : 1];
+    allocPoints(maxpoints > 0 ? maxpoints : 1);
     memset(m_Points, 0, sizeof(vec3_t) * m_NumPoints);
 }
 
 Winding::Winding(const Winding& other)
 {
     m_NumPoints = other.m_NumPoints;
-    m_MaxPoints = (m_NumPoints + 3) & ~3;   // groups of 4
-
-    m_Points = new vec3_t[m_MaxPoints];
+    allocPoints((m_NumPoints + 3) & ~3);   // groups of 4
     memcpy(m_Points, other.m_Points, sizeof(vec3_t) * m_NumPoints);
 }
 
 Winding::~Winding()
 {
-    delete[] m_Points;
+    freePoints();
+}
+
+void            Winding::allocPoints(UINT32 maxpoints)
+{
+#ifdef ZHLT_WINDING_INLINE
+    if (maxpoints <= WINDING_INLINE_POINTS)
+    {
+        m_Points = m_Inline;
+        m_MaxPoints = WINDING_INLINE_POINTS;
+        return;
+    }
+#endif
+    m_Points = new vec3_t[maxpoints];
+    m_MaxPoints = maxpoints;
+}
+
+void            Winding::freePoints()
+{
+#ifdef ZHLT_WINDING_INLINE
+    if (m_Points != m_Inline)
+#endif
+    {
+        delete[] m_Points;
+    }
+    m_Points = NULL;
+    m_MaxPoints = 0;
+}
+
+void            Winding::takePoints(Winding& other)
+{
+    freePoints();
+    m_NumPoints = other.m_NumPoints;
+#ifdef ZHLT_WINDING_INLINE
+    if (other.m_Points == other.m_Inline)
+    {
+        // can't steal another object's inline storage
+        allocPoints(other.m_MaxPoints);
+        memcpy(m_Points, other.m_Points, sizeof(vec3_t) * m_NumPoints);
+        other.freePoints();
+        other.m_NumPoints = 0;
+        return;
+    }
+#endif
+    m_Points = other.m_Points;
+    m_MaxPoints = other.m_MaxPoints;
+    other.m_Points = NULL;
+    other.m_MaxPoints = 0;
+    other.m_NumPoints = 0;
 }
 
 
@@ -368,7 +412,7 @@ void Winding::initFromPlane(const vec3_t normal, const vec_t dist)
 
     // project a really big     axis aligned box onto the plane
     m_NumPoints = 4;
-    m_Points = new vec3_t[m_NumPoints];
+    allocPoints(m_NumPoints);
 
     VectorSubtract(org, vright, m_Points[0]);
     VectorAdd(m_Points[0], vup, m_Points[0]);
@@ -399,7 +443,7 @@ Winding::Winding(const dface_t& face
     int             v;
 
     m_NumPoints = face.numedges;
-    m_Points = new vec3_t[m_NumPoints];
+    allocPoints(m_NumPoints);
 
     unsigned i;
     for (i = 0; i < face.numedges; i++)
@@ -816,18 +860,14 @@ bool          Winding::Chop(const vec3_t normal, const vec_t dist
 
     if (f)
     {
-        delete[] m_Points;
-        m_NumPoints = f->m_NumPoints;
-        m_Points = f->m_Points;
-        f->m_Points = NULL;
+        takePoints(*f);
         delete f;
         return true;
     }
     else
     {
         m_NumPoints = 0;
-        delete[] m_Points;
-        m_Points = NULL;
+        freePoints();
         return false;
     }
 }
@@ -928,8 +968,7 @@ bool Winding::Clip(const dplane_t& split, bool keepon
 
     if (!counts[0])
     {
-        delete[] m_Points;
-        m_Points = NULL;
+        freePoints();
         m_NumPoints = 0;
         return false;
     }
@@ -941,8 +980,11 @@ bool Winding::Clip(const dplane_t& split, bool keepon
 
     unsigned maxpts = m_NumPoints + 4;                            // can't use counts[0]+2 because of fp grouping errors
     unsigned newNumPoints = 0;
-    vec3_t* newPoints = new vec3_t[maxpts];
-    memset(newPoints, 0, sizeof(vec3_t) * maxpts);
+    vec3_t newPoints[MAX_POINTS_ON_WINDING + 4];
+    if (maxpts > MAX_POINTS_ON_WINDING + 4)
+    {
+        Error("Winding::Clip : too many points");
+    }
 
     for (i = 0; i < m_NumPoints; i++)
     {
@@ -1014,8 +1056,9 @@ bool Winding::Clip(const dplane_t& split, bool keepon
         Error("Winding::Clip : points exceeded estimate");
     }
 
-    delete[] m_Points;
-    m_Points = newPoints;
+    freePoints();
+    allocPoints((newNumPoints + 3) & ~3);   // groups of 4
+    memcpy(m_Points, newPoints, sizeof(vec3_t) * newNumPoints);
     m_NumPoints = newNumPoints;
 
     RemoveColinearPoints(
@@ -1026,8 +1069,7 @@ bool Winding::Clip(const dplane_t& split, bool keepon
 #ifdef ZHLT_WINDING_RemoveColinearPoints_VL
 	if (m_NumPoints == 0)
 	{
-		delete[] m_Points;
-		m_Points = NULL;
+		freePoints();
 		m_NumPoints = 0;
 		return false;
 	}
@@ -1280,8 +1322,8 @@ void            Winding::resize(UINT32 newsize)
 
     vec3_t* newpoints = new vec3_t[newsize];
     m_NumPoints = qmin(newsize, m_NumPoints);
-    memcpy(newpoints, m_Points, m_NumPoints);
-    delete[] m_Points;
+    memcpy(newpoints, m_Points, sizeof(vec3_t) * m_NumPoints);
+    freePoints();
     m_Points = newpoints;
     m_MaxPoints = newsize;
 }
@@ -1301,11 +1343,7 @@ void			Winding::CopyPoints(vec3_t *points, int &numpoints)
 
 void Winding::Reset(void)
 {
-	if(m_Points)
-	{
-		delete [] m_Points;
-		m_Points = NULL;
-	}
+	freePoints();
 
 	m_NumPoints = m_MaxPoints = 0;
 }
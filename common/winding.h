@@ -15,6 +15,9 @@
 
 #define MAX_POINTS_ON_WINDING 128
 // TODO: FIX THIS STUPID SHIT (MAX_POINTS_ON_WINDING)
+#ifdef ZHLT_WINDING_INLINE
+#define WINDING_INLINE_POINTS 8 // a quad clipped by a plane still fits
+#endif
 
 #define BASE_WINDING_DISTANCE 9000
 
@@ -103,6 +106,9 @@ public:
 	void			Reset(void);	// Resets the structure
 protected:
     void            resize(UINT32 newsize);
+    void            allocPoints(UINT32 maxpoints);  // storage for at least maxpoints, contents undefined
+    void            freePoints();
+    void            takePoints(Winding& other);     // moves other's points here and leaves it empty
 
 public:
     // Construction
@@ -130,6 +136,9 @@ public:
     vec3_t* m_Points;
 protected:
     UINT32  m_MaxPoints;
+#ifdef ZHLT_WINDING_INLINE
+    vec3_t  m_Inline[WINDING_INLINE_POINTS];        // m_Points when it fits, so small windings never touch the heap
+#endif
 };
 
 #endif
\ No newline at end of file
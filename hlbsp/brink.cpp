@@ -1181,12 +1181,17 @@ bbrinkinfo_t;
 
 #define MAXCLIPNODES (MAX_MAP_CLIPNODES*8)
 
-bclipnode_t *ExpandClipnodes_r (bclipnode_t *bclipnodes, int &numbclipnodes, const dclipnode_t *clipnodes, int headnode)
+int CountClipnodes_r (const dclipnode_t *clipnodes, int headnode)
 {
-	if (numbclipnodes >= MAXCLIPNODES)
+	if (headnode < 0)
 	{
-		Error ("ExpandClipnodes_r: exceeded MAXCLIPNODES");
+		return 1;
 	}
+	return 1 + CountClipnodes_r (clipnodes, clipnodes[headnode].children[0]) + CountClipnodes_r (clipnodes, clipnodes[headnode].children[1]);
+}
+
+bclipnode_t *ExpandClipnodes_r (bclipnode_t *bclipnodes, int &numbclipnodes, const dclipnode_t *clipnodes, int headnode)
+{
 	bclipnode_t *c = &bclipnodes[numbclipnodes];
 	numbclipnodes++;
 	if (headnode < 0)
@@ -1210,21 +1215,16 @@ bclipnode_t *ExpandClipnodes_r (bclipnode_t *bclipnodes, int &numbclipnodes, con
 
 void ExpandClipnodes (bbrinkinfo_t *info, const dclipnode_t *clipnodes, int headnode)
 {
-	bclipnode_t *bclipnodes = (bclipnode_t *)malloc (MAXCLIPNODES * sizeof (bclipnode_t)); // 262144 * 30byte = 7.5MB
-	hlassume (bclipnodes != NULL, assume_NoMemory);
-	info->numclipnodes = 0;
-	ExpandClipnodes_r (bclipnodes, info->numclipnodes, clipnodes, headnode);
-	info->clipnodes = (bclipnode_t *)malloc (info->numclipnodes * sizeof (bclipnode_t));
-	hlassume (info->clipnodes != NULL, assume_NoMemory);
-	memcpy (info->clipnodes, bclipnodes, info->numclipnodes * sizeof (bclipnode_t));
-	for (int i = 0; i < info->numclipnodes; i++)
+	// size the pool exactly, so that the parallel CreateBrinkinfo calls don't each hold a MAXCLIPNODES scratch buffer
+	int numclipnodes = CountClipnodes_r (clipnodes, headnode);
+	if (numclipnodes > MAXCLIPNODES)
 	{
-		for (int k = 0; k < 2; k++)
-		{
-			info->clipnodes[i].children[k] = info->clipnodes + (bclipnodes[i].children[k] - bclipnodes);
-		}
+		Error ("ExpandClipnodes_r: exceeded MAXCLIPNODES");
 	}
-	free (bclipnodes);
+	info->clipnodes = (bclipnode_t *)malloc (numclipnodes * sizeof (bclipnode_t));
+	hlassume (info->clipnodes != NULL, assume_NoMemory);
+	info->numclipnodes = 0;
+	ExpandClipnodes_r (info->clipnodes, info->numclipnodes, clipnodes, headnode);
 }
 
 void BuildTreeCells (bbrinkinfo_t *info)
@@ -1883,18 +1883,9 @@ void *CreateBrinkinfo (const dclipnode_t *clipnodes, int headnode)
 	return info;
 }
 
-#ifdef HLBSP_MERGECLIPNODE
-extern int count_mergedclipnodes;
-typedef std::map< std::pair< int, std::pair< int, int > >, int > clipnodemap_t;
-inline clipnodemap_t::key_type MakeKey (const dclipnode_t &c)
-{
-	return std::make_pair (c.planenum, std::make_pair (c.children[0], c.children[1]));
-}
-#endif
-
 bool FixBrinks_r_r (const bclipnode_t *clipnode, const bpartition_t *p, bbrinklevel_e level, int &headnode_out, dclipnode_t *begin, dclipnode_t *end, dclipnode_t *&current
 #ifdef HLBSP_MERGECLIPNODE
-					, clipnodemap_t *outputmap
+					, clipnodemap_t *outputmap, int &mergedclipnodes
 #endif
 					)
 {
@@ -1926,7 +1917,7 @@ bool FixBrinks_r_r (const bclipnode_t *clipnode, const bpartition_t *p, bbrinkle
 	int r;
 	if (!FixBrinks_r_r (clipnode, p->next, level, r, begin, end, current
 #ifdef HLBSP_MERGECLIPNODE
-		, outputmap
+		, outputmap, mergedclipnodes
 #endif
 		))
 	{
@@ -1948,7 +1939,7 @@ bool FixBrinks_r_r (const bclipnode_t *clipnode, const bpartition_t *p, bbrinkle
 	}
 	else
 	{
-		count_mergedclipnodes++;
+		mergedclipnodes++;
 		if (current != c + 1)
 		{
 			Error ("Merge clipnodes: internal error");
@@ -1964,7 +1955,7 @@ bool FixBrinks_r_r (const bclipnode_t *clipnode, const bpartition_t *p, bbrinkle
 
 bool FixBrinks_r (const bclipnode_t *clipnode, bbrinklevel_e level, int &headnode_out, dclipnode_t *begin, dclipnode_t *end, dclipnode_t *&current
 #ifdef HLBSP_MERGECLIPNODE
-				, clipnodemap_t *outputmap
+				, clipnodemap_t *outputmap, int &mergedclipnodes
 #endif
 				)
 {
@@ -1972,7 +1963,7 @@ bool FixBrinks_r (const bclipnode_t *clipnode, bbrinklevel_e level, int &headnod
 	{
 		return FixBrinks_r_r (clipnode, clipnode->partitions, level, headnode_out, begin, end, current
 #ifdef HLBSP_MERGECLIPNODE
-							, outputmap
+							, outputmap, mergedclipnodes
 #endif
 							);
 	}
@@ -1998,7 +1989,7 @@ bool FixBrinks_r (const bclipnode_t *clipnode, bbrinklevel_e level, int &headnod
 			int r;
 			if (!FixBrinks_r (clipnode->children[k], level, r, begin, end, current
 #ifdef HLBSP_MERGECLIPNODE
-				, outputmap
+				, outputmap, mergedclipnodes
 #endif
 				))
 			{
@@ -2021,7 +2012,7 @@ bool FixBrinks_r (const bclipnode_t *clipnode, bbrinklevel_e level, int &headnod
 		}
 		else
 		{
-			count_mergedclipnodes++;
+			mergedclipnodes++;
 			if (current != c + 1)
 			{
 				Error ("Merge clipnodes: internal error");
@@ -2044,16 +2035,22 @@ bool FixBrinks (const void *brinkinfo, bbrinklevel_e level, int &headnode_out, d
 	dclipnode_t *current = &clipnodes_out[size];
 #ifdef HLBSP_MERGECLIPNODE
 	clipnodemap_t outputmap;
+	int mergedclipnodes = 0;
 #endif
 	int r;
 	if (!FixBrinks_r (&info->clipnodes[0], level, r, begin, end, current
 #ifdef HLBSP_MERGECLIPNODE
-		, &outputmap
+		, &outputmap, mergedclipnodes
 #endif
 		))
 	{
 		return false;
 	}
+#ifdef HLBSP_MERGECLIPNODE
+	ThreadLock ();
+	count_mergedclipnodes += mergedclipnodes;
+	ThreadUnlock ();
+#endif
 	headnode_out = r;
 	size_out = current - begin;
 	return true;
@@ -19,6 +19,11 @@
 #ifdef ZHLT_PARAMFILE
 #include "cmdlinecfg.h"
 #endif
+#include "stagecache.h"
+
+#ifdef HLBSP_MERGECLIPNODE
+#include <unordered_map>
+#endif
 
 #define ENTITIES_VOID "entities.void"
 #define ENTITIES_VOID_EXT ".void"
@@ -260,7 +265,7 @@ void            tjunc(node_t* headnode);
 
 //=============================================================================
 // writebsp.c
-extern void     WriteClipNodes(node_t* headnode);
+extern int      WriteClipNodes(node_t* headnode); // returns the index of the head clipnode
 extern void     WriteDrawNodes(node_t* headnode);
 
 extern void     BeginBSPFile();
@@ -303,6 +308,7 @@ extern void		CalcBrushBounds (const brush_t *b, vec3_t &mins, vec3_t &maxs);
 #endif
 
 extern node_t*  AllocNode();
+extern void     FreeNode(node_t* n);
 
 extern bool     CheckFaceForHint(const face_t* const f);
 extern bool     CheckFaceForSkip(const face_t* const f);
@@ -328,6 +334,27 @@ extern bool FixBrinks (const void *brinkinfo, bbrinklevel_e level, int &headnode
 extern void DeleteBrinkinfo (void *brinkinfo);
 #endif
 
+#ifdef HLBSP_MERGECLIPNODE
+// (planenum, children) of an emitted clipnode -> its index
+typedef std::pair< int, std::pair< int, int > > clipnodekey_t;
+struct clipnodekey_hash
+{
+	size_t operator() (const clipnodekey_t &k) const
+	{
+		unsigned int h = (unsigned int)k.first * 0x9E3779B1u;
+		h = (h ^ (unsigned int)k.second.first) * 0x85EBCA77u;
+		h = (h ^ (unsigned int)k.second.second) * 0xC2B2AE3Du;
+		return h ^ (h >> 15);
+	}
+};
+typedef std::unordered_map< clipnodekey_t, int, clipnodekey_hash > clipnodemap_t;
+inline clipnodekey_t MakeKey (const dclipnode_t &c)
+{
+	return std::make_pair (c.planenum, std::make_pair (c.children[0], c.children[1]));
+}
+extern int count_mergedclipnodes;
+#endif
+
 
 // =====================================================================================
 //Cpt_Andrew - UTSky Check
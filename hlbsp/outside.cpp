@@ -131,7 +131,7 @@ static void FreeDetailNode_r (node_t *n)
 	for (i = 0; i < 2; i++)
 	{
 		FreeDetailNode_r (n->children[i]);
-		free (n->children[i]);
+		FreeNode (n->children[i]);
 		n->children[i] = NULL;
 	}
 	face_t *f, *next;
@@ -434,6 +434,9 @@ void            LoadAllowableOutsideList(const char* const filename)
         fname = (char*)Alloc(len);
         safe_snprintf(fname, len, "%s", filename);
     }
+#ifdef ZHLT_STAGECACHE
+    StageCacheInputFile(fname);
+#endif
 
     if (q_exists(fname))
     {
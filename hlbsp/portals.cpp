@@ -163,6 +163,103 @@ extern bool g_viewportal;
 static int      num_visleafs;                              // leafs the player can be in
 static int      num_visportals;
 
+#ifdef ZHLT_BINARYPORTALS
+extern bool     g_binaryportals;
+static int*     binaryleafcounts;                          // [num_visleafs]
+static int      numbinaryleafcounts;
+static dprtportal_t* binaryportals;
+static int      numbinaryportals;
+static int      maxbinaryportals;
+static float*   binarypoints;                              // x y z of each point, swapped to SoA on write
+static int      numbinarypoints;
+static int      maxbinarypoints;
+
+static void     WriteBinaryPortal(const Winding* const w, const int leaf0, const int leaf1)
+{
+    dprtportal_t*   p;
+    unsigned int    i;
+
+    if (numbinaryportals == maxbinaryportals)
+    {
+        maxbinaryportals = qmax(1024, maxbinaryportals * 2);
+        binaryportals = (dprtportal_t*)realloc(binaryportals, maxbinaryportals * sizeof(dprtportal_t));
+        hlassume(binaryportals != NULL, assume_NoMemory);
+    }
+    while (numbinarypoints + (int)w->m_NumPoints > maxbinarypoints)
+    {
+        maxbinarypoints = qmax(4096, maxbinarypoints * 2);
+        binarypoints = (float*)realloc(binarypoints, maxbinarypoints * 3 * sizeof(float));
+        hlassume(binarypoints != NULL, assume_NoMemory);
+    }
+    p = &binaryportals[numbinaryportals++];
+    p->numpoints = w->m_NumPoints;
+    p->firstpoint = numbinarypoints;
+    p->leafs[0] = leaf0;
+    p->leafs[1] = leaf1;
+    for (i = 0; i < w->m_NumPoints; i++, numbinarypoints++)
+    {
+        VectorCopy(w->m_Points[i], &binarypoints[numbinarypoints * 3]);
+    }
+}
+
+// lays the whole file out in one buffer and writes it with a single call
+static void     WriteBinaryPortalfile()
+{
+    dprtheader_t*   header;
+    int*            leafcounts;
+    dprtportal_t*   portals;
+    float*          coords;
+    byte*           buffer;
+    int             i, k, length;
+
+    length = sizeof(dprtheader_t) + numbinaryleafcounts * sizeof(int)
+        + numbinaryportals * sizeof(dprtportal_t) + numbinarypoints * 3 * sizeof(float);
+    buffer = (byte*)malloc(length);
+    hlassume(buffer != NULL, assume_NoMemory);
+    header = (dprtheader_t*)buffer;
+    leafcounts = (int*)(buffer + sizeof(dprtheader_t));
+    portals = (dprtportal_t*)(leafcounts + numbinaryleafcounts);
+    coords = (float*)(portals + numbinaryportals);
+
+    memcpy(header->ident, PRT_BINARY_IDENT, sizeof(header->ident));
+    header->numleafs = LittleLong(num_visleafs);
+    header->numportals = LittleLong(numbinaryportals);
+    header->numpoints = LittleLong(numbinarypoints);
+    header->leafcountofs = LittleLong(numbinaryleafcounts ? (int)((byte*)leafcounts - buffer) : 0);
+    header->portalofs = LittleLong((int)((byte*)portals - buffer));
+    header->pointofs = LittleLong((int)((byte*)coords - buffer));
+
+    for (i = 0; i < numbinaryleafcounts; i++)
+    {
+        leafcounts[i] = LittleLong(binaryleafcounts[i]);
+    }
+    for (i = 0; i < numbinaryportals; i++)
+    {
+        portals[i].numpoints = LittleLong(binaryportals[i].numpoints);
+        portals[i].firstpoint = LittleLong(binaryportals[i].firstpoint);
+        portals[i].leafs[0] = LittleLong(binaryportals[i].leafs[0]);
+        portals[i].leafs[1] = LittleLong(binaryportals[i].leafs[1]);
+    }
+    for (k = 0; k < 3; k++)
+    {
+        for (i = 0; i < numbinarypoints; i++)
+        {
+            coords[k * numbinarypoints + i] = LittleFloat(binarypoints[i * 3 + k]);
+        }
+    }
+    SafeWrite(pf, buffer, length);
+    free(buffer);
+
+    free(binaryleafcounts);
+    binaryleafcounts = NULL;
+    free(binaryportals);
+    binaryportals = NULL;
+    free(binarypoints);
+    binarypoints = NULL;
+    numbinaryleafcounts = numbinaryportals = maxbinaryportals = numbinarypoints = maxbinarypoints = 0;
+}
+#endif
+
 #ifdef ZHLT_TRANSLUCENT_WORLD_WATER
 /*
 ================
@@ -187,6 +284,7 @@ static void     WritePortalFile_r(const node_t* const node)
     portal_t*       p;
     Winding*        w;
     dplane_t        plane2;
+    int             leafnums[2];
 
 #ifdef ZHLT_DETAILBRUSH
 	if (!node->isportalleaf)
@@ -235,18 +333,30 @@ static void     WritePortalFile_r(const node_t* const node)
 						w->Print ();
 					}
 #endif
-                    fprintf(pf, "%u %i %i ", w->m_NumPoints, p->nodes[1]->visleafnum, p->nodes[0]->visleafnum);
+                    leafnums[0] = p->nodes[1]->visleafnum;
+                    leafnums[1] = p->nodes[0]->visleafnum;
                 }
                 else
                 {
-                    fprintf(pf, "%u %i %i ", w->m_NumPoints, p->nodes[0]->visleafnum, p->nodes[1]->visleafnum);
+                    leafnums[0] = p->nodes[0]->visleafnum;
+                    leafnums[1] = p->nodes[1]->visleafnum;
                 }
 
-                for (i = 0; i < w->m_NumPoints; i++)
+#ifdef ZHLT_BINARYPORTALS
+                if (g_binaryportals)
+                {
+                    WriteBinaryPortal(w, leafnums[0], leafnums[1]);
+                }
+                else
+#endif
                 {
-                    fprintf(pf, "(%f %f %f) ", w->m_Points[i][0], w->m_Points[i][1], w->m_Points[i][2]);
+                    fprintf(pf, "%u %i %i ", w->m_NumPoints, leafnums[0], leafnums[1]);
+                    for (i = 0; i < w->m_NumPoints; i++)
+                    {
+                        fprintf(pf, "(%f %f %f) ", w->m_Points[i][0], w->m_Points[i][1], w->m_Points[i][2]);
+                    }
+                    fprintf(pf, "\n");
                 }
-                fprintf(pf, "\n");
 #ifdef HLBSP_VIEWPORTAL
 				if (g_viewportal)
 				{
@@ -370,6 +480,13 @@ static void WriteLeafCount_r (node_t *node)
 			return;
 		}
 		int count = CountChildLeafs_r (node);
+#ifdef ZHLT_BINARYPORTALS
+		if (g_binaryportals)
+		{
+			binaryleafcounts[numbinaryleafcounts++] = count;
+			return;
+		}
+#endif
 		fprintf (pf, "%i\n", count);
 	}
 }
@@ -387,7 +504,11 @@ void            WritePortalfile(node_t* headnode)
     NumberLeafs_r(headnode);
 
     // write the file
+#ifdef ZHLT_BINARYPORTALS
+    pf = fopen(g_portfilename, g_binaryportals ? "wb" : "w");
+#else
     pf = fopen(g_portfilename, "w");
+#endif
     if (!pf)
     {
         Error("Error writing portal file %s", g_portfilename);
@@ -406,14 +527,29 @@ void            WritePortalfile(node_t* headnode)
 	}
 #endif
 
-    fprintf(pf, "PRT1-AB\n");
-    fprintf(pf, "%i\n", num_visleafs);
-    fprintf(pf, "%i\n", num_visportals);
+#ifdef ZHLT_BINARYPORTALS
+    if (g_binaryportals)
+    {
+#ifdef ZHLT_DETAILBRUSH
+        binaryleafcounts = (int*)malloc(qmax(num_visleafs, 1) * sizeof(int));
+        hlassume(binaryleafcounts != NULL, assume_NoMemory);
+        WriteLeafCount_r (headnode);
+#endif
+        WritePortalFile_r(headnode);
+        WriteBinaryPortalfile();
+    }
+    else
+#endif
+    {
+        fprintf(pf, "PRT1-AB\n");
+        fprintf(pf, "%i\n", num_visleafs);
+        fprintf(pf, "%i\n", num_visportals);
 
 #ifdef ZHLT_DETAILBRUSH
-	WriteLeafCount_r (headnode);
+        WriteLeafCount_r (headnode);
 #endif
-    WritePortalFile_r(headnode);
+        WritePortalFile_r(headnode);
+    }
     fclose(pf);
 #ifdef HLBSP_VIEWPORTAL
 	if (g_viewportal)
@@ -75,6 +75,10 @@ bool g_nohull2 = false;
 bool g_viewportal = false;
 #endif
 
+#ifdef ZHLT_BINARYPORTALS
+bool g_binaryportals = false;
+#endif
+
 #ifdef HLCSG_HLBSP_DOUBLEPLANE
 dplane_t g_dplanes[MAX_INTERNAL_MAP_PLANES];
 #endif
@@ -451,6 +455,77 @@ void            SplitFace(face_t* in, const dplane_t* const split, face_t** fron
     }
 }
 
+#ifdef HLBSP_OBJECTPOOL
+// =====================================================================================
+//  Object pools
+//      The small fixed-size objects of the bsp process are carved out of slabs instead of
+//      being malloc'ed one by one. A freed object goes onto the free list of the thread that
+//      frees it and is handed out again by the next Alloc of its type on that thread, so the
+//      slabs of one model are reused by the next one. Slabs are never returned to the heap.
+// =====================================================================================
+#define OBJPOOL_SLABSIZE	65536	// bytes
+#define OBJPOOL_ALIGN		16
+
+typedef enum
+{
+	pool_face = 0,
+	pool_surface,
+	pool_portal,
+	pool_node,
+#ifdef ZHLT_DETAILBRUSH
+	pool_side,
+	pool_brush,
+#endif
+	pool_count
+}
+objpooltype_e;
+
+typedef struct
+{
+	void *freelist;			// first word of a free object links to the next one
+	char *next, *end;		// unused part of the current slab
+}
+objpool_t;
+
+static thread_local objpool_t t_objpools[pool_count];
+
+static void *PoolAlloc (objpooltype_e type, size_t size)
+{
+	objpool_t *pool = &t_objpools[type];
+	void *obj;
+	if (pool->freelist)
+	{
+		obj = pool->freelist;
+		pool->freelist = *(void **)obj;
+		return obj;
+	}
+	size = (size + OBJPOOL_ALIGN - 1) & ~(size_t)(OBJPOOL_ALIGN - 1);
+	if (pool->next == NULL || pool->end - pool->next < (ptrdiff_t)size)
+	{
+		size_t slabsize = qmax ((size_t)OBJPOOL_SLABSIZE, size);
+		pool->next = (char *)malloc (slabsize);
+		hlassume (pool->next != NULL, assume_NoMemory);
+		pool->end = pool->next + slabsize;
+	}
+	obj = pool->next;
+	pool->next += size;
+	return obj;
+}
+
+static void PoolFree (objpooltype_e type, void *obj)
+{
+	objpool_t *pool = &t_objpools[type];
+	*(void **)obj = pool->freelist;
+	pool->freelist = obj;
+}
+
+#define POOL_ALLOC(type, t) ((t *)PoolAlloc (pool_##type, sizeof (t)))
+#define POOL_FREE(type, p) PoolFree (pool_##type, (p))
+#else
+#define POOL_ALLOC(type, t) ((t *)malloc (sizeof (t)))
+#define POOL_FREE(type, p) free (p)
+#endif
+
 // =====================================================================================
 //  AllocFace
 // =====================================================================================
@@ -458,7 +533,8 @@ face_t*         AllocFace()
 {
     face_t*         f;
 
-    f = (face_t*)malloc(sizeof(face_t));
+    f = POOL_ALLOC(face, face_t);
+    hlassume(f != NULL, assume_NoMemory);
     memset(f, 0, sizeof(face_t));
 
     f->planenum = -1;
@@ -471,7 +547,7 @@ face_t*         AllocFace()
 // =====================================================================================
 void            FreeFace(face_t* f)
 {
-    free(f);
+    POOL_FREE(face, f);
 }
 
 // =====================================================================================
@@ -481,7 +557,8 @@ surface_t*      AllocSurface()
 {
     surface_t*      s;
 
-    s = (surface_t*)malloc(sizeof(surface_t));
+    s = POOL_ALLOC(surface, surface_t);
+    hlassume(s != NULL, assume_NoMemory);
     memset(s, 0, sizeof(surface_t));
 
     return s;
@@ -492,7 +569,7 @@ surface_t*      AllocSurface()
 // =====================================================================================
 void            FreeSurface(surface_t* s)
 {
-    free(s);
+    POOL_FREE(surface, s);
 }
 
 // =====================================================================================
@@ -502,7 +579,8 @@ portal_t*       AllocPortal()
 {
     portal_t*       p;
 
-    p = (portal_t*)malloc(sizeof(portal_t));
+    p = POOL_ALLOC(portal, portal_t);
+    hlassume(p != NULL, assume_NoMemory);
     memset(p, 0, sizeof(portal_t));
 
     return p;
@@ -513,7 +591,7 @@ portal_t*       AllocPortal()
 // =====================================================================================
 void            FreePortal(portal_t* p) // consider: inline
 {
-    free(p);
+    POOL_FREE(portal, p);
 }
 
 
@@ -521,7 +599,8 @@ void            FreePortal(portal_t* p) // consider: inline
 side_t *AllocSide ()
 {
 	side_t *s;
-	s = (side_t *)malloc (sizeof (side_t));
+	s = POOL_ALLOC (side, side_t);
+	hlassume (s != NULL, assume_NoMemory);
 	memset (s, 0, sizeof (side_t));
 	return s;
 }
@@ -532,7 +611,7 @@ void FreeSide (side_t *s)
 	{
 		delete s->w;
 	}
-	free (s);
+	POOL_FREE (side, s);
 	return;
 }
 
@@ -548,7 +627,8 @@ side_t *NewSideFromSide (const side_t *s)
 brush_t *AllocBrush ()
 {
 	brush_t *b;
-	b = (brush_t *)malloc (sizeof (brush_t));
+	b = POOL_ALLOC (brush, brush_t);
+	hlassume (b != NULL, assume_NoMemory);
 	memset (b, 0, sizeof (brush_t));
 	return b;
 }
@@ -564,7 +644,7 @@ void FreeBrush (brush_t *b)
 			FreeSide (s);
 		}
 	}
-	free (b);
+	POOL_FREE (brush, b);
 	return;
 }
 
@@ -737,12 +817,21 @@ node_t*         AllocNode()
 {
     node_t*         n;
 
-    n = (node_t*)malloc(sizeof(node_t));
+    n = POOL_ALLOC(node, node_t);
+    hlassume(n != NULL, assume_NoMemory);
     memset(n, 0, sizeof(node_t));
 
     return n;
 }
 
+// =====================================================================================
+//  FreeNode
+// =====================================================================================
+void            FreeNode(node_t* n)
+{
+    POOL_FREE(node, n);
+}
+
 // =====================================================================================
 //  AddPointToBounds
 // =====================================================================================
@@ -1435,12 +1524,7 @@ static bool     ProcessModel()
 		}
 		else
 		{
-#ifdef ZHLT_XASH2
-	        model->headnode[g_hullnum] = g_numclipnodes[g_hullnum - 1];
-#else
-	        model->headnode[g_hullnum] = g_numclipnodes;
-#endif
-		    WriteClipNodes(nodes);
+		    model->headnode[g_hullnum] = WriteClipNodes(nodes);
 		}
     }
 #if defined (HLCSG_HLBSP_CUSTOMBOUNDINGBOX) || defined (HLCSG_HLBSP_ALLOWEMPTYENTITY)
@@ -1535,6 +1619,9 @@ static void     Usage()
     Log("    -chart         : display bsp statitics\n");
     Log("    -low | -high   : run program an altered priority level\n");
     Log("    -nolog         : don't generate the compile logfiles\n");
+#ifdef ZHLT_STAGECACHE
+    Log("    -stagecache dir: Reuse the outputs of an earlier run with the same inputs, kept in dir\n");
+#endif
     Log("    -threads #     : manually specify the number of threads to run\n");
 #ifdef SYSTEM_WIN32
     Log("    -estimate      : display estimated time during compile\n");
@@ -1557,6 +1644,9 @@ static void     Usage()
 #ifdef HLBSP_VIEWPORTAL
 	Log("    -viewportal    : Show portal boundaries in 'mapname_portal.pts' file\n");
 #endif
+#ifdef ZHLT_BINARYPORTALS
+	Log("    -binaryportals : Write the portal file in the binary format, faster for hlvis to load\n");
+#endif
 
     Log("    -verbose       : compile with verbose messages\n");
     Log("    -noinfo        : Do not show tool configuration information\n");
@@ -1750,15 +1840,54 @@ static void     ProcessFile(const char* const filename)
 		}
 	}
 #endif
-    // init the tables to be shared by all models
-    BeginBSPFile();
+#ifdef ZHLT_STAGECACHE
+    StageCacheInputBSP();
+    for (i = 0; i < NUM_HULLS; i++)
+    {
+        sprintf(name, "%s.p%i", filename, i);
+        StageCacheInputFile(name);
+#ifdef ZHLT_DETAILBRUSH
+        sprintf(name, "%s.b%i", filename, i);
+        StageCacheInputFile(name);
+#endif
+    }
+#ifdef HLCSG_HLBSP_ALLOWEMPTYENTITY
+    safe_snprintf(name, _MAX_PATH, "%s.hsz", filename);
+    StageCacheInputFile(name);
+#endif
+#ifdef HLCSG_HLBSP_DOUBLEPLANE
+    safe_snprintf(name, _MAX_PATH, "%s.pln", filename);
+    StageCacheInputFile(name);
+#endif
+    StageCacheOutput(".bsp");
+    StageCacheOutput(".prt");
+    StageCacheOutput(".pts");
+    StageCacheOutput(".lin");
+#ifdef ZHLT_64BIT_FIX
+    StageCacheOutput(".ext");
+#endif
+#ifdef HLBSP_VIEWPORTAL
+    if (g_viewportal)
+    {
+        StageCacheOutput("_portal.pts");
+    }
+#endif
+    if (!StageCacheRestore())
+#endif
+    {
+        // init the tables to be shared by all models
+        BeginBSPFile();
 
-    // process each model individually
-    while (ProcessModel())
-        ;
+        // process each model individually
+        while (ProcessModel())
+            ;
 
-    // write the updated bsp file out
-    FinishBSPFile();
+        // write the updated bsp file out
+        FinishBSPFile();
+#ifdef ZHLT_STAGECACHE
+        StageCacheStore();
+#endif
+    }
 #ifdef HLBSP_DELETETEMPFILES
 
 	// Because the bsp file has been updated, these polyfiles are no longer valid.
@@ -1953,6 +2082,19 @@ int             main(const int argc, char** argv)
         {
             g_log = false;
         }
+#ifdef ZHLT_STAGECACHE
+        else if (!strcasecmp(argv[i], "-stagecache"))
+        {
+            if (i + 1 < argc)
+            {
+                g_stagecache = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
 
 #ifdef ZHLT_NULLTEX // AJM
         else if (!strcasecmp(argv[i], "-nonulltex"))
@@ -2033,6 +2175,12 @@ int             main(const int argc, char** argv)
 		{
 			g_viewportal = true;
 		}
+#endif
+#ifdef ZHLT_BINARYPORTALS
+		else if (!strcasecmp (argv[i], "-binaryportals"))
+		{
+			g_binaryportals = true;
+		}
 #endif
         else if (!strcasecmp(argv[i], "-texdata"))
         {
@@ -2153,6 +2301,9 @@ int             main(const int argc, char** argv)
     dtexdata_init();
     atexit(dtexdata_free);
     //Settings();
+#ifdef ZHLT_STAGECACHE
+    StageCacheBegin("hlbsp", argc, argv, mapname_from_arg);
+#endif
     // END INIT
 
     // Load the .void files for allowable entities in the void
@@ -26,11 +26,6 @@ static texinfomap_t g_texinfomap;
 #endif
 #ifdef HLBSP_MERGECLIPNODE
 int count_mergedclipnodes;
-typedef std::map< std::pair< int, std::pair< int, int > >, int > clipnodemap_t;
-inline clipnodemap_t::key_type MakeKey (const dclipnode_t &c)
-{
-	return std::make_pair (c.planenum, std::make_pair (c.children[0], c.children[1]));
-}
 #endif
 
 // =====================================================================================
@@ -92,6 +87,66 @@ static int WriteTexinfo (int texinfo)
 	return c;
 }
 
+#endif
+#ifdef HLBSP_MERGECLIPNODE
+// =====================================================================================
+//  EmitClipnode
+//      Hash-consing over an emitted clipnode array: an open-addressing table keyed by
+//      (planenum, children). Children are emitted before their parent, so identical
+//      subtrees get identical indices and collapse into one, across all models sharing
+//      the array.
+// =====================================================================================
+#define CLIPNODETABLE_SIZE 65536
+// EmitClipnode probes until it finds an empty slot, so the table must never fill up;
+// at most MAX_MAP_CLIPNODES slots are used, which keeps the load factor at or below 1/2.
+static_assert (CLIPNODETABLE_SIZE >= 2 * MAX_MAP_CLIPNODES, "CLIPNODETABLE_SIZE must be at least 2 * MAX_MAP_CLIPNODES");
+static_assert ((CLIPNODETABLE_SIZE & (CLIPNODETABLE_SIZE - 1)) == 0, "CLIPNODETABLE_SIZE must be a power of two");
+
+typedef struct
+{
+	int slots[CLIPNODETABLE_SIZE]; // clipnode index + 1, 0 if empty
+}
+clipnodetable_t;
+
+#ifdef ZHLT_XASH2
+static clipnodetable_t g_clipnodetable[MAX_MAP_HULLS - 1];
+#else
+static clipnodetable_t g_clipnodetable;
+#endif
+
+inline unsigned int HashClipnode (const dclipnode_t &c)
+{
+	unsigned int h = (unsigned int)c.planenum * 0x9E3779B1u;
+	h = (h ^ (unsigned int)c.children[0]) * 0x85EBCA77u;
+	h = (h ^ (unsigned int)c.children[1]) * 0xC2B2AE3Du;
+	return h ^ (h >> 16);
+}
+
+// returns false if the clipnode had to be added but the array is full
+static bool EmitClipnode (clipnodetable_t *table, dclipnode_t *clipnodes, int &numclipnodes, const dclipnode_t &cn, int &index_out)
+{
+	unsigned int slot = HashClipnode (cn) & (CLIPNODETABLE_SIZE - 1);
+	for (; table->slots[slot]; slot = (slot + 1) & (CLIPNODETABLE_SIZE - 1))
+	{
+		const dclipnode_t *other = &clipnodes[table->slots[slot] - 1];
+		if (!g_noclipnodemerge && other->planenum == cn.planenum && other->children[0] == cn.children[0] && other->children[1] == cn.children[1])
+		{
+			count_mergedclipnodes++;
+			index_out = table->slots[slot] - 1; // use the existing clipnode
+			return true;
+		}
+	}
+	if (numclipnodes >= MAX_MAP_CLIPNODES)
+	{
+		return false;
+	}
+	clipnodes[numclipnodes] = cn;
+	table->slots[slot] = numclipnodes + 1;
+	index_out = numclipnodes;
+	numclipnodes++;
+	return true;
+}
+
 #endif
 // =====================================================================================
 //  WriteClipNodes_r
@@ -99,9 +154,6 @@ static int WriteTexinfo (int texinfo)
 static int      WriteClipNodes_r(node_t* node
 #ifdef ZHLT_DETAILBRUSH
 								 , const node_t *portalleaf
-#endif
-#ifdef HLBSP_MERGECLIPNODE
-								 , clipnodemap_t *outputmap
 #endif
 								 )
 {
@@ -114,7 +166,7 @@ static int      WriteClipNodes_r(node_t* node
 	{
 		if (node->contents == CONTENTS_SOLID)
 		{
-			free (node);
+			FreeNode (node);
 			return CONTENTS_SOLID;
 		}
 		else
@@ -133,7 +185,7 @@ static int      WriteClipNodes_r(node_t* node
 			num = portalleaf->contents;
 		}
 		free (node->markfaces);
-		free (node);
+		FreeNode (node);
 		return num;
 	}
 #else
@@ -141,31 +193,22 @@ static int      WriteClipNodes_r(node_t* node
     {
         num = node->contents;
         free(node->markfaces);
-        free(node);
+        FreeNode(node);
         return num;
     }
 #endif
 
-#ifdef ZHLT_XASH2
 #ifdef HLBSP_MERGECLIPNODE
-	dclipnode_t tmpclipnode; // this clipnode will be inserted into g_dclipnodes[c] if it can't be merged
+	dclipnode_t tmpclipnode; // emitted after its children, unless an identical clipnode already exists
 	cn = &tmpclipnode;
-	c = g_numclipnodes[g_hullnum - 1];
-	g_numclipnodes[g_hullnum - 1]++;
 #else
+#ifdef ZHLT_XASH2
     // emit a clipnode
     hlassume(g_numclipnodes[g_hullnum - 1] < MAX_MAP_CLIPNODES, assume_MAX_MAP_CLIPNODES);
 
     c = g_numclipnodes[g_hullnum - 1];
     cn = &g_dclipnodes[g_hullnum - 1][c];
     g_numclipnodes[g_hullnum - 1] += 1;
-#endif
-#else
-#ifdef HLBSP_MERGECLIPNODE
-	dclipnode_t tmpclipnode; // this clipnode will be inserted into g_dclipnodes[c] if it can't be merged
-	cn = &tmpclipnode;
-	c = g_numclipnodes;
-	g_numclipnodes++;
 #else
     // emit a clipnode
     hlassume(g_numclipnodes < MAX_MAP_CLIPNODES, assume_MAX_MAP_CLIPNODES);
@@ -185,46 +228,18 @@ static int      WriteClipNodes_r(node_t* node
         cn->children[i] = WriteClipNodes_r(node->children[i]
 #ifdef ZHLT_DETAILBRUSH
 			, portalleaf
-#endif
-#ifdef HLBSP_MERGECLIPNODE
-			, outputmap
 #endif
 			);
     }
 #ifdef HLBSP_MERGECLIPNODE
-	clipnodemap_t::iterator output;
-	output = outputmap->find (MakeKey (*cn));
-	if (g_noclipnodemerge || output == outputmap->end ())
-	{
-		hlassume (c < MAX_MAP_CLIPNODES, assume_MAX_MAP_CLIPNODES);
 #ifdef ZHLT_XASH2
-		g_dclipnodes[g_hullnum - 1][c] = *cn;
+	hlassume (EmitClipnode (&g_clipnodetable[g_hullnum - 1], g_dclipnodes[g_hullnum - 1], g_numclipnodes[g_hullnum - 1], *cn, c), assume_MAX_MAP_CLIPNODES);
 #else
-		g_dclipnodes[c] = *cn;
+	hlassume (EmitClipnode (&g_clipnodetable, g_dclipnodes, g_numclipnodes, *cn, c), assume_MAX_MAP_CLIPNODES);
 #endif
-		(*outputmap)[MakeKey (*cn)] = c;
-	}
-	else
-	{
-		count_mergedclipnodes++;
-#ifdef ZHLT_XASH2
-		if (g_numclipnodes[g_hullnum - 1] != c + 1)
-		{
-			Error ("Merge clipnodes: internal error");
-		}
-		g_numclipnodes[g_hullnum - 1] = c;
-#else
-		if (g_numclipnodes != c + 1)
-		{
-			Error ("Merge clipnodes: internal error");
-		}
-		g_numclipnodes = c;
-#endif
-		c = output->second; // use existing clipnode
-	}
 #endif
 
-    free(node);
+    FreeNode(node);
     return c;
 }
 
@@ -233,18 +248,11 @@ static int      WriteClipNodes_r(node_t* node
 //      Called after the clipping hull is completed.  Generates a disk format
 //      representation and frees the original memory.
 // =====================================================================================
-void            WriteClipNodes(node_t* nodes)
+int             WriteClipNodes(node_t* nodes)
 {
-#ifdef HLBSP_MERGECLIPNODE
-	// we only merge among the clipnodes of the same hull of the same model
-	clipnodemap_t outputmap;
-#endif
-    WriteClipNodes_r(nodes
+    return WriteClipNodes_r(nodes
 #ifdef ZHLT_DETAILBRUSH
 		, NULL
-#endif
-#ifdef HLBSP_MERGECLIPNODE
-		, &outputmap
 #endif
 		);
 }
@@ -632,7 +640,7 @@ static void     FreeDrawNodes_r(node_t* node)
         FreeFace(f);
     }
 
-    free(node);
+    FreeNode(node);
 }
 
 // =====================================================================================
@@ -788,6 +796,7 @@ void            BeginBSPFile()
 #endif
 #ifdef HLBSP_MERGECLIPNODE
 	count_mergedclipnodes = 0;
+	memset (&g_clipnodetable, 0, sizeof (g_clipnodetable));
 #endif
     g_nummodels = 0;
     g_numfaces = 0;
@@ -921,6 +930,138 @@ static void ReduceTextures()
 }
 #endif
 
+#ifdef HLBSP_BRINKHACK
+// =====================================================================================
+//  FixBrinks tasks
+//      Every (model, hull) is analyzed and re-emitted independently: task = model * (NUM_HULLS - 1) + hull - 1.
+//      Each task writes its clipnodes into a private buffer numbered from 0, and the buffers are
+//      stitched together in model/hull order afterwards.
+// =====================================================================================
+static void *(*g_brinkinfo)[NUM_HULLS]; //[MAX_MAP_MODELS]
+static int (*g_brinkheadnode)[NUM_HULLS]; //[MAX_MAP_MODELS]
+static dclipnode_t **g_brinkclipnodes; // per task, NULL if the task didn't fit
+static int *g_brinknumclipnodes; // per task, -1 if the task didn't fit
+static bbrinklevel_e g_brinklevel;
+
+static void CreateBrinkinfoForTask (int task)
+{
+	int i = task / (NUM_HULLS - 1);
+	int j = task % (NUM_HULLS - 1) + 1;
+	Developer (DEVELOPER_LEVEL_MESSAGE, " model %d hull %d\n", i, j);
+#ifdef ZHLT_XASH2
+	g_brinkinfo[i][j] = CreateBrinkinfo (g_dclipnodes[j - 1], g_dmodels[i].headnode[j]);
+#else
+	g_brinkinfo[i][j] = CreateBrinkinfo (g_dclipnodes, g_dmodels[i].headnode[j]);
+#endif
+}
+
+static void FixBrinksForTask (int task)
+{
+	int i = task / (NUM_HULLS - 1);
+	int j = task % (NUM_HULLS - 1) + 1;
+	dclipnode_t *clipnodes;
+	int numclipnodes;
+	clipnodes = (dclipnode_t *)malloc (MAX_MAP_CLIPNODES * sizeof (dclipnode_t));
+	hlassume (clipnodes != NULL, assume_NoMemory);
+	if (!FixBrinks (g_brinkinfo[i][j], g_brinklevel, g_brinkheadnode[i][j], clipnodes, MAX_MAP_CLIPNODES, 0, numclipnodes))
+	{
+		free (clipnodes);
+		g_brinkclipnodes[task] = NULL;
+		g_brinknumclipnodes[task] = -1;
+		return;
+	}
+	if (numclipnodes > 0)
+	{
+		g_brinkclipnodes[task] = (dclipnode_t *)realloc (clipnodes, numclipnodes * sizeof (dclipnode_t));
+		hlassume (g_brinkclipnodes[task] != NULL, assume_NoMemory);
+	}
+	else
+	{
+		free (clipnodes);
+		g_brinkclipnodes[task] = NULL;
+	}
+	g_brinknumclipnodes[task] = numclipnodes;
+}
+
+#ifdef HLBSP_MERGECLIPNODE
+static bool StitchBrinkClipnode_r (const dclipnode_t *taskclipnodes, int *remap, int headnode, clipnodetable_t *table, dclipnode_t *clipnodes_out, int &size, int &headnode_out)
+{
+	if (headnode < 0 || remap[headnode] >= 0)
+	{
+		headnode_out = headnode < 0? headnode: remap[headnode];
+		return true;
+	}
+	dclipnode_t cn = taskclipnodes[headnode];
+	for (int side = 0; side < 2; side++)
+	{
+		int child;
+		if (!StitchBrinkClipnode_r (taskclipnodes, remap, cn.children[side], table, clipnodes_out, size, child))
+		{
+			return false;
+		}
+		cn.children[side] = child;
+	}
+	if (!EmitClipnode (table, clipnodes_out, size, cn, remap[headnode]))
+	{
+		return false;
+	}
+	headnode_out = remap[headnode];
+	return true;
+}
+
+// re-emits a task's clipnodes bottom-up into clipnodes_out, sharing identical subtrees with the tasks before it
+static bool StitchBrinkTask (int task, int &headnode, clipnodetable_t *table, dclipnode_t *clipnodes_out, int &size)
+{
+	int numclipnodes = g_brinknumclipnodes[task];
+	if (numclipnodes < 0)
+	{
+		return false;
+	}
+	if (numclipnodes == 0)
+	{
+		return true;
+	}
+	int *remap = (int *)malloc (numclipnodes * sizeof (int));
+	hlassume (remap != NULL, assume_NoMemory);
+	for (int k = 0; k < numclipnodes; k++)
+	{
+		remap[k] = -1;
+	}
+	bool fitted = StitchBrinkClipnode_r (g_brinkclipnodes[task], remap, headnode, table, clipnodes_out, size, headnode);
+	free (remap);
+	return fitted;
+}
+#else
+// appends a task's clipnodes at clipnodes_out[size], moving its node references and headnode along
+static bool StitchBrinkTask (int task, int &headnode, dclipnode_t *clipnodes_out, int &size)
+{
+	int numclipnodes = g_brinknumclipnodes[task];
+	if (numclipnodes < 0 || size + numclipnodes > MAX_MAP_CLIPNODES)
+	{
+		return false;
+	}
+	for (int k = 0; k < numclipnodes; k++)
+	{
+		dclipnode_t *cn = &clipnodes_out[size + k];
+		*cn = g_brinkclipnodes[task][k];
+		for (int side = 0; side < 2; side++)
+		{
+			if (cn->children[side] >= 0)
+			{
+				cn->children[side] += size;
+			}
+		}
+	}
+	if (headnode >= 0)
+	{
+		headnode += size;
+	}
+	size += numclipnodes;
+	return true;
+}
+#endif
+#endif
+
 // =====================================================================================
 //  FinishBSPFile
 // =====================================================================================
@@ -1001,21 +1142,22 @@ void FinishBSPFile()
 		hlassume (brinkinfo != NULL, assume_NoMemory);
 		headnode = (int (*)[NUM_HULLS])malloc (MAX_MAP_MODELS * sizeof (int [NUM_HULLS]));
 		hlassume (headnode != NULL, assume_NoMemory);
+		int numtasks = g_nummodels * (NUM_HULLS - 1);
+		g_brinkinfo = brinkinfo;
+		g_brinkheadnode = headnode;
+		g_brinkclipnodes = (dclipnode_t **)malloc (numtasks * sizeof (dclipnode_t *));
+		hlassume (g_brinkclipnodes != NULL, assume_NoMemory);
+		g_brinknumclipnodes = (int *)malloc (numtasks * sizeof (int));
+		hlassume (g_brinknumclipnodes != NULL, assume_NoMemory);
 
-		int i, j, level;
-		for (i = 0; i < g_nummodels; i++)
-		{
-			dmodel_t *m = &g_dmodels[i];
-			Developer (DEVELOPER_LEVEL_MESSAGE, " model %d\n", i);
-			for (j = 1; j < NUM_HULLS; j++)
-			{
-#ifdef ZHLT_XASH2
-				brinkinfo[i][j] = CreateBrinkinfo (g_dclipnodes[j - 1], m->headnode[j]);
-#else
-				brinkinfo[i][j] = CreateBrinkinfo (g_dclipnodes, m->headnode[j]);
+#ifdef HLBSP_MERGECLIPNODE
+		// the brink-fixed clipnodes are deduplicated across models the same way WriteClipNodes does it
+		decltype (g_clipnodetable) *stitchtable = (decltype (g_clipnodetable) *)malloc (sizeof (g_clipnodetable));
+		hlassume (stitchtable != NULL, assume_NoMemory);
 #endif
-			}
-		}
+
+		int i, j, level;
+		RunThreadsOnIndividual (numtasks, g_estimate, CreateBrinkinfoForTask);
 		for (level = BrinkAny; level > BrinkNone; level--)
 		{
 #ifdef ZHLT_XASH2
@@ -1028,15 +1170,28 @@ void FinishBSPFile()
 #endif
 #ifdef HLBSP_MERGECLIPNODE
 			count_mergedclipnodes = 0;
+#endif
+			g_brinklevel = (bbrinklevel_e) level;
+			RunThreadsOnIndividual (numtasks, false, FixBrinksForTask);
+#ifdef HLBSP_MERGECLIPNODE
+			memset (stitchtable, 0, sizeof (*stitchtable));
 #endif
 			for (i = 0; i < g_nummodels; i++)
 			{
 				for (j = 1; j < NUM_HULLS; j++)
 				{
+#ifdef HLBSP_MERGECLIPNODE
+#ifdef ZHLT_XASH2
+					if (!StitchBrinkTask (i * (NUM_HULLS - 1) + j - 1, headnode[i][j], &(*stitchtable)[j - 1], clipnodes[j - 1], numclipnodes[j - 1]))
+#else
+					if (!StitchBrinkTask (i * (NUM_HULLS - 1) + j - 1, headnode[i][j], stitchtable, clipnodes, numclipnodes))
+#endif
+#else
 #ifdef ZHLT_XASH2
-					if (!FixBrinks (brinkinfo[i][j], (bbrinklevel_e) level, headnode[i][j], clipnodes[j - 1], MAX_MAP_CLIPNODES, numclipnodes[j - 1], numclipnodes[j - 1]))
+					if (!StitchBrinkTask (i * (NUM_HULLS - 1) + j - 1, headnode[i][j], clipnodes[j - 1], numclipnodes[j - 1]))
 #else
-					if (!FixBrinks (brinkinfo[i][j], (bbrinklevel_e) level, headnode[i][j], clipnodes, MAX_MAP_CLIPNODES, numclipnodes, numclipnodes))
+					if (!StitchBrinkTask (i * (NUM_HULLS - 1) + j - 1, headnode[i][j], clipnodes, numclipnodes))
+#endif
 #endif
 					{
 						break;
@@ -1047,6 +1202,10 @@ void FinishBSPFile()
 					break;
 				}
 			}
+			for (int task = 0; task < numtasks; task++)
+			{
+				free (g_brinkclipnodes[task]);
+			}
 			if (i == g_nummodels)
 			{
 				break;
@@ -1102,6 +1261,11 @@ void FinishBSPFile()
 		}
 		free (brinkinfo);
 		free (headnode);
+		free (g_brinkclipnodes);
+		free (g_brinknumclipnodes);
+#ifdef HLBSP_MERGECLIPNODE
+		free (stitchtable);
+#endif
 #ifdef ZHLT_XASH2
 		for (hull = 1; hull < MAX_MAP_HULLS; hull++)
 		{
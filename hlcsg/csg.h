@@ -26,6 +26,7 @@
 #ifdef ZHLT_PARAMFILE
 #include "cmdlinecfg.h"
 #endif
+#include "stagecache.h"
 
 #include "texturedirectorylisting.h"
 
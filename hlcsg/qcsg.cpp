@@ -1801,6 +1801,10 @@ static void     Usage()
     Log("    -chart           : display bsp statitics\n");
     Log("    -low | -high     : run program an altered priority level\n");
     Log("    -nolog           : don't generate the compile logfiles\n");
+#ifdef ZHLT_STAGECACHE
+    Log("    -stagecache dir  : Reuse the outputs of an earlier run with the same inputs, kept in dir\n");
+    Log("                       (textures are compared by path, size and time, not contents)\n");
+#endif
 #ifdef HLCSG_KEEPLOG
 	Log("    -noresetlog      : Do not delete log file\n");
 #endif
@@ -2091,6 +2095,19 @@ int             main(const int argc, char** argv)
         {
             g_log = false;
         }
+#ifdef ZHLT_STAGECACHE
+        else if (!strcasecmp(argv[i], "-stagecache"))
+        {
+            if (i + 1 < argc)
+            {
+                g_stagecache = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
         else if (!strcasecmp(argv[i], "-skyclip"))
         {
             g_skyclip = true;
@@ -2543,6 +2560,53 @@ int             main(const int argc, char** argv)
         return 0;
     }
 
+#ifdef ZHLT_STAGECACHE
+    StageCacheBegin("hlcsg", argc, argv, mapname_from_arg);
+    StageCacheInputFile(name);
+    if (g_hullfile)
+    {
+        StageCacheInputFile(g_hullfile);
+    }
+#ifdef HLCSG_NULLIFY_INVISIBLE
+    if (g_bUseNullTex && g_nullfile)
+    {
+        StageCacheInputFile(g_nullfile);
+    }
+#endif
+    StageCacheInputTextures();
+    StageCacheOutput(".bsp");
+    for (i = 0; i < NUM_HULLS; i++)
+    {
+        char            suffix[16];
+
+        safe_snprintf(suffix, sizeof(suffix), ".p%i", i);
+        StageCacheOutput(suffix);
+#ifdef ZHLT_DETAILBRUSH
+        safe_snprintf(suffix, sizeof(suffix), ".b%i", i);
+        StageCacheOutput(suffix);
+#endif
+#ifdef HLCSG_VIEWSURFACE
+        if (g_viewsurface)
+        {
+            safe_snprintf(suffix, sizeof(suffix), "_surface%i.pts", i);
+            StageCacheOutput(suffix);
+        }
+#endif
+    }
+#ifdef HLCSG_HLBSP_ALLOWEMPTYENTITY
+    StageCacheOutput(".hsz");
+#endif
+#ifdef HLCSG_HLBSP_DOUBLEPLANE
+    StageCacheOutput(".pln");
+#endif
+    if (StageCacheRestore())
+    {
+        end = I_FloatTime();
+        LogTimeElapsed(end - start);
+        return 0;
+    }
+#endif
+
 #ifdef HLCSG_CLIPECONOMY // AJM
     CheckForNoClip();
 #endif
@@ -2652,6 +2716,9 @@ int             main(const int argc, char** argv)
 #endif
 
     WriteBSP(g_Mapname);
+#ifdef ZHLT_STAGECACHE
+    StageCacheStore();
+#endif
 
     // AJM: debug
 #if 0
@@ -1,5 +1,8 @@
 #include "qrad.h"
 #include "stringlib.h"
+#ifdef HLRAD_LEAFAMBIENT_CULL
+#include <vector>
+#endif
 
 #ifdef ZHLT_PARANOIA_BSP
 
@@ -63,6 +66,29 @@ typedef struct
 } lightpoint_t;
 
 ambientlist_t	g_leaf_samples[MAX_MAP_LEAFS];
+#ifdef HLRAD_LEAFAMBIENT_CULL
+// what R_GetDirectLightFromSurface needs from a face, worked out once instead of on every ray hit
+typedef struct
+{
+	float	texturemins[2];
+	float	extents[2];
+	int		texture_step;
+	bool	special;	// TEX_SPECIAL: no lightmap
+	bool	sky;
+	vec3_t	average;	// average of all the styles, as lightpoint_t::average
+} ambientface_t;
+
+static ambientface_t	*g_ambientfaces = NULL;
+static int		*g_ambientlightleafs = NULL;	// leaf of each world light's (rounded) origin, 0 = unknown
+
+// emit_surface lights that may light some point of one leaf, and the pvs of the last sample
+struct ambientlights_t
+{
+	std::vector< int >	lights;		// g_dworldlights indices in ascending order
+	int		visofs;		// offset of the pvs below, -2 = none decompressed yet
+	byte	pvs[(MAX_MAP_LEAFS + 7) / 8];
+};
+#endif
 static int	lineartoscreen[1024];	// linear (0..1) to gamma corrected vertex light (0..255)
 
 static void BuildGammaTable( void )
@@ -127,6 +153,76 @@ float Engine_WorldLightDistanceFalloff( const dworldlight_t *wl, const vec3_t de
 	return InvRSquared(delta);
 }
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+// collects the ambient cube lights that pass the radius and back side tests for some point
+// of the leaf's bounding box; the samples of a leaf never leave its box
+static void GatherLeafAmbientLights( int leafID, ambientlights_t *lights )
+{
+	const dleaf_t *leaf = g_dleafs + leafID;
+
+	lights->lights.resize( 0 );
+
+	for ( int iLight = 0; iLight < g_numworldlights; iLight++ )
+	{
+		const dworldlight_t *wl = &g_dworldlights[iLight];
+
+		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
+			continue;
+
+		vec3_t wlOrigin;
+		VectorCopy( wl->origin, wlOrigin );
+
+		// Engine_WorldLightDistanceFalloff: nothing beyond the radius
+		if ( wl->radius != 0 )
+		{
+			vec_t dist2 = 0;
+			for ( int k = 0; k < 3; k++ )
+			{
+				vec_t d = 0;
+				if ( wlOrigin[k] < leaf->mins[k] ) d = leaf->mins[k] - wlOrigin[k];
+				else if ( wlOrigin[k] > leaf->maxs[k] ) d = wlOrigin[k] - leaf->maxs[k];
+				dist2 += d * d;
+			}
+			if ( dist2 > wl->radius * wl->radius * 1.01 + 1.0 )
+				continue;
+		}
+
+		// Engine_WorldLightAngle: nothing behind the light surface
+		vec_t front = 0;
+		for ( int k = 0; k < 3; k++ )
+		{
+			front += wl->normal[k] * (( wl->normal[k] > 0 ? leaf->maxs[k] : leaf->mins[k] ) - wlOrigin[k] );
+		}
+		if ( front < -ON_EPSILON )
+			continue;
+
+		lights->lights.push_back( iLight );
+	}
+}
+
+void AddEmitSurfaceLights( const vec3_t vStart, vec3_t lightBoxColor[6], ambientlights_t *lights )
+{
+	vec3_t	wlOrigin;
+
+	// a light the sample's leaf can't see can't reach the sample either
+	const dleaf_t *leaf = PointInLeaf( vStart );
+	bool usepvs = g_visdatasize && leaf != g_dleafs && leaf->visofs != -1;
+
+	if ( usepvs && leaf->visofs != lights->visofs )
+	{
+		DecompressVis( &g_dvisdata[leaf->visofs], lights->pvs, sizeof( lights->pvs ));
+		lights->visofs = leaf->visofs;
+	}
+
+	for ( size_t iCandidate = 0; iCandidate < lights->lights.size(); iCandidate++ )
+	{
+		int iLight = lights->lights[iCandidate];
+		dworldlight_t *wl = &g_dworldlights[iLight];
+		int lightleaf = g_ambientlightleafs[iLight];
+
+		if ( usepvs && lightleaf > 0 && !( lights->pvs[( lightleaf - 1 ) >> 3] & ( 1 << (( lightleaf - 1 ) & 7 ))))
+			continue;
+#else
 void AddEmitSurfaceLights( const vec3_t vStart, vec3_t lightBoxColor[6] )
 {
 	vec3_t	wlOrigin;
@@ -138,13 +234,15 @@ void AddEmitSurfaceLights( const vec3_t vStart, vec3_t lightBoxColor[6] )
 		// Should this light even go in the ambient cubes?
 		if ( !( wl->flags & DWL_FLAGS_INAMBIENTCUBE ) )
 			continue;
+#endif
 
 		hlassert( wl->emittype == emit_surface );
 
 		VectorCopy( wl->origin, wlOrigin );	// short to float
 
 		// Can this light see the point?
-		if( TestLine ( vStart, wlOrigin ) != CONTENTS_EMPTY )
+		trace_t trace;
+		if( TraceSegment( vStart, wlOrigin, TRACE_WORLDONLY, &trace ))
 			continue;
 
 		// Add this light's contribution.
@@ -157,8 +255,7 @@ void AddEmitSurfaceLights( const vec3_t vStart, vec3_t lightBoxColor[6] )
 
 		float flAngleScale = Engine_WorldLightAngle( wl, wl->normal, vDeltaNorm, vDeltaNorm );
 
-//		if( g_trace_fraction != 1.0f ) Log( "trace fraction %g\n", g_trace_fraction );
-		float ratio = flDistanceScale * flAngleScale * g_trace_fraction;
+		float ratio = flDistanceScale * flAngleScale * trace.fraction;
 		if ( ratio == 0 ) continue;
 
 		for ( int i = 0; i < 6; i++ )
@@ -215,16 +312,69 @@ static void CalcFaceExtents( dface_t *surf, float texturemins[2], float extents[
 	}
 }
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+static void BuildAmbientFace( int facenum )
+{
+	dface_t *surf = &g_dfaces[facenum];
+	ambientface_t *af = &g_ambientfaces[facenum];
+	texinfo_t *tex = g_texinfo + surf->texinfo;
+
+	CalcFaceExtents( surf, af->texturemins, af->extents );
+	af->texture_step = GetTextureStep( surf );
+	af->special = ( tex->flags & TEX_SPECIAL ) != 0;
+	af->sky = false;
+	VectorClear( af->average );
+
+	if( af->special )
+	{
+		const std::string texNameString = GetTextureByNumber(surf->texinfo);
+		af->sky = !Q_strnicmp( texNameString.c_str(), SPECIALTEX_SKY, sizeof(SPECIALTEX_SKY) - 1 );
+		return;
+	}
+
+	if( surf->lightofs == -1 )
+		return;
+
+	// same sums as R_GetDirectLightFromSurface used to do per hit
+	int texture_step = af->texture_step;
+	int size = (( af->extents[0] / texture_step ) + 1 ) * (( af->extents[1] / texture_step ) + 1 );
+	byte *lm = g_dlightdata + (unsigned int)surf->lightofs;
+
+	for( int map = 0; map < MAXLIGHTMAPS && surf->styles[map] != 255; map++ )
+	{
+		for( int i = 0; i < size; i++, lm += 3 )
+		{
+			af->average[0] += (float)lm[0] * 264.0f;
+			af->average[1] += (float)lm[1] * 264.0f;
+			af->average[2] += (float)lm[2] * 264.0f;
+		}
+
+		VectorScale( af->average, ( 1.0f / (float)size ), af->average );
+	}
+
+	af->average[0] = qmin( af->average[0] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
+	af->average[1] = qmin( af->average[1] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
+	af->average[2] = qmin( af->average[2] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
+}
+#endif
+
 static bool R_GetDirectLightFromSurface( dface_t *surf, const vec3_t point, lightpoint_t *info )
 {
 	int	map, size, s, t;
 	int	MAXSAMPLES = MAXLIGHTMAPS;
-	float	texturemins[2], extents[2];
 	byte	*lm;
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	const ambientface_t *af = &g_ambientfaces[surf - g_dfaces];
+	const float *texturemins = af->texturemins;
+	const float *extents = af->extents;
+	int texture_step = af->texture_step;
+#else
+	float	texturemins[2], extents[2];
 
 	// recalc face extents here
 	CalcFaceExtents( surf, texturemins, extents );
 	int texture_step = GetTextureStep( surf );
+#endif
 
 	texinfo_t *tex = g_texinfo + surf->texinfo;
 
@@ -234,6 +384,17 @@ static bool R_GetDirectLightFromSurface( dface_t *surf, const vec3_t point, ligh
 	if(( s < 0 || s > extents[0] ) || ( t < 0 || t > extents[1] ))
 		return false;
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	if( af->special )
+	{
+		if( af->sky )
+		{
+			info->hitsky = true;
+		}
+
+		return false; // no lightmaps
+	}
+#else
 	if( tex->flags & TEX_SPECIAL )
 	{
 		const std::string texNameString = GetTextureByNumber(surf->texinfo);
@@ -246,6 +407,7 @@ static bool R_GetDirectLightFromSurface( dface_t *surf, const vec3_t point, ligh
 
 		return false; // no lightmaps
 	}
+#endif
 
 	if( surf->lightofs == -1 )
 		return true;
@@ -270,6 +432,9 @@ static bool R_GetDirectLightFromSurface( dface_t *surf, const vec3_t point, ligh
 	info->diffuse[0] = qmin( info->diffuse[0] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
 	info->diffuse[1] = qmin( info->diffuse[1] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
 	info->diffuse[2] = qmin( info->diffuse[2] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	VectorCopy( af->average, info->average );
+#else
 	VectorClear( info->average );
 	lm = samples;
 
@@ -289,6 +454,7 @@ static bool R_GetDirectLightFromSurface( dface_t *surf, const vec3_t point, ligh
 	info->average[0] = qmin( info->average[0] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
 	info->average[1] = qmin( info->average[1] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
 	info->average[2] = qmin( info->average[2] * (1.0f / 128.0f), 255.0f ) * (1.0f / 255.0f);
+#endif
 	info->surf = surf;
 
 	return true;
@@ -452,7 +618,11 @@ void CalcRayAmbientLighting( const vec3_t vStart, const vec3_t vEnd, dworldlight
 	}
 }
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+void ComputeAmbientFromSphericalSamples( const vec3_t p1, vec3_t lightBoxColor[6], ambientlights_t *lights )
+#else
 void ComputeAmbientFromSphericalSamples( const vec3_t p1, vec3_t lightBoxColor[6] )
+#endif
 {
 	// Figure out the color that rays hit when shot out from this position.
 	float tanTheta = tan( VERTEXNORMAL_CONE_INNER_ANGLE );
@@ -490,7 +660,11 @@ void ComputeAmbientFromSphericalSamples( const vec3_t p1, vec3_t lightBoxColor[6
 
 	// Now add direct light from the emit_surface lights. These go in the ambient cube because
 	// there are a ton of them and they are often so dim that they get filtered out by r_worldlightmin.
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	AddEmitSurfaceLights( p1, lightBoxColor, lights );
+#else
 	AddEmitSurfaceLights( p1, lightBoxColor );
+#endif
 }
 
 bool IsLeafAmbientSurfaceLight( dworldlight_t *wl )
@@ -978,7 +1152,11 @@ void CompressAmbientSampleList( ambientlocallist_t *list )
 	}
 }
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+void ComputeAmbientForLeaf( int leafID, ambientlocallist_t *list, ambientlights_t *lights )
+#else
 void ComputeAmbientForLeaf( int leafID, ambientlocallist_t *list )
+#endif
 {
 	leafplanes_t	leafPlanes;
 
@@ -1014,6 +1192,9 @@ void ComputeAmbientForLeaf( int leafID, ambientlocallist_t *list )
 		return;
 	}
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	GatherLeafAmbientLights( leafID, lights );
+#endif
 	vec3_t cube[6];
 
 	for ( int i = 0; i < sampleCount; i++ )
@@ -1021,7 +1202,11 @@ void ComputeAmbientForLeaf( int leafID, ambientlocallist_t *list )
 		// compute each candidate sample and add to the list
 		vec3_t samplePosition;
 		GenerateLeafSamplePosition( leafID, list, &leafPlanes, samplePosition );
+#ifdef HLRAD_LEAFAMBIENT_CULL
+		ComputeAmbientFromSphericalSamples( samplePosition, cube, lights );
+#else
 		ComputeAmbientFromSphericalSamples( samplePosition, cube );
+#endif
 		// note this will remove the least valuable sample once the limit is reached
 		AddSampleToList( list, samplePosition, cube );
 	}
@@ -1033,6 +1218,11 @@ void ComputeAmbientForLeaf( int leafID, ambientlocallist_t *list )
 static void LeafAmbientLighting( int threadnum )
 {
 	ambientlocallist_t	list;
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	ambientlights_t	*lights = new ambientlights_t;
+
+	lights->visofs = -2;
+#endif
 
 	while( 1 )
 	{
@@ -1041,13 +1231,20 @@ static void LeafAmbientLighting( int threadnum )
 
 		list.numSamples = 0;
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+		ComputeAmbientForLeaf( leafID, &list, lights );
+#else
 		ComputeAmbientForLeaf( leafID, &list );
+#endif
 
 		// copy to the output array
 		g_leaf_samples[leafID].numSamples = list.numSamples;
 		g_leaf_samples[leafID].samples = (ambientsample_t *)AllocBlock( sizeof( ambientsample_t ) * list.numSamples );
 		memcpy( g_leaf_samples[leafID].samples, list.samples, sizeof( ambientsample_t ) * list.numSamples );
 	}
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	delete lights;
+#endif
 }
 
 static void LeafAmbientLightingSingle( int leafID )
@@ -1064,7 +1261,15 @@ static void LeafAmbientLightingSingle( int leafID )
 		return;
 	}
 
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	ambientlights_t	*lights = new ambientlights_t;
+
+	lights->visofs = -2;
+	ComputeAmbientForLeaf( leafID, &list, lights );
+	delete lights;
+#else
 	ComputeAmbientForLeaf( leafID, &list );
+#endif
 
 	// copy to the output array
 	g_leaf_samples[leafID].numSamples = list.numSamples;
@@ -1101,11 +1306,32 @@ void ComputeLeafAmbientLighting( void )
 	BuildGammaTable();		// init gamma table
 
 	Verbose( "%d of %d (%d%% of) surface lights went in leaf ambient cubes.\n", nInAmbientCube, nSurfaceLights, nSurfaceLights ? ((nInAmbientCube*100) / nSurfaceLights) : 0 );
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	g_ambientfaces = (ambientface_t *)malloc( g_numfaces * sizeof( ambientface_t ));
+	hlassume( g_ambientfaces != NULL, assume_NoMemory );
+	for ( i = 0; i < g_numfaces; i++ )
+		BuildAmbientFace( i );
+
+	g_ambientlightleafs = (int *)malloc( qmax( g_numworldlights, 1 ) * sizeof( int ));
+	hlassume( g_ambientlightleafs != NULL, assume_NoMemory );
+	for ( i = 0; i < g_numworldlights; i++ )
+	{
+		vec3_t wlOrigin;
+		VectorCopy( g_dworldlights[i].origin, wlOrigin );
+		g_ambientlightleafs[i] = PointInLeaf( wlOrigin ) - g_dleafs;
+	}
+#endif
 #if 0
 	for ( i = 0; i < g_dmodels[0].visleafs + 1; i++ )
 		LeafAmbientLightingSingle( i );
 #else
 	NamedRunThreadsOnIndividual( g_dmodels[0].visleafs + 1, g_estimate, LeafAmbientLighting );
+#endif
+#ifdef HLRAD_LEAFAMBIENT_CULL
+	free( g_ambientfaces );
+	g_ambientfaces = NULL;
+	free( g_ambientlightleafs );
+	g_ambientlightleafs = NULL;
 #endif
 	// clear old samples
 	g_numleaflights = 0;
@@ -75,9 +75,15 @@ struct facetriangulation_t
 	std::vector< Wall > walls;
 	std::vector< localtriangulation_t * > localtriangulations;
 	std::vector< int > usedpatches;
+
+	// triangulation cache bookkeeping
+	size_t memory;
+	int pins;
+	facetriangulation_t *lruprev;
+	facetriangulation_t *lrunext;
 };
 
-facetriangulation_t *g_facetriangulations[MAX_MAP_FACES];
+static facetriangulation_t *g_facetriangulations[MAX_MAP_FACES];
 
 static bool CalcAdaptedSpot (const localtriangulation_t *lt, const vec3_t position, int surface, vec3_t spot)
 	// If the surface formed by the face and its neighbor faces is not flat, the surface should be unfolded onto the face plane
@@ -848,6 +854,10 @@ void InterpolateSampleLight (const vec3_t position, int surface, int numstyles,
 		Error ("InterpolateSampleLight: internal error: surface number out of range.");
 	}
 	ft = g_facetriangulations[surface];
+	if (ft == NULL)
+	{
+		Error ("InterpolateSampleLight: internal error: triangulation has not been acquired.");
+	}
 	maininterp = new interpolation_t;
 	maininterp->points.reserve (64);
 
@@ -1845,21 +1855,40 @@ static void CollectUsedPatches (facetriangulation_t *facetrian)
 }
 
 
-// =====================================================================================
-//  CreateTriangulations
-// =====================================================================================
-void CreateTriangulations (int facenum)
+static size_t TriangulationMemory (const facetriangulation_t *facetrian)
 {
-	try
+	size_t memory;
+	int i;
+	const localtriangulation_t *lt;
+
+	memory = sizeof (facetriangulation_t);
+	memory += facetrian->neighbors.capacity () * sizeof (int);
+	memory += facetrian->walls.capacity () * sizeof (facetriangulation_t::Wall);
+	memory += facetrian->localtriangulations.capacity () * sizeof (localtriangulation_t *);
+	memory += facetrian->usedpatches.capacity () * sizeof (int);
+	for (i = 0; i < (int)facetrian->localtriangulations.size (); i++)
 	{
+		lt = facetrian->localtriangulations[i];
+		memory += sizeof (localtriangulation_t);
+		memory += lt->winding.m_NumPoints * sizeof (vec3_t);
+		memory += lt->neighborfaces.capacity () * sizeof (int);
+		memory += lt->sortedwedges.capacity () * sizeof (localtriangulation_t::Wedge);
+		memory += lt->sortedhullpoints.capacity () * sizeof (localtriangulation_t::HullPoint);
+	}
+	return memory;
+}
 
+// =====================================================================================
+//  BuildTriangulation
+// =====================================================================================
+static facetriangulation_t *BuildTriangulation (int facenum)
+{
 	facetriangulation_t *facetrian;
 	int patchnum;
 	const patch_t *patch;
 	localtriangulation_t *lt;
 
-	g_facetriangulations[facenum] = new facetriangulation_t;
-	facetrian = g_facetriangulations[facenum];
+	facetrian = new facetriangulation_t;
 
 	facetrian->facenum = facenum;
 
@@ -1881,6 +1910,226 @@ void CreateTriangulations (int facenum)
 	// Collect used patches
 	CollectUsedPatches (facetrian);
 
+	facetrian->memory = TriangulationMemory (facetrian);
+	facetrian->pins = 0;
+	facetrian->lruprev = NULL;
+	facetrian->lrunext = NULL;
+	return facetrian;
+}
+
+static void DeleteTriangulation (facetriangulation_t *facetrian)
+{
+	int j;
+
+	for (j = 0; j < (int)facetrian->localtriangulations.size (); j++)
+	{
+		FreeLocalTriangulation (facetrian->localtriangulations[j]);
+	}
+	delete facetrian;
+}
+
+// =====================================================================================
+//  Triangulation cache
+//      Triangulations are built on demand and kept in an LRU list bounded by -lerpcache.
+//      A face and its neighbors stay pinned while AddPatchLights interpolates that face;
+//      only unpinned triangulations are evicted. Faces are visited in a spatial order so
+//      that the neighbors of a face were usually built for a face shortly before it.
+//      The list, the pin counts and the slots of g_facetriangulations are guarded by
+//      ThreadLock; a pinned triangulation may be read without it.
+// =====================================================================================
+int g_lerpcachesize = DEFAULT_LERPCACHESIZE;
+int g_triangulationorder[MAX_MAP_FACES];
+static std::vector< int > g_triangulationpatches[MAX_MAP_FACES];
+static facetriangulation_t *g_triangulationlruhead = NULL; // most recently released
+static facetriangulation_t *g_triangulationlrutail = NULL;
+static size_t g_triangulationmemory = 0;
+static size_t g_triangulationpeakmemory = 0;
+static int g_numtriangulationbuilds = 0;
+
+static void TriangulationLRUUnlink (facetriangulation_t *facetrian)
+{
+	if (facetrian->lruprev)
+	{
+		facetrian->lruprev->lrunext = facetrian->lrunext;
+	}
+	else
+	{
+		g_triangulationlruhead = facetrian->lrunext;
+	}
+	if (facetrian->lrunext)
+	{
+		facetrian->lrunext->lruprev = facetrian->lruprev;
+	}
+	else
+	{
+		g_triangulationlrutail = facetrian->lruprev;
+	}
+	facetrian->lruprev = NULL;
+	facetrian->lrunext = NULL;
+}
+
+static void TriangulationLRUPushFront (facetriangulation_t *facetrian)
+{
+	facetrian->lruprev = NULL;
+	facetrian->lrunext = g_triangulationlruhead;
+	if (g_triangulationlruhead)
+	{
+		g_triangulationlruhead->lruprev = facetrian;
+	}
+	else
+	{
+		g_triangulationlrutail = facetrian;
+	}
+	g_triangulationlruhead = facetrian;
+}
+
+static const facetriangulation_t *PinTriangulation (int facenum)
+{
+	facetriangulation_t *facetrian;
+	facetriangulation_t *built;
+
+	ThreadLock ();
+	facetrian = g_facetriangulations[facenum];
+	if (facetrian)
+	{
+		if (facetrian->pins++ == 0)
+		{
+			TriangulationLRUUnlink (facetrian);
+		}
+		ThreadUnlock ();
+		return facetrian;
+	}
+	ThreadUnlock ();
+
+	// build outside the lock; if another thread finishes the same face first, ours is dropped
+	built = BuildTriangulation (facenum);
+
+	ThreadLock ();
+	facetrian = g_facetriangulations[facenum];
+	if (facetrian)
+	{
+		if (facetrian->pins++ == 0)
+		{
+			TriangulationLRUUnlink (facetrian);
+		}
+	}
+	else
+	{
+		facetrian = built;
+		built = NULL;
+		facetrian->pins = 1;
+		g_facetriangulations[facenum] = facetrian;
+		g_triangulationmemory += facetrian->memory;
+		g_triangulationpeakmemory = qmax (g_triangulationpeakmemory, g_triangulationmemory);
+		g_numtriangulationbuilds++;
+	}
+	ThreadUnlock ();
+
+	if (built)
+	{
+		DeleteTriangulation (built);
+	}
+	return facetrian;
+}
+
+static void UnpinTriangulations (int numfaces, const int *facenums)
+{
+	std::vector< facetriangulation_t * > evicted;
+	facetriangulation_t *facetrian;
+	size_t limit;
+	int i;
+
+	limit = (size_t)g_lerpcachesize * 1024 * 1024;
+
+	ThreadLock ();
+	for (i = 0; i < numfaces; i++)
+	{
+		facetrian = g_facetriangulations[facenums[i]];
+		if (--facetrian->pins == 0)
+		{
+			TriangulationLRUPushFront (facetrian);
+		}
+	}
+	while (g_triangulationmemory > limit && g_triangulationlrutail)
+	{
+		facetrian = g_triangulationlrutail;
+		TriangulationLRUUnlink (facetrian);
+		g_facetriangulations[facetrian->facenum] = NULL;
+		g_triangulationmemory -= facetrian->memory;
+		evicted.push_back (facetrian);
+	}
+	ThreadUnlock ();
+
+	for (i = 0; i < (int)evicted.size (); i++)
+	{
+		DeleteTriangulation (evicted[i]);
+	}
+}
+
+// =====================================================================================
+//  InitTriangulations
+//      Sorts the faces along a Morton curve through their centroids.
+// =====================================================================================
+static unsigned int TriangulationSpreadBits (unsigned int x)
+{
+	x &= 0x3ff;
+	x = (x | (x << 16)) & 0x030000ff;
+	x = (x | (x << 8)) & 0x0300f00f;
+	x = (x | (x << 4)) & 0x030c30c3;
+	x = (x | (x << 2)) & 0x09249249;
+	return x;
+}
+
+void InitTriangulations ()
+{
+	try
+	{
+
+	std::vector< std::pair< unsigned int, int > > keys;
+	vec3_t mins;
+	vec3_t maxs;
+	vec_t scale;
+	int facenum;
+	int k;
+
+	VectorFill (mins, BOGUS_RANGE);
+	VectorFill (maxs, -BOGUS_RANGE);
+	for (facenum = 0; facenum < g_numfaces; facenum++)
+	{
+		VectorCompareMinimum (mins, g_face_centroids[facenum], mins);
+		VectorCompareMaximum (maxs, g_face_centroids[facenum], maxs);
+	}
+	scale = 0;
+	for (k = 0; k < 3; k++)
+	{
+		scale = qmax (scale, maxs[k] - mins[k]);
+	}
+	scale = scale > 0? 1023 / scale: 0;
+
+	keys.resize (g_numfaces);
+	for (facenum = 0; facenum < g_numfaces; facenum++)
+	{
+		unsigned int key = 0;
+		for (k = 0; k < 3; k++)
+		{
+			vec_t v = (g_face_centroids[facenum][k] - mins[k]) * scale;
+			key |= TriangulationSpreadBits ((unsigned int)qmax (0, qmin (v, 1023))) << k;
+		}
+		keys[facenum].first = key;
+		keys[facenum].second = facenum;
+	}
+	std::sort (keys.begin (), keys.end ());
+	for (facenum = 0; facenum < g_numfaces; facenum++)
+	{
+		g_triangulationorder[facenum] = keys[facenum].second;
+		g_facetriangulations[facenum] = NULL;
+	}
+	g_triangulationlruhead = NULL;
+	g_triangulationlrutail = NULL;
+	g_triangulationmemory = 0;
+	g_triangulationpeakmemory = 0;
+	g_numtriangulationbuilds = 0;
+
 	}
 	catch (std::bad_alloc)
 	{
@@ -1889,18 +2138,95 @@ void CreateTriangulations (int facenum)
 }
 
 // =====================================================================================
-//  GetTriangulationPatches
+//  CreateTriangulations
+//      Builds each face once to record the patches it interpolates from; the
+//      triangulation itself stays only as long as the cache has room for it.
+//      Work items are indices into g_triangulationorder.
 // =====================================================================================
-void GetTriangulationPatches (int facenum, int *numpatches, const int **patches)
+void CreateTriangulations (int index)
+{
+	try
+	{
+
+	int facenum;
+	const facetriangulation_t *facetrian;
+
+	facenum = g_triangulationorder[index];
+	facetrian = PinTriangulation (facenum);
+	g_triangulationpatches[facenum] = facetrian->usedpatches;
+	UnpinTriangulations (1, &facenum);
+
+	}
+	catch (std::bad_alloc)
+	{
+		hlassume (false, assume_NoMemory);
+	}
+}
+
+// =====================================================================================
+//  AcquireTriangulations
+//      Pins the triangulations InterpolateSampleLight needs for samples on this face.
+// =====================================================================================
+void AcquireTriangulations (int facenum)
+{
+	try
+	{
+
+	const facetriangulation_t *facetrian;
+	int i;
+
+	facetrian = PinTriangulation (facenum);
+	if (g_lerp_enabled)
+	{
+		for (i = 1; i < (int)facetrian->neighbors.size (); i++) // neighbors[0] is the face itself
+		{
+			PinTriangulation (facetrian->neighbors[i]);
+		}
+	}
+
+	}
+	catch (std::bad_alloc)
+	{
+		hlassume (false, assume_NoMemory);
+	}
+}
+
+void ReleaseTriangulations (int facenum)
 {
+	try
+	{
+
 	const facetriangulation_t *facetrian;
 
 	facetrian = g_facetriangulations[facenum];
-	*numpatches = (int)facetrian->usedpatches.size ();
+	if (g_lerp_enabled)
+	{
+		UnpinTriangulations ((int)facetrian->neighbors.size (), &facetrian->neighbors[0]);
+	}
+	else
+	{
+		UnpinTriangulations (1, &facenum);
+	}
+
+	}
+	catch (std::bad_alloc)
+	{
+		hlassume (false, assume_NoMemory);
+	}
+}
+
+// =====================================================================================
+//  GetTriangulationPatches
+// =====================================================================================
+void GetTriangulationPatches (int facenum, int *numpatches, const int **patches)
+{
+	const std::vector< int > &usedpatches = g_triangulationpatches[facenum];
+
+	*numpatches = (int)usedpatches.size ();
 	#if !defined __MSC_VER ||  _MSC_VER >= 1600
-		*patches =	  &facetrian->usedpatches.front();
+		*patches =	  usedpatches.empty ()? NULL: &usedpatches.front();
 	#else
-		*patches =	  facetrian->usedpatches.begin();
+		*patches =	  usedpatches.begin();
 	#endif
 }
 
@@ -1913,21 +2239,21 @@ void FreeTriangulations ()
 	{
 
 	int i;
-	int j;
-	facetriangulation_t *facetrian;
 
+	Verbose ("%d triangulations built for %d faces, peak %.1f MB\n",
+		g_numtriangulationbuilds, g_numfaces, g_triangulationpeakmemory / (1024.0 * 1024.0));
 	for (i = 0; i < g_numfaces; i++)
 	{
-		facetrian = g_facetriangulations[i];
-
-		for (j = 0; j < (int)facetrian->localtriangulations.size (); j++)
+		if (g_facetriangulations[i])
 		{
-			FreeLocalTriangulation (facetrian->localtriangulations[j]);
+			DeleteTriangulation (g_facetriangulations[i]);
+			g_facetriangulations[i] = NULL;
 		}
-
-		delete facetrian;
-		g_facetriangulations[i] = NULL;
+		std::vector< int > ().swap (g_triangulationpatches[i]);
 	}
+	g_triangulationlruhead = NULL;
+	g_triangulationlrutail = NULL;
+	g_triangulationmemory = 0;
 
 	}
 	catch (std::bad_alloc)
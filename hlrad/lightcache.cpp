@@ -0,0 +1,613 @@
+#include "qrad.h"
+
+#ifdef HLRAD_LIGHTCACHE
+
+#include <vector>
+#include <algorithm>
+#include <atomic>
+
+// =====================================================================================
+//  Light visibility cache
+//      Every direct light contribution is the product of an analytic term (intensity,
+//      colour, falloff, cone) and the outcome of one shadow ray: blocked, or visible
+//      through a transparency and possibly converted to an opaque entity's style.
+//      Only the ray outcome is stored, keyed by the exact segment that was traced, so a
+//      rerun in which lights only changed brightness, colour or style recombines the
+//      facelights without tracing, while new or moved lights produce new segments that
+//      miss the cache and are traced as usual.
+//      The cache is tied to the map geometry and to every entity that is not a light;
+//      any change there discards it.
+//      Segments are hashed to find their slot, but a slot is only used when its stored
+//      endpoints and sky flag equal the ray being traced, so a hash collision is a miss.
+// =====================================================================================
+
+#define LIGHTCACHE_MAGIC		(('2' << 24) + ('C' << 16) + ('L' << 8) + 'Z')
+#define LIGHTCACHE_MAX_RECORDED	(1 << 22) // segments traced in one run that are kept for the next; the rest are traced and forgotten
+#define LIGHTCACHE_BLOCKED		0 // result codes; codes >= LIGHTCACHE_SPECIAL index the specials array
+#define LIGHTCACHE_VISIBLE		1
+#define LIGHTCACHE_SPECIAL		2
+
+bool            g_lightcache = DEFAULT_LIGHTCACHE;
+
+typedef unsigned long long lightcachekey_t;
+
+typedef struct
+{
+	lightcachekey_t key; // 0 marks an empty slot
+	vec3_t start;
+	vec3_t stop;
+	unsigned int result;
+	bool sky;
+} lightcacheentry_t;
+
+typedef struct
+{
+	vec3_t transparency;
+	int opaquestyle;
+} lightcachespecial_t;
+
+typedef struct
+{
+	std::vector< lightcacheentry_t > entries; // segments traced by this thread
+	std::vector< lightcachespecial_t > specials;
+	unsigned int hits;
+	unsigned int dropped; // traced after LIGHTCACHE_MAX_RECORDED segments were recorded
+} lightcachethread_t;
+
+static bool g_lightcache_active = false;
+static char g_lightcache_file[_MAX_PATH];
+static lightcachekey_t g_lightcache_signature;
+
+// segments read from the cache file, in an open addressing table that is read-only while tracing
+static lightcacheentry_t *g_lightcache_table = NULL;
+static std::atomic<unsigned char> *g_lightcache_used = NULL;
+static unsigned int g_lightcache_mask = 0;
+static std::atomic<unsigned int> g_lightcache_recorded (0);
+static unsigned int g_lightcache_numloaded = 0;
+static std::vector< lightcachespecial_t > g_lightcache_specials;
+
+static std::vector< lightcachethread_t * > g_lightcache_threads;
+static thread_local lightcachethread_t *t_lightcache = NULL;
+
+// =====================================================================================
+//  LightCacheHash
+//      64-bit FNV-1a
+// =====================================================================================
+static lightcachekey_t LightCacheHash (lightcachekey_t hash, const void *data, size_t size)
+{
+	const unsigned char *p = (const unsigned char *)data;
+	for (size_t i = 0; i < size; i++)
+	{
+		hash ^= p[i];
+		hash *= 0x100000001b3ULL;
+	}
+	return hash;
+}
+
+static lightcachekey_t LightCacheHashString (lightcachekey_t hash, const char *s)
+{
+	return LightCacheHash (hash, s, strlen (s) + 1);
+}
+
+static lightcachekey_t LightCacheSegmentKey (const vec3_t start, const vec3_t stop, bool sky)
+{
+	lightcachekey_t key = 0xcbf29ce484222325ULL;
+	key = LightCacheHash (key, start, sizeof (vec3_t));
+	key = LightCacheHash (key, stop, sizeof (vec3_t));
+	key = LightCacheHash (key, &sky, sizeof (sky));
+	return key? key: 1; // 0 marks an empty slot
+}
+
+static bool LightCacheSameSegment (const lightcacheentry_t &entry, const vec3_t start, const vec3_t stop, bool sky)
+{
+	return entry.sky == sky
+		&& entry.start[0] == start[0] && entry.start[1] == start[1] && entry.start[2] == start[2]
+		&& entry.stop[0] == stop[0] && entry.stop[1] == stop[1] && entry.stop[2] == stop[2];
+}
+
+// =====================================================================================
+//  LightCacheSignature
+//      Hash of everything that can change the outcome of a shadow ray: the geometry,
+//      the textures faces use, and all entities except lights. light_shadow and
+//      light_bounce assign styles to opaque entities, so they count as geometry.
+// =====================================================================================
+static lightcachekey_t LightCacheSignature ()
+{
+	lightcachekey_t hash = 0xcbf29ce484222325ULL;
+	int i;
+
+	hash = LightCacheHash (hash, g_dplanes, g_numplanes * sizeof (dplane_t));
+	hash = LightCacheHash (hash, g_dvertexes, g_numvertexes * sizeof (dvertex_t));
+	hash = LightCacheHash (hash, g_dedges, g_numedges * sizeof (dedge_t));
+	hash = LightCacheHash (hash, g_dsurfedges, g_numsurfedges * sizeof (g_dsurfedges[0]));
+	hash = LightCacheHash (hash, g_dnodes, g_numnodes * sizeof (dnode_t));
+	hash = LightCacheHash (hash, g_dmarksurfaces, g_nummarksurfaces * sizeof (g_dmarksurfaces[0]));
+	for (i = 0; i < g_numleafs; i++)
+	{
+		const dleaf_t *leaf = &g_dleafs[i];
+		hash = LightCacheHash (hash, &leaf->contents, sizeof (leaf->contents));
+		hash = LightCacheHash (hash, &leaf->firstmarksurface, sizeof (leaf->firstmarksurface));
+		hash = LightCacheHash (hash, &leaf->nummarksurfaces, sizeof (leaf->nummarksurfaces));
+	}
+	for (i = 0; i < g_nummodels; i++)
+	{
+		const dmodel_t *model = &g_dmodels[i];
+		hash = LightCacheHash (hash, model->origin, sizeof (model->origin));
+		hash = LightCacheHash (hash, model->headnode, sizeof (model->headnode));
+		hash = LightCacheHash (hash, &model->firstface, sizeof (model->firstface));
+		hash = LightCacheHash (hash, &model->numfaces, sizeof (model->numfaces));
+	}
+	// lightofs and styles are outputs of hlrad, and embedded lightmaps add texinfos, so only hash what shapes the samples
+	for (i = 0; i < g_numfaces; i++)
+	{
+		const dface_t *face = &g_dfaces[i];
+		const texinfo_t *tex = &g_texinfo[face->texinfo];
+		hash = LightCacheHash (hash, &face->planenum, sizeof (face->planenum));
+		hash = LightCacheHash (hash, &face->side, sizeof (face->side));
+		hash = LightCacheHash (hash, &face->firstedge, sizeof (face->firstedge));
+		hash = LightCacheHash (hash, &face->numedges, sizeof (face->numedges));
+		hash = LightCacheHash (hash, tex->vecs, sizeof (tex->vecs));
+		hash = LightCacheHash (hash, &tex->flags, sizeof (tex->flags));
+		hash = LightCacheHashString (hash, GetTextureByNumber (face->texinfo).c_str ());
+	}
+	for (i = 0; i < g_numentities; i++)
+	{
+		const entity_t *ent = &g_entities[i];
+		const char *classname = ValueForKey (ent, "classname");
+		if (!strncmp (classname, "light", 5) && strcmp (classname, "light_shadow") && strcmp (classname, "light_bounce"))
+		{
+			continue;
+		}
+		for (const epair_t *ep = ent->epairs; ep; ep = ep->next)
+		{
+			hash = LightCacheHashString (hash, ep->key);
+			hash = LightCacheHashString (hash, ep->value);
+		}
+		hash = LightCacheHash (hash, &i, sizeof (i));
+	}
+	hash = LightCacheHash (hash, &g_allow_opaques, sizeof (g_allow_opaques));
+	unsigned int vecsize = sizeof (vec_t); // segments are stored as raw vec_t
+	hash = LightCacheHash (hash, &vecsize, sizeof (vecsize));
+#ifdef ZHLT_STUDIOSHADOWS
+	hash = LightCacheHash (hash, &g_nostudioshadow, sizeof (g_nostudioshadow));
+	// the placements are among the entities above, the model files are not
+	uint64_t studiohash = HashStudioModels ();
+	hash = LightCacheHash (hash, &studiohash, sizeof (studiohash));
+#endif
+	return hash;
+}
+
+// =====================================================================================
+//  Varint encoding for the cache file
+// =====================================================================================
+static void LightCachePutVarint (std::vector< unsigned char > &out, lightcachekey_t value)
+{
+	while (value >= 0x80)
+	{
+		out.push_back ((unsigned char)(value | 0x80));
+		value >>= 7;
+	}
+	out.push_back ((unsigned char)value);
+}
+
+static bool LightCacheGetVarint (const unsigned char *&p, const unsigned char *end, lightcachekey_t &value)
+{
+	value = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (p >= end)
+		{
+			return false;
+		}
+		unsigned char c = *p++;
+		value |= (lightcachekey_t)(c & 0x7f) << shift;
+		if (!(c & 0x80))
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+static void LightCacheInsert (const lightcacheentry_t &entry)
+{
+	unsigned int slot = (unsigned int)entry.key & g_lightcache_mask;
+	while (g_lightcache_table[slot].key)
+	{
+		if (g_lightcache_table[slot].key == entry.key && LightCacheSameSegment (g_lightcache_table[slot], entry.start, entry.stop, entry.sky))
+		{
+			return;
+		}
+		slot = (slot + 1) & g_lightcache_mask;
+	}
+	g_lightcache_table[slot] = entry;
+	g_lightcache_numloaded++;
+}
+
+static void LightCacheFreeTable ()
+{
+	free (g_lightcache_table);
+	g_lightcache_table = NULL;
+	delete[] g_lightcache_used;
+	g_lightcache_used = NULL;
+}
+
+static void LightCacheAllocTable (unsigned int numentries)
+{
+	unsigned int size = 1024;
+	while (size < numentries * 2)
+	{
+		size <<= 1;
+	}
+	LightCacheFreeTable ();
+	g_lightcache_mask = size - 1;
+	g_lightcache_numloaded = 0;
+	g_lightcache_table = (lightcacheentry_t *)calloc (size, sizeof (lightcacheentry_t));
+	hlassume (g_lightcache_table != NULL, assume_NoMemory);
+	g_lightcache_used = new std::atomic<unsigned char>[size];
+	for (unsigned int i = 0; i < size; i++)
+	{
+		g_lightcache_used[i].store (0, std::memory_order_relaxed);
+	}
+}
+
+// =====================================================================================
+//  LightCacheRead
+//      File layout: magic, signature, numspecials, numentries, then the specials as raw
+//      structs and the entries sorted by key as varint key deltas, varint results, a sky
+//      byte and the raw start and stop points.
+// =====================================================================================
+static bool LightCacheRead (const char *filename)
+{
+	FILE *f = fopen (filename, "rb");
+	if (!f)
+	{
+		return false;
+	}
+	fseek (f, 0, SEEK_END);
+	long size = ftell (f);
+	fseek (f, 0, SEEK_SET);
+	std::vector< unsigned char > buffer (size > 0? size: 0);
+	bool ok = size > 0 && fread (&buffer[0], 1, size, f) == (size_t)size;
+	fclose (f);
+
+	const unsigned char *p = ok? &buffer[0]: NULL;
+	const unsigned char *end = p + (ok? size: 0);
+	unsigned int magic;
+	lightcachekey_t signature;
+	unsigned int header[2];
+	if (!ok || end - p < (long)(sizeof (magic) + sizeof (signature)))
+	{
+		return false;
+	}
+	memcpy (&magic, p, sizeof (magic));
+	p += sizeof (magic);
+	memcpy (&signature, p, sizeof (signature));
+	p += sizeof (signature);
+	if (magic != LIGHTCACHE_MAGIC)
+	{
+		Warning ("'%s' is not a light cache file; ignored.", filename);
+		return false;
+	}
+	if (signature != g_lightcache_signature)
+	{
+		Log ("Geometry, non-light entities or studio models changed since '%s' was written; rebuilding light cache.\n", filename);
+		return false;
+	}
+	if (end - p < (long)sizeof (header))
+	{
+		return false;
+	}
+	memcpy (header, p, sizeof (header));
+	p += sizeof (header);
+	if ((lightcachekey_t)(end - p) < (lightcachekey_t)header[0] * sizeof (lightcachespecial_t))
+	{
+		return false;
+	}
+	g_lightcache_specials.resize (header[0]);
+	if (header[0])
+	{
+		memcpy (&g_lightcache_specials[0], p, header[0] * sizeof (lightcachespecial_t));
+	}
+	p += header[0] * sizeof (lightcachespecial_t);
+
+	LightCacheAllocTable (header[1]);
+	lightcachekey_t key = 0;
+	for (unsigned int i = 0; i < header[1]; i++)
+	{
+		lightcachekey_t delta, result;
+		lightcacheentry_t entry;
+		if (!LightCacheGetVarint (p, end, delta) || !LightCacheGetVarint (p, end, result)
+			|| result >= LIGHTCACHE_SPECIAL + (lightcachekey_t)header[0]
+			|| end - p < (long)(1 + 2 * sizeof (vec3_t)))
+		{
+			Warning ("Light cache file '%s' is corrupt; ignored.", filename);
+			g_lightcache_specials.clear ();
+			LightCacheAllocTable (0);
+			return false;
+		}
+		key += delta;
+		entry.key = key;
+		entry.result = (unsigned int)result;
+		entry.sky = *p++ != 0;
+		memcpy (entry.start, p, sizeof (vec3_t));
+		p += sizeof (vec3_t);
+		memcpy (entry.stop, p, sizeof (vec3_t));
+		p += sizeof (vec3_t);
+		if (entry.key != LightCacheSegmentKey (entry.start, entry.stop, entry.sky))
+		{
+			Warning ("Light cache file '%s' is corrupt; ignored.", filename);
+			g_lightcache_specials.clear ();
+			LightCacheAllocTable (0);
+			return false;
+		}
+		LightCacheInsert (entry);
+	}
+	return true;
+}
+
+// =====================================================================================
+//  LightCacheLoad
+//      Run after the direct lights and opaque entities exist and before BuildFacelights.
+// =====================================================================================
+void LightCacheLoad ()
+{
+	if (!g_lightcache)
+	{
+		return;
+	}
+	safe_snprintf (g_lightcache_file, _MAX_PATH, "%s.lc", g_Mapname);
+	g_lightcache_signature = LightCacheSignature ();
+	g_lightcache_specials.clear ();
+	g_lightcache_recorded = 0;
+	if (LightCacheRead (g_lightcache_file))
+	{
+		Log ("Loaded %u cached light segments from '%s'\n", g_lightcache_numloaded, g_lightcache_file);
+	}
+	else
+	{
+		LightCacheAllocTable (0);
+	}
+	g_lightcache_active = true;
+}
+
+static lightcachethread_t *LightCacheThread ()
+{
+	if (!t_lightcache)
+	{
+		t_lightcache = new lightcachethread_t;
+		t_lightcache->hits = 0;
+		t_lightcache->dropped = 0;
+		ThreadLock ();
+		g_lightcache_threads.push_back (t_lightcache);
+		ThreadUnlock ();
+	}
+	return t_lightcache;
+}
+
+static bool TraceLightSegment (const vec3_t start, const vec3_t stop, bool sky, vec3_t &transparency, int &opaquestyle)
+{
+	trace_t trace;
+	bool blocked = TraceSegment (start, stop, sky? TRACE_SKY: 0, &trace);
+	VectorCopy (trace.transparency, transparency);
+	opaquestyle = trace.opaquestyle;
+	return blocked;
+}
+
+// =====================================================================================
+//  TestLightSegment
+//      Shadow ray from a sample towards a light origin (or, for sky, towards the sky
+//      along a fixed direction). Returns true when the light is blocked; otherwise fills
+//      transparency and opaquestyle like TestSegmentAgainstOpaqueList.
+// =====================================================================================
+bool TestLightSegment (const vec3_t start, const vec3_t stop, bool sky, vec3_t &transparency, int &opaquestyle)
+{
+	if (!g_lightcache_active)
+	{
+		return TraceLightSegment (start, stop, sky, transparency, opaquestyle);
+	}
+	lightcachethread_t *t = LightCacheThread ();
+	lightcachekey_t key = LightCacheSegmentKey (start, stop, sky);
+	unsigned int slot = (unsigned int)key & g_lightcache_mask;
+	unsigned int result;
+	for (; g_lightcache_table[slot].key; slot = (slot + 1) & g_lightcache_mask)
+	{
+		if (g_lightcache_table[slot].key != key || !LightCacheSameSegment (g_lightcache_table[slot], start, stop, sky))
+		{
+			continue;
+		}
+		g_lightcache_used[slot].store (1, std::memory_order_relaxed); // only read by LightCacheSave after the threads have joined
+		result = g_lightcache_table[slot].result;
+		t->hits++;
+		if (result == LIGHTCACHE_BLOCKED)
+		{
+			return true;
+		}
+		if (result == LIGHTCACHE_VISIBLE)
+		{
+			VectorFill (transparency, 1.0);
+			opaquestyle = -1;
+			return false;
+		}
+		const lightcachespecial_t &special = g_lightcache_specials[result - LIGHTCACHE_SPECIAL];
+		VectorCopy (special.transparency, transparency);
+		opaquestyle = special.opaquestyle;
+		return false;
+	}
+
+	bool blocked = TraceLightSegment (start, stop, sky, transparency, opaquestyle);
+
+	if (g_lightcache_recorded.load (std::memory_order_relaxed) >= LIGHTCACHE_MAX_RECORDED
+		|| g_lightcache_recorded.fetch_add (1, std::memory_order_relaxed) >= LIGHTCACHE_MAX_RECORDED)
+	{
+		t->dropped++;
+		return blocked;
+	}
+	lightcacheentry_t entry;
+	entry.key = key;
+	VectorCopy (start, entry.start);
+	VectorCopy (stop, entry.stop);
+	entry.sky = sky;
+	if (blocked)
+	{
+		entry.result = LIGHTCACHE_BLOCKED;
+	}
+	else if (opaquestyle == -1 && transparency[0] == 1.0 && transparency[1] == 1.0 && transparency[2] == 1.0)
+	{
+		entry.result = LIGHTCACHE_VISIBLE;
+	}
+	else
+	{
+		lightcachespecial_t special;
+		VectorCopy (transparency, special.transparency);
+		special.opaquestyle = opaquestyle;
+		entry.result = LIGHTCACHE_SPECIAL + (unsigned int)t->specials.size ();
+		t->specials.push_back (special);
+	}
+	t->entries.push_back (entry);
+	return blocked;
+}
+
+static int LightCacheCompareSegments (const lightcacheentry_t &a, const lightcacheentry_t &b)
+{
+	if (a.sky != b.sky)
+	{
+		return a.sky? 1: -1;
+	}
+	for (int k = 0; k < 3; k++)
+	{
+		if (a.start[k] != b.start[k])
+		{
+			return a.start[k] < b.start[k]? -1: 1;
+		}
+		if (a.stop[k] != b.stop[k])
+		{
+			return a.stop[k] < b.stop[k]? -1: 1;
+		}
+	}
+	return 0;
+}
+
+static bool LightCacheEntryLess (const lightcacheentry_t &a, const lightcacheentry_t &b)
+{
+	if (a.key != b.key)
+	{
+		return a.key < b.key;
+	}
+	return LightCacheCompareSegments (a, b) < 0;
+}
+
+static bool LightCacheEntryEqual (const lightcacheentry_t &a, const lightcacheentry_t &b)
+{
+	return a.key == b.key && LightCacheCompareSegments (a, b) == 0;
+}
+
+// =====================================================================================
+//  LightCacheSave
+//      Writes the segments that were used or traced in this run, which drops those of
+//      removed or moved lights, and frees the cache.
+// =====================================================================================
+void LightCacheSave ()
+{
+	if (!g_lightcache_active)
+	{
+		return;
+	}
+	g_lightcache_active = false;
+
+	std::vector< lightcacheentry_t > entries;
+	std::vector< lightcachespecial_t > specials;
+	std::vector< int > remap (g_lightcache_specials.size (), -1);
+	unsigned int hits = 0;
+	unsigned int dropped = 0;
+	unsigned int i;
+
+	for (i = 0; i <= g_lightcache_mask; i++)
+	{
+		if (!g_lightcache_table[i].key || !g_lightcache_used[i].load (std::memory_order_relaxed))
+		{
+			continue;
+		}
+		lightcacheentry_t entry = g_lightcache_table[i];
+		if (entry.result >= LIGHTCACHE_SPECIAL)
+		{
+			int &index = remap[entry.result - LIGHTCACHE_SPECIAL];
+			if (index == -1)
+			{
+				index = (int)specials.size ();
+				specials.push_back (g_lightcache_specials[entry.result - LIGHTCACHE_SPECIAL]);
+			}
+			entry.result = LIGHTCACHE_SPECIAL + index;
+		}
+		entries.push_back (entry);
+	}
+	unsigned int numreused = (unsigned int)entries.size ();
+	for (i = 0; i < g_lightcache_threads.size (); i++)
+	{
+		lightcachethread_t *t = g_lightcache_threads[i];
+		unsigned int base = (unsigned int)specials.size ();
+		specials.insert (specials.end (), t->specials.begin (), t->specials.end ());
+		for (size_t j = 0; j < t->entries.size (); j++)
+		{
+			lightcacheentry_t entry = t->entries[j];
+			if (entry.result >= LIGHTCACHE_SPECIAL)
+			{
+				entry.result += base;
+			}
+			entries.push_back (entry);
+		}
+		hits += t->hits;
+		dropped += t->dropped;
+		delete t;
+	}
+	g_lightcache_threads.clear ();
+	unsigned int numtraced = (unsigned int)entries.size () - numreused;
+
+	// two threads can trace the same segment; either result is valid
+	std::sort (entries.begin (), entries.end (), LightCacheEntryLess);
+	entries.erase (std::unique (entries.begin (), entries.end (), LightCacheEntryEqual), entries.end ());
+
+	Log ("Light cache: %u segments reused (%u lookups), %u traced, %u stale dropped\n",
+		numreused, hits, numtraced, g_lightcache_numloaded - numreused);
+	if (dropped)
+	{
+		Log ("Light cache: %u traced segments not recorded (limit %u)\n", dropped, (unsigned int)LIGHTCACHE_MAX_RECORDED);
+	}
+
+	std::vector< unsigned char > out;
+	unsigned int magic = LIGHTCACHE_MAGIC;
+	unsigned int header[2] = {(unsigned int)specials.size (), (unsigned int)entries.size ()};
+	out.insert (out.end (), (const unsigned char *)&magic, (const unsigned char *)&magic + sizeof (magic));
+	out.insert (out.end (), (const unsigned char *)&g_lightcache_signature, (const unsigned char *)&g_lightcache_signature + sizeof (g_lightcache_signature));
+	out.insert (out.end (), (const unsigned char *)header, (const unsigned char *)header + sizeof (header));
+	if (!specials.empty ())
+	{
+		out.insert (out.end (), (const unsigned char *)&specials[0], (const unsigned char *)&specials[0] + specials.size () * sizeof (lightcachespecial_t));
+	}
+	lightcachekey_t lastkey = 0;
+	for (i = 0; i < entries.size (); i++)
+	{
+		LightCachePutVarint (out, entries[i].key - lastkey);
+		LightCachePutVarint (out, entries[i].result);
+		out.push_back (entries[i].sky? 1: 0);
+		out.insert (out.end (), (const unsigned char *)entries[i].start, (const unsigned char *)entries[i].start + sizeof (vec3_t));
+		out.insert (out.end (), (const unsigned char *)entries[i].stop, (const unsigned char *)entries[i].stop + sizeof (vec3_t));
+		lastkey = entries[i].key;
+	}
+
+	FILE *f = fopen (g_lightcache_file, "wb");
+	if (!f || fwrite (&out[0], 1, out.size (), f) != out.size ())
+	{
+		Warning ("Failed to write light cache file '%s'", g_lightcache_file);
+	}
+	if (f)
+	{
+		fclose (f);
+	}
+
+	LightCacheFreeTable ();
+	g_lightcache_specials.clear ();
+	g_lightcache_numloaded = 0;
+}
+
+#endif
@@ -1,5 +1,7 @@
 #include "qrad.h"
 #include "miptexwrapper.h"
+#include <vector>
+#include <algorithm>
 
 edgeshare_t     g_edgeshare[MAX_MAP_EDGES];
 vec3_t          g_face_centroids[MAX_MAP_FACES]; // BUG: should this be [MAX_MAP_FACES]?
@@ -647,6 +649,25 @@ typedef enum
 }
 wallflag_t;
 
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+typedef enum
+{
+	FACELIGHT_UNKNOWN = 0, // not classified yet
+	FACELIGHT_PARTIAL, // test every sample
+	FACELIGHT_OUTSIDE, // the light can't reach any point in the sphere
+	FACELIGHT_INSIDE, // every point in the sphere is inside the light's full brightness cone
+}
+facelightclass_t;
+
+typedef struct
+{
+	vec3_t			center; // a sphere around the face's samples; samples outside it are not culled
+	vec_t			radius;
+	unsigned char	*classes; // facelightclass_t of each directlight_t, classified when a sample first meets it
+}
+facelightcull_t;
+
 #endif
 typedef struct
 {
@@ -705,6 +726,9 @@ typedef struct
 	int				lmcachewidth;
 	int				lmcacheheight;
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+	facelightcull_t	cull;
+#endif
 }
 lightinfo_t;
 #ifdef HLRAD_MDL_LIGHT_HACK
@@ -2820,6 +2844,9 @@ facelight_t;
 static directlight_t* directlights[MAX_MAP_LEAFS];
 static facelight_t facelight[MAX_MAP_FACES];
 static int      numdlights;
+#ifdef HLRAD_FACELIGHT_CULL
+static int		numindexedlights; // directlight_t::index
+#endif
 
 #ifndef HLRAD_REFLECTIVITY
 #define	DIRECT_SCALE	0.1f
@@ -3691,6 +3718,23 @@ void            CreateDirectLights()
 		directlights[0] = skylights;
 	}
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+	numindexedlights = 0;
+	{
+		int l;
+	#ifdef HLRAD_VIS_FIX
+		for (l = 0; l < 1 + g_dmodels[0].visleafs; l++)
+	#else
+		for (l = 0; l < g_numleafs; l++)
+	#endif
+		{
+			for (dl = directlights[l]; dl; dl = dl->next)
+			{
+				dl->index = numindexedlights++;
+			}
+		}
+	}
+#endif
 #ifdef ZHLT_ENTITY_INFOSUNLIGHT
 #ifdef HLRAD_MULTISKYLIGHT
 	if (g_sky_lighting_fix)
@@ -3950,6 +3994,116 @@ void BuildDiffuseNormals ()
 	free (triangles);
 }
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+// =====================================================================================
+//  ClassifyFaceLight
+//      Only says OUTSIDE when GatherSampleLight would drop the light for every point in
+//      the sphere, and INSIDE when every point passes its cone tests.
+// =====================================================================================
+#define FACELIGHT_COS_EPSILON	0.0001 // well above the float error of dot2 in GatherSampleLight
+static facelightclass_t ClassifyFaceLight (const facelightcull_t *cull, const directlight_t *l)
+{
+	vec3_t origin, v;
+	vec_t d, r, slack;
+	double alpha, theta, cosmax, cosmin;
+
+	if (l->type != emit_spotlight && l->type != emit_surface)
+	{
+		return FACELIGHT_PARTIAL;
+	}
+	VectorCopy (l->origin, origin);
+	if (l->type == emit_surface)
+	{
+		// move emitter back to its plane, as GatherSampleLight does
+		VectorMA (origin, -PATCH_HUNT_OFFSET, l->normal, origin);
+	}
+	VectorSubtract (cull->center, origin, v);
+	d = VectorLength (v);
+	r = cull->radius;
+	slack = ON_EPSILON + d * 0.0001;
+	if (d <= r + 2.0 + slack)
+	{
+		return FACELIGHT_PARTIAL; // samples may come near the light, where dist is clamped
+	}
+
+	// range of the cosine between the light's normal and the direction from the light to a point in the sphere
+	alpha = asin (r / d);
+	theta = acos (qmax (-1.0, qmin (1.0, DotProduct (v, l->normal) / d)));
+	cosmax = theta - alpha <= 0? 1.0: cos (theta - alpha);
+	cosmin = theta + alpha >= Q_PI? -1.0: cos (theta + alpha);
+
+	if (l->type == emit_spotlight)
+	{
+		if (cosmax <= l->stopdot2 - FACELIGHT_COS_EPSILON)
+		{
+			return FACELIGHT_OUTSIDE; // outside light cone
+		}
+		if (cosmin >= qmax (l->stopdot, l->stopdot2) + FACELIGHT_COS_EPSILON)
+		{
+			return FACELIGHT_INSIDE;
+		}
+		return FACELIGHT_PARTIAL;
+	}
+
+	// dot2 * dist is the distance from the emitter's plane
+	if (DotProduct (v, l->normal) + r <= MINIMUM_PATCH_DISTANCE - slack)
+	{
+		return FACELIGHT_OUTSIDE;
+	}
+	if (l->stopdot > 0.0)
+	{
+		vec_t range_scale;
+		range_scale = 1 - l->stopdot2 * l->stopdot2;
+		range_scale = 1 / sqrt (qmax (NORMAL_EPSILON, range_scale));
+		range_scale = qmin (range_scale, 2);
+		if (d - r >= l->patch_emitter_range * range_scale + slack
+			&& cosmax <= l->stopdot2 + NORMAL_EPSILON - FACELIGHT_COS_EPSILON)
+		{
+			return FACELIGHT_OUTSIDE;
+		}
+		if (cosmin >= qmax (l->stopdot, l->stopdot2 + NORMAL_EPSILON) + FACELIGHT_COS_EPSILON)
+		{
+			return FACELIGHT_INSIDE;
+		}
+	}
+	return FACELIGHT_PARTIAL;
+}
+
+// =====================================================================================
+//  SetupFaceLightCull
+// =====================================================================================
+static void SetupFaceLightCull (lightinfo_t *l, int texture_step)
+{
+	facelightcull_t *cull = &l->cull;
+	Winding *w = new Winding (*l->face);
+	vec3_t mins, maxs, v;
+	unsigned int k;
+
+	w->getBounds (mins, maxs);
+	VectorAdd (mins, maxs, cull->center);
+	VectorScale (cull->center, 0.5, cull->center);
+	cull->radius = 0;
+	for (k = 0; k < w->m_NumPoints; k++)
+	{
+		VectorSubtract (w->m_Points[k], cull->center, v);
+		cull->radius = qmax (cull->radius, VectorLength (v));
+	}
+	delete w;
+	VectorAdd (cull->center, g_face_offset[l->surfnum], cull->center);
+
+	// samples can be a little off the face, or behind it for translucent faces
+	cull->radius += 2 * texture_step + 2 * DEFAULT_HUNT_OFFSET;
+#ifdef HLRAD_TRANSLUCENT
+	if (l->translucent_b)
+	{
+		cull->radius += g_translucentdepth + 2 * PATCH_HUNT_OFFSET;
+	}
+#endif
+
+	cull->classes = (unsigned char *)calloc (qmax (numindexedlights, 1), sizeof (unsigned char));
+	hlassume (cull->classes != NULL, assume_NoMemory);
+}
+#endif
 static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const vec3_t normal, vec3_t* sample
 #ifdef ZHLT_XASH
 								  , vec3_t* sample_direction
@@ -3963,6 +4117,9 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 #endif
 #ifdef HLRAD_TEXLIGHTGAP
 								  , int texlightgap_surfacenum
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+								  , facelightcull_t *cull
 #endif
 								  )
 {
@@ -4038,6 +4195,17 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 	}
 #endif
 
+#ifdef HLRAD_FACELIGHT_CULL
+	if (cull)
+	{
+		VectorSubtract (pos, cull->center, delta);
+		if (DotProduct (delta, delta) > cull->radius * cull->radius)
+		{
+			cull = NULL; // a sample grown or nudged away from the face
+		}
+	}
+#endif
+
 #ifdef HLRAD_SKYFIX_FIX
 #ifdef HLRAD_VIS_FIX
     for (i = 0; i < 1 + g_dmodels[0].visleafs; i++)
@@ -4127,6 +4295,14 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 	#endif
 	#endif
 							VectorAdd(pos, delta, delta);
+	#ifdef HLRAD_LIGHTCACHE
+							vec3_t transparency;
+							int opaquestyle;
+							if (TestLightSegment (pos, delta, true, transparency, opaquestyle))
+							{
+								continue;
+							}
+	#else
 	#ifdef HLRAD_OPAQUEINSKY_FIX
 							vec3_t skyhit;
 							VectorCopy (delta, skyhit);
@@ -4162,6 +4338,7 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 							{
 								continue;
 							}
+	#endif
 
 		#ifdef ZHLT_XASH
 							vec3_t direction;
@@ -4291,6 +4468,14 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 					#endif
 					#endif
 								VectorAdd(pos, delta, delta);
+					#if defined (HLRAD_LIGHTCACHE) && defined (HLRAD_OPAQUE_DIFFUSE_FIX)
+								vec3_t transparency;
+								int opaquestyle;
+								if (TestLightSegment (pos, delta, true, transparency, opaquestyle))
+								{
+									continue;
+								}
+					#else
 					#ifdef HLRAD_OPAQUEINSKY_FIX
 								vec3_t skyhit;
 								VectorCopy (delta, skyhit);
@@ -4328,6 +4513,7 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 									continue;
 								}
 					#endif /*HLRAD_OPAQUE_DIFFUSE_FIX*/
+					#endif
 
 						#ifdef ZHLT_XASH
 								vec3_t direction;
@@ -4476,6 +4662,22 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 						if (!(l->intensity[0] || l->intensity[1] || l->intensity[2]))
 							continue;
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+						facelightclass_t lightclass = FACELIGHT_PARTIAL;
+						if (cull)
+						{
+							lightclass = (facelightclass_t)cull->classes[l->index];
+							if (lightclass == FACELIGHT_UNKNOWN)
+							{
+								lightclass = ClassifyFaceLight (cull, l);
+								cull->classes[l->index] = lightclass;
+							}
+							if (lightclass == FACELIGHT_OUTSIDE)
+							{
+								continue;
+							}
+						}
+#endif
 #ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 						VectorCopy (l->origin, testline_origin);
 #endif
@@ -4613,6 +4815,13 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 								range_scale = qmin (range_scale, 2); // restrict this to 2, because skylevel has limit.
 								range *= range_scale; // because smaller cones are more likely to create the ugly grid effect.
 
+		#ifdef HLRAD_FACELIGHT_CULL
+								if (lightclass == FACELIGHT_INSIDE)
+								{
+									ratio = dot * dot2 / (dist * dist);
+								}
+								else
+		#endif
 								if (dot2 <= l->stopdot2 + NORMAL_EPSILON)
 								{
 									if (dist >= range) // use the old method, which will merely give 0 in this case
@@ -4761,6 +4970,9 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 							}
 #endif
                             dot2 = -DotProduct(delta, l->normal);
+#ifdef HLRAD_FACELIGHT_CULL
+							if (lightclass != FACELIGHT_INSIDE)
+#endif
                             if (dot2 <= l->stopdot2)
                             {
                                 continue;                  // outside light cone
@@ -4782,6 +4994,9 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 #endif
                             ratio = dot * dot2 / denominator;
 
+#ifdef HLRAD_FACELIGHT_CULL
+							if (lightclass != FACELIGHT_INSIDE)
+#endif
                             if (dot2 <= l->stopdot)
                             {
                                 ratio *= (dot2 - l->stopdot2) / (l->stopdot - l->stopdot2);
@@ -4797,6 +5012,20 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
                         }
                         }
 #ifdef HLRAD_OPAQUE_STYLE
+	#ifdef HLRAD_LIGHTCACHE
+						vec3_t transparency;
+						int opaquestyle;
+						if (TestLightSegment (pos,
+		#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
+							testline_origin
+		#else
+							l->origin
+		#endif
+							, false, transparency, opaquestyle))
+						{
+							continue;
+						}
+	#else
 						if (TestLine (pos,
 	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 							testline_origin
@@ -4824,6 +5053,7 @@ static void     GatherSampleLight(const vec3_t pos, const byte* const pvs, const
 						{
 							continue;
 						}
+	#endif
 	#ifdef HLRAD_HULLU
 						VectorMultiply (add, transparency, add);
 	#endif
@@ -5930,6 +6160,9 @@ void CalcLightmap (lightinfo_t *l, byte *styles)
 		#else
 					, facenum
 		#endif
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+					, &l->cull
 	#endif
 					);
 			}
@@ -5966,6 +6199,9 @@ void CalcLightmap (lightinfo_t *l, byte *styles)
 		#else
 						, facenum
 		#endif
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+						, &l->cull
 	#endif
 						);
 				}
@@ -6173,6 +6409,9 @@ void            BuildFacelights(const int facenum)
     CalcFaceVectors(&l);
     CalcFaceExtents(&l);
     CalcPoints(&l);
+#ifdef HLRAD_FACELIGHT_CULL
+	SetupFaceLightCull (&l, texture_step);
+#endif
 #ifdef HLRAD_BLUR
 	CalcLightmap (&l
 #ifdef HLRAD_AUTOCORING
@@ -6702,6 +6941,9 @@ void            BuildFacelights(const int facenum)
 #endif
 #ifdef HLRAD_TEXLIGHTGAP
 							, facenum
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+							, &l.cull
 #endif
 							);
 #ifdef HLRAD_CalcPoints_NEW
@@ -6753,6 +6995,9 @@ void            BuildFacelights(const int facenum)
 #endif
 #ifdef HLRAD_TEXLIGHTGAP
 								, facenum
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+								, &l.cull
 #endif
 								);
 #ifdef HLRAD_CalcPoints_NEW
@@ -6868,6 +7113,9 @@ void            BuildFacelights(const int facenum)
 #endif
 #ifdef HLRAD_TEXLIGHTGAP
 				, facenum
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+				, &l.cull
 #endif
 				);
 #ifdef HLRAD_CalcPoints_NEW
@@ -6910,6 +7158,9 @@ void            BuildFacelights(const int facenum)
 #endif
 #ifdef HLRAD_TEXLIGHTGAP
 					, facenum
+#endif
+#ifdef HLRAD_FACELIGHT_CULL
+					, &l.cull
 #endif
 					);
 #ifdef HLRAD_AUTOCORING
@@ -7178,6 +7429,9 @@ void            BuildFacelights(const int facenum)
 	#endif
 	#ifdef HLRAD_TEXLIGHTGAP
 				, facenum
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+				, &l.cull
 	#endif
 				);
 			GatherSampleLight (spot2, pvs2, normal2, backsampled,
@@ -7195,6 +7449,9 @@ void            BuildFacelights(const int facenum)
 	#endif
 	#ifdef HLRAD_TEXLIGHTGAP
 				, facenum
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+				, &l.cull
 	#endif
 				);
 	#ifdef HLRAD_AUTOCORING
@@ -7247,6 +7504,9 @@ void            BuildFacelights(const int facenum)
 	#endif
 	#ifdef HLRAD_TEXLIGHTGAP
 				, facenum
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+				, &l.cull
 	#endif
 				);
 		}
@@ -7267,6 +7527,9 @@ void            BuildFacelights(const int facenum)
 	#endif
 	#ifdef HLRAD_TEXLIGHTGAP
 			, facenum
+	#endif
+	#ifdef HLRAD_FACELIGHT_CULL
+			, &l.cull
 	#endif
 			);
 #endif
@@ -7642,6 +7905,9 @@ void            BuildFacelights(const int facenum)
 	free (l.surfpt_surface);
 #endif
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+	free (l.cull.classes);
+#endif
 }
 
 // =====================================================================================
@@ -8464,68 +8730,104 @@ void MdlLightHack ()
 
 #ifdef HLRAD_GROWSAMPLE
 
-typedef struct facelightlist_s
+// faces that have samples on each surface, in CSR form: the faces depending on surface s are
+// g_dependentfacelights[g_dependentfacelightoffsets[s]] .. g_dependentfacelights[g_dependentfacelightoffsets[s + 1] - 1]
+static int *g_dependentfacelightoffsets = NULL;
+static int *g_dependentfacelights = NULL;
+
+// per face: the distinct surfaces its samples landed on, sorted
+static int *g_facelightsurfaces[MAX_MAP_FACES];
+static int g_facelightnumsurfaces[MAX_MAP_FACES];
+
+// =====================================================================================
+//  CollectFacelightSurfaces
+//    This function is run multithreaded
+// =====================================================================================
+static void CollectFacelightSurfaces (int facenum)
 {
-	int facenum;
-	facelightlist_s *next;
-}
-facelightlist_t;
+	dface_t *f = &g_dfaces[facenum];
+	facelight_t *fl = &facelight[facenum];
+	std::vector<int> surfaces;
+	int lastsurface = -1;
+	int k;
+	int i;
+
+	g_facelightsurfaces[facenum] = NULL;
+	g_facelightnumsurfaces[facenum] = 0;
+	if (g_texinfo[f->texinfo].flags & TEX_SPECIAL)
+	{
+		return;
+	}
+
+	for (k = 0; k < MAXLIGHTMAPS && f->styles[k] != 255; k++)
+	{
+		for (i = 0; i < fl->numsamples; i++)
+		{
+			int surface = fl->samples[k][i].surface; // that surface contains at least one sample from this face
+			if (surface == lastsurface || surface < 0 || surface >= g_numfaces)
+			{
+				continue;
+			}
+			surfaces.push_back (surface);
+			lastsurface = surface;
+		}
+	}
+	if (surfaces.empty ())
+	{
+		return;
+	}
 
-static facelightlist_t *g_dependentfacelights[MAX_MAP_FACES];
+	std::sort (surfaces.begin (), surfaces.end ());
+	surfaces.erase (std::unique (surfaces.begin (), surfaces.end ()), surfaces.end ());
+
+	g_facelightnumsurfaces[facenum] = (int)surfaces.size ();
+	g_facelightsurfaces[facenum] = (int *)malloc (surfaces.size () * sizeof (int));
+	hlassume (g_facelightsurfaces[facenum] != NULL, assume_NoMemory);
+	memcpy (g_facelightsurfaces[facenum], &surfaces[0], surfaces.size () * sizeof (int));
+}
 
 // =====================================================================================
 //  CreateFacelightDependencyList
+//      collects the (surface, face) pairs in parallel, then buckets them by surface with a counting sort;
+//      the faces in each bucket end up in ascending order
 // =====================================================================================
 void CreateFacelightDependencyList ()
 {
 	int facenum;
-	dface_t *f;
-	facelight_t *fl;
-	int i;
-	int k;
 	int surface;
-	facelightlist_t *item;
+	int total;
+	int i;
 
-	for (i = 0; i < MAX_MAP_FACES; i++)
-	{
-		g_dependentfacelights[i] = NULL;
-	}
+	RunThreadsOnIndividual (g_numfaces, false, CollectFacelightSurfaces);
 
-	// for each face
+	g_dependentfacelightoffsets = (int *)calloc (g_numfaces + 1, sizeof (int));
+	hlassume (g_dependentfacelightoffsets != NULL, assume_NoMemory);
 	for (facenum = 0; facenum < g_numfaces; facenum++)
 	{
-		f = &g_dfaces[facenum];
-		fl = &facelight[facenum];
-		if (g_texinfo[f->texinfo].flags & TEX_SPECIAL)
+		for (i = 0; i < g_facelightnumsurfaces[facenum]; i++)
 		{
-			continue;
+			g_dependentfacelightoffsets[g_facelightsurfaces[facenum][i] + 1]++;
 		}
+	}
+	for (surface = 0; surface < g_numfaces; surface++)
+	{
+		g_dependentfacelightoffsets[surface + 1] += g_dependentfacelightoffsets[surface];
+	}
+	total = g_dependentfacelightoffsets[g_numfaces];
 
-		for (k = 0; k < MAXLIGHTMAPS && f->styles[k] != 255; k++)
+	g_dependentfacelights = (int *)malloc (qmax (total, 1) * sizeof (int));
+	hlassume (g_dependentfacelights != NULL, assume_NoMemory);
+	{
+		std::vector<int> cursor (g_dependentfacelightoffsets, g_dependentfacelightoffsets + g_numfaces);
+		for (facenum = 0; facenum < g_numfaces; facenum++)
 		{
-			for (i = 0; i < fl->numsamples; i++)
+			for (i = 0; i < g_facelightnumsurfaces[facenum]; i++)
 			{
-				surface = fl->samples[k][i].surface; // that surface contains at least one sample from this face
-				if (0 <= surface && surface < g_numfaces)
-				{
-					// insert this face into the dependency list of that surface
-					for (item = g_dependentfacelights[surface]; item != NULL; item = item->next)
-					{
-						if (item->facenum == facenum)
-							break;
-					}
-					if (item)
-					{
-						continue;
-					}
-
-					item = (facelightlist_t *)malloc (sizeof (facelightlist_t));
-					hlassume (item != NULL, assume_NoMemory);
-					item->facenum = facenum;
-					item->next = g_dependentfacelights[surface];
-					g_dependentfacelights[surface] = item;
-				}
+				g_dependentfacelights[cursor[g_facelightsurfaces[facenum][i]]++] = facenum;
 			}
+			free (g_facelightsurfaces[facenum]);
+			g_facelightsurfaces[facenum] = NULL;
+			g_facelightnumsurfaces[facenum] = 0;
 		}
 	}
 }
@@ -8535,18 +8837,10 @@ void CreateFacelightDependencyList ()
 // =====================================================================================
 void FreeFacelightDependencyList ()
 {
-	int i;
-	facelightlist_t *item;
-
-	for (i = 0; i < MAX_MAP_FACES; i++)
-	{
-		while (g_dependentfacelights[i])
-		{
-			item = g_dependentfacelights[i];
-			g_dependentfacelights[i] = item->next;
-			free (item);
-		}
-	}
+	free (g_dependentfacelights);
+	g_dependentfacelights = NULL;
+	free (g_dependentfacelightoffsets);
+	g_dependentfacelightoffsets = NULL;
 }
 
 // =====================================================================================
@@ -8589,20 +8883,27 @@ void ScaleDirectLights ()
 // =====================================================================================
 //  AddPatchLights
 //    This function is run multithreaded
+//    With local triangulations the work items are indices into g_triangulationorder
 // =====================================================================================
 void AddPatchLights (int facenum)
 {
 	dface_t *f;
-#ifndef HLRAD_LOCALTRIANGULATION
+#ifdef HLRAD_LOCALTRIANGULATION
+	bool acquired = false;
+#else
 	lerpTriangulation_t *trian;
 #endif
-	facelightlist_t *item;
+	int j;
+	int otherfacenum;
 	dface_t *f_other;
 	facelight_t *fl_other;
 	int k;
 	int i;
 	sample_t *samp;
 
+#ifdef HLRAD_LOCALTRIANGULATION
+	facenum = g_triangulationorder[facenum];
+#endif
 	f = &g_dfaces[facenum];
 
 	if (g_texinfo[f->texinfo].flags & TEX_SPECIAL)
@@ -8614,10 +8915,11 @@ void AddPatchLights (int facenum)
 	trian = CreateTriangulation (facenum);
 #endif
 
-	for (item = g_dependentfacelights[facenum]; item != NULL; item = item->next)
+	for (j = g_dependentfacelightoffsets[facenum]; j < g_dependentfacelightoffsets[facenum + 1]; j++)
 	{
-		f_other = &g_dfaces[item->facenum];
-		fl_other = &facelight[item->facenum];
+		otherfacenum = g_dependentfacelights[j];
+		f_other = &g_dfaces[otherfacenum];
+		fl_other = &facelight[otherfacenum];
 		for (k = 0; k < MAXLIGHTMAPS && f_other->styles[k] != 255; k++)
 		{
 			for (i = 0; i < fl_other->numsamples; i++)
@@ -8635,6 +8937,11 @@ void AddPatchLights (int facenum)
 		#endif
 
 #ifdef HLRAD_LOCALTRIANGULATION
+					if (!acquired)
+					{
+						AcquireTriangulations (facenum);
+						acquired = true;
+					}
 					int style = f_other->styles[k];
 					InterpolateSampleLight (samp->pos, samp->surface, 1, &style, &v
 		#ifdef ZHLT_XASH
@@ -8684,7 +8991,12 @@ void AddPatchLights (int facenum)
 		}
 	}
 
-#ifndef HLRAD_LOCALTRIANGULATION
+#ifdef HLRAD_LOCALTRIANGULATION
+	if (acquired)
+	{
+		ReleaseTriangulations (facenum);
+	}
+#else
 	FreeTriangulation (trian);
 #endif
 }
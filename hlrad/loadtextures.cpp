@@ -7,6 +7,8 @@
 
 #include <vector>
 #include <memory>
+#include <climits>
+#include <unordered_map>
 #include "miptexwrapper.h"
 #include "pngtexturepath.h"
 #include "stb_image.h"
@@ -319,6 +321,26 @@ typedef struct cq_searchnode_s
 }
 cq_searchnode_t;
 
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CQ_SSE2
+#include <emmintrin.h>
+#endif
+
+typedef struct
+{
+	int numcolors;
+#ifdef CQ_SSE2
+	// groups of 4 colours as 16-bit (r, g) and (b, 0) pairs; the last group is padded with copies of colour 0
+	int numgroups;
+	__m128i rg[64];
+	__m128i b[64];
+#else
+	const unsigned char (*colors)[CQ_DIM];
+	cq_searchnode_t searchtree[2 * 256 - 1];
+#endif
+}
+cq_palettelookup_t; // finds the nearest palette entry for a colour
+
 static void CQ_SelectPartition (cq_node_t *node)
 {
 	CQ_VectorClear (node->centerofpoints);
@@ -403,28 +425,20 @@ static void CQ_SelectPartition (cq_node_t *node)
 	}
 }
 
-static cq_searchnode_t *CQ_AllocSearchTree (int maxcolors)
-{
-	cq_searchnode_t *searchtree;
-	searchtree = (cq_searchnode_t *)malloc ((2 * maxcolors - 1) * sizeof (cq_searchnode_t));
-	hlassume (searchtree != NULL, assume_NoMemory);
-	return searchtree;
-}
-
-static void CQ_FreeSearchTree (cq_searchnode_t *searchtree)
-{
-	free (searchtree);
-}
-
 static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DIM],
 					   int maxcolors, unsigned char (*colors_out)[CQ_DIM], int &numcolors_out,
-					   cq_searchnode_t *searchtree_out) //[2 * maxcolors - 1]
+					   cq_palettelookup_t &lookup_out) // maxcolors <= 256
 {
+	lookup_out.numcolors = 0;
 	if (numpoints <= 0 || maxcolors <= 0)
 	{
 		numcolors_out = 0;
 		return;
 	}
+	if (maxcolors > 256)
+	{
+		Error ("CQ_CreatePalette: internal error");
+	}
 
 	unsigned char (*pointarray)[CQ_DIM];
 	pointarray = (unsigned char (*)[CQ_DIM])malloc (numpoints * sizeof (unsigned char [CQ_DIM]));
@@ -432,7 +446,9 @@ static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DI
 	memcpy (pointarray, points, numpoints * sizeof (unsigned char [CQ_DIM]));
 
 	cq_node_t *n;
+#ifndef CQ_SSE2
 	cq_searchnode_t *s;
+#endif
 	int numnodes = 0;
 	int maxnodes = 2 * maxcolors - 1;
 	cq_node_t *nodes = (cq_node_t *)malloc (maxnodes * sizeof (cq_node_t));
@@ -546,6 +562,8 @@ static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DI
 		CQ_SelectPartition (bestnode->childrennode[1]);
 	}
 
+#ifndef CQ_SSE2
+	cq_searchnode_t *searchtree_out = lookup_out.searchtree;
 	for (i = 0; i < numnodes; i++)
 	{
 		n = &nodes[i];
@@ -559,6 +577,7 @@ static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DI
 			s->childrennode[1] = &searchtree_out[n->childrennode[1] - nodes];
 		}
 	}
+#endif
 
 	numcolors_out = 0;
 	n = &nodes[0];
@@ -568,8 +587,10 @@ static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DI
 		{
 			n = n->childrennode[0];
 		}
+#ifndef CQ_SSE2
 		s = &searchtree_out[n - nodes];
 		s->result = numcolors_out;
+#endif
 		for (int k = 0; k < CQ_DIM; k++)
 		{
 			int val = (int)floor (n->centerofpoints[k] + 0.5 + 0.00001);
@@ -597,12 +618,81 @@ static void CQ_CreatePalette (int numpoints, const unsigned char (*points)[CQ_DI
 		Error ("CQ_CreatePalette: internal error");
 	}
 
+	lookup_out.numcolors = numcolors_out;
+#ifdef CQ_SSE2
+	lookup_out.numgroups = (numcolors_out + 3) / 4;
+	for (i = 0; i < lookup_out.numgroups; i++)
+	{
+		short rg[8], b[8];
+		for (int k = 0; k < 4; k++)
+		{
+			int c = 4 * i + k < numcolors_out? 4 * i + k: 0; // a padded copy of colour 0 always loses the tie to colour 0
+			rg[2 * k] = colors_out[c][0];
+			rg[2 * k + 1] = colors_out[c][1];
+			b[2 * k] = colors_out[c][2];
+			b[2 * k + 1] = 0;
+		}
+		lookup_out.rg[i] = _mm_loadu_si128 ((const __m128i *)rg);
+		lookup_out.b[i] = _mm_loadu_si128 ((const __m128i *)b);
+	}
+#else
+	lookup_out.colors = colors_out;
+#endif
+
 	free (pointarray);
 	free (nodes);
 }
 
+#ifdef CQ_SSE2
+// =====================================================================================
+//  CQ_MapPoint
+//      exhaustive nearest-colour search, 4 palette entries per step; ties go to the lowest index,
+//      which gives the same result as the k-d tree search
+// =====================================================================================
+static int CQ_MapPoint (const unsigned char point[CQ_DIM], const cq_palettelookup_t &lookup)
+{
+	if (lookup.numcolors <= 0)
+	{
+		Error ("CQ_MapPoint: internal error");
+	}
+
+	const __m128i pointrg = _mm_set1_epi32 (point[0] | (point[1] << 16));
+	const __m128i pointb = _mm_set1_epi32 (point[2]);
+	const __m128i four = _mm_set1_epi32 (4);
+	__m128i index = _mm_setr_epi32 (0, 1, 2, 3);
+	__m128i bestdist = _mm_set1_epi32 (INT_MAX);
+	__m128i best = _mm_setzero_si128 ();
+
+	for (int i = 0; i < lookup.numgroups; i++)
+	{
+		__m128i drg = _mm_sub_epi16 (lookup.rg[i], pointrg);
+		__m128i db = _mm_sub_epi16 (lookup.b[i], pointb);
+		__m128i dist = _mm_add_epi32 (_mm_madd_epi16 (drg, drg), _mm_madd_epi16 (db, db));
+		__m128i closer = _mm_cmplt_epi32 (dist, bestdist);
+		bestdist = _mm_or_si128 (_mm_and_si128 (closer, dist), _mm_andnot_si128 (closer, bestdist));
+		best = _mm_or_si128 (_mm_and_si128 (closer, index), _mm_andnot_si128 (closer, best));
+		index = _mm_add_epi32 (index, four);
+	}
+
+	int dists[4], indices[4];
+	_mm_storeu_si128 ((__m128i *)dists, bestdist);
+	_mm_storeu_si128 ((__m128i *)indices, best);
+	int result = indices[0];
+	int resultdist = dists[0];
+	for (int k = 1; k < 4; k++)
+	{
+		if (dists[k] < resultdist || (dists[k] == resultdist && indices[k] < result))
+		{
+			resultdist = dists[k];
+			result = indices[k];
+		}
+	}
+	return result;
+}
+#else
+
 static void CQ_MapPoint_r (int *bestdist, int *best,
-					cq_searchnode_t *node, const unsigned char (*colors)[CQ_DIM],
+					const cq_searchnode_t *node, const unsigned char (*colors)[CQ_DIM],
 					const unsigned char point[CQ_DIM], int searchradius)
 {
 	while (!node->isleafnode)
@@ -638,14 +728,16 @@ static void CQ_MapPoint_r (int *bestdist, int *best,
 	}
 }
 
-static int CQ_MapPoint (const unsigned char point[CQ_DIM], const unsigned char (*colors)[CQ_DIM], int numcolors, cq_searchnode_t *searchtree)
+static int CQ_MapPoint (const unsigned char point[CQ_DIM], const cq_palettelookup_t &lookup)
 {
-	if (numcolors <= 0)
+	if (lookup.numcolors <= 0)
 	{
 		Error ("CQ_MapPoint: internal error");
 	}
 
-	cq_searchnode_t *node;
+	const unsigned char (*colors)[CQ_DIM] = lookup.colors;
+	const cq_searchnode_t *searchtree = lookup.searchtree;
+	const cq_searchnode_t *node;
 	int bestdist;
 	int best;
 	int searchradius;
@@ -665,6 +757,7 @@ static int CQ_MapPoint (const unsigned char point[CQ_DIM], const unsigned char (
 	CQ_MapPoint_r (&bestdist, &best, searchtree, colors, point, searchradius);
 	return best;
 }
+#endif
 
 // =====================================================================================
 //  EmbedLightmapInTextures
@@ -709,11 +802,11 @@ void NewTextures_Write()
 		MiptexWrapper* wrapper = g_TextureCollection.miptexAt(index);
 		hlassert(wrapper);
 
-		const miptex_t* miptex = (const miptex_t*)g_newtextures_data[index];
-		hlassert(g_newtextures_size[index] == MiptexWrapper::totalIdealBytesRequired(miptex->width, miptex->height));
+		const miptex_t* miptex = (const miptex_t*)g_newtextures_data[index - oldCount];
+		hlassert(g_newtextures_size[index - oldCount] == MiptexWrapper::totalIdealBytesRequired(miptex->width, miptex->height));
 
 		wrapper->setFromMiptex(miptex);
-		free(g_newtextures_data[index]);
+		free(g_newtextures_data[index - oldCount]);
 	}
 
 	hlassume(g_TextureCollection.count() < MAX_MAP_TEXTURES, assume_MAX_MAP_TEXTURES);
@@ -801,6 +894,384 @@ static bool GetValidTextureName (int miptex, char* name, unsigned int length)
 	return true;
 }
 
+typedef struct
+{
+	int facenum;
+	int originaltexinfonum;
+	int resolution;
+	int texture_step;
+	int texmins[2];
+	int texsize[2]; // texturesize = (texsize + 1) * texture_step
+	int texturesize[2];
+	int side[2];
+	bool alphamasked;
+
+	// filled in by EmbedLightmapFace
+	miptex_t *miptex;
+	int miptexsize;
+	unsigned int namehash;
+	unsigned long long contenthash;
+}
+embedlightmap_t;
+
+static int g_numembedlightmaps = 0;
+static embedlightmap_t *g_embedlightmaps = NULL;
+
+// 64-bit FNV-1a, used to find faces whose generated textures are identical
+static unsigned long long ContentHash (int size, const void *data, unsigned long long seed)
+{
+	unsigned long long hash = 14695981039346656037ULL ^ seed;
+	for (int i = 0; i < size; i++)
+	{
+		hash ^= ((const unsigned char *)data)[i];
+		hash *= 1099511628211ULL;
+	}
+	return hash;
+}
+
+// =====================================================================================
+//  EmbedLightmapFace
+//      builds the texture, mips and palette for one face; runs on the thread pool and
+//      only touches its own embedlightmap_t, so the results are committed later in face order
+// =====================================================================================
+static void EmbedLightmapFace (int jobnum)
+{
+	embedlightmap_t *job = &g_embedlightmaps[jobnum];
+	dface_t *f = &g_dfaces[job->facenum];
+	const RadTexture& radTex = g_RadTextures[g_texinfo[job->originaltexinfonum].miptex];
+	const int texture_step = job->texture_step;
+	const int resolution = job->resolution;
+	const int *texmins = job->texmins;
+	const int *texsize = job->texsize;
+	const int *texturesize = job->texturesize;
+	const int *side = job->side;
+	const vec_t denominator = DEFAULT_EMBEDLIGHTMAP_DENOMINATOR;
+	const vec_t gamma = DEFAULT_EMBEDLIGHTMAP_GAMMA;
+
+	int j, k;
+	int miplevel;
+	float (*texture)[5]; // red, green, blue and alpha channel; the last one is number of samples
+	byte (*texturemips[MIPLEVELS])[4]; // red, green, blue and alpha channel
+	int s, t;
+
+	texture = (float (*)[5])malloc (texturesize[0] * texturesize[1] * sizeof (float [5]));
+	hlassume (texture != NULL, assume_NoMemory);
+	for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
+	{
+		texturemips[miplevel] = (byte (*)[4])malloc ((texturesize[0] >> miplevel) * (texturesize[1] >> miplevel) * sizeof (byte [4]));
+		hlassume (texturemips[miplevel] != NULL, assume_NoMemory);
+	}
+
+	// calculate the texture
+
+	for (t = 0; t < texturesize[1]; t++)
+	{
+		for (s = 0; s < texturesize[0]; s++)
+		{
+			float (*dest)[5] = &texture[t * texturesize[0] + s];
+			VectorFill (*dest, 0);
+			(*dest)[3] = 0;
+			(*dest)[4] = 0;
+		}
+	}
+	for (t = -side[1]; t < texsize[1] * texture_step + side[1]; t++)
+	{
+		for (s = -side[0]; s < texsize[0] * texture_step + side[0]; s++)
+		{
+			double s_vec, t_vec;
+			double src_s, src_t;
+			int src_is, src_it;
+			byte src_color[3] = {0,0,0};
+			double dest_s, dest_t;
+			int dest_is, dest_it;
+			float (*dest)[5];
+			double light_s, light_t;
+			vec3_t light;
+
+			s_vec = s + texmins[0] * texture_step + 0.5;
+			t_vec = t + texmins[1] * texture_step + 0.5;
+
+			if (resolution == 1)
+			{
+				dest_s = s_vec;
+				dest_t = t_vec;
+			}
+			else // the final blurred texture is shifted by a half pixel so that lightmap samples align with the center of pixels
+			{
+				dest_s = s_vec / resolution + 0.5;
+				dest_t = t_vec / resolution + 0.5;
+			}
+			dest_s = dest_s - texturesize[0] * floor (dest_s / texturesize[0]);
+			dest_t = dest_t - texturesize[1] * floor (dest_t / texturesize[1]);
+			dest_is = (int)floor (dest_s); // dest_is = dest_s % texturesize[0]
+			dest_it = (int)floor (dest_t); // dest_it = dest_t % texturesize[1]
+			dest_is = qmax (0, qmin (dest_is, texturesize[0] - 1));
+			dest_it = qmax (0, qmin (dest_it, texturesize[1] - 1));
+			dest = &texture[dest_it * texturesize[0] + dest_is];
+
+			src_s = s_vec;
+			src_t = t_vec;
+			src_s = src_s - radTex.width() * floor (src_s / radTex.width());
+			src_t = src_t - radTex.height() * floor (src_t / radTex.height());
+			src_is = (int)floor (src_s); // src_is = src_s % radTex.width()
+			src_it = (int)floor (src_t); // src_it = src_t % radTex.height()
+			src_is = qmax (0, qmin (src_is, radTex.width() - 1));
+			src_it = qmax (0, qmin (src_it, radTex.height() - 1));
+
+			const RadTexture::RGB* colour = radTex.canvasColour(src_is, src_it);
+			if ( colour )
+			{
+				src_color[0] = (*colour)[0];
+				src_color[1] = (*colour)[1];
+				src_color[2] = (*colour)[2];
+			}
+
+			const uint8_t opacity = radTex.opacity(src_is, src_it);
+
+			// get light from the center of the destination pixel
+			light_s = (s_vec + resolution * (dest_is + 0.5 - dest_s)) / texture_step - texmins[0];
+			light_t = (t_vec + resolution * (dest_it + 0.5 - dest_t)) / texture_step - texmins[1];
+			GetLight (f, texsize, light_s, light_t, light);
+
+			(*dest)[4] += 1;
+
+			if (opacity > 0x00)
+			{
+				float flOpacity = (float)opacity / 255.0f;
+
+				for (k = 0; k < 3; k++)
+				{
+					float v = (float)src_color[k] * flOpacity * pow(light[k] / denominator, gamma);
+					(*dest)[k] += 255 * qmax (0, qmin (v, 255));
+				}
+
+				(*dest)[3] += 255;
+			}
+		}
+	}
+	for (t = 0; t < texturesize[1]; t++)
+	{
+		for (s = 0; s < texturesize[0]; s++)
+		{
+			float (*src)[5] = &texture[t * texturesize[0] + s];
+			byte (*dest)[4] = &texturemips[0][t * texturesize[0] + s];
+
+			if ((*src)[4] == 0) // no samples (outside face range?)
+			{
+				VectorFill (*dest, 0);
+				(*dest)[3] = 255;
+			}
+			else
+			{
+				if ((*src)[3] / (*src)[4] <= 0.4 * 255) // transparent
+				{
+					VectorFill (*dest, 0);
+					(*dest)[3] = 0;
+				}
+				else // normal
+				{
+					for (j = 0; j < 3; j++)
+					{
+						int val = (int)floor ((*src)[j] / (*src)[3] + 0.5);
+						(*dest)[j] = qmax (0, qmin (val, 255));
+					}
+					(*dest)[3] = 255;
+				}
+			}
+		}
+	}
+
+	for (miplevel = 1; miplevel < MIPLEVELS; miplevel++)
+	{
+		for (t = 0; t < (texturesize[1] >> miplevel); t++)
+		{
+			for (s = 0; s < (texturesize[0] >> miplevel); s++)
+			{
+				byte (*src[4])[4];
+				byte (*dest)[4];
+				double average[4];
+
+				dest = &texturemips[miplevel][t * (texturesize[0] >> miplevel) + s];
+				src[0] = &texturemips[miplevel - 1][(2 * t) * (texturesize[0] >> (miplevel - 1)) + (2 * s)];
+				src[1] = &texturemips[miplevel - 1][(2 * t) * (texturesize[0] >> (miplevel - 1)) + (2 * s + 1)];
+				src[2] = &texturemips[miplevel - 1][(2 * t + 1) * (texturesize[0] >> (miplevel - 1)) + (2 * s)];
+				src[3] = &texturemips[miplevel - 1][(2 * t + 1) * (texturesize[0] >> (miplevel - 1)) + (2 * s + 1)];
+
+				VectorClear (average);
+				average[3] = 0;
+				for (k = 0; k < 4; k++)
+				{
+					for (j = 0; j < 3; j++)
+					{
+						average[j] += (*src[k])[3] * (*src[k])[j];
+					}
+					average[3] += (*src[k])[3];
+				}
+
+				if (average[3] / 4 <= 0.4 * 255)
+				{
+					VectorClear (*dest);
+					(*dest)[3] = 0;
+				}
+				else
+				{
+					for (j = 0; j < 3; j++)
+					{
+						int val = (int)floor (average[j] / average[3] + 0.5);
+						(*dest)[j] = qmax (0, qmin (val, 255));
+					}
+					(*dest)[3] = 255;
+				}
+			}
+		}
+	}
+
+	// create its palette
+
+	byte palette[256][3];
+	cq_palettelookup_t palettelookup;
+	int paletteoffset;
+	int palettenumcolors;
+
+	{
+		int palettemaxcolors;
+		int numsamplepoints;
+		unsigned char (*samplepoints)[3];
+
+		if (job->alphamasked)
+		{
+			paletteoffset = 0;
+			palettemaxcolors = 255;
+
+			const RadTexture::RGB* transparentColour = radTex.paletteColour(255);
+
+			if ( transparentColour )
+			{
+				palette[255][0] = (*transparentColour)[0];
+				palette[255][1] = (*transparentColour)[1];
+				palette[255][2] = (*transparentColour)[2];
+			}
+			else
+			{
+				// Should never happen.
+				Error("Internal error: could not get RadTexture transparency colour.\n");
+			}
+		}
+		else
+		{
+			paletteoffset = 0;
+			palettemaxcolors = 256;
+		}
+
+		samplepoints = (unsigned char (*)[3])malloc (texturesize[0] * texturesize[1] * sizeof (unsigned char [3]));
+		hlassume (samplepoints != NULL, assume_NoMemory);
+		numsamplepoints = 0;
+		for (t = 0; t < texturesize[1]; t++)
+		{
+			for (s = 0; s < texturesize[0]; s++)
+			{
+				byte (*src)[4] = &texturemips[0][t * texturesize[0] + s];
+				if ((*src)[3] > 0)
+				{
+					VectorCopy (*src, samplepoints[numsamplepoints]);
+					numsamplepoints++;
+				}
+			}
+		}
+
+		CQ_CreatePalette (numsamplepoints, samplepoints, palettemaxcolors, &palette[paletteoffset], palettenumcolors, palettelookup);
+		for (j = palettenumcolors; j < palettemaxcolors; j++)
+		{
+			VectorClear (palette[paletteoffset + j]);
+		}
+
+		free (samplepoints);
+	}
+
+	// emit a texture
+
+	int miptexsize;
+
+	miptexsize = (int)sizeof (miptex_t);
+	for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
+	{
+		miptexsize += (texturesize[0] >> miplevel) * (texturesize[1] >> miplevel);
+	}
+	miptexsize += 2 + 256 * 3 + 2;
+	miptex_t *miptex = (miptex_t *)malloc (miptexsize);
+	hlassume (miptex != NULL, assume_NoMemory);
+
+	memset (miptex, 0, sizeof (miptex_t));
+	miptex->width = texturesize[0];
+	miptex->height = texturesize[1];
+	byte *p = (byte *)miptex + sizeof (miptex_t);
+	for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
+	{
+		miptex->offsets[miplevel] = p - (byte *)miptex;
+		for (int t = 0; t < (texturesize[1] >> miplevel); t++)
+		{
+			for (int s = 0; s < (texturesize[0] >> miplevel); s++)
+			{
+				byte (*src)[4] = &texturemips[miplevel][t * (texturesize[0] >> miplevel) + s];
+				if ((*src)[3] > 0)
+				{
+					if (palettenumcolors)
+					{
+						*p = paletteoffset + CQ_MapPoint (*src, palettelookup);
+					}
+					else // this should never happen
+					{
+						*p = paletteoffset + 0;
+					}
+				}
+				else
+				{
+					*p = 255;
+				}
+				p++;
+			}
+		}
+	}
+	*(short *)p = 256;
+	p += 2;
+	memcpy (p, palette, 256 * 3);
+	p += 256 * 3;
+	*(short *)p = 0;
+	p += 2;
+	if (p != (byte *)miptex + miptexsize)
+	{
+		Error ("EmbedLightmapInTextures: internal error");
+	}
+
+	if (job->alphamasked)
+	{
+		safe_strncpy(miptex->name, "{_rad", sizeof(miptex->name));
+	}
+	else
+	{
+		safe_strncpy(miptex->name, "__rad", sizeof(miptex->name));
+	}
+
+	const int originaltexinfonum = job->originaltexinfonum;
+	miptex->name[5] = '0' + (originaltexinfonum / 10000) % 10; // store the original texinfo
+	miptex->name[6] = '0' + (originaltexinfonum / 1000) % 10;
+	miptex->name[7] = '0' + (originaltexinfonum / 100) % 10;
+	miptex->name[8] = '0' + (originaltexinfonum / 10) % 10;
+	miptex->name[9] = '0' + (originaltexinfonum) % 10;
+
+	// name[10..15] are still zero; the rest of the name is filled in once the texture is committed
+	job->miptex = miptex;
+	job->miptexsize = miptexsize;
+	job->namehash = Hash (miptexsize, miptex);
+	job->contenthash = ContentHash (miptexsize, miptex, (unsigned long long)resolution);
+
+	free (texture);
+	for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
+	{
+		free (texturemips[miplevel]);
+	}
+}
+
 void EmbedLightmapInTextures ()
 {
 	if (!g_lightdatasize)
@@ -820,11 +1291,17 @@ void EmbedLightmapInTextures ()
 	}
 
 	int i, j, k;
-	int miplevel;
 	int count = 0;
 	int count_bytes = 0;
+	int count_shared = 0;
 	bool logged = false;
 
+	g_numembedlightmaps = 0;
+	g_embedlightmaps = (embedlightmap_t *)malloc (qmax (g_numfaces, 1) * sizeof (embedlightmap_t));
+	hlassume (g_embedlightmaps != NULL, assume_NoMemory);
+
+	// pick the faces and lay out their textures; this reads the original texinfos, so it has to finish before any are replaced
+
 	for (i = 0; i < g_numfaces; i++)
 	{
 		dface_t *f = &g_dfaces[i];
@@ -881,8 +1358,6 @@ void EmbedLightmapInTextures ()
 		}
 
 		bool poweroftwo = DEFAULT_EMBEDLIGHTMAP_POWEROFTWO;
-		vec_t denominator = DEFAULT_EMBEDLIGHTMAP_DENOMINATOR;
-		vec_t gamma = DEFAULT_EMBEDLIGHTMAP_GAMMA;
 		int resolution = DEFAULT_EMBEDLIGHTMAP_RESOLUTION;
 		if (IntForKey (ent, "zhlt_embedlightmapresolution"))
 		{
@@ -892,17 +1367,18 @@ void EmbedLightmapInTextures ()
 				Error ("resolution cannot be %d; valid values are 1, 2, 4 ... %d.", resolution, (int)texture_step);
 			}
 		}
+		if (originaltexinfonum < 0 || originaltexinfonum > 99999)
+		{
+			Error ("EmbedLightmapInTextures: internal error: texinfo out of range");
+		}
 
-		// calculate texture size and allocate memory for all miplevels
+		// calculate texture size
 
-		int texturesize[2];
-		float (*texture)[5]; // red, green, blue and alpha channel; the last one is number of samples
-		byte (*texturemips[MIPLEVELS])[4]; // red, green, blue and alpha channel
-		int s, t;
-		int texmins[2];
+		embedlightmap_t *job = &g_embedlightmaps[g_numembedlightmaps];
+		int *texturesize = job->texturesize;
+		int *texmins = job->texmins;
+		int *texsize = job->texsize;
 		int texmaxs[2];
-		int texsize[2]; // texturesize = (texsize + 1) * texture_step
-		int side[2];
 
 		GetFaceExtents (i, texmins, texmaxs);
 		texsize[0] = texmaxs[0] - texmins[0];
@@ -933,379 +1409,116 @@ void EmbedLightmapInTextures ()
 					}
 				}
 			}
-			side[k] = (texturesize[k] * resolution - texsize[k] * texture_step) / 2;
-		}
-		texture = (float (*)[5])malloc (texturesize[0] * texturesize[1] * sizeof (float [5]));
-		hlassume (texture != NULL, assume_NoMemory);
-		for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
-		{
-			texturemips[miplevel] = (byte (*)[4])malloc ((texturesize[0] >> miplevel) * (texturesize[1] >> miplevel) * sizeof (byte [4]));
-			hlassume (texturemips[miplevel] != NULL, assume_NoMemory);
+			job->side[k] = (texturesize[k] * resolution - texsize[k] * texture_step) / 2;
 		}
 
-		// calculate the texture
-
-		for (t = 0; t < texturesize[1]; t++)
-		{
-			for (s = 0; s < texturesize[0]; s++)
-			{
-				float (*dest)[5] = &texture[t * texturesize[0] + s];
-				VectorFill (*dest, 0);
-				(*dest)[3] = 0;
-				(*dest)[4] = 0;
-			}
-		}
-		for (t = -side[1]; t < texsize[1] * texture_step + side[1]; t++)
-		{
-			for (s = -side[0]; s < texsize[0] * texture_step + side[0]; s++)
-			{
-				double s_vec, t_vec;
-				double src_s, src_t;
-				int src_is, src_it;
-				byte src_color[3] = {0,0,0};
-				double dest_s, dest_t;
-				int dest_is, dest_it;
-				float (*dest)[5];
-				double light_s, light_t;
-				vec3_t light;
-
-				s_vec = s + texmins[0] * texture_step + 0.5;
-				t_vec = t + texmins[1] * texture_step + 0.5;
-
-				if (resolution == 1)
-				{
-					dest_s = s_vec;
-					dest_t = t_vec;
-				}
-				else // the final blurred texture is shifted by a half pixel so that lightmap samples align with the center of pixels
-				{
-					dest_s = s_vec / resolution + 0.5;
-					dest_t = t_vec / resolution + 0.5;
-				}
-				dest_s = dest_s - texturesize[0] * floor (dest_s / texturesize[0]);
-				dest_t = dest_t - texturesize[1] * floor (dest_t / texturesize[1]);
-				dest_is = (int)floor (dest_s); // dest_is = dest_s % texturesize[0]
-				dest_it = (int)floor (dest_t); // dest_it = dest_t % texturesize[1]
-				dest_is = qmax (0, qmin (dest_is, texturesize[0] - 1));
-				dest_it = qmax (0, qmin (dest_it, texturesize[1] - 1));
-				dest = &texture[dest_it * texturesize[0] + dest_is];
-
-				src_s = s_vec;
-				src_t = t_vec;
-				src_s = src_s - radTex.width() * floor (src_s / radTex.width());
-				src_t = src_t - radTex.height() * floor (src_t / radTex.height());
-				src_is = (int)floor (src_s); // src_is = src_s % radTex.width()
-				src_it = (int)floor (src_t); // src_it = src_t % radTex.height()
-				src_is = qmax (0, qmin (src_is, radTex.width() - 1));
-				src_it = qmax (0, qmin (src_it, radTex.height() - 1));
-
-				const RadTexture::RGB* colour = radTex.canvasColour(src_is, src_it);
-				if ( colour )
-				{
-					src_color[0] = (*colour)[0];
-					src_color[1] = (*colour)[1];
-					src_color[2] = (*colour)[2];
-				}
-
-				const uint8_t opacity = radTex.opacity(src_is, src_it);
+		job->facenum = i;
+		job->originaltexinfonum = originaltexinfonum;
+		job->resolution = resolution;
+		job->texture_step = texture_step;
+		job->alphamasked = (radTex.attributeFlags() & RadTexture::IsAlphaMasked) != 0;
+		job->miptex = NULL;
+		job->miptexsize = 0;
+		g_numembedlightmaps++;
+	}
 
-				// get light from the center of the destination pixel
-				light_s = (s_vec + resolution * (dest_is + 0.5 - dest_s)) / texture_step - texmins[0];
-				light_t = (t_vec + resolution * (dest_it + 0.5 - dest_t)) / texture_step - texmins[1];
-				GetLight (f, texsize, light_s, light_t, light);
+	// build the textures in parallel
 
-				(*dest)[4] += 1;
+	RunThreadsOnIndividual (g_numembedlightmaps, false, EmbedLightmapFace);
 
-				if (opacity > 0x00)
-				{
-					float flOpacity = (float)opacity / 255.0f;
+	// commit them in face order, so that texinfo and texture numbering doesn't depend on thread timing
 
-					for (k = 0; k < 3; k++)
-					{
-						float v = (float)src_color[k] * flOpacity * pow(light[k] / denominator, gamma);
-						(*dest)[k] += 255 * qmax (0, qmin (v, 255));
-					}
+	std::unordered_map<unsigned long long, int> committed; // content hash -> job that owns the texinfo
+	std::vector<int> committedtexinfo (g_numembedlightmaps, -1);
 
-					(*dest)[3] += 255;
-				}
-			}
-		}
-		for (t = 0; t < texturesize[1]; t++)
-		{
-			for (s = 0; s < texturesize[0]; s++)
-			{
-				float (*src)[5] = &texture[t * texturesize[0] + s];
-				byte (*dest)[4] = &texturemips[0][t * texturesize[0] + s];
+	char table[62];
+	for (k = 0; k < 62; k++)
+	{
+		table[k] = k >= 36? 'a' + (k - 36): k >= 10? 'A' + (k - 10): '0' + k; // same order as the ASCII table
+	}
 
-				if ((*src)[4] == 0) // no samples (outside face range?)
-				{
-					VectorFill (*dest, 0);
-					(*dest)[3] = 255;
-				}
-				else
-				{
-					if ((*src)[3] / (*src)[4] <= 0.4 * 255) // transparent
-					{
-						VectorFill (*dest, 0);
-						(*dest)[3] = 0;
-					}
-					else // normal
-					{
-						for (j = 0; j < 3; j++)
-						{
-							int val = (int)floor ((*src)[j] / (*src)[3] + 0.5);
-							(*dest)[j] = qmax (0, qmin (val, 255));
-						}
-						(*dest)[3] = 255;
-					}
-				}
-			}
-		}
+	for (int jobnum = 0; jobnum < g_numembedlightmaps; jobnum++)
+	{
+		embedlightmap_t *job = &g_embedlightmaps[jobnum];
+		dface_t *f = &g_dfaces[job->facenum];
+		miptex_t *miptex = job->miptex;
 
-		for (miplevel = 1; miplevel < MIPLEVELS; miplevel++)
+		// faces with the same original texinfo, resolution and pixels can share one texinfo and texture
+		std::unordered_map<unsigned long long, int>::iterator it = committed.find (job->contenthash);
+		if (it != committed.end ())
 		{
-			for (t = 0; t < (texturesize[1] >> miplevel); t++)
+			const embedlightmap_t *other = &g_embedlightmaps[it->second];
+			if (other->miptexsize == job->miptexsize
+				&& other->resolution == job->resolution
+				&& !memcmp (other->miptex, miptex, job->miptexsize))
 			{
-				for (s = 0; s < (texturesize[0] >> miplevel); s++)
-				{
-					byte (*src[4])[4];
-					byte (*dest)[4];
-					double average[4];
-
-					dest = &texturemips[miplevel][t * (texturesize[0] >> miplevel) + s];
-					src[0] = &texturemips[miplevel - 1][(2 * t) * (texturesize[0] >> (miplevel - 1)) + (2 * s)];
-					src[1] = &texturemips[miplevel - 1][(2 * t) * (texturesize[0] >> (miplevel - 1)) + (2 * s + 1)];
-					src[2] = &texturemips[miplevel - 1][(2 * t + 1) * (texturesize[0] >> (miplevel - 1)) + (2 * s)];
-					src[3] = &texturemips[miplevel - 1][(2 * t + 1) * (texturesize[0] >> (miplevel - 1)) + (2 * s + 1)];
-
-					VectorClear (average);
-					average[3] = 0;
-					for (k = 0; k < 4; k++)
-					{
-						for (j = 0; j < 3; j++)
-						{
-							average[j] += (*src[k])[3] * (*src[k])[j];
-						}
-						average[3] += (*src[k])[3];
-					}
-
-					if (average[3] / 4 <= 0.4 * 255)
-					{
-						VectorClear (*dest);
-						(*dest)[3] = 0;
-					}
-					else
-					{
-						for (j = 0; j < 3; j++)
-						{
-							int val = (int)floor (average[j] / average[3] + 0.5);
-							(*dest)[j] = qmax (0, qmin (val, 255));
-						}
-						(*dest)[3] = 255;
-					}
-				}
+				f->texinfo = committedtexinfo[it->second];
+				committedtexinfo[jobnum] = f->texinfo;
+				count_shared++;
+				Developer (DEVELOPER_LEVEL_MESSAGE, "Shared texinfo %d for face at (%4.3f %4.3f %4.3f)\n", f->texinfo, g_face_centroids[job->facenum][0], g_face_centroids[job->facenum][1], g_face_centroids[job->facenum][2]);
+				continue;
 			}
 		}
-
-		// create its palette
-
-		byte palette[256][3];
-		cq_searchnode_t *palettetree = CQ_AllocSearchTree (256);
-		int paletteoffset;
-		int palettenumcolors;
-
+		else
 		{
-			int palettemaxcolors;
-			int numsamplepoints;
-			unsigned char (*samplepoints)[3];
-
-			if (radTex.attributeFlags() & RadTexture::IsAlphaMasked)
-			{
-				paletteoffset = 0;
-				palettemaxcolors = 255;
-
-				const RadTexture::RGB* transparentColour = radTex.paletteColour(255);
-
-				if ( transparentColour )
-				{
-					palette[255][0] = (*transparentColour)[0];
-					palette[255][1] = (*transparentColour)[1];
-					palette[255][2] = (*transparentColour)[2];
-				}
-				else
-				{
-					// Should never happen.
-					Error("Internal error: could not get RadTexture transparency colour.\n");
-				}
-			}
-			else
-			{
-				paletteoffset = 0;
-				palettemaxcolors = 256;
-			}
-
-			samplepoints = (unsigned char (*)[3])malloc (texturesize[0] * texturesize[1] * sizeof (unsigned char [3]));
-			hlassume (samplepoints != NULL, assume_NoMemory);
-			numsamplepoints = 0;
-			for (t = 0; t < texturesize[1]; t++)
-			{
-				for (s = 0; s < texturesize[0]; s++)
-				{
-					byte (*src)[4] = &texturemips[0][t * texturesize[0] + s];
-					if ((*src)[3] > 0)
-					{
-						VectorCopy (*src, samplepoints[numsamplepoints]);
-						numsamplepoints++;
-					}
-				}
-			}
-
-			CQ_CreatePalette (numsamplepoints, samplepoints, palettemaxcolors, &palette[paletteoffset], palettenumcolors, palettetree);
-			for (j = palettenumcolors; j < palettemaxcolors; j++)
-			{
-				VectorClear (palette[paletteoffset + j]);
-			}
-
-			free (samplepoints);
+			committed[job->contenthash] = jobnum;
 		}
 
 		// emit a texinfo
 
 		hlassume (g_numtexinfo < MAX_MAP_TEXINFO, assume_MAX_MAP_TEXINFO);
 		f->texinfo = g_numtexinfo;
+		committedtexinfo[jobnum] = g_numtexinfo;
 		texinfo_t *info = &g_texinfo[g_numtexinfo];
 		g_numtexinfo++;
 
-		*info = g_texinfo[originaltexinfonum];
-		if (resolution != 1)
+		*info = g_texinfo[job->originaltexinfonum];
+		if (job->resolution != 1)
 		{
 			// apply a scale and a shift over the original vectors
 			for (k = 0; k < 2; k++)
 			{
-				VectorScale (info->vecs[k], 1.0 / resolution, info->vecs[k]);
-				info->vecs[k][3] = info->vecs[k][3] / resolution + 0.5;
+				VectorScale (info->vecs[k], 1.0 / job->resolution, info->vecs[k]);
+				info->vecs[k][3] = info->vecs[k][3] / job->resolution + 0.5;
 			}
 		}
 		info->miptex = NewTextures_GetCurrentMiptexIndex ();
 
-		// emit a texture
+		// emit a texture; the hash was taken by the worker with name[10..15] cleared
 
-		int miptexsize;
-
-		miptexsize = (int)sizeof (miptex_t);
-		for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
-		{
-			miptexsize += (texturesize[0] >> miplevel) * (texturesize[1] >> miplevel);
-		}
-		miptexsize += 2 + 256 * 3 + 2;
-		miptex_t *miptex = (miptex_t *)malloc (miptexsize);
-		hlassume (miptex != NULL, assume_NoMemory);
-
-		memset (miptex, 0, sizeof (miptex_t));
-		miptex->width = texturesize[0];
-		miptex->height = texturesize[1];
-		byte *p = (byte *)miptex + sizeof (miptex_t);
-		for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
-		{
-			miptex->offsets[miplevel] = p - (byte *)miptex;
-			for (int t = 0; t < (texturesize[1] >> miplevel); t++)
-			{
-				for (int s = 0; s < (texturesize[0] >> miplevel); s++)
-				{
-					byte (*src)[4] = &texturemips[miplevel][t * (texturesize[0] >> miplevel) + s];
-					if ((*src)[3] > 0)
-					{
-						if (palettenumcolors)
-						{
-							unsigned char point[3];
-							VectorCopy (*src, point);
-							*p = paletteoffset + CQ_MapPoint (point, &palette[paletteoffset], palettenumcolors, palettetree);
-						}
-						else // this should never happen
-						{
-							*p = paletteoffset + 0;
-						}
-					}
-					else
-					{
-						*p = 255;
-					}
-					p++;
-				}
-			}
-		}
-		*(short *)p = 256;
-		p += 2;
-		memcpy (p, palette, 256 * 3);
-		p += 256 * 3;
-		*(short *)p = 0;
-		p += 2;
-		if (p != (byte *)miptex + miptexsize)
-		{
-			Error ("EmbedLightmapInTextures: internal error");
-		}
-
-		if (radTex.attributeFlags() & RadTexture::IsAlphaMasked)
-		{
-			safe_strncpy(miptex->name, "{_rad", sizeof(miptex->name));
-		}
-		else
-		{
-			safe_strncpy(miptex->name, "__rad", sizeof(miptex->name));
-		}
-		if (originaltexinfonum < 0 || originaltexinfonum > 99999)
-		{
-			Error ("EmbedLightmapInTextures: internal error: texinfo out of range");
-		}
-
-		if ( sizeof(miptex->name) < 16 )
-		{
-			Error("EmbedLightmapInTextures: internal error: texture name buffer size is too small");
-		}
-
-		miptex->name[5] = '0' + (originaltexinfonum / 10000) % 10; // store the original texinfo
-		miptex->name[6] = '0' + (originaltexinfonum / 1000) % 10;
-		miptex->name[7] = '0' + (originaltexinfonum / 100) % 10;
-		miptex->name[8] = '0' + (originaltexinfonum / 10) % 10;
-		miptex->name[9] = '0' + (originaltexinfonum) % 10;
-		char table[62];
-		for (int k = 0; k < 62; k++)
-		{
-			table[k] = k >= 36? 'a' + (k - 36): k >= 10? 'A' + (k - 10): '0' + k; // same order as the ASCII table
-		}
-		miptex->name[10] = '\0';
-		miptex->name[11] = '\0';
-		miptex->name[12] = '\0';
-		miptex->name[13] = '\0';
-		miptex->name[14] = '\0';
-		miptex->name[15] = '\0';
-		unsigned int hash = Hash (miptexsize, miptex);
+		unsigned int hash = job->namehash;
 		miptex->name[10] = table[(hash / 62 / 62) % 52 + 10];
 		miptex->name[11] = table[(hash / 62) % 62];
 		miptex->name[12] = table[(hash) % 62];
 		miptex->name[13] = table[(count / 62) % 62];
 		miptex->name[14] = table[(count) % 62];
 		miptex->name[15] = '\0';
-		NewTextures_PushTexture (miptexsize, miptex);
+		NewTextures_PushTexture (job->miptexsize, miptex);
 		count++;
-		count_bytes += miptexsize;
-		Developer (DEVELOPER_LEVEL_MESSAGE, "Created texture '%s' for face (texture %s) at (%4.3f %4.3f %4.3f)\n", miptex->name, texname, g_face_centroids[i][0], g_face_centroids[i][1], g_face_centroids[i][2]);
-
-		free (miptex);
-
-		CQ_FreeSearchTree (palettetree);
+		count_bytes += job->miptexsize;
+		Developer (DEVELOPER_LEVEL_MESSAGE, "Created texture '%s' for face (texture %s) at (%4.3f %4.3f %4.3f)\n", miptex->name, g_TextureCollection.miptexAt (g_texinfo[job->originaltexinfonum].miptex)->name(), g_face_centroids[job->facenum][0], g_face_centroids[job->facenum][1], g_face_centroids[job->facenum][2]);
 
-		free (texture);
-		for (miplevel = 0; miplevel < MIPLEVELS; miplevel++)
-		{
-			free (texturemips[miplevel]);
-		}
+		// later faces compare against this one with the name cleared again
+		memset (&miptex->name[10], 0, 6);
 	}
 	NewTextures_Write (); // update texdata now
 
+	for (i = 0; i < g_numembedlightmaps; i++)
+	{
+		free (g_embedlightmaps[i].miptex);
+	}
+	free (g_embedlightmaps);
+	g_embedlightmaps = NULL;
+	g_numembedlightmaps = 0;
+
 	if (logged)
 	{
-		Log ("added %d texinfos and textures (%d bytes)\n", count, count_bytes);
+		Log ("added %d texinfos and textures (%d bytes)", count, count_bytes);
+		if (count_shared)
+		{
+			Log (", %d faces share an identical texture", count_shared);
+		}
+		Log ("\n");
 	}
 }
 
@@ -17,12 +17,35 @@ GNU General Public License for more details.
 #include "meshdesc.h"
 #include "stringlib.h"
 #include "TimeCounter.h"
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+#include "checksum.h"
+#endif
 
 //#define AABB_OFFSET
 #define SIMPLIFICATION_FACTOR_HIGH	0.15f
 #define SIMPLIFICATION_FACTOR_MED	0.55f
 #define SIMPLIFICATION_FACTOR_LOW	0.85f
 
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+// -stagecache keeps the built triangles of each studio mesh; the facets' planes and the
+// AABB tree are rebuilt from them on load, which is cheap next to the simplification
+#define STUDIOMESH_CACHE_ID	"MESH0001"	// change it whenever the built triangles would change
+
+typedef struct
+{
+	char		id[8];
+	int		numtris;		// passed to InitMeshBuild, decides if the mesh gets an AABB tree
+	int		numfacets;
+	vec3_t		mins, maxs;	// also cover the triangles AddMeshTrinagle rejected
+} meshcacheheader_t;
+
+typedef struct
+{
+	mvert_t		triangle[3];
+	int		texture;		// index into the model textures, -1 = none
+} meshcachefacet_t;
+#endif
+
 CMeshDesc :: CMeshDesc( void )
 {
 	memset( &m_mesh, 0, sizeof( m_mesh ));
@@ -110,6 +133,10 @@ void CMeshDesc :: FreeMesh( void )
 
 	// single memory block
 	free( m_mesh.planes );
+#ifdef HLRAD_MESH_BVH
+	free( m_mesh.bvhnodes );
+	free( m_mesh.bvhpackets );
+#endif
 
 	FreeMeshBuild();
 
@@ -485,6 +512,101 @@ void CMeshDesc :: StudioCalcBonePosition( mstudiobone_t *pbone, mstudioanim_t *p
 	}
 }
 
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+static uint64_t StudioMeshKey( const model_t *pModel )
+{
+	const studiohdr_t *phdr = (const studiohdr_t *)pModel->extradata;
+	int params[3] = { pModel->body, pModel->skin, pModel->trace_mode };
+	uint64_t key;
+
+	// the mesh is built in object space, so the placement isn't part of the key
+	key = HashBytes64( STUDIOMESH_CACHE_ID, sizeof( STUDIOMESH_CACHE_ID ), 0 );
+	key = HashBytes64( phdr, phdr->length, key );
+	return HashBytes64( params, sizeof( params ), key );
+}
+
+bool CMeshDesc :: StudioLoadMeshCache( model_t *pModel, uint64_t key )
+{
+	studiohdr_t *phdr = (studiohdr_t *)pModel->extradata;
+	mstudiotexture_t *ptexture = (mstudiotexture_t *)((byte *)phdr + phdr->textureindex);
+	int length;
+	byte *data = StageCacheLoadObject( "mesh", key, &length );
+
+	if( !data )
+		return false;
+
+	meshcacheheader_t *header = (meshcacheheader_t *)data;
+	meshcachefacet_t *in = (meshcachefacet_t *)(header + 1);
+
+	if( length < (int)sizeof( *header ) || memcmp( header->id, STUDIOMESH_CACHE_ID, sizeof( header->id ))
+	|| header->numfacets <= 0 || header->numtris < header->numfacets
+	|| ( length - (int)sizeof( *header )) % (int)sizeof( *in ) != 0
+	|| ( length - (int)sizeof( *header )) / (int)sizeof( *in ) != header->numfacets )
+	{
+		Developer( DEVELOPER_LEVEL_WARNING, "StudioLoadMeshCache: damaged cache entry for %s\n", pModel->name );
+		Free( data );
+		return false;
+	}
+
+	m_mesh.trace_mode = pModel->trace_mode;
+
+	if( !InitMeshBuild( pModel->name, header->numtris ))
+	{
+		Free( data );
+		return false;
+	}
+
+	for( int i = 0; i < header->numfacets; i++, in++ )
+	{
+		mstudiotexture_t *tex = NULL;
+
+		if( in->texture >= 0 && in->texture < phdr->numtextures )
+			tex = &ptexture[in->texture];
+		AddMeshTrinagle( in->triangle, tex );
+	}
+
+	VectorCopy( header->mins, m_mesh.mins );
+	VectorCopy( header->maxs, m_mesh.maxs );
+	Free( data );
+
+	return FinishMeshBuild();
+}
+
+void CMeshDesc :: StudioStoreMeshCache( model_t *pModel, uint64_t key, int numTris )
+{
+	if( !g_stagecache )
+		return;
+
+	studiohdr_t *phdr = (studiohdr_t *)pModel->extradata;
+	mstudiotexture_t *ptexture = (mstudiotexture_t *)((byte *)phdr + phdr->textureindex);
+	int length = sizeof( meshcacheheader_t ) + m_mesh.numfacets * sizeof( meshcachefacet_t );
+	byte *data = (byte *)malloc( length );
+	meshcacheheader_t *header = (meshcacheheader_t *)data;
+	meshcachefacet_t *out = (meshcachefacet_t *)(header + 1);
+
+	hlassume( data != NULL, assume_NoMemory );
+	memset( data, 0, length );	// padding too, so equal meshes write equal files
+
+	memcpy( header->id, STUDIOMESH_CACHE_ID, sizeof( header->id ));
+	header->numtris = numTris;
+	header->numfacets = m_mesh.numfacets;
+	VectorCopy( m_mesh.mins, header->mins );
+	VectorCopy( m_mesh.maxs, header->maxs );
+
+	for( int i = 0; i < m_mesh.numfacets; i++, out++ )
+	{
+		mfacet_t *facet = &m_mesh.facets[i];
+
+		for( int k = 0; k < 3; k++ )
+			out->triangle[k] = facet->triangle[k];
+		out->texture = facet->texture ? facet->texture - ptexture : -1;
+	}
+
+	StageCacheStoreObject( "mesh", key, data, length );
+	free( data );
+}
+#endif
+
 bool CMeshDesc :: StudioConstructMesh( model_t *pModel )
 {
 	int i;
@@ -500,6 +622,21 @@ bool CMeshDesc :: StudioConstructMesh( model_t *pModel )
 
 	profile.start();
 	bool simplify_model = (pModel->trace_mode == 2) ? true : false; // trying to reduce polycount and the speedup compilation
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+	uint64_t cachekey = StudioMeshKey( pModel );
+
+	if( StudioLoadMeshCache( pModel, cachekey ))
+	{
+		profile.stop();
+		if( g_verbose )
+		{
+			ThreadLock(); // Q_memprint hands out a shared static buffer
+			Verbose( "%s: cached, load time %g secs, size %s\n", m_debugName, profile.getTotal(), Q_memprint( mesh_size ));
+			ThreadUnlock();
+		}
+		return true;
+	}
+#endif
 
 	// compute default pose for building mesh from
 	mstudioseqdesc_t *pseqdesc = (mstudioseqdesc_t *)((byte *)phdr + phdr->seqindex);
@@ -518,8 +655,13 @@ bool CMeshDesc :: StudioConstructMesh( model_t *pModel )
 	mstudioanim_t *panim = (mstudioanim_t *)((byte *)phdr + pseqgroup->data + pseqdesc->animindex);
 #endif
 	mstudiobone_t *pbone = (mstudiobone_t *)((byte *)phdr + phdr->boneindex);
+#ifdef HLRAD_STUDIOMESH_SHARE
+	vec3_t pos[MAXSTUDIOBONES];	// meshes are built on several threads at once
+	vec4_t q[MAXSTUDIOBONES];
+#else
 	static vec3_t pos[MAXSTUDIOBONES];
 	static vec4_t q[MAXSTUDIOBONES];
+#endif
 	int totalVertSize = 0;
 
 	for( int i = 0; i < phdr->numbones; i++, pbone++, panim++ )
@@ -777,10 +919,18 @@ bool CMeshDesc :: StudioConstructMesh( model_t *pModel )
 		Developer( DEVELOPER_LEVEL_ERROR, "StudioConstructMesh: failed to build mesh from %s\n", pModel->name );
 		return false;
 	}
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+	StudioStoreMeshCache( pModel, cachekey, numTris );
+#endif
 	profile.stop();
 #if 1
 	// g-cont. i'm leave this for debug
-	Verbose( "%s: build time %g secs, size %s\n", m_debugName, profile.getTotal(), Q_memprint( mesh_size ));
+	if( g_verbose )
+	{
+		ThreadLock(); // meshes are built on several threads, and Q_memprint hands out a shared static buffer
+		Verbose( "%s: build time %g secs, size %s\n", m_debugName, profile.getTotal(), Q_memprint( mesh_size ));
+		ThreadUnlock();
+	}
 #endif
 	// done
 	return true;
@@ -977,6 +1127,212 @@ void CMeshDesc :: RelinkFacet( mfacet_t *facet )
 	InsertLinkBefore( &facet->area, &node->facets );
 }
 
+#ifdef HLRAD_MESH_BVH
+#define BVH_BINS		16
+#define BVH_FACET_PAD	0.05f	// ClipRayToFace takes hits a little outside the triangle (BARY_EPSILON)
+#define BVH_MAX_DEPTH	32	// below this just halve the list, so the trace stack can't overflow
+
+typedef struct bvhfacet_s
+{
+	vec3_t		mins, maxs;	// padded facet bounds
+	vec3_t		center;
+	uint		facet;
+} bvhfacet_t;
+
+static float BVHBoundsArea( const vec3_t mins, const vec3_t maxs )
+{
+	vec3_t	size;
+
+	VectorSubtract( maxs, mins, size );
+
+	if( size[0] < 0.0f || size[1] < 0.0f || size[2] < 0.0f )
+		return 0.0f; // empty
+
+	return size[0] * size[1] + size[1] * size[2] + size[2] * size[0];
+}
+
+static int BVHBin( const bvhfacet_t *f, int axis, float base, float scale )
+{
+	int b = (int)(( f->center[axis] - base ) * scale );
+
+	return bound( 0, b, BVH_BINS - 1 );
+}
+
+/*
+===============
+BuildBVHNode
+
+nodes are stored depth first, so the first child of a node is the next node
+===============
+*/
+int CMeshDesc :: BuildBVHNode( bvhfacet_t *list, int count, int depth, int &numpackets )
+{
+	int		nodenum = m_mesh.numbvhnodes++;
+	mbvhnode_t	*node = &m_mesh.bvhnodes[nodenum];
+	vec3_t		cmins, cmaxs;
+	int		i, j, b;
+
+	ClearBounds( node->mins, node->maxs );
+	ClearBounds( cmins, cmaxs );
+
+	for( i = 0; i < count; i++ )
+	{
+		AddPointToBounds( list[i].mins, node->mins, node->maxs );
+		AddPointToBounds( list[i].maxs, node->mins, node->maxs );
+		AddPointToBounds( list[i].center, cmins, cmaxs );
+	}
+
+	if( count <= BVH_LEAF_FACETS )
+	{
+		mbvhpacket_t *packet = &m_mesh.bvhpackets[numpackets];
+
+		memset( packet, 0, sizeof( *packet ));
+
+		for( i = 0; i < count; i++ )
+		{
+			mfacet_t *facet = &m_mesh.facets[list[i].facet];
+
+			for( j = 0; j < 3; j++ )
+			{
+				packet->v0[j][i] = facet->triangle[0].point[j];
+				packet->edge1[j][i] = facet->edge1[j];
+				packet->edge2[j][i] = facet->edge2[j];
+			}
+			packet->facets[i] = list[i].facet;
+		}
+
+		node->index = numpackets++;
+		node->numfacets = count;
+		node->axis = -1;
+		return nodenum;
+	}
+
+	// binned surface area heuristic over the facet centers
+	float	bestcost = 1e30f;
+	int	bestaxis = -1, bestbin = 0;
+
+	for( int axis = 0; axis < 3 && depth < BVH_MAX_DEPTH; axis++ )
+	{
+		vec3_t	binmins[BVH_BINS], binmaxs[BVH_BINS];
+		int	bincount[BVH_BINS];
+		float	rightarea[BVH_BINS];
+		int	rightcount[BVH_BINS];
+		vec3_t	mins, maxs;
+		int	n;
+
+		if( cmaxs[axis] - cmins[axis] <= 0.0f )
+			continue;
+
+		float scale = BVH_BINS / ( cmaxs[axis] - cmins[axis] );
+
+		for( b = 0; b < BVH_BINS; b++ )
+		{
+			ClearBounds( binmins[b], binmaxs[b] );
+			bincount[b] = 0;
+		}
+
+		for( i = 0; i < count; i++ )
+		{
+			b = BVHBin( &list[i], axis, cmins[axis], scale );
+			AddPointToBounds( list[i].mins, binmins[b], binmaxs[b] );
+			AddPointToBounds( list[i].maxs, binmins[b], binmaxs[b] );
+			bincount[b]++;
+		}
+
+		ClearBounds( mins, maxs );
+		for( b = BVH_BINS - 1, n = 0; b > 0; b-- )
+		{
+			AddPointToBounds( binmins[b], mins, maxs );
+			AddPointToBounds( binmaxs[b], mins, maxs );
+			n += bincount[b];
+			rightarea[b] = BVHBoundsArea( mins, maxs );
+			rightcount[b] = n;
+		}
+
+		ClearBounds( mins, maxs );
+		for( b = 0, n = 0; b < BVH_BINS - 1; b++ )
+		{
+			AddPointToBounds( binmins[b], mins, maxs );
+			AddPointToBounds( binmaxs[b], mins, maxs );
+			n += bincount[b];
+
+			if( !n || !rightcount[b+1] )
+				continue;
+
+			float cost = BVHBoundsArea( mins, maxs ) * n + rightarea[b+1] * rightcount[b+1];
+
+			if( cost < bestcost )
+			{
+				bestcost = cost;
+				bestaxis = axis;
+				bestbin = b;
+			}
+		}
+	}
+
+	int mid;
+
+	if( bestaxis == -1 )
+	{
+		mid = count / 2; // all the centers are in one point or the tree is too deep
+	}
+	else
+	{
+		float scale = BVH_BINS / ( cmaxs[bestaxis] - cmins[bestaxis] );
+
+		for( i = mid = 0; i < count; i++ )
+		{
+			if( BVHBin( &list[i], bestaxis, cmins[bestaxis], scale ) > bestbin )
+				continue;
+
+			bvhfacet_t temp = list[i];
+			list[i] = list[mid];
+			list[mid++] = temp;
+		}
+	}
+
+	node->numfacets = 0;
+	node->axis = ( bestaxis == -1 ) ? 0 : bestaxis;
+
+	BuildBVHNode( list, mid, depth + 1, numpackets );
+	m_mesh.bvhnodes[nodenum].index = BuildBVHNode( list + mid, count - mid, depth + 1, numpackets );
+
+	return nodenum;
+}
+
+void CMeshDesc :: BuildBVH( void )
+{
+	bvhfacet_t *list = (bvhfacet_t *)malloc( sizeof( bvhfacet_t ) * m_mesh.numfacets );
+	int numpackets = 0;
+
+	for( int i = 0; i < m_mesh.numfacets; i++ )
+	{
+		mfacet_t *facet = &m_mesh.facets[i];
+		vec3_t size;
+
+		VectorSubtract( facet->maxs, facet->mins, size );
+		float pad = qmax( size[0], qmax( size[1], size[2] )) * BVH_FACET_PAD + 0.1f;
+
+		for( int j = 0; j < 3; j++ )
+		{
+			list[i].mins[j] = facet->mins[j] - pad;
+			list[i].maxs[j] = facet->maxs[j] + pad;
+			list[i].center[j] = ( facet->mins[j] + facet->maxs[j] ) * 0.5f;
+		}
+		list[i].facet = i;
+	}
+
+	// a leaf holds at least one facet, so there are less than 2 * numfacets nodes
+	m_mesh.bvhnodes = (mbvhnode_t *)malloc( sizeof( mbvhnode_t ) * m_mesh.numfacets * 2 );
+	m_mesh.bvhpackets = (mbvhpacket_t *)malloc( sizeof( mbvhpacket_t ) * m_mesh.numfacets );
+	m_mesh.numbvhnodes = 0;
+
+	BuildBVHNode( list, m_mesh.numfacets, 0, numpackets );
+
+	free( list );
+}
+#endif
+
 bool CMeshDesc :: FinishMeshBuild( void )
 {
 	if( m_mesh.numfacets <= 0 )
@@ -1039,6 +1395,13 @@ bool CMeshDesc :: FinishMeshBuild( void )
 			m_mesh.facets[i].triangle[k] = facets[i].triangle[k];
 	}
 
+#ifdef HLRAD_MESH_BVH
+	if( m_mesh.trace_mode == SHADOW_NORMAL || m_mesh.trace_mode == SHADOW_SLOW )
+	{
+		BuildBVH();
+		has_tree = false; // the bvh replaces the areanodes
+	}
+#endif
 	if( has_tree )
 	{
 		// create tree
@@ -1051,6 +1414,10 @@ bool CMeshDesc :: FinishMeshBuild( void )
 	FreeMeshBuild();
 
 	mesh_size = sizeof( m_mesh ) + memsize;
+#ifdef HLRAD_MESH_BVH
+	if( m_mesh.numbvhnodes )
+		mesh_size += sizeof( mbvhnode_t ) * m_mesh.numfacets * 2 + sizeof( mbvhpacket_t ) * m_mesh.numfacets;
+#endif
 #if 0
 	Developer( DEVELOPER_LEVEL_ALWAYS, "FinishMesh: %s %i k", m_debugName, ( mesh_size / 1024 ));
 	Developer( DEVELOPER_LEVEL_ALWAYS, " (planes reduced from %i to %i)", m_iTotalPlanes, m_mesh.numplanes );
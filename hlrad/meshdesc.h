@@ -93,6 +93,27 @@ typedef struct
 	uint		*indices;		// a indexes into mesh plane pool
 } mfacet_t;
 
+#ifdef HLRAD_MESH_BVH
+#define BVH_LEAF_FACETS	4		// one SSE packet of triangles per leaf
+
+typedef struct
+{
+	vec3_t		mins, maxs;	// padded, so the ray test never drops a hit ClipRayToFace would take
+	int		index;		// leaf: packet number, node: the second child (the first follows the node)
+	short		numfacets;	// 0 = node
+	short		axis;		// node: split axis, the first child is on the low side
+} mbvhnode_t;
+
+// the triangles of one leaf as ClipRayToFace reads them, one lane each; unused lanes are degenerate
+typedef struct
+{
+	float		v0[3][BVH_LEAF_FACETS];
+	float		edge1[3][BVH_LEAF_FACETS];
+	float		edge2[3][BVH_LEAF_FACETS];
+	uint		facets[BVH_LEAF_FACETS];
+} mbvhpacket_t;
+#endif
+
 typedef struct
 {
 	int		trace_mode;	// trace method
@@ -101,6 +122,11 @@ typedef struct
 	uint		numplanes;
 	mfacet_t		*facets;
 	mplane_t		*planes;		// shared plane pool
+#ifdef HLRAD_MESH_BVH
+	int		numbvhnodes;	// 0 = no bvh, trace the areanodes
+	mbvhnode_t	*bvhnodes;
+	mbvhpacket_t	*bvhpackets;
+#endif
 } mmesh_t;
 
 class triset
@@ -159,6 +185,10 @@ public:
 	void StudioCalcBoneQuaterion( mstudiobone_t *pbone, mstudioanim_t *panim, vec4_t q );
 	void StudioCalcBonePosition( mstudiobone_t *pbone, mstudioanim_t *panim, vec3_t pos );
 	bool StudioConstructMesh( struct model_s *pModel );
+#if defined( HLRAD_STUDIOMESH_SHARE ) && defined( ZHLT_STAGECACHE )
+	bool StudioLoadMeshCache( struct model_s *pModel, uint64_t key );
+	void StudioStoreMeshCache( struct model_s *pModel, uint64_t key, int numTris );
+#endif
 
 	// linked list operations
 	void InsertLinkBefore( link_t *l, link_t *before );
@@ -168,6 +198,11 @@ public:
 	// AABB tree contsruction
 	areanode_t *CreateAreaNode( int depth, const vec3_t mins, const vec3_t maxs );
 	void RelinkFacet( mfacet_t *facet );
+#ifdef HLRAD_MESH_BVH
+	// SAH bvh for the normal and slow shadow modes
+	void BuildBVH( void );
+	int BuildBVHNode( struct bvhfacet_s *list, int count, int depth, int &numpackets );
+#endif
 	_inline areanode_t *GetHeadNode( void ) { return (has_tree) ? &areanodes[0] : NULL; }
 
 	// plane cache
@@ -230,4 +265,15 @@ typedef struct model_s
 	CMeshDesc		mesh;		// cform
 } model_t;
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+// one placed copy of a model_t, whose mesh is kept in object space
+typedef struct
+{
+	model_t		*model;
+	matrix3x4		transform;	// object space -> world
+	matrix3x4		invtransform;	// world -> object space, for the traces
+	vec3_t		absmin, absmax;	// world bounds of the mesh
+} modelinstance_t;
+#endif
+
 #endif//MESHDESC_H
\ No newline at end of file
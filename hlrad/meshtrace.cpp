@@ -16,6 +16,13 @@ GNU General Public License for more details.
 #include "qrad.h"
 #include "meshtrace.h"
 
+#ifdef HLRAD_MESH_BVH
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define MESHTRACE_SSE2
+#include <emmintrin.h>
+#endif
+#endif
+
 void TraceMesh :: SetupTrace( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end )
 {
 	m_bHitTriangle = false;
@@ -380,12 +387,188 @@ void TraceMesh :: ClipToLinks( areanode_t *node )
 		ClipToLinks( node->children[1] );
 }
 
+#ifdef HLRAD_MESH_BVH
+#define BVH_STACK_SIZE	64	// BuildBVHNode keeps the tree shallower than this
+
+bool TraceMesh :: ClipRayToBVHNode( const mbvhnode_t *node )
+{
+	if( !BoundsIntersect( m_vecAbsMins, m_vecAbsMaxs, node->mins, node->maxs ))
+		return false;
+
+	// slow mode takes hits up to FRAC_EPSILON off the ray, keep the box test only
+	if( mesh->trace_mode != SHADOW_NORMAL )
+		return true;
+
+	float tmin = 0.0f, tmax = m_flTraceDistance;
+
+	for( int i = 0; i < 3; i++ )
+	{
+		if( fabs( m_vecTraceDirection[i] ) < 1e-8f )
+		{
+			if( m_vecStart[i] < node->mins[i] || m_vecStart[i] > node->maxs[i] )
+				return false;
+			continue;
+		}
+
+		float inv = 1.0f / m_vecTraceDirection[i];
+		float t0 = ( node->mins[i] - m_vecStart[i] ) * inv;
+		float t1 = ( node->maxs[i] - m_vecStart[i] ) * inv;
+
+		if( t0 > t1 )
+		{
+			float temp = t0;
+			t0 = t1;
+			t1 = temp;
+		}
+
+		tmin = qmax( tmin, t0 );
+		tmax = qmin( tmax, t1 );
+
+		if( tmin > tmax )
+			return false;
+	}
+
+	return true;
+}
+
+bool TraceMesh :: ClipToBVHLeaf( const mbvhnode_t *node )
+{
+	const mbvhpacket_t *packet = &mesh->bvhpackets[node->index];
+	int bits = ( 1 << node->numfacets ) - 1;
+
+	if( mesh->trace_mode == SHADOW_NORMAL )
+	{
+#ifdef MESHTRACE_SSE2
+		// ClipRayToFace for the whole packet with looser limits, the lanes that pass are retested exactly
+		__m128 dx = _mm_set1_ps( m_vecTraceDirection[0] );
+		__m128 dy = _mm_set1_ps( m_vecTraceDirection[1] );
+		__m128 dz = _mm_set1_ps( m_vecTraceDirection[2] );
+		__m128 e1x = _mm_loadu_ps( packet->edge1[0] );
+		__m128 e1y = _mm_loadu_ps( packet->edge1[1] );
+		__m128 e1z = _mm_loadu_ps( packet->edge1[2] );
+		__m128 e2x = _mm_loadu_ps( packet->edge2[0] );
+		__m128 e2y = _mm_loadu_ps( packet->edge2[1] );
+		__m128 e2z = _mm_loadu_ps( packet->edge2[2] );
+
+		__m128 px = _mm_sub_ps( _mm_mul_ps( dy, e2z ), _mm_mul_ps( dz, e2y ));
+		__m128 py = _mm_sub_ps( _mm_mul_ps( dz, e2x ), _mm_mul_ps( dx, e2z ));
+		__m128 pz = _mm_sub_ps( _mm_mul_ps( dx, e2y ), _mm_mul_ps( dy, e2x ));
+		__m128 det = _mm_add_ps( _mm_add_ps( _mm_mul_ps( e1x, px ), _mm_mul_ps( e1y, py )), _mm_mul_ps( e1z, pz ));
+
+		__m128 tx = _mm_sub_ps( _mm_set1_ps( m_vecStart[0] ), _mm_loadu_ps( packet->v0[0] ));
+		__m128 ty = _mm_sub_ps( _mm_set1_ps( m_vecStart[1] ), _mm_loadu_ps( packet->v0[1] ));
+		__m128 tz = _mm_sub_ps( _mm_set1_ps( m_vecStart[2] ), _mm_loadu_ps( packet->v0[2] ));
+
+		__m128 qx = _mm_sub_ps( _mm_mul_ps( ty, e1z ), _mm_mul_ps( tz, e1y ));
+		__m128 qy = _mm_sub_ps( _mm_mul_ps( tz, e1x ), _mm_mul_ps( tx, e1z ));
+		__m128 qz = _mm_sub_ps( _mm_mul_ps( tx, e1y ), _mm_mul_ps( ty, e1x ));
+
+		__m128 invdet = _mm_div_ps( _mm_set1_ps( 1.0f ), det );
+		__m128 u = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( tx, px ), _mm_mul_ps( ty, py )), _mm_mul_ps( tz, pz )), invdet );
+		__m128 v = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( dx, qx ), _mm_mul_ps( dy, qy )), _mm_mul_ps( dz, qz )), invdet );
+		__m128 depth = _mm_mul_ps( _mm_add_ps( _mm_add_ps( _mm_mul_ps( e2x, qx ), _mm_mul_ps( e2y, qy )), _mm_mul_ps( e2z, qz )), invdet );
+
+		__m128 lo = _mm_set1_ps( -BARY_EPSILON - 0.01f );
+		__m128 hi = _mm_set1_ps( 1.0f + BARY_EPSILON + 0.01f );
+		__m128 absdet = _mm_andnot_ps( _mm_set1_ps( -0.0f ), det );
+
+		// NaN lanes (degenerate padding) fail every compare
+		__m128 mask = _mm_cmpge_ps( absdet, _mm_set1_ps( COPLANAR_EPSILON * 0.5f ));
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( u, lo ));
+		mask = _mm_and_ps( mask, _mm_cmple_ps( u, hi ));
+		mask = _mm_and_ps( mask, _mm_cmpge_ps( v, lo ));
+		mask = _mm_and_ps( mask, _mm_cmple_ps( _mm_add_ps( u, v ), hi ));
+		mask = _mm_and_ps( mask, _mm_cmpgt_ps( depth, _mm_set1_ps( NEAR_SHADOW_EPSILON - 0.5f )));
+		mask = _mm_and_ps( mask, _mm_cmplt_ps( depth, _mm_set1_ps( m_flTraceDistance + 0.5f )));
+
+		bits &= _mm_movemask_ps( mask );
+#endif
+		for( int i = 0; bits; i++, bits >>= 1 )
+		{
+			if( !( bits & 1 ))
+				continue;
+
+			const mfacet_t *facet = &mesh->facets[packet->facets[i]];
+
+			if( !BoundsIntersect( m_vecAbsMins, m_vecAbsMaxs, facet->mins, facet->maxs ))
+				continue;
+
+			if( ClipRayToFace( facet ))
+				return true;
+		}
+	}
+	else
+	{
+		for( int i = 0; i < node->numfacets; i++ )
+		{
+			const mfacet_t *facet = &mesh->facets[packet->facets[i]];
+
+			if( !BoundsIntersect( m_vecAbsMins, m_vecAbsMaxs, facet->mins, facet->maxs ))
+				continue;
+
+			// does trace for planes bbox for each triangle
+			if( ClipRayToFacet( facet ))
+				return true;
+		}
+	}
+
+	return false;
+}
+
+/*
+===============
+ClipToBVH
+
+any hit will do for a shadow, so stop at the first one
+===============
+*/
+bool TraceMesh :: ClipToBVH( void )
+{
+	int	stack[BVH_STACK_SIZE];
+	int	nodenum = 0, sp = 0;
+
+	while( 1 )
+	{
+		const mbvhnode_t *node = &mesh->bvhnodes[nodenum];
+
+		if( ClipRayToBVHNode( node ))
+		{
+			if( !node->numfacets )
+			{
+				// visit the near child first
+				if( m_vecTraceDirection[node->axis] < 0.0f )
+				{
+					stack[sp++] = nodenum + 1;
+					nodenum = node->index;
+				}
+				else
+				{
+					stack[sp++] = node->index;
+					nodenum = nodenum + 1;
+				}
+				continue;
+			}
+
+			if( ClipToBVHLeaf( node ))
+				return true;
+		}
+
+		if( !sp ) return false;
+		nodenum = stack[--sp];
+	}
+}
+#endif
+
 bool TraceMesh :: DoTrace( void )
 {
 	if( !mesh || !BoundsIntersect( mesh->mins, mesh->maxs, m_vecAbsMins, m_vecAbsMaxs ))
 		return false; // invalid mesh or no intersection
 
 	checkcount = 0;
+#ifdef HLRAD_MESH_BVH
+	if( mesh->numbvhnodes )
+		return ClipToBVH();
+#endif
 
 	if( areanodes )
 	{
@@ -81,6 +81,11 @@ public:
 	bool ClipRayToFacet( const mfacet_t *facet );
 	bool ClipRayToFace( const mfacet_t *facet ); // ripped out from q3map2
 	void ClipToLinks( areanode_t *node );
+#ifdef HLRAD_MESH_BVH
+	bool ClipRayToBVHNode( const mbvhnode_t *node );
+	bool ClipToBVHLeaf( const mbvhnode_t *node );
+	bool ClipToBVH( void );
+#endif
 	bool DoTrace( void );
 };
 
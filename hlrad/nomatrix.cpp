@@ -59,12 +59,9 @@ static bool     CheckVisBitNoVismatrix(unsigned patchnum1, unsigned patchnum2
 
             const dplane_t* plane = getPlaneFromFaceNumber(patch->faceNumber);
 
-#ifdef HLRAD_HULLU
-            vec3_t transparency = {1.0,1.0,1.0};
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-			int opaquestyle = -1;
-#endif
+			trace_t trace;
+			vec3_t &transparency = trace.transparency;
+			int &opaquestyle = trace.opaquestyle;
 
             // check vis between patch and patch2
             //  if v2 is not behind light plane
@@ -105,39 +102,13 @@ static bool     CheckVisBitNoVismatrix(unsigned patchnum1, unsigned patchnum2
 				return false;
 			}
 #endif
-#ifdef HLRAD_WATERBLOCKLIGHT
-            if (TestLine(
+            if (TraceSegment (
 	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 				origin1, origin2
 	#else
 				patch->origin, patch2->origin
 	#endif
-				) != CONTENTS_EMPTY)
-#else
-            if (TestLine_r(0, 0.0f, 1.0f, 
-	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-				origin1, origin2
-	#else
-				patch->origin, patch2->origin
-	#endif
-				) != CONTENTS_EMPTY)
-#endif
-			{
-				return false;
-			}
-            if (TestSegmentAgainstOpaqueList(
-#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-				origin1, origin2
-#else
-				patch->origin, patch2->origin
-#endif
-#ifdef HLRAD_HULLU
-				, transparency
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-				, opaquestyle
-#endif
-				))
+				, 0, &trace))
 			{
 				return false;
 			}
@@ -183,12 +154,9 @@ static bool     CheckVisBitNoVismatrix(unsigned patchnum1, unsigned patchnum2
         if (DotProduct(backorigin, emitplane->normal) > (PatchPlaneDist(emitpatch) + MINIMUM_PATCH_DISTANCE))
         {
 
-#ifdef HLRAD_HULLU
-            vec3_t transparency = {1.0,1.0,1.0};
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-			int opaquestyle = -1;
-#endif
+			trace_t trace;
+			vec3_t &transparency = trace.transparency;
+			int &opaquestyle = trace.opaquestyle;
 
 #ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 			vec3_t emitorigin;
@@ -214,39 +182,13 @@ static bool     CheckVisBitNoVismatrix(unsigned patchnum1, unsigned patchnum2
 				return false;
 			}
 #endif
-#ifdef HLRAD_WATERBLOCKLIGHT
-            if (TestLine(
+            if (TraceSegment (
 	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 				backorigin, emitorigin
 	#else
 				backorigin, emitpatch->origin
 	#endif
-				) != CONTENTS_EMPTY)
-#else
-            if (TestLine_r(0, 0.0f, 1.0f,
-	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-				backorigin, emitorigin
-	#else
-				backorigin, emitpatch->origin
-	#endif
-				) != CONTENTS_EMPTY)
-#endif
-			{
-				return false;
-			}
-            if (TestSegmentAgainstOpaqueList(
-#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-				backorigin, emitorigin
-#else
-				backorigin, emitpatch->origin
-#endif
-#ifdef HLRAD_HULLU
-				, transparency
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-				, opaquestyle
-#endif
-				))
+				, 0, &trace))
 			{
 				return false;
 			}
@@ -9,6 +9,10 @@
 
 #include "qrad.h"
 #include "meshdesc.h"
+#ifdef HLRAD_STUDIOMESH_SHARE
+#include <queue>
+#include <vector>
+#endif
 
 /*
  *  For the polygon reduction algorithm we use data structures
@@ -44,14 +48,40 @@ public:
 	List<CTriangle *>	face;     // adjacent triangles
 	float		objdist;  // cached cost of collapsing edge
 	CVertex*		collapse; // candidate vertex for collapse
+#ifdef HLRAD_STUDIOMESH_SHARE
+	int		stamp;    // bumped on every cost update, so older heap entries are skipped
+#endif
 
 	CVertex( const vector &v, int _id );
 	~CVertex();
 	void RemoveIfNonNeighbor( CVertex *n );
 };
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+// studio meshes are simplified on several threads at once
+typedef struct
+{
+	float	objdist;
+	int	id;
+	int	stamp;
+} collapsecost_t;
+
+// std::priority_queue keeps the largest on top; this puts the cheapest collapse there,
+// and of equal costs the lowest id, which is what the old sequential search picked
+static bool operator<( const collapsecost_t &a, const collapsecost_t &b )
+{
+	if( a.objdist != b.objdist )
+		return a.objdist > b.objdist;
+	return a.id > b.id;
+}
+
+static thread_local List<CVertex *> vertices;	// indexed by id, NULL once collapsed
+static thread_local int numvertices;		// not collapsed yet
+static thread_local std::priority_queue< collapsecost_t, std::vector< collapsecost_t > > collapseheap;
+#else
 List<CVertex *> vertices;
 List<CTriangle *> triangles;
+#endif
 
 CTriangle :: CTriangle( CVertex *v0, CVertex *v1, CVertex *v2 )
 {
@@ -63,7 +93,9 @@ CTriangle :: CTriangle( CVertex *v0, CVertex *v1, CVertex *v2 )
 
 	ComputeNormal();
 
+#ifndef HLRAD_STUDIOMESH_SHARE
 	triangles.Add( this );
+#endif
 
 	for( int i = 0; i < 3; i++ )
 	{
@@ -82,7 +114,9 @@ CTriangle :: ~CTriangle()
 {
 	int i1;
 
+#ifndef HLRAD_STUDIOMESH_SHARE
 	triangles.Remove( this );
+#endif
 
 	for( i1 = 0; i1 < 3; i1++ )
 	{
@@ -176,6 +210,10 @@ CVertex :: CVertex( const vector &v, int _id )
 	id = _id;
 
 	vertices.Add( this );
+#ifdef HLRAD_STUDIOMESH_SHARE
+	stamp = 0;
+	numvertices++;
+#endif
 }
 
 CVertex :: ~CVertex()
@@ -188,7 +226,12 @@ CVertex :: ~CVertex()
 		neighbor.Remove( neighbor[0] );
 	}
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+	vertices[id] = NULL;
+	numvertices--;
+#else
 	vertices.Remove( this );
+#endif
 }
 
 void CVertex :: RemoveIfNonNeighbor( CVertex *n )
@@ -258,6 +301,18 @@ static float ComputeEdgeCollapseCost( CVertex *u, CVertex *v )
 	return edgelength * curvature;
 }
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+static void PushEdgeCost( CVertex *v )
+{
+	collapsecost_t	c;
+
+	c.objdist = v->objdist;
+	c.id = v->id;
+	c.stamp = ++v->stamp;
+	collapseheap.push( c );
+}
+#endif
+
 static void ComputeEdgeCostAtVertex( CVertex *v )
 {
 	// compute the edge collapse cost for all edges that start
@@ -272,6 +327,9 @@ static void ComputeEdgeCostAtVertex( CVertex *v )
 		// v doesn't have neighbors so it costs nothing to collapse
 		v->collapse = NULL;
 		v->objdist = -0.01f;
+#ifdef HLRAD_STUDIOMESH_SHARE
+		PushEdgeCost( v );
+#endif
 		return;
 	}
 
@@ -290,6 +348,9 @@ static void ComputeEdgeCostAtVertex( CVertex *v )
 			v->objdist = dist;		// cost of the collapse
 		}
 	}
+#ifdef HLRAD_STUDIOMESH_SHARE
+	PushEdgeCost( v );
+#endif
 }
 
 static void ComputeAllEdgeCollapseCosts( void )
@@ -364,6 +425,24 @@ static void AddFaces( List<triset> &tri )
 	}
 }
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+static CVertex *MinimumCostEdge( void )
+{
+	// Find the edge that when collapsed will affect model the least.
+	// The heap holds every cost a vertex ever had; only the entry
+	// pushed by its last update is current.
+	while( 1 )
+	{
+		collapsecost_t c = collapseheap.top();
+		collapseheap.pop();
+
+		CVertex *v = vertices[c.id];
+
+		if( v && v->stamp == c.stamp )
+			return v;
+	}
+}
+#else
 static CVertex *MinimumCostEdge( void )
 {
 	// Find the edge that when collapsed will affect model the least.
@@ -384,7 +463,45 @@ static CVertex *MinimumCostEdge( void )
 
 	return mn;
 }
+#endif
+
+#ifdef HLRAD_STUDIOMESH_SHARE
+void ProgressiveMesh( List<vector> &vert, List<triset> &tri, List<int> &map, List<int> &permutation )
+{
+	vertices.num = 0;
+	numvertices = 0;
+	collapseheap = std::priority_queue< collapsecost_t, std::vector< collapsecost_t > >();
+
+	AddVertex( vert );  // put input data into our data structures
+	AddFaces( tri );
 
+	ComputeAllEdgeCollapseCosts();	// cache all edge collapse costs
+	permutation.SetSize( vertices.num );	// allocate space
+	map.SetSize( vertices.num );		// allocate space
+
+	// reduce the object down to nothing:
+	while( numvertices > 0 )
+	{
+		// get the next vertex to collapse
+		CVertex *mn = MinimumCostEdge();
+		// keep track of this vertex, i.e. the collapse ordering
+		permutation[mn->id] = numvertices - 1;
+		// keep track of vertex to which we collapse to
+		map[numvertices-1] = (mn->collapse) ? mn->collapse->id : -1;
+		// Collapse this edge
+		Collapse( mn, mn->collapse );
+	}
+
+	vertices.num = 0;
+	collapseheap = std::priority_queue< collapsecost_t, std::vector< collapsecost_t > >();
+
+	// reorder the map list based on the collapse ordering
+	for( int i = 0; i < map.num; i++ )
+	{
+		map[i] = (map[i] == -1 ) ? 0 : permutation[map[i]];
+	}
+}
+#else
 void ProgressiveMesh( List<vector> &vert, List<triset> &tri, List<int> &map, List<int> &permutation )
 {
 	AddVertex( vert );  // put input data into our data structures
@@ -416,6 +533,7 @@ void ProgressiveMesh( List<vector> &vert, List<triset> &tri, List<int> &map, Lis
 	// The caller of this function should reorder their vertices
 	// according to the returned "permutation".
 }
+#endif
 
 void PermuteVertices( List<int> &permutation, List<vector> &vert, List<triset> &tris )
 {
@@ -101,6 +101,32 @@ static vec3_t   addlight[MAX_PATCHES];
 #endif
 #endif
 
+#ifdef ZHLT_TEXLIGHT
+// The parts of an emitting patch that GatherLight reads for every transfer, copied out of patch_t
+// before bouncing so the gather loop walks a small array. CollectLight keeps totalstyle up to date.
+typedef struct
+{
+#ifdef ZHLT_XASH
+	vec3_t			origin;
+#endif
+	unsigned char	totalstyle[MAXLIGHTMAPS];
+#ifdef HLRAD_AUTOCORING
+	unsigned char	directstyle[MAXLIGHTMAPS];
+	vec3_t			directlight[MAXLIGHTMAPS];
+#endif
+#ifdef HLRAD_BOUNCE_STYLE
+	int				bouncestyle;
+#endif
+#ifdef HLRAD_REFLECTIVITY
+	vec3_t			bouncereflectivity;
+#endif
+} patchemit_t;
+
+static patchemit_t* g_patchemit = NULL;
+#endif
+
+patchgeometry_t* g_patchgeometry = NULL;
+
 vec3_t          g_face_offset[MAX_MAP_FACES];              // for rotating bmodels
 
 vec_t           g_direct_scale = DEFAULT_DLIGHT_SCALE;
@@ -542,6 +568,9 @@ static void     ReadLightFile(const char* const filename)
     short           argCnt;
     unsigned int    file_texlights = 0;
 
+#ifdef ZHLT_STAGECACHE
+    StageCacheInputFile(filename);
+#endif
     f = fopen(filename, "r");
     if (!f)
     {
@@ -2446,7 +2475,7 @@ static void     MakePatches()
 
     Log("Create Patches : ");
 #ifdef HLRAD_MORE_PATCHES
-	g_patches = (patch_t *)AllocBlock (MAX_PATCHES * sizeof (patch_t));
+	g_patches = (patch_t *)AllocHuge (MAX_PATCHES * sizeof (patch_t));
 #endif
 
     for (i = 0; i < g_nummodels; i++)
@@ -2696,41 +2725,189 @@ static void     MakePatches()
 }
 
 // =====================================================================================
-//  patch_sorter
+//  SortPatches helpers
+//      The patches are ordered by face and then along a Morton curve through their origins, so
+//      patches that are close in space get close indices; that keeps the runs in the transfer
+//      lists long. The keys are sorted with a parallel LSD radix sort, 8 bits per pass, in chunks
+//      that each own a contiguous range of the array.
 // =====================================================================================
-static int CDECL patch_sorter(const void* p1, const void* p2)
+typedef struct
 {
-    patch_t*        patch1 = (patch_t*)p1;
-    patch_t*        patch2 = (patch_t*)p2;
+	unsigned long long key;
+	unsigned index;
+} patchsortkey_t;
 
-    if (patch1->faceNumber < patch2->faceNumber)
-    {
-        return -1;
-    }
-    else if (patch1->faceNumber > patch2->faceNumber)
-    {
-        return 1;
-    }
-    else
-    {
-        return 0;
-    }
+#define PATCHSORT_MORTONBITS 16 // per axis; the face number takes the top 16 bits
+
+static patchsortkey_t* g_patchsortkeys;
+static patchsortkey_t* g_patchsorttemp;
+static unsigned g_patchsortnumchunks;
+static unsigned g_patchsortshift;
+static unsigned (*g_patchsortcounts)[256]; // per chunk: digit histogram, then output cursors
+static vec3_t g_patchsortmins;
+static vec_t g_patchsortscale;
+
+static void PatchSortChunk (int chunk, unsigned &start, unsigned &end)
+{
+	start = (unsigned)((unsigned long long)g_num_patches * chunk / g_patchsortnumchunks);
+	end = (unsigned)((unsigned long long)g_num_patches * (chunk + 1) / g_patchsortnumchunks);
+}
+
+static unsigned long long MortonSpread (unsigned v)
+{
+	unsigned long long x = v & ((1 << PATCHSORT_MORTONBITS) - 1);
+	x = (x | (x << 32)) & 0x001f00000000ffffULL;
+	x = (x | (x << 16)) & 0x001f0000ff0000ffULL;
+	x = (x | (x << 8)) & 0x100f00f00f00f00fULL;
+	x = (x | (x << 4)) & 0x10c30c30c30c30c3ULL;
+	x = (x | (x << 2)) & 0x1249249249249249ULL;
+	return x;
+}
+
+static void PatchSortMakeKeys (int chunk)
+{
+	unsigned start, end;
+	PatchSortChunk (chunk, start, end);
+	for (unsigned i = start; i < end; i++)
+	{
+		const patch_t *patch = &g_patches[i];
+		unsigned long long morton = 0;
+		for (int k = 0; k < 3; k++)
+		{
+			vec_t v = (patch->origin[k] - g_patchsortmins[k]) * g_patchsortscale;
+			unsigned q = (unsigned)qmax (0, qmin (v, (vec_t)((1 << PATCHSORT_MORTONBITS) - 1)));
+			morton |= MortonSpread (q) << k;
+		}
+		g_patchsortkeys[i].key = ((unsigned long long)patch->faceNumber << (3 * PATCHSORT_MORTONBITS)) | morton;
+		g_patchsortkeys[i].index = i;
+	}
+}
+
+static void PatchSortCount (int chunk)
+{
+	unsigned start, end;
+	unsigned *counts = g_patchsortcounts[chunk];
+	PatchSortChunk (chunk, start, end);
+	memset (counts, 0, 256 * sizeof (unsigned));
+	for (unsigned i = start; i < end; i++)
+	{
+		counts[(g_patchsortkeys[i].key >> g_patchsortshift) & 0xff]++;
+	}
+}
+
+static void PatchSortScatter (int chunk)
+{
+	unsigned start, end;
+	unsigned *cursors = g_patchsortcounts[chunk];
+	PatchSortChunk (chunk, start, end);
+	for (unsigned i = start; i < end; i++)
+	{
+		const patchsortkey_t &item = g_patchsortkeys[i];
+		g_patchsorttemp[cursors[(item.key >> g_patchsortshift) & 0xff]++] = item;
+	}
 }
 
 // =====================================================================================
-//  patch_sorter
+//  SortPatches
 //      This sorts the patches by facenumber, which makes their runs compress even better
 // =====================================================================================
 static void     SortPatches()
 {
+	unsigned x;
+	int k;
+
+	if (g_num_patches == 0)
+	{
+		return;
+	}
+
+	// quantise the origins into the patch bounds
+	{
+		vec3_t maxs;
+		vec_t size = 0;
+		VectorCopy (g_patches[0].origin, g_patchsortmins);
+		VectorCopy (g_patches[0].origin, maxs);
+		for (x = 1; x < g_num_patches; x++)
+		{
+			for (k = 0; k < 3; k++)
+			{
+				g_patchsortmins[k] = qmin (g_patchsortmins[k], g_patches[x].origin[k]);
+				maxs[k] = qmax (maxs[k], g_patches[x].origin[k]);
+			}
+		}
+		for (k = 0; k < 3; k++)
+		{
+			size = qmax (size, maxs[k] - g_patchsortmins[k]);
+		}
+		g_patchsortscale = size > 0? ((1 << PATCHSORT_MORTONBITS) - 1) / size: 0;
+	}
+
+	g_patchsortnumchunks = qmax (1, qmin (g_numthreads, (int)((g_num_patches + 4095) / 4096)));
+	g_patchsortkeys = (patchsortkey_t *)malloc (g_num_patches * sizeof (patchsortkey_t));
+	g_patchsorttemp = (patchsortkey_t *)malloc (g_num_patches * sizeof (patchsortkey_t));
+	g_patchsortcounts = (unsigned (*)[256])malloc (g_patchsortnumchunks * sizeof (unsigned [256]));
+	hlassume (g_patchsortkeys != NULL && g_patchsorttemp != NULL && g_patchsortcounts != NULL, assume_NoMemory);
+
+	RunThreadsOnIndividual (g_patchsortnumchunks, false, PatchSortMakeKeys);
+
+	for (g_patchsortshift = 0; g_patchsortshift < 64; g_patchsortshift += 8)
+	{
+		RunThreadsOnIndividual (g_patchsortnumchunks, false, PatchSortCount);
+
+		// turn the histograms into output cursors: digit-major, chunk-minor keeps the sort stable
+		unsigned total = 0;
+		bool trivial = false;
+		for (int digit = 0; digit < 256; digit++)
+		{
+			unsigned digittotal = 0;
+			for (unsigned chunk = 0; chunk < g_patchsortnumchunks; chunk++)
+			{
+				unsigned count = g_patchsortcounts[chunk][digit];
+				g_patchsortcounts[chunk][digit] = total;
+				total += count;
+				digittotal += count;
+			}
+			if (digittotal == g_num_patches)
+			{
+				trivial = true; // every key has this digit, so the pass would not move anything
+			}
+		}
+		if (trivial)
+		{
+			continue;
+		}
+
+		RunThreadsOnIndividual (g_patchsortnumchunks, false, PatchSortScatter);
+		patchsortkey_t *swap = g_patchsortkeys;
+		g_patchsortkeys = g_patchsorttemp;
+		g_patchsorttemp = swap;
+	}
+
+	// move the patches into their sorted order
 #ifdef HLRAD_MORE_PATCHES
 	// SortPatches is the ideal place to do this, because the address of the patches are going to be invalidated.
 	patch_t *old_patches = g_patches;
-	g_patches = (patch_t *)AllocBlock ((g_num_patches + 1) * sizeof (patch_t)); // allocate one extra slot considering how terribly the code were written
-	memcpy (g_patches, old_patches, g_num_patches * sizeof (patch_t));
+	g_patches = (patch_t *)AllocHuge ((g_num_patches + 1) * sizeof (patch_t)); // allocate one extra slot considering how terribly the code were written
+#else
+	patch_t *old_patches = (patch_t *)AllocBlock (g_num_patches * sizeof (patch_t));
+	memcpy (old_patches, g_patches, g_num_patches * sizeof (patch_t));
+#endif
+	for (x = 0; x < g_num_patches; x++)
+	{
+		memcpy (&g_patches[x], &old_patches[g_patchsortkeys[x].index], sizeof (patch_t));
+	}
+#ifdef HLRAD_MORE_PATCHES
+	FreeHuge (old_patches);
+#else
 	FreeBlock (old_patches);
 #endif
-    qsort((void*)g_patches, (size_t) g_num_patches, sizeof(patch_t), patch_sorter);
+
+	free (g_patchsortkeys);
+	g_patchsortkeys = NULL;
+	free (g_patchsorttemp);
+	g_patchsorttemp = NULL;
+	free (g_patchsortcounts);
+	g_patchsortcounts = NULL;
 
     // Fixup g_face_patches & Fixup patch->next
     memset(g_face_patches, 0, sizeof(g_face_patches));
@@ -2785,7 +2962,7 @@ static void     FreePatches()
     }
     memset(g_patches, 0, sizeof(patch_t) * g_num_patches);
 #ifdef HLRAD_MORE_PATCHES
-	FreeBlock (g_patches);
+	FreeHuge (g_patches);
 	g_patches = NULL;
 #endif
 }
@@ -2874,6 +3051,7 @@ static void     CollectLight()
 			if (newstyles[i][j] != 255)
 			{
 				patch->totalstyle[j] = newstyles[i][j];
+				g_patchemit[i].totalstyle[j] = newstyles[i][j];
 				VectorCopy (newtotallight[j], patch->totallight[j]);
 				VectorCopy (addlight[i][j], emitlight[i][j]);
 #ifdef ZHLT_XASH
@@ -2884,6 +3062,7 @@ static void     CollectLight()
 			else
 			{
 				patch->totalstyle[j] = 255;
+				g_patchemit[i].totalstyle[j] = 255;
 			}
 		}
 #else
@@ -3019,7 +3198,7 @@ static void     GatherLight(int threadnum)
                 vec3_t          v;
 #ifdef ZHLT_TEXLIGHT
                  //LRC:
-				patch_t*		emitpatch = &g_patches[patchnum];
+				const patchemit_t*	emitpatch = &g_patchemit[patchnum];
 				unsigned		emitstyle;
 #ifdef HLRAD_OPAQUE_STYLE_BOUNCE
 				int				opaquestyle = -1;
@@ -3415,7 +3594,7 @@ static void     GatherRGBLight(int threadnum)
                 vec3_t          v;
 #ifdef ZHLT_TEXLIGHT
                  //LRC:
-				patch_t*		emitpatch = &g_patches[patchnum];
+				const patchemit_t*	emitpatch = &g_patchemit[patchnum];
 				unsigned		emitstyle;
 #ifdef HLRAD_OPAQUE_STYLE_BOUNCE
 				int				opaquestyle = -1;
@@ -3722,6 +3901,80 @@ static void     GatherRGBLight(int threadnum)
 // =====================================================================================
 //  BounceLight
 // =====================================================================================
+#ifdef ZHLT_TEXLIGHT
+// =====================================================================================
+//  BuildPatchEmitters
+//      copy the fields GatherLight reads from emitting patches into g_patchemit
+// =====================================================================================
+static void     BuildPatchEmitters()
+{
+	unsigned i;
+	int j;
+
+	g_patchemit = (patchemit_t *)AllocHuge ((g_num_patches + 1) * sizeof (patchemit_t));
+	for (i = 0; i < g_num_patches; i++)
+	{
+		const patch_t *patch = &g_patches[i];
+		patchemit_t *emit = &g_patchemit[i];
+#ifdef ZHLT_XASH
+		VectorCopy (patch->origin, emit->origin);
+#endif
+		for (j = 0; j < MAXLIGHTMAPS; j++)
+		{
+			emit->totalstyle[j] = (unsigned char)patch->totalstyle[j];
+#ifdef HLRAD_AUTOCORING
+			emit->directstyle[j] = patch->directstyle[j];
+			VectorCopy (patch->directlight[j], emit->directlight[j]);
+#endif
+		}
+#ifdef HLRAD_BOUNCE_STYLE
+		emit->bouncestyle = patch->bouncestyle;
+#endif
+#ifdef HLRAD_REFLECTIVITY
+		VectorCopy (patch->bouncereflectivity, emit->bouncereflectivity);
+#endif
+	}
+}
+
+static void     FreePatchEmitters()
+{
+	FreeHuge (g_patchemit);
+	g_patchemit = NULL;
+}
+#endif
+
+// =====================================================================================
+//  BuildPatchGeometry
+//      copy the fields MakeScales reads from every other patch into g_patchgeometry
+// =====================================================================================
+static void     BuildPatchGeometry()
+{
+	unsigned i;
+
+	g_patchgeometry = (patchgeometry_t *)AllocHuge ((g_num_patches + 1) * sizeof (patchgeometry_t));
+	for (i = 0; i < g_num_patches; i++)
+	{
+		const patch_t *patch = &g_patches[i];
+		patchgeometry_t *geometry = &g_patchgeometry[i];
+		VectorCopy (patch->origin, geometry->origin);
+		VectorCopy (getPlaneFromFaceNumber (patch->faceNumber)->normal, geometry->normal);
+		geometry->area = patch->area;
+#ifdef HLRAD_ACCURATEBOUNCE_REDUCEAREA
+		geometry->exposure = patch->exposure;
+#endif
+#ifdef HLRAD_ACCURATEBOUNCE
+		geometry->emitter_range = patch->emitter_range;
+		geometry->emitter_skylevel = patch->emitter_skylevel;
+#endif
+	}
+}
+
+static void     FreePatchGeometry()
+{
+	FreeHuge (g_patchgeometry);
+	g_patchgeometry = NULL;
+}
+
 static void     BounceLight()
 {
     unsigned        i;
@@ -4075,7 +4328,13 @@ static void     RadWorld()
 
 #endif
     // build initial facelights
+#ifdef HLRAD_LIGHTCACHE
+	LightCacheLoad ();
+#endif
     NamedRunThreadsOnIndividual(g_numfaces, g_estimate, BuildFacelights);
+#ifdef HLRAD_LIGHTCACHE
+	LightCacheSave ();
+#endif
 
 #ifdef HLRAD_GROWSAMPLE
 	FreePositionMaps ();
@@ -4087,27 +4346,35 @@ static void     RadWorld()
     if (g_numbounce > 0)
     {
         // build transfer lists
+		BuildPatchGeometry ();
         MakeScalesStub();
+		FreePatchGeometry ();
 
 #ifdef HLRAD_MORE_PATCHES
 		// these arrays are only used in CollectLight, GatherLight and BounceLight
 	#ifdef ZHLT_TEXLIGHT
-		emitlight = (vec3_t (*)[MAXLIGHTMAPS])AllocBlock ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
-		addlight = (vec3_t (*)[MAXLIGHTMAPS])AllocBlock ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
+		emitlight = (vec3_t (*)[MAXLIGHTMAPS])AllocHuge ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
+		addlight = (vec3_t (*)[MAXLIGHTMAPS])AllocHuge ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
 	#ifdef ZHLT_XASH
-		emitlight_direction = (vec3_t (*)[MAXLIGHTMAPS])AllocBlock ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
-		addlight_direction = (vec3_t (*)[MAXLIGHTMAPS])AllocBlock ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
+		emitlight_direction = (vec3_t (*)[MAXLIGHTMAPS])AllocHuge ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
+		addlight_direction = (vec3_t (*)[MAXLIGHTMAPS])AllocHuge ((g_num_patches + 1) * sizeof (vec3_t [MAXLIGHTMAPS]));
 	#endif
 	#ifdef HLRAD_AUTOCORING
-		newstyles = (unsigned char (*)[MAXLIGHTMAPS])AllocBlock ((g_num_patches + 1) * sizeof (unsigned char [MAXLIGHTMAPS]));
+		newstyles = (unsigned char (*)[MAXLIGHTMAPS])AllocHuge ((g_num_patches + 1) * sizeof (unsigned char [MAXLIGHTMAPS]));
 	#endif
 	#else
-		emitlight = (vec3_t *)AllocBlock ((g_num_patches + 1) * sizeof (vec3_t));
-		addlight = (vec3_t *)AllocBlock ((g_num_patches + 1) * sizeof (vec3_t));
+		emitlight = (vec3_t *)AllocHuge ((g_num_patches + 1) * sizeof (vec3_t));
+		addlight = (vec3_t *)AllocHuge ((g_num_patches + 1) * sizeof (vec3_t));
 	#endif
 #endif
         // spread light around
+#ifdef ZHLT_TEXLIGHT
+		BuildPatchEmitters ();
+#endif
         BounceLight();
+#ifdef ZHLT_TEXLIGHT
+		FreePatchEmitters ();
+#endif
 
 #ifndef HLRAD_AUTOCORING
         for (int i = 0; i < g_num_patches; i++)
@@ -4124,24 +4391,24 @@ static void     RadWorld()
 #endif
 #ifdef HLRAD_MORE_PATCHES
 	#ifdef ZHLT_TEXLIGHT
-		FreeBlock (emitlight);
+		FreeHuge (emitlight);
 		emitlight = NULL;
-		FreeBlock (addlight);
+		FreeHuge (addlight);
 		addlight = NULL;
 	#ifdef ZHLT_XASH
-		FreeBlock (emitlight_direction);
+		FreeHuge (emitlight_direction);
 		emitlight_direction = NULL;
-		FreeBlock (addlight_direction);
+		FreeHuge (addlight_direction);
 		addlight_direction = NULL;
 	#endif
 	#ifdef HLRAD_AUTOCORING
-		FreeBlock (newstyles);
+		FreeHuge (newstyles);
 		newstyles = NULL;
 	#endif
 	#else
-		FreeBlock (emitlight);
+		FreeHuge (emitlight);
 		emitlight = NULL;
-		FreeBlock (addlight);
+		FreeHuge (addlight);
 		addlight = NULL;
 	#endif
 #endif
@@ -4171,6 +4438,7 @@ static void     RadWorld()
 #endif
 
 #ifdef HLRAD_LOCALTRIANGULATION
+	InitTriangulations ();
 	NamedRunThreadsOnIndividual (g_numfaces, g_estimate, CreateTriangulations);
 
 #endif
@@ -4278,7 +4546,11 @@ static void     Usage()
     Log("    -notexscale     : Do not scale radiosity patches with texture scale\n");
     Log("    -coring #       : Set lighting threshold before blackness\n");
     Log("    -dlight #       : Set direct lighting threshold\n");
-    Log("    -nolerp         : Disable radiosity interpolation, nearest point instead\n\n");
+    Log("    -nolerp         : Disable radiosity interpolation, nearest point instead\n");
+#ifdef HLRAD_LOCALTRIANGULATION
+    Log("    -lerpcache #    : Set memory limit for cached interpolation data (in MB)\n");
+#endif
+    Log("\n");
     Log("    -fade #         : Set global fade (larger values = shorter lights)\n");
 #ifndef HLRAD_ARG_MISC
     Log("    -falloff #      : Set global falloff mode (1 = inv linear, 2 = inv square)\n");
@@ -4291,13 +4563,21 @@ static void     Usage()
     Log("    -sky #          : Set ambient sunlight contribution in the shade outside\n");
     Log("    -lights file    : Manually specify a lights.rad file to use\n");
     Log("    -noskyfix       : Disable light_environment being global\n");
-    Log("    -incremental    : Use or create an incremental transfer list file\n\n");
+    Log("    -incremental    : Use or create an incremental transfer list file\n");
+#ifdef HLRAD_LIGHTCACHE
+    Log("    -lightcache     : Use or create a light visibility cache file\n");
+#endif
+    Log("\n");
     Log("    -dump           : Dumps light patches to a file for hlrad debugging info\n\n");
     Log("    -texdata #      : Alter maximum texture memory limit (in kb)\n");
     Log("    -lightdata #    : Alter maximum lighting memory limit (in kb)\n"); //lightdata
     Log("    -chart          : display bsp statitics\n");
     Log("    -low | -high    : run program an altered priority level\n");
     Log("    -nolog          : Do not generate the compile logfiles\n");
+#ifdef ZHLT_STAGECACHE
+    Log("    -stagecache dir : Reuse the outputs of an earlier run with the same inputs, kept in dir\n");
+    Log("                      (textures are compared by path, size and time, not contents)\n");
+#endif
     Log("    -threads #      : manually specify the number of threads to run\n");
 #ifdef SYSTEM_WIN32
     Log("    -estimate       : display estimated time during compile\n");
@@ -4530,6 +4810,9 @@ static void     Settings()
     safe_snprintf(buf2, sizeof(buf2), "%3.3f", DEFAULT_CORING);
     Log("coring threshold     [ %17s ] [ %17s ]\n", buf1, buf2);
     Log("patch interpolation  [ %17s ] [ %17s ]\n", g_lerp_enabled ? "on" : "off", DEFAULT_LERP_ENABLED ? "on" : "off");
+#ifdef HLRAD_LOCALTRIANGULATION
+    Log("lerp cache size (MB) [ %17d ] [ %17d ]\n", g_lerpcachesize, DEFAULT_LERPCACHESIZE);
+#endif
 
     Log("\n");
 
@@ -4590,6 +4873,9 @@ static void     Settings()
     Log("opaque entities      [ %17s ] [ %17s ]\n", g_allow_opaques ? "on" : "off", DEFAULT_ALLOW_OPAQUES ? "on" : "off");
     Log("sky lighting fix     [ %17s ] [ %17s ]\n", g_sky_lighting_fix ? "on" : "off", DEFAULT_SKY_LIGHTING_FIX ? "on" : "off");
     Log("incremental          [ %17s ] [ %17s ]\n", g_incremental ? "on" : "off", DEFAULT_INCREMENTAL ? "on" : "off");
+#ifdef HLRAD_LIGHTCACHE
+    Log("light cache          [ %17s ] [ %17s ]\n", g_lightcache ? "on" : "off", DEFAULT_LIGHTCACHE ? "on" : "off");
+#endif
     Log("dump                 [ %17s ] [ %17s ]\n", g_dumppatches ? "on" : "off", DEFAULT_DUMPPATCHES ? "on" : "off");
 
     // ------------------------------------------------------------------------
@@ -5022,6 +5308,24 @@ int             main(const int argc, char** argv)
         {
              g_lerp_enabled  = false;
         }
+#ifdef HLRAD_LOCALTRIANGULATION
+        else if (!strcasecmp(argv[i], "-lerpcache"))
+        {
+            if (i + 1 < argc)
+            {
+                g_lerpcachesize = atoi(argv[++i]);
+                if (g_lerpcachesize < 0)
+                {
+                    Log("expected a non-negative value for '-lerpcache'\n");
+                    Usage();
+                }
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
         else if (!strcasecmp(argv[i], "-chop"))
         {
             if (i + 1 < argc)	//added "1" .--vluzacn
@@ -5204,6 +5508,12 @@ int             main(const int argc, char** argv)
         {
             g_incremental = true;
         }
+#ifdef HLRAD_LIGHTCACHE
+        else if (!strcasecmp(argv[i], "-lightcache"))
+        {
+            g_lightcache = true;
+        }
+#endif
         else if (!strcasecmp(argv[i], "-chart"))
         {
             g_chart = true;
@@ -5220,6 +5530,19 @@ int             main(const int argc, char** argv)
         {
             g_log = false;
         }
+#ifdef ZHLT_STAGECACHE
+        else if (!strcasecmp(argv[i], "-stagecache"))
+        {
+            if (i + 1 < argc)
+            {
+                g_stagecache = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
         else if (!strcasecmp(argv[i], "-gamma"))
         {
             if (i + 1 < argc)	//added "1" .--vluzacn
@@ -5824,6 +6147,10 @@ int             main(const int argc, char** argv)
 	hlassume (CalcFaceExtents_test (), assume_first);
 #endif
 #endif
+    // rad rebuilds lighting and entities and may append texinfo; it writes lightofs, styles and
+    // texinfo of every face, so the faces are copied and only the rest stays in the mapped bsp
+    g_bspfixedlumps = ~((1u << LUMP_TEXINFO) | (1u << LUMP_LIGHTING) | (1u << LUMP_ENTITIES));
+    g_bspmappedlumps = g_bspfixedlumps & ~(1u << LUMP_FACES);
     dtexdata_init();
     atexit(dtexdata_free);
     // END INIT
@@ -5845,6 +6172,10 @@ int             main(const int argc, char** argv)
     DefaultExtension(g_source, ".bsp");
 #endif
     LoadBSPFile(g_source);
+#ifdef ZHLT_STAGECACHE
+    StageCacheBegin("hlrad", argc, argv, mapname_from_arg);
+    StageCacheInputBSP();
+#endif
 #ifdef ZHLT_64BIT_FIX
 #ifndef PLATFORM_CAN_CALC_EXTENT
 	char extentfilename[_MAX_PATH];
@@ -5855,6 +6186,9 @@ int             main(const int argc, char** argv)
 		hlassume (false, assume_NO_EXTENT_FILE);
 	}
 	LoadExtentFile (extentfilename);
+#ifdef ZHLT_STAGECACHE
+	StageCacheInputFile (extentfilename);
+#endif
 #endif
 #endif
     ParseEntities();
@@ -5937,6 +6271,44 @@ int             main(const int argc, char** argv)
 	}
 #endif
 
+#ifdef ZHLT_STAGECACHE
+    {
+        char            name[_MAX_PATH];
+
+        StageCacheInputTextures();
+#ifdef ZHLT_STUDIOSHADOWS
+        {
+            // env_static and zhlt_studioshadow models shadow the map
+            uint64_t        studiohash = HashStudioModels();
+
+            StageCacheInputData(&studiohash, sizeof(studiohash));
+        }
+#endif
+        // the transfer and light cache files are read and rewritten, so they are both inputs and outputs
+        if (g_incremental)
+        {
+            safe_snprintf(name, _MAX_PATH, "%s.inc", g_Mapname);
+            StageCacheInputFile(name);
+            StageCacheOutput(".inc");
+        }
+#ifdef HLRAD_LIGHTCACHE
+        if (g_lightcache)
+        {
+            safe_snprintf(name, _MAX_PATH, "%s.lc", g_Mapname);
+            StageCacheInputFile(name);
+            StageCacheOutput(".lc");
+        }
+#endif
+        StageCacheOutput(".bsp");
+        if (StageCacheRestore())
+        {
+            end = I_FloatTime();
+            LogTimeElapsed(end - start);
+            return 0;
+        }
+    }
+#endif
+
     RadWorld();
 
 #ifdef ZHLT_STUDIOSHADOWS
@@ -5963,6 +6335,9 @@ int             main(const int argc, char** argv)
         PrintBSPFileSizes();
 
     WriteBSPFile(g_source);
+#ifdef ZHLT_STAGECACHE
+    StageCacheStore();
+#endif
 
     end = I_FloatTime();
     LogTimeElapsed(end - start);
@@ -24,6 +24,7 @@
 #ifdef ZHLT_PARAMFILE
 #include "cmdlinecfg.h"
 #endif
+#include "stagecache.h"
 
 #ifdef SYSTEM_WIN32
 #pragma warning(disable: 4142 4028)
@@ -54,6 +55,9 @@
 #define DEFAULT_METHOD eMethodSparseVismatrix
 #endif
 #define DEFAULT_LERP_ENABLED        true
+#ifdef HLRAD_LOCALTRIANGULATION
+#define DEFAULT_LERPCACHESIZE       256 // MB
+#endif
 #define DEFAULT_FADE                1.0
 #ifndef HLRAD_ARG_MISC
 #define DEFAULT_FALLOFF             2
@@ -99,6 +103,9 @@
 #define DEFAULT_SMOOTHING2_VALUE	-1.0
 #endif
 #define DEFAULT_INCREMENTAL         false
+#ifdef HLRAD_LIGHTCACHE
+#define DEFAULT_LIGHTCACHE          false
+#endif
 
 #ifdef ZHLT_PROGRESSFILE // AJM
 #define DEFAULT_PROGRESSFILE NULL // progress file is only used if g_progressfile is non-null
@@ -353,6 +360,9 @@ typedef struct directlight_s
 #ifdef HLRAD_GatherPatchLight
 	bool			topatch;
 #endif
+#ifdef HLRAD_FACELIGHT_CULL
+	int				index; // into facelightcull_t::classes
+#endif
 
 	// used by worldlights
 	short			facenum;
@@ -525,6 +535,22 @@ typedef struct patch_s
 	short	modelnum;
 } patch_t;
 
+// The fields of patch_t that MakeScales reads for every other patch, packed together so the
+// inner loop doesn't drag whole patches through the cache. Only valid while transfers are made.
+typedef struct
+{
+    vec3_t          origin;
+    vec3_t          normal;
+    vec_t           area;
+#ifdef HLRAD_ACCURATEBOUNCE_REDUCEAREA
+	vec_t			exposure;
+#endif
+#ifdef HLRAD_ACCURATEBOUNCE
+	vec_t			emitter_range;
+	int				emitter_skylevel;
+#endif
+} patchgeometry_t;
+
 #ifdef ZHLT_TEXLIGHT
 //LRC
 vec3_t* GetTotalLight(patch_t* patch, int style
@@ -724,10 +750,10 @@ extern patch_t* g_patches; // shrinked to its real size, because 1048576 patches
 extern patch_t  g_patches[MAX_PATCHES];
 #endif
 extern unsigned g_num_patches;
+extern patchgeometry_t* g_patchgeometry;
 
 extern int      leafparents[MAX_MAP_LEAFS];
 extern int      nodeparents[MAX_MAP_NODES];
-extern float    g_trace_fraction;
 extern float    g_lightscale;
 extern float    g_dlight_threshold;
 extern float    g_coring;
@@ -767,11 +793,15 @@ extern vec_t    g_fade;
 extern int      g_falloff;
 #endif
 extern bool     g_incremental;
+#ifdef HLRAD_LIGHTCACHE
+extern bool     g_lightcache;
+#endif
 extern bool     g_circus;
 #ifdef HLRAD_SUNSPREAD
 extern bool		g_allow_spread;
 #endif
 extern bool     g_sky_lighting_fix;
+extern bool     g_allow_opaques;
 extern vec_t    g_chop;    // Chop value for normal textures
 extern vec_t    g_texchop; // Chop value for texture lights
 extern opaqueList_t* g_opaque_face_list;
@@ -910,18 +940,23 @@ extern void		CreateFacelightDependencyList (); // run before AddPatchLights
 extern void		AddPatchLights (int facenum);
 extern void		FreeFacelightDependencyList ();
 #endif
+// what one segment trace found; every call fills its own, so worker threads share nothing
+typedef struct
+{
+	int				contents;		// what the world part ended on: CONTENTS_EMPTY, CONTENTS_SOLID or CONTENTS_SKY
+	float			fraction;		// how far along the segment that happened, 1 if it didn't
+	vec3_t			skyhit;			// where the segment went into the sky, stop if it didn't
+	vec3_t			transparency;	// light let through by the translucent entities crossed
+	int				opaquestyle;	// style of the toggleable opaque entity crossed, -1 if none
+} trace_t;
+#define TRACE_SKY		1	// only reaching the sky counts as clear; entities are tested up to skyhit
+#define TRACE_WORLDONLY	2	// don't test the opaque entities
+extern bool		TraceSegment (const vec3_t start, const vec3_t stop, int flags, trace_t *trace); // true when blocked
 extern int      TestLine(const vec3_t start, const vec3_t stop
 #ifdef HLRAD_OPAQUEINSKY_FIX
 						 , vec_t *skyhitout = NULL
 #endif
 						 );
-#ifndef HLRAD_WATERBLOCKLIGHT
-extern int      TestLine_r(int node, float p1f, float p2f, const vec3_t start, const vec3_t stop
-#ifdef HLRAD_OPAQUEINSKY_FIX
-						   , vec_t *skyhitout = NULL
-#endif
-						   );
-#endif
 #ifdef HLRAD_OPAQUE_NODE
 #define OPAQUE_NODE_INLINECALL
 #ifdef OPAQUE_NODE_INLINECALL
@@ -1055,7 +1090,12 @@ extern void	FreeStyleArrays();
 
 // lerp.c
 #ifdef HLRAD_LOCALTRIANGULATION
-extern void CreateTriangulations (int facenum);
+extern int g_lerpcachesize;
+extern int g_triangulationorder[MAX_MAP_FACES]; // faces in the order the lerp stage visits them
+extern void InitTriangulations ();
+extern void CreateTriangulations (int index);
+extern void AcquireTriangulations (int facenum); // run before InterpolateSampleLight on samples of this face
+extern void ReleaseTriangulations (int facenum);
 extern void GetTriangulationPatches (int facenum, int *numpatches, const int **patches);
 extern void InterpolateSampleLight (const vec3_t position, int surface, int numstyles, const int *styles, vec3_t *outs
 #ifdef ZHLT_XASH
@@ -1145,8 +1185,16 @@ extern void ComputeLeafAmbientLighting( void );
 // studio.cpp
 extern void LoadStudioModels( void );
 extern void FreeStudioModels( void );
+extern uint64_t HashStudioModels( void );
 extern bool TestSegmentAgainstStudioList( const vec_t* p1, const vec_t* p2 );
 extern bool g_nostudioshadow;
 #endif
 
+#ifdef HLRAD_LIGHTCACHE
+// lightcache.cpp
+extern void LightCacheLoad ();
+extern void LightCacheSave ();
+extern bool TestLightSegment (const vec3_t start, const vec3_t stop, bool sky, vec3_t &transparency, int &opaquestyle);
+#endif
+
 #endif //HLRAD_H__
@@ -540,12 +540,7 @@ static bool IsPositionValid (positionmap_t *map, const vec3_t &pos_st, vec3_t &p
 	{
 		// if the sample has gone beyond face boundaries, be careful that it hasn't passed a wall
 		vec3_t test;
-#ifdef HLRAD_HULLU
-		vec3_t transparency;
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-		int opaquestyle;
-#endif
+		trace_t trace;
 
 		VectorCopy (pos, test);
 		snap_to_winding_noedge (*map->facewindingwithoffset, map->faceplanewithoffset, test, DEFAULT_EDGE_WIDTH, 4 * DEFAULT_EDGE_WIDTH);
@@ -555,23 +550,7 @@ static bool IsPositionValid (positionmap_t *map, const vec3_t &pos_st, vec3_t &p
 			return false;
 		}
 
-		if (TestLine (pos, test) != CONTENTS_EMPTY)
-		{
-			return false;
-		}
-
-		if (TestSegmentAgainstOpaqueList (pos, test
-#ifdef HLRAD_HULLU
-				, transparency
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-				, opaquestyle
-#endif
-				) == true
-#ifdef HLRAD_OPAQUE_STYLE
-			|| opaquestyle != -1
-#endif
-			)
+		if (TraceSegment (pos, test, 0, &trace) || trace.opaquestyle != -1)
 		{
 			return false;
 		}
@@ -431,12 +431,9 @@ static void     TestPatchToFace(const unsigned patchnum, const int facenum, cons
             {
                 unsigned        m = patch2 - g_patches;
 
-#ifdef HLRAD_HULLU
-                vec3_t		transparency = {1.0,1.0,1.0};
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-				int opaquestyle = -1;
-#endif
+				trace_t trace;
+				vec3_t &transparency = trace.transparency;
+				int &opaquestyle = trace.opaquestyle;
 
                 // check vis between patch and patch2
                 // if bit has not already been set
@@ -486,39 +483,13 @@ static void     TestPatchToFace(const unsigned patchnum, const int facenum, cons
 						continue;
 					}
 #endif
-#ifdef HLRAD_WATERBLOCKLIGHT
-                    if (TestLine(
+                    if (TraceSegment (
 	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
 						origin1, origin2
 	#else
 						patch->origin, patch2->origin
 	#endif
-						) != CONTENTS_EMPTY)
-#else
-                    if (TestLine_r(head, 0.0f, 1.0f, 
-	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-						origin1, origin2
-	#else
-						patch->origin, patch2->origin
-	#endif
-						) != CONTENTS_EMPTY)
-#endif
-					{
-						continue;
-					}
-                    if (TestSegmentAgainstOpaqueList(
-	#ifdef HLRAD_ACCURATEBOUNCE_ALTERNATEORIGIN
-						origin1, origin2
-	#else
-						patch->origin, patch2->origin
-	#endif
-#ifdef HLRAD_HULLU
-						, transparency
-#endif
-#ifdef HLRAD_OPAQUE_STYLE
-						, opaquestyle
-#endif
-					))
+						, 0, &trace))
 					{
 						continue;
 					}
@@ -2,6 +2,7 @@
 #include "meshtrace.h"
 #include "filelib.h"
 #include "stringlib.h"
+#include "checksum.h"
 
 #ifdef ZHLT_STUDIOSHADOWS
 
@@ -9,9 +10,187 @@
 
 model_t models[MAX_MODELS];
 int num_models;
+static bool studio_fs_ready = false;
+
+// the game filesystem is set up by the first caller that needs a model, so maps
+// without studio shadows never go looking for a game directory
+static void StudioInitFileSystem( void )
+{
+	if( studio_fs_ready ) return;
+
+	FS_Init();
+	studio_fs_ready = true;
+}
+
+// the model an entity casts a studio shadow with, "" when its model key is empty,
+// NULL when it casts none
+static const char *StudioShadowModel( entity_t *e )
+{
+	const char *name = ValueForKey( e, "classname" );
+
+	if( !stricmp( name, "env_static" ))
+	{
+		if( IntForKey( e, "spawnflags" ) & 4 )
+			return NULL; // shadow disabled
+	}
+	else if( !IntForKey( e, "zhlt_studioshadow" ))
+	{
+		return NULL;
+	}
+
+	return ValueForKey( e, "model" );
+}
+
+static uint64_t HashStudioFile( uint64_t hash, const char *filename, studiohdr_t *phdr_out )
+{
+	long	length;
+	byte	*data = FS_LoadFile( filename, &length, false );
+
+	hash = HashBytes64( filename, Q_strlen( filename ) + 1, hash );
+	if( !data )
+	{
+		length = -1;
+		return HashBytes64( &length, sizeof( length ), hash );
+	}
+
+	hash = HashBytes64( &length, sizeof( length ), hash );
+	hash = HashBytes64( data, length, hash );
+	if( phdr_out && length >= (long)sizeof( studiohdr_t ))
+		*phdr_out = *(studiohdr_t *)data;
+	Free( data );
+
+	return hash;
+}
+
+// =====================================================================================
+//  HashStudioModels
+//      the contents of every .mdl (and T.mdl) LoadStudioModels would read, for the keys
+//      of the caches whose results depend on studio shadows
+// =====================================================================================
+uint64_t HashStudioModels( void )
+{
+	uint64_t hash = 0;
+	int i, j;
+
+	if( g_nostudioshadow ) return hash;
+
+	for( i = 0; i < g_numentities; i++ )
+	{
+		const char *model = StudioShadowModel( &g_entities[i] );
+
+		if( !model || !*model )
+			continue;
+
+		// every placement of a model reads the same file
+		for( j = 0; j < i; j++ )
+		{
+			const char *other = StudioShadowModel( &g_entities[j] );
+
+			if( other && !Q_stricmp( other, model ))
+				break;
+		}
+		if( j < i )
+			continue;
+
+		StudioInitFileSystem();
+
+		studiohdr_t hdr;
+		hdr.numtextures = -1;
+		hash = HashStudioFile( hash, model, &hdr );
+
+		// same rule as LoadStudioModel for textures kept in a separate file
+		if( hdr.numtextures == 0 )
+		{
+			char texname[128], texpath[128];
+
+			Q_strncpy( texname, model, sizeof( texname ));
+			StripExtension( texname );
+			Q_snprintf( texpath, sizeof( texpath ), "%sT.mdl", texname );
+			hash = HashStudioFile( hash, texpath, NULL );
+		}
+	}
+
+	return hash;
+}
+#ifdef HLRAD_STUDIOMESH_SHARE
+modelinstance_t instances[MAX_MODELS];
+int num_instances;
+
+static model_t *FindStudioModel( const char *modelname, int body, int skin, int trace_mode )
+{
+	for( int i = 0; i < num_models; i++ )
+	{
+		model_t *m = &models[i];
+
+		if( m->body == body && m->skin == skin && m->trace_mode == trace_mode && !Q_stricmp( m->name, modelname ))
+			return m;
+	}
+
+	return NULL;
+}
+
+// inverse of an AngleMatrix placement: rotation, the (per axis) scale and the origin
+static bool InvertStudioTransform( matrix3x4 in, matrix3x4 out )
+{
+	vec_t det = in[0][0] * ( in[1][1] * in[2][2] - in[1][2] * in[2][1] )
+		- in[0][1] * ( in[1][0] * in[2][2] - in[1][2] * in[2][0] )
+		+ in[0][2] * ( in[1][0] * in[2][1] - in[1][1] * in[2][0] );
+
+	if( fabs( det ) < 1e-6 )
+		return false;
+
+	vec_t invdet = 1.0 / det;
+
+	out[0][0] = ( in[1][1] * in[2][2] - in[1][2] * in[2][1] ) * invdet;
+	out[0][1] = ( in[0][2] * in[2][1] - in[0][1] * in[2][2] ) * invdet;
+	out[0][2] = ( in[0][1] * in[1][2] - in[0][2] * in[1][1] ) * invdet;
+	out[1][0] = ( in[1][2] * in[2][0] - in[1][0] * in[2][2] ) * invdet;
+	out[1][1] = ( in[0][0] * in[2][2] - in[0][2] * in[2][0] ) * invdet;
+	out[1][2] = ( in[0][2] * in[1][0] - in[0][0] * in[1][2] ) * invdet;
+	out[2][0] = ( in[1][0] * in[2][1] - in[1][1] * in[2][0] ) * invdet;
+	out[2][1] = ( in[0][1] * in[2][0] - in[0][0] * in[2][1] ) * invdet;
+	out[2][2] = ( in[0][0] * in[1][1] - in[0][1] * in[1][0] ) * invdet;
+
+	for( int i = 0; i < 3; i++ )
+		out[i][3] = -( out[i][0] * in[0][3] + out[i][1] * in[1][3] + out[i][2] * in[2][3] );
+
+	return true;
+}
+
+static void AddStudioInstance( model_t *m, const vec3_t origin, const vec3_t angles, const vec3_t scale )
+{
+	if( num_instances >= MAX_MODELS )
+	{
+		Developer( DEVELOPER_LEVEL_ERROR, "AddStudioInstance: MAX_MODELS exceeded\n" );
+		return;
+	}
+
+	modelinstance_t *inst = &instances[num_instances];
+
+	m->mesh.AngleMatrix( angles, origin, scale, inst->transform );
+
+	if( !InvertStudioTransform( inst->transform, inst->invtransform ))
+	{
+		Warning( "AddStudioInstance: %s has a degenerate placement\n", m->name );
+		return;
+	}
+
+	inst->model = m;
+	num_instances++;
+}
+#endif
 
 void LoadStudioModel( const char *modelname, const vec3_t origin, const vec3_t angles, const vec3_t scale, int body, int skin, int trace_mode )
 {
+#ifdef HLRAD_STUDIOMESH_SHARE
+	model_t *shared = FindStudioModel( modelname, body, skin, trace_mode );
+
+	if( shared )
+	{
+		AddStudioInstance( shared, origin, angles, scale );
+		return;
+	}
+#endif
 	if( num_models >= MAX_MODELS )
 	{
 		Developer( DEVELOPER_LEVEL_ERROR, "LoadStudioModel: MAX_MODELS exceeded\n" );
@@ -100,20 +279,88 @@ void LoadStudioModel( const char *modelname, const vec3_t origin, const vec3_t a
 #endif
 	}
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+	// the mesh is built in object space by BuildStudioMeshes and placed by each instance
+	VectorClear( m->origin );
+	VectorClear( m->angles );
+	VectorFill( m->scale, 1.0f );
+#else
 	VectorCopy( origin, m->origin );
 	VectorCopy( angles, m->angles );
 	VectorCopy( scale, m->scale );
+#endif
 
 	m->trace_mode = trace_mode;
 
 	m->body = body;
 	m->skin = skin;
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+	num_models++;
+
+	AddStudioInstance( m, origin, angles, scale );
+#else
 	m->mesh.StudioConstructMesh( m );
 
 	num_models++;
+#endif
+}
+
+#ifdef HLRAD_STUDIOMESH_SHARE
+static void BuildStudioMesh( int modelnum )
+{
+	model_t *m = &models[modelnum];
+
+	m->mesh.StudioConstructMesh( m );
 }
 
+// =====================================================================================
+//  BuildStudioMeshes
+//      one mesh per distinct model, then the world bounds of every placement
+// =====================================================================================
+static void BuildStudioMeshes( void )
+{
+	int i, j;
+
+	if( num_models > 0 )
+	{
+		NamedRunThreadsOnIndividual( num_models, g_estimate, BuildStudioMesh );
+	}
+
+	for( i = j = 0; i < num_instances; i++ )
+	{
+		modelinstance_t *inst = &instances[i];
+		mmesh_t *pMesh = inst->model->mesh.GetMesh();
+
+		if( pMesh->numfacets <= 0 )
+			continue; // mesh failed to build
+
+		VectorFill( inst->absmin, 999999.0f );
+		VectorFill( inst->absmax, -999999.0f );
+
+		for( int k = 0; k < 8; k++ )
+		{
+			vec3_t corner, point;
+
+			corner[0] = ( k & 1 ) ? pMesh->maxs[0] : pMesh->mins[0];
+			corner[1] = ( k & 2 ) ? pMesh->maxs[1] : pMesh->mins[1];
+			corner[2] = ( k & 4 ) ? pMesh->maxs[2] : pMesh->mins[2];
+			inst->model->mesh.VectorTransform( corner, inst->transform, point );
+
+			for( int l = 0; l < 3; l++ )
+			{
+				inst->absmin[l] = qmin( inst->absmin[l], point[l] );
+				inst->absmax[l] = qmax( inst->absmax[l], point[l] );
+			}
+		}
+
+		instances[j++] = *inst;
+	}
+
+	num_instances = j;
+}
+#endif
+
 // =====================================================================================
 //  LoadStudioModels
 // =====================================================================================
@@ -121,45 +368,28 @@ void LoadStudioModels( void )
 {
 	memset( models, 0, sizeof( models ));
 	num_models = 0;
+#ifdef HLRAD_STUDIOMESH_SHARE
+	memset( instances, 0, sizeof( instances ));
+	num_instances = 0;
+#endif
 
 	if( g_nostudioshadow ) return;
 
-	// Removed for now, because if there's a "maps" in the working directory path
-	// (as there is in the path to tha Afterburner map sources), the code assumes
-	// that it can initialise a game filesystem. This causes it to crash.
-	// We need to take a proper look at this, but until then I've removed it.
-	//FS_Init();
-
 	for( int i = 0; i < g_numentities; i++ )
 	{
-		const char *name, *model;
+		const char *model;
 		vec3_t origin, angles;
 
 		entity_t* e = &g_entities[i];
-		name = ValueForKey( e, "classname" );
-
-		if( !stricmp( name, "env_static" ))
-		{
-			int spawnflags = IntForKey( e, "spawnflags" );
-			if( spawnflags & 4 ) continue; // shadow disabled
+		model = StudioShadowModel( e );
 
-			model = ValueForKey( e, "model" );
-
-			if( !model || !*model )
-			{
-				Developer( DEVELOPER_LEVEL_WARNING, "env_static has empty model field\n" );
-				continue;
-			}
-		}
-		else if( IntForKey( e, "zhlt_studioshadow" ))
-		{
-			model = ValueForKey( e, "model" );
+		if( !model )
+			continue;
 
-			if( !model || !*model )
-				continue;
-		}
-		else
+		if( !*model )
 		{
+			if( !stricmp( ValueForKey( e, "classname" ), "env_static" ))
+				Developer( DEVELOPER_LEVEL_WARNING, "env_static has empty model field\n" );
 			continue;
 		}
 
@@ -192,10 +422,19 @@ void LoadStudioModels( void )
 		if( xform[1] > 16.0f ) xform[1] = 16.0f;
 		if( xform[2] > 16.0f ) xform[2] = 16.0f;
 
+		StudioInitFileSystem();
+
 		LoadStudioModel( model, origin, angles, xform, body, skin, trace_mode );
 	}
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+	BuildStudioMeshes();
+
+	Log( "%i opaque studio models\n", num_instances );
+	Verbose( "%i studio meshes\n", num_models );
+#else
 	Log( "%i opaque studio models\n", num_models );
+#endif
 }
 
 void FreeStudioModels( void )
@@ -213,8 +452,12 @@ void FreeStudioModels( void )
 
 	memset( models, 0, sizeof( models ));
 	num_models = 0;
+#ifdef HLRAD_STUDIOMESH_SHARE
+	num_instances = 0;
+#endif
 
 	FS_Shutdown();
+	studio_fs_ready = false;
 }
 
 void MoveBounds( const vec3_t start, const vec3_t mins, const vec3_t maxs, const vec3_t end, vec3_t outmins, vec3_t outmaxs )
@@ -234,6 +477,44 @@ void MoveBounds( const vec3_t start, const vec3_t mins, const vec3_t maxs, const
 	}
 }
 
+#ifdef HLRAD_STUDIOMESH_SHARE
+bool TestSegmentAgainstStudioList( const vec_t* p1, const vec_t* p2 )
+{
+	if( !num_instances ) return false; // easy out
+
+	vec3_t	trace_mins, trace_maxs;
+
+	MoveBounds( p1, vec3_origin, vec3_origin, p2, trace_mins, trace_maxs );
+
+	for( int i = 0; i < num_instances; i++ )
+	{
+		modelinstance_t *inst = &instances[i];
+		model_t *m = inst->model;
+
+		if( inst->absmin[0] > trace_maxs[0] || inst->absmin[1] > trace_maxs[1] || inst->absmin[2] > trace_maxs[2] )
+			continue;
+		if( inst->absmax[0] < trace_mins[0] || inst->absmax[1] < trace_mins[1] || inst->absmax[2] < trace_mins[2] )
+			continue;
+
+		// the placement's transform is affine, so the segment stays a segment in object space
+		vec3_t	start, end;
+
+		m->mesh.VectorTransform( p1, inst->invtransform, start );
+		m->mesh.VectorTransform( p2, inst->invtransform, end );
+
+		TraceMesh	trm;
+
+		trm.SetTraceModExtradata( m->extradata );
+		trm.SetTraceMesh( m->mesh.GetMesh(), m->mesh.GetHeadNode() );
+		trm.SetupTrace( start, vec3_origin, vec3_origin, end );
+
+		if( trm.DoTrace())
+			return true; // we hit studio model
+	}
+
+	return false;
+}
+#else
 bool TestSegmentAgainstStudioList( const vec_t* p1, const vec_t* p2 )
 {
 	if( !num_models ) return false; // easy out
@@ -266,3 +547,5 @@ bool TestSegmentAgainstStudioList( const vec_t* p1, const vec_t* p2 )
 }
 
 #endif
+
+#endif
@@ -5,11 +5,7 @@
 #ifdef HLRAD_OPAQUE_NODE
 #include "winding.h"
 #endif
-#ifdef HLRAD_OPAQUE_ALPHATEST
 #include "qrad.h"
-#endif
-
-float g_trace_fraction;
 
 // #define      ON_EPSILON      0.001
 
@@ -320,44 +316,35 @@ void            MakeTnodes(dmodel_t* /*bm*/)
 
 //==========================================================
 
-int TestLine_r( const int node, float p1f, float p2f, const vec3_t start, const vec3_t stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-						   , int &linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-						   , vec_t *skyhit
-#endif
-						   )
+// =====================================================================================
+//  TraceLine_r
+//      Walks start->stop through the world nodes, writing the fraction and sky hit to the
+//      caller's trace. linecontent is the liquid the segment is in (0 = not yet in one);
+//      it is only used with HLRAD_WATERBLOCKLIGHT.
+// =====================================================================================
+static int TraceLine_r (const int node, float p1f, float p2f, const vec3_t start, const vec3_t stop, int &linecontent, trace_t *trace)
 {
-    tnode_t*        tnode;
-    float           front, back;
-    vec3_t          mid;
-    float           frac, midf;
-    int             side;
-    int             r;
+	tnode_t *tnode;
+	float front, back;
+	vec3_t mid;
+	float frac, midf;
+	int side;
+	int r;
 
 #ifdef HLRAD_WATERBLOCKLIGHT
 	if (node < 0)
 	{
 		if (node == linecontent)
 			return CONTENTS_EMPTY;
-#ifdef HLRAD_OPAQUEINSKY_FIX
 		if (node == CONTENTS_SOLID)
 		{
 			return CONTENTS_SOLID;
 		}
 		if (node == CONTENTS_SKY)
 		{
-			if (skyhit)
-			{
-				VectorCopy (start, skyhit);
-			}
+			VectorCopy (start, trace->skyhit);
 			return CONTENTS_SKY;
 		}
-#else
-		if (node == CONTENTS_SOLID || node == CONTENTS_SKY)
-			return node;
-#endif
 		if (linecontent)
 		{
 			return CONTENTS_SOLID;
@@ -366,86 +353,52 @@ int TestLine_r( const int node, float p1f, float p2f, const vec3_t start, const
 		return CONTENTS_EMPTY;
 	}
 #else
-#ifdef HLRAD_OPAQUEINSKY_FIX
 	if (node == CONTENTS_SKY)
 	{
-		VectorCopy (start, skyhit);
+		VectorCopy (start, trace->skyhit);
 	}
-#endif
-	if (   (node == CONTENTS_SOLID)
-        || (node == CONTENTS_SKY  )
-      /*|| (node == CONTENTS_NULL ) */
-       )
+	if (node == CONTENTS_SOLID || node == CONTENTS_SKY)
 		return node;
-
-    if (node < 0)
-        return CONTENTS_EMPTY;
+	if (node < 0)
+		return CONTENTS_EMPTY;
 #endif
 
-    tnode = &tnodes[node];
-    switch (tnode->type)
-    {
-    case plane_x:
-        front = start[0] - tnode->dist;
-        back = stop[0] - tnode->dist;
-        break;
-    case plane_y:
-        front = start[1] - tnode->dist;
-        back = stop[1] - tnode->dist;
-        break;
-    case plane_z:
-        front = start[2] - tnode->dist;
-        back = stop[2] - tnode->dist;
-        break;
-    default:
-        front = (start[0] * tnode->normal[0] + start[1] * tnode->normal[1] + start[2] * tnode->normal[2]) - tnode->dist;
-        back = (stop[0] * tnode->normal[0] + stop[1] * tnode->normal[1] + stop[2] * tnode->normal[2]) - tnode->dist;
-        break;
-    }
+	tnode = &tnodes[node];
+	switch (tnode->type)
+	{
+	case plane_x:
+		front = start[0] - tnode->dist;
+		back = stop[0] - tnode->dist;
+		break;
+	case plane_y:
+		front = start[1] - tnode->dist;
+		back = stop[1] - tnode->dist;
+		break;
+	case plane_z:
+		front = start[2] - tnode->dist;
+		back = stop[2] - tnode->dist;
+		break;
+	default:
+		front = (start[0] * tnode->normal[0] + start[1] * tnode->normal[1] + start[2] * tnode->normal[2]) - tnode->dist;
+		back = (stop[0] * tnode->normal[0] + stop[1] * tnode->normal[1] + stop[2] * tnode->normal[2]) - tnode->dist;
+		break;
+	}
 
 #ifdef HLRAD_TestLine_EDGE_FIX
 	if (front > ON_EPSILON/2 && back > ON_EPSILON/2)
 	{
-		return TestLine_r(tnode->children[0], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-			, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-			, skyhit
-#endif
-			);
+		return TraceLine_r (tnode->children[0], p1f, p2f, start, stop, linecontent, trace);
 	}
 	if (front < -ON_EPSILON/2 && back < -ON_EPSILON/2)
 	{
-		return TestLine_r(tnode->children[1], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-			, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-			, skyhit
-#endif
-			);
+		return TraceLine_r (tnode->children[1], p1f, p2f, start, stop, linecontent, trace);
 	}
 	if (fabs(front) <= ON_EPSILON && fabs(back) <= ON_EPSILON)
 	{
-		int r1 = TestLine_r(tnode->children[0], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-			, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-			, skyhit
-#endif
-			);
+		int r1 = TraceLine_r (tnode->children[0], p1f, p2f, start, stop, linecontent, trace);
 		if (r1 == CONTENTS_SOLID)
 			return CONTENTS_SOLID;
-		int r2 = TestLine_r(tnode->children[1], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-			, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-			, skyhit
-#endif
-			);
+		int r2 = TraceLine_r (tnode->children[1], p1f, p2f, start, stop, linecontent, trace);
 		if (r2 == CONTENTS_SOLID)
 			return CONTENTS_SOLID;
 		if (r1 == CONTENTS_SKY || r2 == CONTENTS_SKY)
@@ -456,103 +409,85 @@ int TestLine_r( const int node, float p1f, float p2f, const vec3_t start, const
 	frac = front / (front - back);
 	if (frac < 0) frac = 0;
 	if (frac > 1) frac = 1;
+#else //bug: light can go through edges of solid brushes
+	if (front >= -ON_EPSILON && back >= -ON_EPSILON)
+		return TraceLine_r (tnode->children[0], p1f, p2f, start, stop, linecontent, trace);
+	if (front < ON_EPSILON && back < ON_EPSILON)
+		return TraceLine_r (tnode->children[1], p1f, p2f, start, stop, linecontent, trace);
+	side = front < 0;
+	frac = front / (front - back);
+#endif
 	midf = p1f + ( p2f - p1f ) * frac;
 	mid[0] = start[0] + (stop[0] - start[0]) * frac;
 	mid[1] = start[1] + (stop[1] - start[1]) * frac;
 	mid[2] = start[2] + (stop[2] - start[2]) * frac;
-	r = TestLine_r(tnode->children[side], p1f, midf, start, mid
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
-#endif
-		);
+	r = TraceLine_r (tnode->children[side], p1f, midf, start, mid, linecontent, trace);
 	if (r != CONTENTS_EMPTY)
 	{
-		g_trace_fraction = midf;
+		trace->fraction = midf;
 		return r;
 	}
-	return TestLine_r(tnode->children[!side], midf, p2f, mid, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
-#endif
-		);
-#else //bug: light can go through edges of solid brushes
-    if (front >= -ON_EPSILON && back >= -ON_EPSILON)
-        return TestLine_r(tnode->children[0], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
-#endif
-		);
-
-    if (front < ON_EPSILON && back < ON_EPSILON)
-        return TestLine_r(tnode->children[1], p1f, p2f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
-#endif
-		);
-
-    side = front < 0;
+	return TraceLine_r (tnode->children[!side], midf, p2f, mid, stop, linecontent, trace);
+}
 
-    frac = front / (front - back);
-    midf = p1f + ( p2f - p1f ) * frac;
-    mid[0] = start[0] + (stop[0] - start[0]) * frac;
-    mid[1] = start[1] + (stop[1] - start[1]) * frac;
-    mid[2] = start[2] + (stop[2] - start[2]) * frac;
+// =====================================================================================
+//  TraceSegment
+//      Traces start->stop through the world and then, unless TRACE_WORLDONLY is given,
+//      through the opaque entities. Returns true when the segment is blocked; trace holds
+//      the rest of the result either way, so concurrent callers never share state.
+// =====================================================================================
+bool TraceSegment (const vec3_t start, const vec3_t stop, int flags, trace_t *trace)
+{
+	int linecontent = 0;
 
-    r = TestLine_r(tnode->children[side], p1f, midf, start, mid
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
+	trace->fraction = 1.0f;
+	VectorCopy (stop, trace->skyhit);
+	VectorFill (trace->transparency, 1.0);
+	trace->opaquestyle = -1;
+	trace->contents = TraceLine_r (0, 0.0f, 1.0f, start, stop, linecontent, trace);
+	if (trace->contents != ((flags & TRACE_SKY)? CONTENTS_SKY: CONTENTS_EMPTY))
+	{
+		return true;
+	}
+	if (flags & TRACE_WORLDONLY)
+	{
+		return false;
+	}
 #ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
+	return TestSegmentAgainstOpaqueList (start, (flags & TRACE_SKY)? trace->skyhit: stop
+#else
+	return TestSegmentAgainstOpaqueList (start, stop
 #endif
-		);
-    if (r != CONTENTS_EMPTY)
-    {
-        g_trace_fraction = midf;
-        return r;
-    }
-    return TestLine_r(tnode->children[!side], midf, p2f, mid, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
+#ifdef HLRAD_HULLU
+		, trace->transparency
 #endif
-#ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
+#ifdef HLRAD_OPAQUE_STYLE
+		, trace->opaquestyle
 #endif
 		);
-#endif
 }
 
+// =====================================================================================
+//  TestLine
+//      World-only TraceSegment for the callers that just want the contents the segment
+//      ended on.
+// =====================================================================================
 int             TestLine(const vec3_t start, const vec3_t stop
 #ifdef HLRAD_OPAQUEINSKY_FIX
 						 , vec_t *skyhit
 #endif
 						 )
 {
-	g_trace_fraction = 1.0f; // set trace default fraction
+	trace_t trace;
 
-#ifdef HLRAD_WATERBLOCKLIGHT
-	int linecontent = 0;
-#endif
-    return TestLine_r(0, 0.0f, 1.0f, start, stop
-#ifdef HLRAD_WATERBLOCKLIGHT
-		, linecontent
-#endif
+	TraceSegment (start, stop, TRACE_WORLDONLY, &trace);
 #ifdef HLRAD_OPAQUEINSKY_FIX
-		, skyhit
+	if (skyhit)
+	{
+		VectorCopy (trace.skyhit, skyhit);
+	}
 #endif
-		);
+	return trace.contents;
 }
 
 #ifdef HLRAD_OPAQUE_NODE
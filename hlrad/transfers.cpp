@@ -144,7 +144,7 @@ bool            readtransfers(const char* const transferfile, const long numpatc
             }
             if (patch->iIndex)
             {
-                patch->tIndex = (transfer_index_t*)AllocBlock(patch->iIndex * sizeof(transfer_index_t *));
+                patch->tIndex = (transfer_index_t*)AllocBlockNoZero(patch->iIndex * sizeof(transfer_index_t *));
                 hlassume(patch->tIndex != NULL, assume_NoMemory);
                 amtread = fread(patch->tIndex, sizeof(transfer_index_t), patch->iIndex, file);
                 if (amtread != patch->iIndex)
@@ -164,7 +164,7 @@ bool            readtransfers(const char* const transferfile, const long numpatc
 				if(g_rgb_transfers)
 				{
 	#ifdef HLRAD_TRANSFERDATA_COMPRESS
-                    patch->tRGBData = (rgb_transfer_data_t*)AllocBlock(patch->iData * vector_size[g_rgbtransfer_compress_type] + unused_size);
+                    patch->tRGBData = (rgb_transfer_data_t*)AllocBlockNoZero(patch->iData * vector_size[g_rgbtransfer_compress_type] + unused_size);
 	#else
                     patch->tRGBData = (rgb_transfer_data_t*)AllocBlock(patch->iData * sizeof(rgb_transfer_data_t *)); //wrong? --vluzacn
 	#endif
@@ -178,7 +178,7 @@ bool            readtransfers(const char* const transferfile, const long numpatc
 				else
 				{
 	#ifdef HLRAD_TRANSFERDATA_COMPRESS
-                    patch->tData = (transfer_data_t*)AllocBlock(patch->iData * float_size[g_transfer_compress_type] + unused_size);
+                    patch->tData = (transfer_data_t*)AllocBlockNoZero(patch->iData * float_size[g_transfer_compress_type] + unused_size);
 	#else
                     patch->tData = (transfer_data_t*)AllocBlock(patch->iData * sizeof(transfer_data_t *));
 	#endif
@@ -191,7 +191,7 @@ bool            readtransfers(const char* const transferfile, const long numpatc
 				}
 #else
 	#ifdef HLRAD_TRANSFERDATA_COMPRESS
-                patch->tData = (transfer_data_t*)AllocBlock(patch->iData * float_size[g_transfer_compress_type] + unused_size);
+                patch->tData = (transfer_data_t*)AllocBlockNoZero(patch->iData * float_size[g_transfer_compress_type] + unused_size);
 	#else
                 patch->tData = (transfer_data_t*)AllocBlock(patch->iData * sizeof(transfer_data_t *));
 	#endif
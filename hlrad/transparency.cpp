@@ -4,6 +4,9 @@
 //	Transparency Arrays for sparse and vismatrix methods
 //
 #include "qrad.h"
+#ifdef HLRAD_TRANSPARENCY_CSR
+#include <vector>
+#endif
 
 #ifdef HLRAD_HULLU
 
@@ -18,6 +21,7 @@ typedef struct {
 	unsigned	data_index;
 } transList_t;
 
+#ifndef HLRAD_TRANSPARENCY_CSR
 static vec3_t *		s_trans_list	= NULL;
 static unsigned int	s_trans_count	= 0;
 static unsigned int	s_max_trans_count = 0;
@@ -28,9 +32,339 @@ static unsigned int	s_max_raw_count	= 0;	// Current array maximum (used for real
 
 static transList_t*	s_sorted_list	= NULL;	// Sorted first by p1 then p2
 static unsigned int	s_sorted_count	= 0;
+#endif
 
 const vec3_t vec3_one = {1.0,1.0,1.0};
 
+#ifdef HLRAD_TRANSPARENCY_CSR
+//
+//	Threads add pairs to their own buffers without locking. When all pairs are in, the
+//	buffers are merged into one row per receiver patch (p1) and every row is sorted by
+//	p2, so a lookup is a binary search inside one short row. Transparency colours are
+//	kept once each in a palette and the rows store the palette index.
+//
+
+typedef struct {
+	vec3_t *	colours;
+	unsigned int	count;
+	unsigned int	max_count;
+	unsigned int *	slots;		// colour index + 1, 0 = empty
+	unsigned int	mask;
+} transPalette_t;
+
+typedef struct {
+	int		generation;
+	std::vector< transList_t > pairs;	// data_index is into the thread palette
+	transPalette_t	palette;
+} transStage_t;
+
+typedef struct {
+	unsigned	p2;
+	unsigned	data_index;
+} transEntry_t;
+
+static std::vector< transStage_t * > s_trans_stages;
+static int		s_trans_generation = 1;
+static thread_local transStage_t *t_trans_stage = NULL;
+
+static transPalette_t	s_trans_palette;
+static unsigned int *	s_trans_rows	= NULL;	// s_trans_rows[p1] .. s_trans_rows[p1 + 1] in s_trans_entries
+static unsigned int	s_trans_numrows	= 0;
+static transEntry_t *	s_trans_entries	= NULL;
+
+//===============================================
+// Transparency palette
+//===============================================
+static unsigned PaletteHash(const vec3_t colour)
+{
+	vec3_t c;
+	unsigned hash = 2166136261u;
+
+	VectorAdd(colour, vec3_origin, c); // -0 and 0 are the same colour
+	const unsigned char *p = (const unsigned char *)c;
+	for(unsigned int i = 0; i < sizeof(vec3_t); i++)
+	{
+		hash = (hash ^ p[i]) * 16777619u;
+	}
+	return hash ^ (hash >> 16);
+}
+
+static void PaletteGrow(transPalette_t *pal)
+{
+	pal->mask = pal->mask? pal->mask * 2 + 1: 63;
+	free(pal->slots);
+	pal->slots = (unsigned int *)calloc(pal->mask + 1, sizeof(unsigned int));
+	hlassume (pal->slots != NULL, assume_NoMemory);
+
+	for(unsigned int i = 0; i < pal->count; i++)
+	{
+		unsigned slot = PaletteHash(pal->colours[i]) & pal->mask;
+		while(pal->slots[slot])
+		{
+			slot = (slot + 1) & pal->mask;
+		}
+		pal->slots[slot] = i + 1;
+	}
+}
+
+static unsigned PaletteIndex(transPalette_t *pal, const vec3_t colour)
+{
+	if( (pal->count + 1) * 2 > pal->mask )
+	{
+		PaletteGrow(pal);
+	}
+
+	unsigned slot = PaletteHash(colour) & pal->mask;
+	while(pal->slots[slot])
+	{
+		const vec_t *c = pal->colours[pal->slots[slot] - 1];
+		if( c[0] == colour[0] && c[1] == colour[1] && c[2] == colour[2] )
+		{
+			return pal->slots[slot] - 1;
+		}
+		slot = (slot + 1) & pal->mask;
+	}
+
+	if( pal->count >= pal->max_count )
+	{
+		pal->max_count = qmax (64u, pal->max_count * 2);
+		pal->colours = (vec3_t *)realloc( pal->colours, sizeof(vec3_t) * pal->max_count );
+		hlassume (pal->colours != NULL, assume_NoMemory);
+	}
+	VectorCopy(colour, pal->colours[pal->count]);
+	pal->slots[slot] = pal->count + 1;
+
+	return ( pal->count++ );
+}
+
+static void PaletteFree(transPalette_t *pal)
+{
+	free(pal->colours);
+	free(pal->slots);
+	memset(pal, 0, sizeof(*pal));
+}
+
+//===============================================
+// TransparencyStage -- this thread's buffer, made on first use after each merge
+//===============================================
+static transStage_t *TransparencyStage()
+{
+	if( !t_trans_stage || t_trans_stage->generation != s_trans_generation )
+	{
+		t_trans_stage = new transStage_t;
+		t_trans_stage->generation = s_trans_generation;
+		memset(&t_trans_stage->palette, 0, sizeof(transPalette_t));
+
+		ThreadLock();
+		s_trans_stages.push_back(t_trans_stage);
+		ThreadUnlock();
+	}
+	return t_trans_stage;
+}
+
+static void FreeTransparencyStages()
+{
+	for(size_t i = 0; i < s_trans_stages.size(); i++)
+	{
+		PaletteFree(&s_trans_stages[i]->palette);
+		delete s_trans_stages[i];
+	}
+	s_trans_stages.clear();
+	s_trans_generation++; // threads that outlive the merge start a new buffer
+	t_trans_stage = NULL;
+}
+
+//===============================================
+// AddTransparencyToRawArray
+//===============================================
+void	AddTransparencyToRawArray(const unsigned p1, const unsigned p2, const vec3_t trans)
+{
+	transStage_t *stage = TransparencyStage();
+	transList_t pair;
+
+	pair.p1 = p1;
+	pair.p2 = p2;
+	pair.data_index = PaletteIndex(&stage->palette, trans);
+
+	stage->pairs.push_back(pair);
+}
+
+//===============================================
+// SortTransparencyRow
+//===============================================
+static int CDECL SortTransparencyEntries(const void *a, const void *b)
+{
+	const transEntry_t* item1 = (transEntry_t *)a;
+	const transEntry_t* item2 = (transEntry_t *)b;
+	
+	if( item1->p2 != item2->p2 )
+	{
+		return item1->p2 < item2->p2? -1: 1;
+	}
+
+	// same pair twice, keep the order independent of the threads
+	const vec_t *c1 = s_trans_palette.colours[item1->data_index];
+	const vec_t *c2 = s_trans_palette.colours[item2->data_index];
+	for( int i = 0; i < 3; i++ )
+	{
+		if( c1[i] != c2[i] )
+		{
+			return c1[i] < c2[i]? -1: 1;
+		}
+	}
+	return 0;
+}
+
+static void SortTransparencyRow(int p1)
+{
+	unsigned count = s_trans_rows[p1 + 1] - s_trans_rows[p1];
+
+	if( count > 1 )
+	{
+		qsort( &s_trans_entries[s_trans_rows[p1]], count, sizeof(transEntry_t), SortTransparencyEntries );
+	}
+}
+
+//===============================================
+// CreateFinalTransparencyArrays
+//===============================================
+void	CreateFinalTransparencyArrays(const char *print_name)
+{
+	unsigned int total = 0;
+	size_t i, j;
+
+	for( i = 0; i < s_trans_stages.size(); i++ )
+	{
+		total += s_trans_stages[i]->pairs.size();
+	}
+	if( total == 0 )
+	{
+		FreeTransparencyStages();
+		return;
+	}
+#ifdef ZHLT_64BIT_FIX
+	if( total >= (unsigned int)INT_MAX / 2 )
+	{
+		Error ("CreateFinalTransparencyArrays: array size exceeded INT_MAX");
+	}
+#endif
+
+	s_trans_numrows = g_num_patches;
+	s_trans_rows = (unsigned int *)calloc( s_trans_numrows + 1, sizeof(unsigned int) );
+	unsigned int *fill = (unsigned int *)malloc( sizeof(unsigned int) * s_trans_numrows );
+	s_trans_entries = (transEntry_t *)malloc( sizeof(transEntry_t) * total * 2 );
+	hlassume (s_trans_rows != NULL && fill != NULL && s_trans_entries != NULL, assume_NoMemory);
+
+	//each pair goes to the rows of both patches
+	for( i = 0; i < s_trans_stages.size(); i++ )
+	{
+		const std::vector< transList_t > &pairs = s_trans_stages[i]->pairs;
+		for( j = 0; j < pairs.size(); j++ )
+		{
+			s_trans_rows[pairs[j].p1 + 1]++;
+			s_trans_rows[pairs[j].p2 + 1]++;
+		}
+	}
+	for( i = 0; i < s_trans_numrows; i++ )
+	{
+		s_trans_rows[i + 1] += s_trans_rows[i];
+		fill[i] = s_trans_rows[i];
+	}
+
+	for( i = 0; i < s_trans_stages.size(); i++ )
+	{
+		transStage_t *stage = s_trans_stages[i];
+		std::vector< unsigned > remap( stage->palette.count );
+
+		for( j = 0; j < stage->palette.count; j++ )
+		{
+			remap[j] = PaletteIndex(&s_trans_palette, stage->palette.colours[j]);
+		}
+		for( j = 0; j < stage->pairs.size(); j++ )
+		{
+			const transList_t &pair = stage->pairs[j];
+			transEntry_t *e;
+
+			e = &s_trans_entries[fill[pair.p1]++];
+			e->p2 = pair.p2;
+			e->data_index = remap[pair.data_index];
+
+			e = &s_trans_entries[fill[pair.p2]++];
+			e->p2 = pair.p1;
+			e->data_index = remap[pair.data_index];
+		}
+	}
+	free( fill );
+	FreeTransparencyStages();
+
+	RunThreadsOnIndividual( s_trans_numrows, false, SortTransparencyRow );
+
+	size_t size = (size_t)total * 2 * sizeof(transEntry_t) + (s_trans_numrows + 1) * sizeof(unsigned int) + s_trans_palette.count * sizeof(vec3_t);
+	if ( size > 1024 * 1024 )
+        	Log("%-20s: %5.1f megs \n", print_name, (double)size / (1024.0 * 1024.0));
+        else if ( size > 1024 )
+        	Log("%-20s: %5.1f kilos\n", print_name, (double)size / 1024.0);
+        else
+        	Log("%-20s: %5.1f bytes\n", print_name, (double)size); //--vluzacn
+	Developer (DEVELOPER_LEVEL_MESSAGE, "\tpalette=%u\tentries=%u\n", s_trans_palette.count, total * 2);
+}
+
+//===============================================
+// FreeTransparencyArrays
+//===============================================
+void	FreeTransparencyArrays( )
+{
+	free(s_trans_rows);
+	free(s_trans_entries);
+	PaletteFree(&s_trans_palette);
+	FreeTransparencyStages();
+	
+	s_trans_rows = NULL;
+	s_trans_entries = NULL;
+	s_trans_numrows = 0;
+}
+
+//===============================================
+// GetTransparency -- find transparency in the row of p1. next_index is where the last
+// lookup stopped; walking a row in order starts from there
+//===============================================
+void GetTransparency(const unsigned p1, const unsigned p2, vec3_t &trans, unsigned int &next_index)
+{
+	VectorFill( trans, 1.0 );
+
+	if( p1 >= s_trans_numrows )
+	{
+		return;
+	}
+
+	unsigned lo = s_trans_rows[p1];
+	unsigned hi = s_trans_rows[p1 + 1];
+
+	if( next_index > lo && next_index <= hi && s_trans_entries[next_index - 1].p2 < p2 )
+	{
+		lo = next_index;
+	}
+	while( lo < hi )
+	{
+		unsigned mid = ( lo + hi ) / 2;
+		if( s_trans_entries[mid].p2 < p2 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if( lo < s_trans_rows[p1 + 1] && s_trans_entries[lo].p2 == p2 )
+	{
+		VectorCopy( s_trans_palette.colours[s_trans_entries[lo].data_index], trans );
+		next_index = lo + 1;
+	}
+	else
+	{
+		next_index = lo;
+	}
+}
+#else /*HLRAD_TRANSPARENCY_CSR*/
+
 //===============================================
 // AddTransparencyToRawArray
 //===============================================
@@ -303,6 +637,7 @@ void GetTransparency(const unsigned p1, const unsigned p2, vec3_t &trans, unsign
 	
 	next_index = s_sorted_count;
 }
+#endif /*HLRAD_TRANSPARENCY_CSR*/
 
 
 #endif /*HLRAD_HULLU*/
@@ -319,6 +654,183 @@ typedef struct {
 	unsigned	p2;
 	char		style;
 } styleList_t;
+#ifdef HLRAD_TRANSPARENCY_CSR
+// same layout as the transparency rows, without the palette and with one entry per pair
+typedef struct {
+	int		generation;
+	std::vector< styleList_t > pairs;
+} styleStage_t;
+
+typedef struct {
+	unsigned	p2;
+	char		style;
+} styleEntry_t;
+
+static std::vector< styleStage_t * > s_style_stages;
+static int		s_style_generation = 1;
+static thread_local styleStage_t *t_style_stage = NULL;
+
+static unsigned int *	s_style_rows	= NULL;
+static unsigned int	s_style_numrows	= 0;
+static styleEntry_t *	s_style_entries	= NULL;
+static unsigned int	s_style_count	= 0;
+
+static void FreeStyleStages()
+{
+	for(size_t i = 0; i < s_style_stages.size(); i++)
+	{
+		delete s_style_stages[i];
+	}
+	s_style_stages.clear();
+	s_style_generation++;
+	t_style_stage = NULL;
+}
+void	AddStyleToStyleArray(const unsigned p1, const unsigned p2, const int style)
+{
+	if (style == -1)
+		return;
+
+	if( !t_style_stage || t_style_stage->generation != s_style_generation )
+	{
+		t_style_stage = new styleStage_t;
+		t_style_stage->generation = s_style_generation;
+
+		ThreadLock();
+		s_style_stages.push_back(t_style_stage);
+		ThreadUnlock();
+	}
+
+	styleList_t pair;
+	pair.p1 = p1;
+	pair.p2 = p2;
+	pair.style = (char)style;
+
+	t_style_stage->pairs.push_back(pair);
+}
+static int CDECL SortStyleEntries(const void *a, const void *b)
+{
+	const styleEntry_t* item1 = (styleEntry_t *)a;
+	const styleEntry_t* item2 = (styleEntry_t *)b;
+	
+	if( item1->p2 != item2->p2 )
+	{
+		return item1->p2 < item2->p2? -1: 1;
+	}
+	return item1->style - item2->style;
+}
+static void SortStyleRow(int p1)
+{
+	unsigned count = s_style_rows[p1 + 1] - s_style_rows[p1];
+
+	if( count > 1 )
+	{
+		qsort( &s_style_entries[s_style_rows[p1]], count, sizeof(styleEntry_t), SortStyleEntries );
+	}
+}
+void	CreateFinalStyleArrays(const char *print_name)
+{
+	size_t i, j;
+
+	s_style_count = 0;
+	for( i = 0; i < s_style_stages.size(); i++ )
+	{
+		s_style_count += s_style_stages[i]->pairs.size();
+	}
+	if( s_style_count == 0 )
+	{
+		FreeStyleStages();
+		return;
+	}
+
+	s_style_numrows = g_num_patches;
+	s_style_rows = (unsigned int *)calloc( s_style_numrows + 1, sizeof(unsigned int) );
+	unsigned int *fill = (unsigned int *)malloc( sizeof(unsigned int) * s_style_numrows );
+	s_style_entries = (styleEntry_t *)malloc( sizeof(styleEntry_t) * s_style_count );
+	hlassume (s_style_rows != NULL && fill != NULL && s_style_entries != NULL, assume_NoMemory);
+
+	for( i = 0; i < s_style_stages.size(); i++ )
+	{
+		const std::vector< styleList_t > &pairs = s_style_stages[i]->pairs;
+		for( j = 0; j < pairs.size(); j++ )
+		{
+			s_style_rows[pairs[j].p1 + 1]++;
+		}
+	}
+	for( i = 0; i < s_style_numrows; i++ )
+	{
+		s_style_rows[i + 1] += s_style_rows[i];
+		fill[i] = s_style_rows[i];
+	}
+	for( i = 0; i < s_style_stages.size(); i++ )
+	{
+		const std::vector< styleList_t > &pairs = s_style_stages[i]->pairs;
+		for( j = 0; j < pairs.size(); j++ )
+		{
+			styleEntry_t *e = &s_style_entries[fill[pairs[j].p1]++];
+			e->p2 = pairs[j].p2;
+			e->style = pairs[j].style;
+		}
+	}
+	free( fill );
+	FreeStyleStages();
+
+	RunThreadsOnIndividual( s_style_numrows, false, SortStyleRow );
+
+	size_t size = s_style_count * sizeof(styleEntry_t) + (s_style_numrows + 1) * sizeof(unsigned int);
+	if ( size > 1024 * 1024 )
+        	Log("%-20s: %5.1f megs \n", print_name, (double)size / (1024.0 * 1024.0));
+        else if ( size > 1024 )
+        	Log("%-20s: %5.1f kilos\n", print_name, (double)size / 1024.0);
+        else
+        	Log("%-20s: %5.1f bytes\n", print_name, (double)size); //--vluzacn
+}
+void	FreeStyleArrays( )
+{
+	free(s_style_rows);
+	free(s_style_entries);
+	FreeStyleStages();
+	
+	s_style_rows = NULL;
+	s_style_entries = NULL;
+	
+	s_style_numrows = s_style_count = 0;
+}
+void GetStyle(const unsigned p1, const unsigned p2, int &style, unsigned int &next_index)
+{
+	style = -1;
+
+	if( p1 >= s_style_numrows )
+	{
+		return;
+	}
+
+	unsigned lo = s_style_rows[p1];
+	unsigned hi = s_style_rows[p1 + 1];
+
+	if( next_index > lo && next_index <= hi && s_style_entries[next_index - 1].p2 < p2 )
+	{
+		lo = next_index;
+	}
+	while( lo < hi )
+	{
+		unsigned mid = ( lo + hi ) / 2;
+		if( s_style_entries[mid].p2 < p2 )
+			lo = mid + 1;
+		else
+			hi = mid;
+	}
+
+	if( lo < s_style_rows[p1 + 1] && s_style_entries[lo].p2 == p2 )
+	{
+		style = (int)s_style_entries[lo].style;
+		next_index = lo + 1;
+	}
+	else
+	{
+		next_index = lo;
+	}
+}
+#else /*HLRAD_TRANSPARENCY_CSR*/
 static styleList_t* s_style_list = NULL;
 static unsigned int	s_style_count = 0;
 static unsigned int	s_max_style_count = 0;
@@ -449,4 +961,5 @@ void GetStyle(const unsigned p1, const unsigned p2, int &style, unsigned int &ne
 	
 	next_index = s_style_count;
 }
+#endif /*HLRAD_TRANSPARENCY_CSR*/
 #endif
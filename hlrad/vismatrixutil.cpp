@@ -105,7 +105,7 @@ static transfer_index_t* CompressTransferIndicies(transfer_raw_index_t* tRaw, co
 		return NULL;
 	}
 
-	transfer_index_t* CompressedArray = (transfer_index_t*)AllocBlock(sizeof(transfer_index_t) * compressed_count_1);
+	transfer_index_t* CompressedArray = (transfer_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * compressed_count_1);
 #else
     transfer_index_t CompressedArray[MAX_PATCHES];         // somewhat big stack object (1 Mb with 256k patches)
 #endif
@@ -233,7 +233,7 @@ void            MakeScales(const int threadnum)
     int             count;
     float           trans;
     patch_t*        patch;
-    patch_t*        patch2;
+    const patchgeometry_t* patch2;
     vec3_t          origin;
     vec_t           area;
     const vec_t*    normal1;
@@ -252,22 +252,22 @@ void            MakeScales(const int threadnum)
     float* tData;
 
 #ifdef HLRAD_MORE_PATCHES
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * (g_num_patches + 1));
-    float* tData_All = (float*)AllocBlock(sizeof(float) * (g_num_patches + 1));
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * (g_num_patches + 1));
+    float* tData_All = (float*)AllocBlockNoZero(sizeof(float) * (g_num_patches + 1));
 #else
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * MAX_PATCHES);
-    float* tData_All = (float*)AllocBlock(sizeof(float) * MAX_PATCHES);
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * MAX_PATCHES);
+    float* tData_All = (float*)AllocBlockNoZero(sizeof(float) * MAX_PATCHES);
 #endif
 #else
     transfer_raw_index_t* tIndex;
     transfer_data_t* tData;
 
 #ifdef HLRAD_MORE_PATCHES
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * (g_num_patches + 1));
-    transfer_data_t* tData_All = (transfer_data_t*)AllocBlock(sizeof(transfer_data_t) * (g_num_patches + 1));
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * (g_num_patches + 1));
+    transfer_data_t* tData_All = (transfer_data_t*)AllocBlockNoZero(sizeof(transfer_data_t) * (g_num_patches + 1));
 #else
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * MAX_PATCHES);
-    transfer_data_t* tData_All = (transfer_data_t*)AllocBlock(sizeof(transfer_data_t) * MAX_PATCHES);
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * MAX_PATCHES);
+    transfer_data_t* tData_All = (transfer_data_t*)AllocBlockNoZero(sizeof(transfer_data_t) * MAX_PATCHES);
 #endif
 #endif
 
@@ -317,7 +317,7 @@ void            MakeScales(const int threadnum)
         // from patch
 		// HLRAD_NOSWAP: patch collect light from patch2
 
-        for (j = 0, patch2 = g_patches; j < g_num_patches; j++, patch2++)
+        for (j = 0, patch2 = g_patchgeometry; j < g_num_patches; j++, patch2++)
         {
             vec_t           dot1;
             vec_t           dot2;
@@ -362,7 +362,7 @@ void            MakeScales(const int threadnum)
 #endif
             }
 
-            normal2 = getPlaneFromFaceNumber(patch2->faceNumber)->normal;
+            normal2 = patch2->normal;
 
             // calculate transferemnce
             VectorSubtract(patch2->origin, origin, delta);
@@ -451,7 +451,7 @@ void            MakeScales(const int threadnum)
 					receiver_normal = backnormal;
 				}
 	#endif
-				emitter_winding = patch2->winding;
+				emitter_winding = g_patches[j].winding;
 				sightarea = CalcSightArea (receiver_origin, receiver_normal, emitter_winding, patch2->emitter_skylevel
 	#ifdef HLRAD_DIVERSE_LIGHTING
 					, lighting_power, lighting_scale
@@ -578,7 +578,7 @@ void            MakeScales(const int threadnum)
             unsigned        data_size = patch->iData * sizeof(transfer_data_t);
 #endif
 
-            patch->tData = (transfer_data_t*)AllocBlock(data_size);
+            patch->tData = (transfer_data_t*)AllocBlockNoZero(data_size);
             patch->tIndex = CompressTransferIndicies(tIndex_All, patch->iData, &patch->iIndex);
 
             hlassume(patch->tData != NULL, assume_NoMemory);
@@ -731,7 +731,7 @@ void            MakeRGBScales(const int threadnum)
     float           trans[3];
     float           trans_one;
     patch_t*        patch;
-    patch_t*        patch2;
+    const patchgeometry_t* patch2;
     vec3_t          origin;
     vec_t           area;
     const vec_t*    normal1;
@@ -747,22 +747,22 @@ void            MakeRGBScales(const int threadnum)
     float* tRGBData;
 
 #ifdef HLRAD_MORE_PATCHES
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * (g_num_patches + 1));
-    float* tRGBData_All = (float*)AllocBlock(sizeof(float[3]) * (g_num_patches + 1));
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * (g_num_patches + 1));
+    float* tRGBData_All = (float*)AllocBlockNoZero(sizeof(float[3]) * (g_num_patches + 1));
 #else
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * MAX_PATCHES);
-    float* tRGBData_All = (float*)AllocBlock(sizeof(float[3]) * MAX_PATCHES);
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * MAX_PATCHES);
+    float* tRGBData_All = (float*)AllocBlockNoZero(sizeof(float[3]) * MAX_PATCHES);
 #endif
 #else
     transfer_raw_index_t* tIndex;
     rgb_transfer_data_t* tRGBData;
 
 #ifdef HLRAD_MORE_PATCHES
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * (g_num_patches + 1));
-    rgb_transfer_data_t* tRGBData_All = (rgb_transfer_data_t*)AllocBlock(sizeof(rgb_transfer_data_t) * (g_num_patches + 1));
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * (g_num_patches + 1));
+    rgb_transfer_data_t* tRGBData_All = (rgb_transfer_data_t*)AllocBlockNoZero(sizeof(rgb_transfer_data_t) * (g_num_patches + 1));
 #else
-    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlock(sizeof(transfer_index_t) * MAX_PATCHES);
-    rgb_transfer_data_t* tRGBData_All = (rgb_transfer_data_t*)AllocBlock(sizeof(rgb_transfer_data_t) * MAX_PATCHES);
+    transfer_raw_index_t* tIndex_All = (transfer_raw_index_t*)AllocBlockNoZero(sizeof(transfer_index_t) * MAX_PATCHES);
+    rgb_transfer_data_t* tRGBData_All = (rgb_transfer_data_t*)AllocBlockNoZero(sizeof(rgb_transfer_data_t) * MAX_PATCHES);
 #endif
 #endif
 
@@ -812,7 +812,7 @@ void            MakeRGBScales(const int threadnum)
         // from patch
 		// HLRAD_NOSWAP: patch collect light from patch2
 
-        for (j = 0, patch2 = g_patches; j < g_num_patches; j++, patch2++)
+        for (j = 0, patch2 = g_patchgeometry; j < g_num_patches; j++, patch2++)
         {
             vec_t           dot1;
             vec_t           dot2;
@@ -851,7 +851,7 @@ void            MakeRGBScales(const int threadnum)
 #endif
             }
 
-            normal2 = getPlaneFromFaceNumber(patch2->faceNumber)->normal;
+            normal2 = patch2->normal;
 
             // calculate transferemnce
             VectorSubtract(patch2->origin, origin, delta);
@@ -941,7 +941,7 @@ void            MakeRGBScales(const int threadnum)
 					receiver_normal = backnormal;
 				}
 	#endif
-				emitter_winding = patch2->winding;
+				emitter_winding = g_patches[j].winding;
 				sightarea = CalcSightArea (receiver_origin, receiver_normal, emitter_winding, patch2->emitter_skylevel
 	#ifdef HLRAD_DIVERSE_LIGHTING
 					, lighting_power, lighting_scale
@@ -1133,7 +1133,7 @@ void            MakeRGBScales(const int threadnum)
             unsigned data_size = patch->iData * sizeof(rgb_transfer_data_t);
 #endif
 
-            patch->tRGBData = (rgb_transfer_data_t*)AllocBlock(data_size);
+            patch->tRGBData = (rgb_transfer_data_t*)AllocBlock(data_size); // stays zeroed: vector_compress skips a slot whose input is not a number
             patch->tIndex = CompressTransferIndicies(tIndex_All, patch->iData, &patch->iIndex);
 
             hlassume(patch->tRGBData != NULL, assume_NoMemory);
@@ -439,7 +439,27 @@ inline static void     RecursiveLeafFlow(const int leafnum, const threaddata_t*
         {
             long* test;
 
-            if (p->status == stat_done)
+#ifdef HLVIS_NETVIS
+            if (g_netvis_ranked)
+            {
+                // workers must not change the result, so use exactly the portals a single
+                // thread would have finished before this one
+                if (p->rank < thread->base->rank)
+                {
+                    if (GetPortalStatus(p) != stat_done)
+                    {
+                        NetvisWaitForPortal(p);
+                    }
+                    test = (long*)p->visbits;
+                }
+                else
+                {
+                    test = (long*)p->mightsee;
+                }
+            }
+            else
+#endif
+            if (GetPortalStatus(p) == stat_done)
             {
                 test = (long*)p->visbits;
             }
@@ -620,12 +640,96 @@ void            PortalFlow(portal_t* p)
 #ifdef ZHLT_NETVIS
     p->fromclient = g_clientid;
 #endif
-    p->status = stat_done;
+    SetPortalDone(p);
 #ifdef ZHLT_NETVIS
     Flag_VIS_DONE_PORTAL(g_visportalindex);
 #endif
 }
 
+#ifdef HLVIS_BASEVIS_LAZY
+// =====================================================================================
+//  PortalSeesPortal
+//      The BasePortalVis test: some point of tp is in front of p's plane, and some point
+//      of p is behind tp's plane.
+// =====================================================================================
+static bool     PortalSeesPortal(const portal_t* const p, const portal_t* const tp)
+{
+    const winding_t* w;
+    int             k;
+    float           d;
+
+    w = tp->winding;
+    for (k = 0; k < w->numpoints; k++)
+    {
+        d = DotProduct(w->points[k], p->plane.normal) - p->plane.dist;
+        if (d > ON_EPSILON)
+        {
+            break;
+        }
+    }
+    if (k == w->numpoints)
+    {
+        return false;                                      // no points on front
+    }
+
+    w = p->winding;
+    for (k = 0; k < w->numpoints; k++)
+    {
+        d = DotProduct(w->points[k], tp->plane.normal) - tp->plane.dist;
+        if (d < -ON_EPSILON)
+        {
+            break;
+        }
+    }
+    if (k == w->numpoints)
+    {
+        return false;                                      // no points on back
+    }
+
+    return true;
+}
+
+// =====================================================================================
+//  BaseFlood
+//      SimpleFlood from portal p, testing each portal only when the flood reaches the leaf
+//      it leaves from and has not yet reached the leaf it leads into. The flood result
+//      is the set of leafs reachable through passing portals, so skipping the portals
+//      that could add nothing gives the same mightsee as testing every portal up front.
+// =====================================================================================
+static void     BaseFlood(portal_t* const p, const int leafnum)
+{
+    unsigned        i;
+    int             next;
+    const leaf_t*   leaf;
+    const portal_t* tp;
+
+    p->mightsee[leafnum >> 3] |= 1 << (leafnum & 7);
+    p->nummightsee++;
+    leaf = &g_leafs[leafnum];
+
+    for (i = 0; i < leaf->numportals; i++)
+    {
+        tp = leaf->portals[i];
+        next = tp->leaf;
+        if (tp == p || (p->mightsee[next >> 3] & (1 << (next & 7))))
+        {
+            continue;
+        }
+#if ZHLT_ZONES
+        if (g_Zones->check(p->zone, tp->zone))
+        {
+            continue;
+        }
+#endif
+        if (!PortalSeesPortal(p, tp))
+        {
+            continue;
+        }
+        BaseFlood(p, next);
+    }
+}
+
+#else
 // =====================================================================================
 //  SimpleFlood
 //      This is a rough first-order aproximation that is used to trivially reject some
@@ -665,6 +769,7 @@ static void     SimpleFlood(byte* const srcmightsee, const int leafnum, byte* co
     }
 }
 
+#endif
 #define PORTALSEE_SIZE (MAX_PORTALS*2)
 #ifdef SYSTEM_WIN32
 #pragma warning(push)
@@ -1158,6 +1263,10 @@ static float		CalcSplitsAndDotProducts(plane_t *org_split_plane, leaf_t *leaf1,
 // =====================================================================================
 void            BasePortalVis(int unused)
 {
+#ifdef HLVIS_BASEVIS_LAZY
+    int             i;
+    portal_t*       p;
+#else
     int             i, j, k;
     portal_t*       tp;
     portal_t*       p;
@@ -1165,6 +1274,7 @@ void            BasePortalVis(int unused)
     winding_t*      w;
     byte            portalsee[PORTALSEE_SIZE];
     const int       portalsize = (g_numportals * 2);
+#endif
 
 #ifdef ZHLT_NETVIS
     {
@@ -1180,6 +1290,9 @@ void            BasePortalVis(int unused)
 
         p->mightsee = (byte*)calloc(1, g_bitbytes);
 
+#ifdef HLVIS_BASEVIS_LAZY
+        BaseFlood(p, p->leaf);
+#else
         memset(portalsee, 0, portalsize);
 
 #if ZHLT_ZONES
@@ -1233,6 +1346,7 @@ void            BasePortalVis(int unused)
         }
 
         SimpleFlood(p->mightsee, p->leaf, portalsee, &p->nummightsee);
+#endif
         Verbose("portal:%4i  nummightsee:%4i \n", i, p->nummightsee);
     }
 }
@@ -1485,27 +1599,150 @@ vec_t WindingDist (const winding_t *w[2])
 	return (sqrt (minsqrdist));
 }
 #endif
+#ifdef HLVIS_MAXDIST_NEW
+// =====================================================================================
+//  PrepareMaxDistVis
+//      The bounding sphere of every leaf's portal points, and for every leaf a row of
+//      the leafs it shares visibility with either way. MaxDistVis only changes the bits
+//      of the pair it is testing, so both stay valid while it runs.
+// =====================================================================================
+typedef struct
+{
+	vec3_t center;
+	vec_t radius;
+	int count;
+}
+leafsphere_t;
+
+static leafsphere_t *g_leafspheres = NULL;
+static leafsphere_t *g_portalspheres = NULL; // [numportals * 2]
+static byte *g_maxdistvisible = NULL; // [portalleafs * bitbytes]
+
+void PrepareMaxDistVis ()
+{
+	unsigned i, j;
+	int a, b, k;
+
+	g_leafspheres = (leafsphere_t *)malloc (qmax (g_portalleafs, 1u) * sizeof (leafsphere_t));
+	g_portalspheres = (leafsphere_t *)malloc (qmax (g_numportals * 2, 1) * sizeof (leafsphere_t));
+	g_maxdistvisible = (byte *)calloc (qmax (g_portalleafs, 1u), g_bitbytes);
+	hlassume (g_leafspheres != NULL && g_portalspheres != NULL && g_maxdistvisible != NULL, assume_NoMemory);
+
+	for (a = 0; a < g_numportals * 2; a++)
+	{
+		const winding_t *w = g_portals[a].winding;
+		leafsphere_t *s = &g_portalspheres[a];
+		vec3_t v;
+
+		s->count = w->numpoints;
+		VectorClear (s->center);
+		for (b = 0; b < w->numpoints; b++)
+		{
+			VectorAdd (w->points[b], s->center, s->center);
+		}
+		VectorScale (s->center, 1.0 / (vec_t)qmax (w->numpoints, 1), s->center);
+		s->radius = 0;
+		for (b = 0; b < w->numpoints; b++)
+		{
+			VectorSubtract (w->points[b], s->center, v);
+			s->radius = qmax (s->radius, DotProduct (v, v));
+		}
+		s->radius = sqrt (s->radius);
+	}
+
+	for (i = 0; i < g_portalleafs; i++)
+	{
+		const leaf_t *l = &g_leafs[i];
+		leafsphere_t *s = &g_leafspheres[i];
+		const winding_t *w;
+		vec3_t v;
+		vec_t dist;
+		byte *row = g_maxdistvisible + i * g_bitbytes;
+
+		s->count = 0;
+		VectorClear (s->center);
+		for (a = 0; a < l->numportals; a++)
+		{
+			w = l->portals[a]->winding;
+			for (b = 0; b < w->numpoints; b++)
+			{
+				VectorAdd (w->points[b], s->center, s->center);
+				s->count++;
+			}
+		}
+		VectorScale (s->center, 1.0 / (vec_t)s->count, s->center);
+		s->radius = 0;
+		for (a = 0; a < l->numportals; a++)
+		{
+			w = l->portals[a]->winding;
+			for (b = 0; b < w->numpoints; b++)
+			{
+				VectorSubtract (w->points[b], s->center, v);
+				dist = DotProduct (v, v);
+				s->radius = qmax (s->radius, dist);
+			}
+		}
+		s->radius = sqrt (s->radius);
+
+		for (a = 0; a < l->numportals; a++)
+		{
+			const long *src = (const long *)l->portals[a]->visbits;
+			long *dest = (long *)row;
+			for (k = 0; k < (int)g_bitlongs; k++)
+			{
+				dest[k] |= src[k];
+			}
+		}
+	}
+
+	// mirror the rows, a pair is tested if either leaf's portals see the other
+	for (i = 0; i < g_portalleafs; i++)
+	{
+		const byte *row = g_maxdistvisible + i * g_bitbytes;
+		for (j = 0; j < g_portalleafs; j++)
+		{
+			if (!row[j >> 3])
+			{
+				j |= 7;
+				continue;
+			}
+			if (row[j >> 3] & (1 << (j & 7)))
+			{
+				g_maxdistvisible[j * g_bitbytes + (i >> 3)] |= 1 << (i & 7);
+			}
+		}
+	}
+}
+
+void FreeMaxDistVis ()
+{
+	free (g_leafspheres);
+	g_leafspheres = NULL;
+	free (g_portalspheres);
+	g_portalspheres = NULL;
+	free (g_maxdistvisible);
+	g_maxdistvisible = NULL;
+}
+
 // AJM: MVD
 // =====================================================================================
 //  MaxDistVis
+//      Only the pairs in g_maxdistvisible are visited; the bounding spheres settle
+//      most of them, and only those straddling g_maxdistance get the WindingDist test.
 // =====================================================================================
 void	MaxDistVis(int unused)
 {
 	int i, j, k, m;
-	int a, b, c, d;
 	leaf_t	*l;
 	leaf_t	*tl;
-	plane_t	*boundary = NULL;
-	vec3_t delta;
-
-	float new_dist;
+	const byte *row;
 
 	unsigned offset_l;
 	unsigned bit_l;
 
 	unsigned offset_tl;
 	unsigned bit_tl;
-	
+
 	while(1)
 	{
 		i = GetThreadWork();
@@ -1513,119 +1750,127 @@ void	MaxDistVis(int unused)
 			break;
 
 		l = &g_leafs[i];
+		row = g_maxdistvisible + i * g_bitbytes;
 
-		for(j = i + 1, tl = g_leafs + j; j < g_portalleafs; j++, tl++)
-		{
-#ifdef HLVIS_MAXDIST_NEW
-
-			offset_l = i >> 3;
-			bit_l = (1 << (i & 7));
+		offset_l = i >> 3;
+		bit_l = (1 << (i & 7));
 
+		for(j = i + 1; j < g_portalleafs; j++)
+		{
 			offset_tl = j >> 3;
 			bit_tl = (1 << (j & 7));
 
+			if (!row[offset_tl])
 			{
-				bool visible = false;
-				for (k = 0; k < l->numportals; k++)
-				{
-					if (l->portals[k]->visbits[offset_tl] & bit_tl)
-					{
-						visible = true;
-					}
-				}
-				for (m = 0; m < tl->numportals; m++)
-				{	
-					if (tl->portals[m]->visbits[offset_l] & bit_l)
-					{
-						visible = true;
-					}
-				}
-				if (!visible)
-				{
-					goto NoWork;
-				}
+				j |= 7;
+				continue;
 			}
-			
+			if (!(row[offset_tl] & bit_tl))
+			{
+				continue;
+			}
+			tl = &g_leafs[j];
+
 			// rough check
 			{
+				const leafsphere_t *s[2] = {&g_leafspheres[i], &g_leafspheres[j]};
 				vec3_t v;
 				vec_t dist;
-				const winding_t *w;
-				const leaf_t *leaf[2] = {l, tl};
-				vec3_t center[2];
-				vec_t radius[2];
-				int side, count[2];
-				for (side = 0; side < 2; side++)
-				{
-					count[side] = 0;
-					VectorClear (center[side]);
-					for (a = 0; a < leaf[side]->numportals; a++)
-					{
-						w = leaf[side]->portals[a]->winding;
-						for (b = 0; b < w->numpoints; b++)
-						{
-							VectorAdd (w->points[b], center[side], center[side]);
-							count[side]++;
-						}
-					}
-				}
-				if (!count[0] && !count[1])
+				if (!s[0]->count && !s[1]->count)
 				{
 					goto Work;
 				}
-				for (side = 0; side < 2; side++)
-				{
-					VectorScale (center[side], 1.0 / (vec_t)count[side], center[side]);
-					radius[side] = 0;
-					for (a = 0; a < leaf[side]->numportals; a++)
-					{
-						w = leaf[side]->portals[a]->winding;
-						for (b = 0; b < w->numpoints; b++)
-						{
-							VectorSubtract (w->points[b], center[side], v);
-							dist = DotProduct (v, v);
-							radius[side] = qmax (radius[side], dist);
-						}
-					}
-					radius[side] = sqrt (radius[side]);
-				}
-				VectorSubtract (center[0], center[1], v);
+				VectorSubtract (s[0]->center, s[1]->center, v);
 				dist = VectorLength (v);
-				if (qmax (dist - radius[0] - radius[1], 0) >= g_maxdistance - ON_EPSILON)
+				if (qmax (dist - s[0]->radius - s[1]->radius, 0) >= g_maxdistance - ON_EPSILON)
 				{
 					goto Work;
 				}
-				if (dist + radius[0] + radius[1] < g_maxdistance - ON_EPSILON)
+				if (dist + s[0]->radius + s[1]->radius < g_maxdistance - ON_EPSILON)
 				{
-					goto NoWork;
+					continue;
 				}
 			}
 
-			// exact check
+			// exact check, stopping at the first pair of portals within range; portals whose
+			// spheres are clearly out of range can't be that pair
 			{
-				vec_t mindist = 9999999999;
-				vec_t dist;
-				for (k = 0; k < l->numportals; k++)
+				const vec_t range = g_maxdistance - ON_EPSILON;
+				bool near = false;
+				for (k = 0; k < l->numportals && !near; k++)
 				{
+					const leafsphere_t *s0 = &g_portalspheres[l->portals[k] - g_portals];
 					for (m = 0; m < tl->numportals; m++)
 					{
+						const leafsphere_t *s1 = &g_portalspheres[tl->portals[m] - g_portals];
 						const winding_t *w[2];
+						vec3_t v;
+						VectorSubtract (s0->center, s1->center, v);
+						if (VectorLength (v) - s0->radius - s1->radius >= range + 1)
+						{
+							continue;
+						}
 						w[0] = l->portals[k]->winding;
 						w[1] = tl->portals[m]->winding;
-						dist = WindingDist (w);
-						mindist = qmin (dist, mindist);
+						if (WindingDist (w) < range)
+						{
+							near = true;
+							break;
+						}
 					}
 				}
-				if (mindist >= g_maxdistance - ON_EPSILON)
-				{
-					goto Work;
-				}
-				else
+				if (near)
 				{
-					goto NoWork;
+					continue;
 				}
 			}
+
+Work:
+			ThreadLock ();
+			for (k = 0; k < l->numportals; k++)
+			{
+				l->portals[k]->visbits[offset_tl] &= ~bit_tl;
+			}
+			for (m = 0; m < tl->numportals; m++)
+			{
+				tl->portals[m]->visbits[offset_l] &= ~bit_l;
+			}
+			ThreadUnlock ();
+		}
+	}
+}
 #else
+// AJM: MVD
+// =====================================================================================
+//  MaxDistVis
+// =====================================================================================
+void	MaxDistVis(int unused)
+{
+	int i, j, k, m;
+	int a, b, c, d;
+	leaf_t	*l;
+	leaf_t	*tl;
+	plane_t	*boundary = NULL;
+	vec3_t delta;
+
+	float new_dist;
+
+	unsigned offset_l;
+	unsigned bit_l;
+
+	unsigned offset_tl;
+	unsigned bit_tl;
+	
+	while(1)
+	{
+		i = GetThreadWork();
+		if (i == -1)
+			break;
+
+		l = &g_leafs[i];
+
+		for(j = i + 1, tl = g_leafs + j; j < g_portalleafs; j++, tl++)
+		{
 			if(j == i)		// Ideally, should never be true
 			{
 				continue;
@@ -1718,21 +1963,7 @@ void	MaxDistVis(int unused)
 					}
 				}
 			}
-#endif
 
-#ifdef HLVIS_MAXDIST_NEW
-Work:
-			ThreadLock ();
-			for (k = 0; k < l->numportals; k++)
-			{
-				l->portals[k]->visbits[offset_tl] &= ~bit_tl;
-			}
-			for (m = 0; m < tl->numportals; m++)
-			{
-				tl->portals[m]->visbits[offset_l] &= ~bit_l;
-			}
-			ThreadUnlock ();
-#else
 			offset_l = i >> 3;
 			bit_l = (1 << (i & 7));
 
@@ -1754,7 +1985,6 @@ Work:
 						tl->portals[m]->mightsee[offset_l] &= ~bit_l;
 				}
 			}
-#endif
 			
 NoWork:
 			continue;	// Hack to keep label from causing compile error
@@ -1765,6 +1995,7 @@ NoWork:
 	if(boundary)
 		delete [] boundary;
 }
+#endif
 #endif // HLVIS_MAXDIST
 
 #ifdef SYSTEM_WIN32
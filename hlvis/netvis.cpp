@@ -0,0 +1,1161 @@
+#include "vis.h"
+
+#ifdef HLVIS_NETVIS
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netdb.h>
+#include <poll.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <errno.h>
+
+// =====================================================================================
+//  Netvis
+//      The coordinator (-listen) is a normal hlvis run that also accepts worker processes
+//      (-worker) while PortalFlow runs. A worker receives the portal file, the fullvis
+//      setting and the mightsee bits of every portal, then asks for one portal per thread
+//      at a time. Portals are handed out from the same least complex first queue the
+//      local threads use, and every finished portal (local or remote) is broadcast to the
+//      workers, because PortalFlow waits for the portals ranked before its own (see
+//      RankPortals). That makes the result identical to a single threaded run.
+//      Visbits travel compressed with CompressVis.
+//      A worker that drops out returns its portals to the queue; the coordinator's own
+//      threads keep flowing until every portal is done, so the run never depends on the
+//      workers.
+//      Messages are a type and a payload length followed by the payload, all integers
+//      little endian.
+// =====================================================================================
+
+#define NETVIS_VERSION          1
+#define NETVIS_DEFAULT_PORT     "21212"
+#define NETVIS_MAX_WORKERS      256
+#define NETVIS_MAX_MESSAGE      (1 << 26)
+#define NETVIS_CONNECT_TIMEOUT  60                         // seconds a worker keeps trying to reach the coordinator
+#define NETVIS_SEND_TIMEOUT     60                         // seconds before a worker that stopped reading is dropped
+#define NETVIS_LINGER_TIMEOUT   5.0                        // seconds to answer the last requests once all portals are done
+
+typedef enum
+{
+    netvis_hello = 1,                                      // worker: version
+    netvis_setup,                                          // coordinator: settings and portal file, then a netvis_sync with the mightsee of every portal
+    netvis_want,                                           // worker: thread, ready for a portal
+    netvis_result,                                         // worker: portal, numcansee, compressed visbits
+    netvis_sync,                                           // coordinator: a finished portal, laid out like netvis_result
+    netvis_work                                            // coordinator: thread, portal to flow or -1 when none are left
+}
+netvismessage_t;
+
+typedef struct
+{
+    byte*           data;
+    int             size;
+    int             maxsize;
+}
+netvisbuffer_t;
+
+typedef struct
+{
+    int             socket;                                // -1 for a free slot
+    netvisbuffer_t  in;                                    // partially received messages
+    int             synced;                                // entries of g_netvisdone already sent, -1 before the setup
+}
+netvisworker_t;
+
+const char*     g_netvis_listen = NULL;
+const char*     g_netvis_worker = NULL;
+bool            g_netvis_ranked = false;                   // PortalFlow uses the portals ranked before its own, see RankPortals
+
+// coordinator
+static int      g_netvissocket = -1;
+static char     g_netvissocketpath[_MAX_PATH] = "";        // Unix socket to remove on exit
+static char*    g_netvisportalfile = NULL;
+static int      g_netvisportalfilesize = 0;
+static netvisbuffer_t g_netvissetup;
+static netvisworker_t g_netvisworkers[NETVIS_MAX_WORKERS];
+static int      g_netviswake[2] = { -1, -1 };              // pipe that wakes the serving thread when a portal is done
+static int      g_netvisthread = -1;                       // thread number that serves the workers
+static bool     g_netvisextrathread = false;
+static int*     g_netvisowner = NULL;                      // worker flowing each portal, -1 if none
+static int*     g_netvisdone = NULL;                       // portals in the order they were finished
+static int      g_netvisnumdone = 0;
+static int      g_netvisnumremote = 0;
+
+// worker
+static int      g_netvisconnection = -1;
+static volatile bool g_netvisconnected = false;
+static int      g_netvisassigned[MAX_THREADS];             // portal the coordinator gave each thread, -2 while waiting
+static int      g_netvisnumflowed = 0;
+static pthread_mutex_t g_netvissendlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t g_netvisworkerlock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_netvisworkercond = PTHREAD_COND_INITIALIZER;
+
+// both
+static pthread_mutex_t g_netvissignallock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t g_netvissignalcond = PTHREAD_COND_INITIALIZER;
+static unsigned g_netvissignals = 0;                       // bumped whenever a waiting flow thread might go on
+
+// =====================================================================================
+//  Message buffers
+// =====================================================================================
+static void     BufferReserve(netvisbuffer_t* const b, const int size)
+{
+    if (b->size + size > b->maxsize)
+    {
+        b->maxsize = qmax(b->size + size, b->maxsize * 2);
+        b->data = (byte*)realloc(b->data, b->maxsize);
+        hlassume(b->data != NULL, assume_NoMemory);
+    }
+}
+
+static void     BufferPutInt(netvisbuffer_t* const b, const int value)
+{
+    const int       little = LittleLong(value);
+
+    BufferReserve(b, sizeof(int));
+    memcpy(b->data + b->size, &little, sizeof(int));
+    b->size += sizeof(int);
+}
+
+static void     BufferPutBytes(netvisbuffer_t* const b, const void* const data, const int size)
+{
+    BufferReserve(b, size);
+    memcpy(b->data + b->size, data, size);
+    b->size += size;
+}
+
+// returns the offset to pass to EndMessage
+static int      BeginMessage(netvisbuffer_t* const b, const netvismessage_t type)
+{
+    const int       start = b->size;
+
+    BufferPutInt(b, type);
+    BufferPutInt(b, 0);
+    return start;
+}
+
+static void     EndMessage(netvisbuffer_t* const b, const int start)
+{
+    const int       little = LittleLong(b->size - start - 2 * (int)sizeof(int));
+
+    memcpy(b->data + start + sizeof(int), &little, sizeof(int));
+}
+
+static void     FreeBuffer(netvisbuffer_t* const b)
+{
+    free(b->data);
+    memset(b, 0, sizeof(*b));
+}
+
+// reads from a received payload; false once the payload is exhausted
+static bool     GetInt(const byte** const p, const byte* const end, int* const value)
+{
+    int             little;
+
+    if (end - *p < (int)sizeof(int))
+    {
+        return false;
+    }
+    memcpy(&little, *p, sizeof(int));
+    *value = LittleLong(little);
+    *p += sizeof(int);
+    return true;
+}
+
+// appends a portal and its compressed bits (netvis_result and netvis_sync)
+static void     PutPortalBits(netvisbuffer_t* const b, const netvismessage_t type, const int portalnum, const int count, const byte* const bits)
+{
+    byte*           compressed = (byte*)alloca(g_bitbytes * 2);
+    const int       start = BeginMessage(b, type);
+    const int       size = CompressVis(bits, g_bitbytes, compressed, g_bitbytes * 2);
+
+    BufferPutInt(b, portalnum);
+    BufferPutInt(b, count);
+    BufferPutInt(b, size);
+    BufferPutBytes(b, compressed, size);
+    EndMessage(b, start);
+}
+
+// reads what PutPortalBits wrote; bits is allocated here
+// (DecompressVis only reads from g_dvisdata, so the runs are expanded here with bounds checks)
+static bool     GetPortalBits(const byte* p, const byte* const end, int* const portalnum, int* const count, byte** const bits)
+{
+    unsigned        out;
+    int             size;
+
+    if (!GetInt(&p, end, portalnum) || !GetInt(&p, end, count) || !GetInt(&p, end, &size))
+    {
+        return false;
+    }
+    if (*portalnum < 0 || *portalnum >= g_numportals * 2 || size != end - p)
+    {
+        return false;
+    }
+    *bits = (byte*)calloc(1, g_bitbytes);
+    hlassume(*bits != NULL, assume_NoMemory);
+    for (out = 0; out < g_bitbytes && p < end; p++)
+    {
+        if (*p)
+        {
+            (*bits)[out++] = *p;
+        }
+        else if (++p < end)
+        {
+            out += *p;                                     // run of zeros, already cleared
+        }
+    }
+    if (out != g_bitbytes || p != end)
+    {
+        free(*bits);
+        return false;
+    }
+    return true;
+}
+
+// =====================================================================================
+//  Sockets
+// =====================================================================================
+static bool     SendAll(const int s, const void* const data, const int size)
+{
+    const char*     p = (const char*)data;
+    int             left = size;
+
+    while (left > 0)
+    {
+        const ssize_t   n = send(s, p, left, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+static bool     RecvAll(const int s, void* const data, const int size)
+{
+    char*           p = (char*)data;
+    int             left = size;
+
+    while (left > 0)
+    {
+        const ssize_t   n = recv(s, p, left, 0);
+        if (n < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (n <= 0)
+        {
+            return false;
+        }
+        p += n;
+        left -= n;
+    }
+    return true;
+}
+
+// blocking receive of one message into payload; false if the connection is gone
+static bool     RecvMessage(const int s, int* const type, netvisbuffer_t* const payload)
+{
+    int             header[2];
+    int             size;
+
+    if (!RecvAll(s, header, sizeof(header)))
+    {
+        return false;
+    }
+    *type = LittleLong(header[0]);
+    size = LittleLong(header[1]);
+    if (size < 0 || size > NETVIS_MAX_MESSAGE)
+    {
+        return false;
+    }
+    payload->size = 0;
+    BufferReserve(payload, size);
+    payload->size = size;
+    return RecvAll(s, payload->data, size);
+}
+
+// =====================================================================================
+//  OpenSocket
+//      address is a Unix socket path (anything containing a slash), "host:port", "port"
+//      or "host". Returns -1 if a worker cannot connect yet; listening failures are fatal.
+// =====================================================================================
+static int      OpenSocket(const char* const address, const bool listening)
+{
+    int             s;
+
+    if (strchr(address, '/'))
+    {
+        struct sockaddr_un addr;
+
+        memset(&addr, 0, sizeof(addr));
+        addr.sun_family = AF_UNIX;
+        if (strlen(address) >= sizeof(addr.sun_path))
+        {
+            Error("Netvis: socket path '%s' is too long", address);
+        }
+        strcpy(addr.sun_path, address);
+        s = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (s < 0)
+        {
+            Error("Netvis: socket() failed: %s", strerror(errno));
+        }
+        if (listening)
+        {
+            unlink(address);
+            if (bind(s, (struct sockaddr*)&addr, sizeof(addr)) < 0 || listen(s, 64) < 0)
+            {
+                Error("Netvis: cannot listen on '%s': %s", address, strerror(errno));
+            }
+            safe_strncpy(g_netvissocketpath, address, _MAX_PATH);
+        }
+        else if (connect(s, (struct sockaddr*)&addr, sizeof(addr)) < 0)
+        {
+            close(s);
+            return -1;
+        }
+        return s;
+    }
+
+    char            host[_MAX_PATH];
+    const char*     port;
+    char*           colon;
+    struct addrinfo hints;
+    struct addrinfo* list;
+    struct addrinfo* ai;
+    int             rval;
+
+    safe_strncpy(host, address, _MAX_PATH);
+    colon = strrchr(host, ':');
+    if (colon)
+    {
+        *colon = '\0';
+        port = colon + 1;
+    }
+    else if (strspn(host, "0123456789") == strlen(host))
+    {
+        port = address;
+        host[0] = '\0';
+    }
+    else
+    {
+        port = NETVIS_DEFAULT_PORT;
+    }
+
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    hints.ai_flags = listening ? AI_PASSIVE : 0;
+    rval = getaddrinfo(host[0] ? host : NULL, port, &hints, &list);
+    if (rval != 0)
+    {
+        Error("Netvis: cannot resolve '%s': %s", address, gai_strerror(rval));
+    }
+
+    s = -1;
+    for (ai = list; ai != NULL && s == -1; ai = ai->ai_next)
+    {
+        const int       on = 1;
+
+        s = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (s < 0)
+        {
+            s = -1;
+            continue;
+        }
+        if (listening)
+        {
+            setsockopt(s, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+            if (bind(s, ai->ai_addr, ai->ai_addrlen) < 0 || listen(s, 64) < 0)
+            {
+                close(s);
+                s = -1;
+            }
+        }
+        else if (connect(s, ai->ai_addr, ai->ai_addrlen) < 0)
+        {
+            close(s);
+            s = -1;
+        }
+        if (s != -1)
+        {
+            setsockopt(s, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        }
+    }
+    freeaddrinfo(list);
+
+    if (s == -1 && listening)
+    {
+        Error("Netvis: cannot listen on '%s': %s", address, strerror(errno));
+    }
+    return s;
+}
+
+static void     NetvisClose()
+{
+    if (g_netvissocket != -1)
+    {
+        close(g_netvissocket);
+        g_netvissocket = -1;
+    }
+    if (g_netvissocketpath[0])
+    {
+        unlink(g_netvissocketpath);
+        g_netvissocketpath[0] = '\0';
+    }
+}
+
+// =====================================================================================
+//  NetvisListen
+//      Opens the coordinator socket at startup, so workers can connect while
+//      BasePortalVis runs; they wait in the backlog until PortalFlow begins.
+// =====================================================================================
+void            NetvisListen(const char* const portalfile)
+{
+    signal(SIGPIPE, SIG_IGN);
+    g_netvissocket = OpenSocket(g_netvis_listen, true);
+    g_netvis_ranked = true;
+    atexit(NetvisClose);
+    g_netvisportalfilesize = LoadFile(portalfile, &g_netvisportalfile);
+    Log("Netvis: listening for workers on %s\n", g_netvis_listen);
+}
+
+
+// =====================================================================================
+//  NetvisBeginFlow / NetvisEndFlow
+//      Bracket the PortalFlow threads. One extra thread serves the workers, so that it
+//      shares ThreadLock with the local threads when claiming portals.
+// =====================================================================================
+void            NetvisBeginFlow()
+{
+    const int       numportals = g_numportals * 2;
+    int             i, start;
+
+    if (g_netvissocket == -1)
+    {
+        return;
+    }
+
+    start = BeginMessage(&g_netvissetup, netvis_setup);
+    BufferPutInt(&g_netvissetup, g_fullvis);
+    BufferPutInt(&g_netvissetup, g_portalleafs);
+    BufferPutInt(&g_netvissetup, g_numportals);
+#ifdef ZHLT_DETAILBRUSH
+    BufferPutInt(&g_netvissetup, g_dmodels[0].visleafs);
+#else
+    BufferPutInt(&g_netvissetup, 0);
+#endif
+    BufferPutInt(&g_netvissetup, g_netvisportalfilesize);
+    BufferPutBytes(&g_netvissetup, g_netvisportalfile, g_netvisportalfilesize);
+    EndMessage(&g_netvissetup, start);
+    free(g_netvisportalfile);
+    g_netvisportalfile = NULL;
+    for (i = 0; i < numportals; i++)
+    {
+        PutPortalBits(&g_netvissetup, netvis_sync, i, g_portals[i].nummightsee, g_portals[i].mightsee);
+    }
+
+    g_netvisowner = (int*)malloc(qmax(numportals, 1) * sizeof(int));
+    g_netvisdone = (int*)malloc(qmax(numportals, 1) * sizeof(int));
+    hlassume(g_netvisowner != NULL && g_netvisdone != NULL, assume_NoMemory);
+    for (i = 0; i < numportals; i++)
+    {
+        g_netvisowner[i] = -1;
+    }
+    g_netvisnumdone = 0;
+    g_netvisnumremote = 0;
+    for (i = 0; i < NETVIS_MAX_WORKERS; i++)
+    {
+        g_netvisworkers[i].socket = -1;
+    }
+    if (pipe(g_netviswake) < 0)
+    {
+        Error("Netvis: pipe() failed: %s", strerror(errno));
+    }
+    fcntl(g_netviswake[0], F_SETFL, O_NONBLOCK);
+    fcntl(g_netviswake[1], F_SETFL, O_NONBLOCK);
+
+    g_netvisextrathread = g_numthreads < MAX_THREADS;
+    if (g_netvisextrathread)
+    {
+        g_numthreads++;
+    }
+    g_netvisthread = g_numthreads - 1;
+}
+
+void            NetvisEndFlow()
+{
+    int             i;
+
+    if (g_netvisthread == -1)
+    {
+        return;
+    }
+    if (g_netvisextrathread)
+    {
+        g_numthreads--;
+    }
+    g_netvisthread = -1;
+    for (i = 0; i < NETVIS_MAX_WORKERS; i++)
+    {
+        if (g_netvisworkers[i].socket != -1)
+        {
+            close(g_netvisworkers[i].socket);
+            g_netvisworkers[i].socket = -1;
+        }
+        FreeBuffer(&g_netvisworkers[i].in);
+    }
+    for (i = 0; i < 2; i++)
+    {
+        close(g_netviswake[i]);
+        g_netviswake[i] = -1;
+    }
+    FreeBuffer(&g_netvissetup);
+    free(g_netvisowner);
+    g_netvisowner = NULL;
+    free(g_netvisdone);
+    g_netvisdone = NULL;
+    NetvisClose();
+    Log("Netvis: %d of %d portals were flowed by workers\n", g_netvisnumremote, g_numportals * 2);
+}
+
+// =====================================================================================
+//  NetvisSignal
+//      Wakes the threads blocked in NetvisWaitForPortal and NetvisNextPortal. Called when
+//      a portal is done, returned to the queue, or the coordinator is lost. A waiter reads
+//      the count before it tests its condition, so a signal in between is never missed.
+// =====================================================================================
+void            NetvisSignal()
+{
+    if (!g_netvis_ranked)
+    {
+        return;
+    }
+    pthread_mutex_lock(&g_netvissignallock);
+    g_netvissignals++;
+    pthread_cond_broadcast(&g_netvissignalcond);
+    pthread_mutex_unlock(&g_netvissignallock);
+}
+
+static unsigned GetSignals()
+{
+    unsigned        signals;
+
+    pthread_mutex_lock(&g_netvissignallock);
+    signals = g_netvissignals;
+    pthread_mutex_unlock(&g_netvissignallock);
+    return signals;
+}
+
+// blocks until NetvisSignal is called after signals was read
+static void     WaitForSignal(const unsigned signals)
+{
+    pthread_mutex_lock(&g_netvissignallock);
+    while (g_netvissignals == signals)
+    {
+        pthread_cond_wait(&g_netvissignalcond, &g_netvissignallock);
+    }
+    pthread_mutex_unlock(&g_netvissignallock);
+}
+
+// =====================================================================================
+//  NetvisPortalDone
+//      Queues a portal finished by a local thread for the workers.
+// =====================================================================================
+void            NetvisPortalDone(const portal_t* const p)
+{
+    const byte      wake = 0;
+
+    if (g_netvisthread == -1)
+    {
+        return;
+    }
+    ThreadLock();
+    g_netvisdone[g_netvisnumdone++] = p - g_portals;
+    ThreadUnlock();
+    NetvisSignal();                                        // the last one ends NetvisNextPortal
+    if (write(g_netviswake[1], &wake, 1) < 0)
+    {
+        // the pipe is already full of wake ups
+    }
+}
+
+static bool     AllPortalsDone()
+{
+    bool            done;
+
+    ThreadLock();
+    done = g_netvisnumdone == g_numportals * 2;
+    ThreadUnlock();
+    return done;
+}
+
+// =====================================================================================
+//  NetvisNextPortal
+//      For a local thread that found the queue empty: waits until the workers are done,
+//      flowing any portal that a lost worker put back.
+// =====================================================================================
+portal_t*       NetvisNextPortal()
+{
+    portal_t*       p;
+    unsigned        signals;
+
+    if (g_netvisthread == -1)
+    {
+        return NULL;
+    }
+    while (1)
+    {
+        signals = GetSignals();
+        if (AllPortalsDone())
+        {
+            return NULL;
+        }
+        if ((p = ClaimNextPortal()) != NULL)
+        {
+            return p;
+        }
+        WaitForSignal(signals);
+    }
+}
+
+// =====================================================================================
+//  NetvisWaitForPortal
+//      Blocks PortalFlow until an earlier ranked portal is done. On the coordinator, a
+//      portal a lost worker put back is flowed right here, since every local thread
+//      might be waiting for it. On a worker, a lost coordinator is fatal.
+// =====================================================================================
+void            NetvisWaitForPortal(portal_t* const p)
+{
+    unsigned        signals;
+    bool            claimed;
+
+    while (1)
+    {
+        signals = GetSignals();
+        if (GetPortalStatus(p) == stat_done)
+        {
+            return;
+        }
+        if (g_netvis_worker)
+        {
+            if (!g_netvisconnected)
+            {
+                Error("Netvis: lost connection to coordinator");
+            }
+        }
+        else if (g_netvisthread != -1)
+        {
+            claimed = false;
+            ThreadLock();
+            if (p->status == stat_none)
+            {
+                p->status = stat_working;
+                claimed = true;
+            }
+            ThreadUnlock();
+            if (claimed)
+            {
+                PortalFlow(p);
+                NetvisPortalDone(p);
+                return;
+            }
+        }
+        WaitForSignal(signals);
+    }
+}
+
+static void     DropWorker(const int w)
+{
+    netvisworker_t* worker = &g_netvisworkers[w];
+    int             i, returned;
+
+    close(worker->socket);
+    worker->socket = -1;
+    worker->in.size = 0;
+
+    returned = 0;
+    ThreadLock();
+    for (i = 0; i < g_numportals * 2; i++)
+    {
+        if (g_netvisowner[i] == w)
+        {
+            g_netvisowner[i] = -1;
+            g_portals[i].status = stat_none;
+            returned++;
+        }
+    }
+    ThreadUnlock();
+    if (returned)
+    {
+        NetvisSignal();
+        Warning("Netvis: lost worker %d, %d portals returned to the queue", w, returned);
+    }
+}
+
+// handles one message from a worker; false drops the worker
+static bool     ServeMessage(const int w, const int type, const byte* payload, const byte* const end)
+{
+    netvisworker_t* worker = &g_netvisworkers[w];
+    int             portalnum, count, threadnum, start;
+    byte*           bits;
+    portal_t*       p;
+
+    switch (type)
+    {
+    case netvis_hello:
+        if (!GetInt(&payload, end, &count) || count != NETVIS_VERSION)
+        {
+            Warning("Netvis: worker %d runs a different version", w);
+            return false;
+        }
+        if (AllPortalsDone())
+        {
+            return false;                                  // nothing left to do
+        }
+        Log("Netvis: worker %d connected\n", w);
+        worker->synced = 0;
+        return SendAll(worker->socket, g_netvissetup.data, g_netvissetup.size);
+
+    case netvis_result:
+        if (!GetPortalBits(payload, end, &portalnum, &count, &bits))
+        {
+            return false;
+        }
+        ThreadLock();
+        if (g_netvisowner[portalnum] != w)
+        {
+            ThreadUnlock();
+            free(bits);
+            return false;
+        }
+        g_netvisowner[portalnum] = -1;
+        g_portals[portalnum].visbits = bits;
+        g_portals[portalnum].numcansee = count;
+        SetPortalDone(&g_portals[portalnum]);
+        g_netvisdone[g_netvisnumdone++] = portalnum;
+        g_netvisnumremote++;
+        ThreadUnlock();
+        Verbose("portal:%4i  mightsee:%4i  cansee:%4i  (worker %d)\n", portalnum, g_portals[portalnum].nummightsee, count, w);
+        return true;
+
+    case netvis_want:
+        if (worker->synced == -1 || !GetInt(&payload, end, &threadnum))
+        {
+            return false;
+        }
+        portalnum = -1;
+        if ((p = ClaimNextPortal()) != NULL)
+        {
+            portalnum = p - g_portals;
+            ThreadLock();
+            g_netvisowner[portalnum] = w;
+            ThreadUnlock();
+        }
+        {
+            netvisbuffer_t  out;
+            bool            ok;
+
+            memset(&out, 0, sizeof(out));
+            start = BeginMessage(&out, netvis_work);
+            BufferPutInt(&out, threadnum);
+            BufferPutInt(&out, portalnum);
+            EndMessage(&out, start);
+            ok = SendAll(worker->socket, out.data, out.size);
+            FreeBuffer(&out);
+            return ok;
+        }
+
+    default:
+        return false;
+    }
+}
+
+// reads what has arrived from a worker and handles every complete message
+static void     ServeWorker(const int w)
+{
+    netvisworker_t* worker = &g_netvisworkers[w];
+    ssize_t         n;
+    int             used;
+
+    BufferReserve(&worker->in, 65536);
+    n = recv(worker->socket, worker->in.data + worker->in.size, worker->in.maxsize - worker->in.size, 0);
+    if (n <= 0)
+    {
+        DropWorker(w);
+        return;
+    }
+    worker->in.size += n;
+
+    used = 0;
+    while (worker->in.size - used >= 2 * (int)sizeof(int))
+    {
+        const byte*     header = worker->in.data + used;
+        const byte*     payload = header + 2 * sizeof(int);
+        int             type, size;
+
+        GetInt(&header, payload, &type);
+        GetInt(&header, payload, &size);
+        if (size < 0 || size > NETVIS_MAX_MESSAGE)
+        {
+            DropWorker(w);
+            return;
+        }
+        if (worker->in.size - used - 2 * (int)sizeof(int) < size)
+        {
+            BufferReserve(&worker->in, size);
+            break;
+        }
+        if (!ServeMessage(w, type, payload, payload + size))
+        {
+            DropWorker(w);
+            return;
+        }
+        used += 2 * sizeof(int) + size;
+    }
+    memmove(worker->in.data, worker->in.data + used, worker->in.size - used);
+    worker->in.size -= used;
+}
+
+// =====================================================================================
+//  NetvisServe
+//      Body of the extra PortalFlow thread: serves the workers until every portal is
+//      done. Returns false on the other threads.
+// =====================================================================================
+bool            NetvisServe(const int threadnum)
+{
+    struct pollfd   fds[NETVIS_MAX_WORKERS + 2];
+    int             fdworker[NETVIS_MAX_WORKERS + 2];
+    double          donetime = 0;
+    int             numfds, numdone, i, w;
+
+    if (g_netvisthread == -1 || threadnum != g_netvisthread)
+    {
+        return false;
+    }
+
+    while (1)
+    {
+        if (AllPortalsDone())
+        {
+            // answer the requests that are still on their way, then stop
+            bool            connected = false;
+
+            if (donetime == 0)
+            {
+                donetime = I_FloatTime();
+            }
+            for (w = 0; w < NETVIS_MAX_WORKERS; w++)
+            {
+                connected = connected || g_netvisworkers[w].socket != -1;
+            }
+            if (!connected || I_FloatTime() - donetime > NETVIS_LINGER_TIMEOUT)
+            {
+                break;
+            }
+        }
+
+        numfds = 0;
+        fds[numfds].fd = g_netvissocket;
+        fds[numfds].events = POLLIN;
+        fdworker[numfds++] = -1;
+        fds[numfds].fd = g_netviswake[0];
+        fds[numfds].events = POLLIN;
+        fdworker[numfds++] = -2;
+        for (w = 0; w < NETVIS_MAX_WORKERS; w++)
+        {
+            if (g_netvisworkers[w].socket != -1)
+            {
+                fds[numfds].fd = g_netvisworkers[w].socket;
+                fds[numfds].events = POLLIN;
+                fdworker[numfds++] = w;
+            }
+        }
+        poll(fds, numfds, 100);
+
+        for (i = 0; i < numfds; i++)
+        {
+            if (!(fds[i].revents & (POLLIN | POLLHUP | POLLERR)))
+            {
+                continue;
+            }
+            if (fdworker[i] == -2)
+            {
+                byte            drain[256];
+                while (read(g_netviswake[0], drain, sizeof(drain)) > 0)
+                {
+                }
+            }
+            else if (fdworker[i] == -1)
+            {
+                const int       s = accept(g_netvissocket, NULL, NULL);
+                struct timeval  timeout;
+
+                if (s < 0)
+                {
+                    continue;
+                }
+                for (w = 0; w < NETVIS_MAX_WORKERS && g_netvisworkers[w].socket != -1; w++)
+                {
+                }
+                if (w == NETVIS_MAX_WORKERS)
+                {
+                    close(s);
+                    continue;
+                }
+                timeout.tv_sec = NETVIS_SEND_TIMEOUT;
+                timeout.tv_usec = 0;
+                setsockopt(s, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+                g_netvisworkers[w].socket = s;
+                g_netvisworkers[w].in.size = 0;
+                g_netvisworkers[w].synced = -1;
+            }
+            else
+            {
+                ServeWorker(fdworker[i]);
+            }
+        }
+
+        // pass the finished portals on
+        ThreadLock();
+        numdone = g_netvisnumdone;
+        ThreadUnlock();
+        for (w = 0; w < NETVIS_MAX_WORKERS; w++)
+        {
+            netvisworker_t* worker = &g_netvisworkers[w];
+            netvisbuffer_t  out;
+
+            if (worker->socket == -1 || worker->synced == -1 || worker->synced == numdone)
+            {
+                continue;
+            }
+            memset(&out, 0, sizeof(out));
+            for (i = worker->synced; i < numdone; i++)
+            {
+                const portal_t* p = &g_portals[g_netvisdone[i]];
+                PutPortalBits(&out, netvis_sync, g_netvisdone[i], p->numcansee, p->visbits);
+            }
+            worker->synced = numdone;
+            if (!SendAll(worker->socket, out.data, out.size))
+            {
+                DropWorker(w);
+            }
+            FreeBuffer(&out);
+        }
+    }
+    return true;
+}
+
+// =====================================================================================
+//  Worker
+// =====================================================================================
+
+// applies a netvis_sync message; portals already done here are kept as they are
+static void     ApplySync(const byte* const payload, const byte* const end)
+{
+    int             portalnum, count;
+    byte*           bits;
+    portal_t*       p;
+
+    if (!GetPortalBits(payload, end, &portalnum, &count, &bits))
+    {
+        Error("Netvis: damaged message from coordinator");
+    }
+    p = &g_portals[portalnum];
+    if (p->status != stat_none)
+    {
+        free(bits);                                        // flowed here
+        return;
+    }
+    p->visbits = bits;
+    p->numcansee = count;
+    SetPortalDone(p);
+}
+
+// receives everything the coordinator sends while the worker threads run
+static void*    NetvisReceiveThread(void* unused)
+{
+    netvisbuffer_t  in;
+    int             type, threadnum, portalnum;
+
+    memset(&in, 0, sizeof(in));
+    while (RecvMessage(g_netvisconnection, &type, &in))
+    {
+        const byte*     p = in.data;
+        const byte*     end = in.data + in.size;
+
+        if (type == netvis_sync)
+        {
+            ApplySync(p, end);
+            continue;
+        }
+        if (type != netvis_work || !GetInt(&p, end, &threadnum) || !GetInt(&p, end, &portalnum)
+            || threadnum < 0 || threadnum >= MAX_THREADS || portalnum < -1 || portalnum >= g_numportals * 2)
+        {
+            Error("Netvis: damaged message from coordinator");
+        }
+        pthread_mutex_lock(&g_netvisworkerlock);
+        g_netvisassigned[threadnum] = portalnum;
+        pthread_cond_broadcast(&g_netvisworkercond);
+        pthread_mutex_unlock(&g_netvisworkerlock);
+    }
+    FreeBuffer(&in);
+
+    pthread_mutex_lock(&g_netvisworkerlock);
+    g_netvisconnected = false;
+    pthread_cond_broadcast(&g_netvisworkercond);
+    pthread_mutex_unlock(&g_netvisworkerlock);
+    NetvisSignal();                                        // NetvisWaitForPortal fails from here on
+    return NULL;
+}
+
+static void     NetvisWorkerThread(int threadnum)
+{
+    netvisbuffer_t  out;
+    int             portalnum = -1;
+    int             start;
+    bool            ok;
+
+    memset(&out, 0, sizeof(out));
+    while (1)
+    {
+        out.size = 0;
+        if (portalnum != -1)
+        {
+            PutPortalBits(&out, netvis_result, portalnum, g_portals[portalnum].numcansee, g_portals[portalnum].visbits);
+        }
+        start = BeginMessage(&out, netvis_want);
+        BufferPutInt(&out, threadnum);
+        EndMessage(&out, start);
+
+        pthread_mutex_lock(&g_netvisworkerlock);
+        g_netvisassigned[threadnum] = -2;
+        pthread_mutex_unlock(&g_netvisworkerlock);
+
+        pthread_mutex_lock(&g_netvissendlock);
+        ok = SendAll(g_netvisconnection, out.data, out.size);
+        pthread_mutex_unlock(&g_netvissendlock);
+
+        pthread_mutex_lock(&g_netvisworkerlock);
+        while (ok && g_netvisconnected && g_netvisassigned[threadnum] == -2)
+        {
+            pthread_cond_wait(&g_netvisworkercond, &g_netvisworkerlock);
+        }
+        portalnum = ok ? g_netvisassigned[threadnum] : -1;
+        pthread_mutex_unlock(&g_netvisworkerlock);
+
+        if (portalnum < 0)
+        {
+            break;
+        }
+        g_portals[portalnum].status = stat_working;
+        PortalFlow(&g_portals[portalnum]);
+        ThreadLock();
+        g_netvisnumflowed++;
+        ThreadUnlock();
+    }
+    FreeBuffer(&out);
+}
+
+// =====================================================================================
+//  RunNetvisWorker
+//      Connects to g_netvis_worker and flows portals until the coordinator runs out.
+// =====================================================================================
+void            RunNetvisWorker()
+{
+    netvisbuffer_t  message;
+    const byte*     p;
+    const byte*     end;
+    double          start;
+    pthread_t       receiver;
+    int             type, fullvis, portalleafs, numportals, visleafs, size, i;
+    char*           portalfile;
+
+    signal(SIGPIPE, SIG_IGN);
+    start = I_FloatTime();
+    while ((g_netvisconnection = OpenSocket(g_netvis_worker, false)) == -1)
+    {
+        if (I_FloatTime() - start > NETVIS_CONNECT_TIMEOUT)
+        {
+            Error("Netvis: cannot connect to '%s'", g_netvis_worker);
+        }
+        sleep(1);
+    }
+    Log("Netvis: connected to %s\n", g_netvis_worker);
+
+    memset(&message, 0, sizeof(message));
+    i = BeginMessage(&message, netvis_hello);
+    BufferPutInt(&message, NETVIS_VERSION);
+    EndMessage(&message, i);
+    if (!SendAll(g_netvisconnection, message.data, message.size) || !RecvMessage(g_netvisconnection, &type, &message))
+    {
+        Log("Netvis: the coordinator has no work\n");
+        close(g_netvisconnection);
+        FreeBuffer(&message);
+        return;
+    }
+
+    p = message.data;
+    end = message.data + message.size;
+    if (type != netvis_setup
+        || !GetInt(&p, end, &fullvis) || !GetInt(&p, end, &portalleafs) || !GetInt(&p, end, &numportals)
+        || !GetInt(&p, end, &visleafs) || !GetInt(&p, end, &size) || size < 0 || size > end - p)
+    {
+        Error("Netvis: damaged message from coordinator");
+    }
+    g_fullvis = fullvis != 0;
+#ifdef ZHLT_DETAILBRUSH
+    g_dmodels[0].visleafs = visleafs;                      // LoadPortals checks the leaf mapping against the bsp
+#endif
+    portalfile = (char*)malloc(size + 1);
+    hlassume(portalfile != NULL, assume_NoMemory);
+    memcpy(portalfile, p, size);
+    portalfile[size] = '\0';
+    LoadPortals(portalfile, size);
+    free(portalfile);
+    if (g_portalleafs != (unsigned)portalleafs || g_numportals != numportals)
+    {
+        Error("Netvis: portal file mismatch");
+    }
+
+    for (i = 0; i < g_numportals * 2; i++)
+    {
+        int             portalnum, count;
+        byte*           bits;
+
+        if (!RecvMessage(g_netvisconnection, &type, &message) || type != netvis_sync
+            || !GetPortalBits(message.data, message.data + message.size, &portalnum, &count, &bits) || portalnum != i)
+        {
+            Error("Netvis: damaged message from coordinator");
+        }
+        g_portals[i].mightsee = bits;
+        g_portals[i].nummightsee = count;
+    }
+    FreeBuffer(&message);
+    g_netvis_ranked = true;
+    RankPortals();
+
+    g_netvisconnected = true;
+    if (pthread_create(&receiver, NULL, NetvisReceiveThread, NULL) != 0)
+    {
+        Error("Netvis: pthread_create failed");
+    }
+    NamedRunThreadsOn(g_numportals * 2, false, NetvisWorkerThread);
+    shutdown(g_netvisconnection, SHUT_RDWR);
+    pthread_join(receiver, NULL);
+    close(g_netvisconnection);
+    g_netvisconnection = -1;
+    Log("Netvis: flowed %d portals\n", g_netvisnumflowed);
+}
+
+#endif // HLVIS_NETVIS
@@ -20,6 +20,10 @@
 #ifdef ZHLT_NETVIS
 #include "zlib.h"
 #endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define LEAFFLOW_SSE2
+#include <emmintrin.h>
+#endif
 
 /*
 
@@ -336,19 +340,94 @@ static int      AllPortalsDone()
 // NETVIS
 ///////////
 
+#ifdef HLVIS_NETVIS
 // =====================================================================================
-//  GetNextPortal
-//      Returns the next portal for a thread to work on
-//      Returns the portals from the least complex, so the later ones can reuse the earlier information.
+//  RankPortals
+//      Numbers the portals in the order a single thread flows them: least complex first,
+//      ties by portal number. In netvis runs PortalFlow treats exactly the portals ranked
+//      before its own as finished, which keeps the result independent of the workers.
 // =====================================================================================
-static portal_t* GetNextPortal()
+static int CDECL PortalRankSorter(const void* p1, const void* p2)
+{
+    const portal_t* portal1 = g_portals + *(const int*)p1;
+    const portal_t* portal2 = g_portals + *(const int*)p2;
+
+    if (portal1->nummightsee != portal2->nummightsee)
+    {
+        return portal1->nummightsee < portal2->nummightsee ? -1 : 1;
+    }
+    return *(const int*)p1 - *(const int*)p2;
+}
+
+void            RankPortals()
+{
+    const int       numportals = g_numportals * 2;
+    int*            order;
+    int             i;
+
+    order = (int*)malloc(qmax(numportals, 1) * sizeof(int));
+    hlassume(order != NULL, assume_NoMemory);
+    for (i = 0; i < numportals; i++)
+    {
+        order[i] = i;
+    }
+    qsort(order, numportals, sizeof(int), PortalRankSorter);
+    for (i = 0; i < numportals; i++)
+    {
+        g_portals[order[i]].rank = i;
+    }
+    free(order);
+}
+#endif
+
+// =====================================================================================
+//  ClaimNextPortal
+//      Marks the least complex portal that has not been started as being worked on.
+// =====================================================================================
+portal_t*       ClaimNextPortal()
 {
     int             j;
     portal_t*       p;
     portal_t*       tp;
     int             min;
 
+    ThreadLock();
+
+    min = 99999;
+    p = NULL;
+
+    for (j = 0, tp = g_portals; j < g_numportals * 2; j++, tp++)
+    {
+        if (tp->nummightsee < min && tp->status == stat_none)
+        {
+            min = tp->nummightsee;
+            p = tp;
 #ifdef ZHLT_NETVIS
+            g_visportalindex = j;
+#endif
+        }
+    }
+
+    if (p)
+    {
+        p->status = stat_working;
+    }
+
+    ThreadUnlock();
+
+    return p;
+}
+
+// =====================================================================================
+//  GetNextPortal
+//      Returns the next portal for a thread to work on
+//      Returns the portals from the least complex, so the later ones can reuse the earlier information.
+// =====================================================================================
+static portal_t* GetNextPortal()
+{
+#ifdef ZHLT_NETVIS
+    portal_t*       tp;
+
     if (g_vismode == VIS_MODE_SERVER)
     {
 #else
@@ -358,31 +437,7 @@ static portal_t* GetNextPortal()
             return NULL;
         }
 #endif
-        ThreadLock();
-
-        min = 99999;
-        p = NULL;
-
-        for (j = 0, tp = g_portals; j < g_numportals * 2; j++, tp++)
-        {
-            if (tp->nummightsee < min && tp->status == stat_none)
-            {
-                min = tp->nummightsee;
-                p = tp;
-#ifdef ZHLT_NETVIS
-                g_visportalindex = j;
-#endif
-            }
-        }
-
-        if (p)
-        {
-            p->status = stat_working;
-        }
-
-        ThreadUnlock();
-
-        return p;
+        return ClaimNextPortal();
     }
 #ifdef ZHLT_NETVIS
     else                                                   // AS CLIENT
@@ -486,18 +541,31 @@ void			CompressAll(void)
 #endif
 
 #ifndef ZHLT_NETVIS
-static void     LeafThread(int unused)
+static void     LeafThread(int threadnum)
 {
     portal_t*       p;
 
+#ifdef HLVIS_NETVIS
+    if (NetvisServe(threadnum))
+    {
+        return;
+    }
+#endif
     while (1)
     {
         if (!(p = GetNextPortal()))
         {
+#ifdef HLVIS_NETVIS
+            // wait for the portals on workers, taking back any a lost worker returns
+            if (!(p = NetvisNextPortal()))
+#endif
             return;
         }
 
         PortalFlow(p);
+#ifdef HLVIS_NETVIS
+        NetvisPortalDone(p);
+#endif
 
         Verbose("portal:%4i  mightsee:%4i  cansee:%4i\n", (int)(p - g_portals), p->nummightsee, p->numcansee);
     }
@@ -585,28 +653,97 @@ static void     LeafThread(int unused)
 
 // =====================================================================================
 //  LeafFlow
-//      Builds the entire visibility list for a leaf
+//      Builds the entire visibility list for a leaf into its own compressed buffer;
+//      run on the thread pool, AssembleLeafVis lays the buffers out afterwards.
 // =====================================================================================
+typedef struct
+{
+    byte*           compressed;
+    int             size;
+    int             numvis;
+    const portal_t* sawself;                               // first portal that saw back into the leaf
+}
+leafvis_t;
+
+static leafvis_t* g_leafvis;
+#ifdef HLVIS_SKYBOXMODEL
+static byte*    g_skyboxbits;                              // [bitbytes], every leaf sees the skybox leafs
+#endif
+
+// ors src into dest, g_bitbytes is a multiple of 8
+inline static void OrVisBits(byte* const dest, const byte* const src)
+{
+    unsigned        j = 0;
+
+#ifdef LEAFFLOW_SSE2
+    for (; j + 16 <= g_bitbytes; j += 16)
+    {
+        const __m128i   a = _mm_loadu_si128((const __m128i*)(dest + j));
+        const __m128i   b = _mm_loadu_si128((const __m128i*)(src + j));
+        _mm_storeu_si128((__m128i*)(dest + j), _mm_or_si128(a, b));
+    }
+#endif
+    for (; j < g_bitbytes; j += 8)
+    {
+        unsigned long long a, b;
+        memcpy(&a, dest + j, 8);
+        memcpy(&b, src + j, 8);
+        a |= b;
+        memcpy(dest + j, &a, 8);
+    }
+}
+
+inline static int CountBits64(unsigned long long x)
+{
+#if defined(__GNUC__)
+    return __builtin_popcountll(x);
+#else
+    x = x - ((x >> 1) & 0x5555555555555555ULL);
+    x = (x & 0x3333333333333333ULL) + ((x >> 2) & 0x3333333333333333ULL);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    return (int)((x * 0x0101010101010101ULL) >> 56);
+#endif
+}
+
+// number of the first g_portalleafs bits that are set
+static int      CountVisBits(const byte* const bits)
+{
+    const unsigned  fullwords = g_portalleafs >> 6;
+    unsigned long long word;
+    unsigned        j;
+    int             count = 0;
+
+    for (j = 0; j < fullwords; j++)
+    {
+        memcpy(&word, bits + j * 8, 8);
+        count += CountBits64(word);
+    }
+    for (j = fullwords << 6; j < g_portalleafs; j++)
+    {
+        if (bits[j >> 3] & (1 << (j & 7)))
+        {
+            count++;
+        }
+    }
+    return count;
+}
+
 static void     LeafFlow(const int leafnum)
 {
+    leafvis_t*      lv = &g_leafvis[leafnum];
     leaf_t*         leaf;
     byte*           outbuffer;
     byte            compressed[MAX_MAP_LEAFS / 8];
     unsigned        i;
-    unsigned        j;
-    int             k;
-    int             tmp;
-    int             numvis;
-    byte*           dest;
+    int             size;
     portal_t*       p;
 
     //
     // flow through all portals, collecting visible bits
     //
-    memset(compressed, 0, sizeof(compressed));
     outbuffer = g_uncompressed + leafnum * g_bitbytes;
     leaf = &g_leafs[leafnum];
-    tmp = 0;
+    lv->sawself = NULL;
 
     const unsigned offset = leafnum >> 3;
     const unsigned bit = (1 << (leafnum & 7));
@@ -619,25 +756,11 @@ static void     LeafFlow(const int leafnum)
             Error("portal not done (leaf %d)", leafnum);
         }
 
-        {
-            byte* dst = outbuffer;
-            byte* src = p->visbits;
-            for (j=0; j<g_bitbytes; j++, dst++, src++)
-            {
-                *dst |= *src;
-            }
-        }
+        OrVisBits(outbuffer, p->visbits);
 
-        if ((tmp == 0) && (outbuffer[offset] & bit))
+        if (!lv->sawself && (outbuffer[offset] & bit))
         {
-            tmp = 1;
-            Warning("Leaf portals saw into leaf");
-            Log("    Problem at portal between leaves %i and %i:\n   ", leafnum, p->leaf);
-            for (k = 0; k < p->winding->numpoints; k++)
-            {
-                Log("    (%4.3f %4.3f %4.3f)\n", p->winding->points[k][0], p->winding->points[k][1], p->winding->points[k][2]);
-            }
-            Log("\n");
+            lv->sawself = p;
         }
     }
 
@@ -652,71 +775,119 @@ static void     LeafFlow(const int leafnum)
 		}
 	}
 #ifdef HLVIS_SKYBOXMODEL
-	for (i = 0; i < g_portalleafs; i++)
+	if (g_skyboxbits)
 	{
-		if (g_leafinfos[i].isskyboxpoint)
-		{
-			outbuffer[i >> 3] |= (1 << (i & 7));
-		}
+		OrVisBits(outbuffer, g_skyboxbits);
 	}
 #endif
 #endif
-    numvis = 0;
-    for (i = 0; i < g_portalleafs; i++)
-    {
-        if (outbuffer[i >> 3] & (1 << (i & 7)))
-        {
-            numvis++;
-        }
-    }
+    lv->numvis = CountVisBits(outbuffer);
 
     //
     // compress the bit string
     //
-    Verbose("leaf %4i : %4i visible\n", leafnum, numvis);
-    totalvis += numvis;
-
 #ifdef ZHLT_DETAILBRUSH
 	byte buffer2[MAX_MAP_LEAFS / 8];
 	int diskbytes = (g_leafcount_all + 7) >> 3;
 	memset (buffer2, 0, diskbytes);
 	for (i = 0; i < g_portalleafs; i++)
 	{
-		for (j = 0; j < g_leafcounts[i]; j++)
+		if (!(outbuffer[i >> 3] & (1 << (i & 7))))
 		{
-			int srcofs = i >> 3;
-			int srcbit = 1 << (i & 7);
-			int dstofs = (g_leafstarts[i] + j) >> 3;
-			int dstbit = 1 << ((g_leafstarts[i] + j) & 7);
-			if (outbuffer[srcofs] & srcbit)
-			{
-				buffer2[dstofs] |= dstbit;
-			}
+			continue;
+		}
+		for (int j = g_leafstarts[i]; j < g_leafstarts[i] + g_leafcounts[i]; j++)
+		{
+			buffer2[j >> 3] |= 1 << (j & 7);
 		}
 	}
-	i = CompressVis (buffer2, diskbytes, compressed, sizeof (compressed));
+	size = CompressVis (buffer2, diskbytes, compressed, sizeof (compressed));
 #else
-    i = CompressVis(outbuffer, g_bitbytes, compressed, sizeof(compressed));
+    size = CompressVis(outbuffer, g_bitbytes, compressed, sizeof(compressed));
 #endif
 
-    dest = vismap_p;
-    vismap_p += i;
+    lv->compressed = (byte*)malloc(qmax(size, 1));
+    hlassume(lv->compressed != NULL, assume_NoMemory);
+    memcpy(lv->compressed, compressed, size);
+    lv->size = size;
+}
+
+// =====================================================================================
+//  AssembleLeafVis
+//      Assembles the leaf vis lists by oring and compressing the portal lists on the
+//      thread pool, then lays them out in g_dvisdata in leaf order.
+// =====================================================================================
+static void     AssembleLeafVis()
+{
+    unsigned        i;
+    int             k;
 
-    if (vismap_p > vismap_end)
+    g_leafvis = (leafvis_t*)calloc(qmax(g_portalleafs, 1u), sizeof(leafvis_t));
+    hlassume(g_leafvis != NULL, assume_NoMemory);
+#if defined (HLVIS_OVERVIEW) && defined (HLVIS_SKYBOXMODEL)
+    g_skyboxbits = NULL;
+    for (i = 0; i < g_portalleafs; i++)
     {
-        Error("Vismap expansion overflow");
+        if (g_leafinfos[i].isskyboxpoint)
+        {
+            if (!g_skyboxbits)
+            {
+                g_skyboxbits = (byte*)calloc(g_bitbytes, 1);
+                hlassume(g_skyboxbits != NULL, assume_NoMemory);
+            }
+            g_skyboxbits[i >> 3] |= (1 << (i & 7));
+        }
     }
+#endif
+
+    NamedRunThreadsOnIndividual(g_portalleafs, g_estimate, LeafFlow);
+
+    for (i = 0; i < g_portalleafs; i++)
+    {
+        leafvis_t*      lv = &g_leafvis[i];
+        const portal_t* p = lv->sawself;
+        byte*           dest;
+
+        if (p)
+        {
+            Warning("Leaf portals saw into leaf");
+            Log("    Problem at portal between leaves %i and %i:\n   ", i, p->leaf);
+            for (k = 0; k < p->winding->numpoints; k++)
+            {
+                Log("    (%4.3f %4.3f %4.3f)\n", p->winding->points[k][0], p->winding->points[k][1], p->winding->points[k][2]);
+            }
+            Log("\n");
+        }
+        Verbose("leaf %4i : %4i visible\n", i, lv->numvis);
+        totalvis += lv->numvis;
+
+        dest = vismap_p;
+        vismap_p += lv->size;
+
+        if (vismap_p > vismap_end)
+        {
+            Error("Vismap expansion overflow");
+        }
 
 #ifdef ZHLT_DETAILBRUSH
-	for (j = 0; j < g_leafcounts[leafnum]; j++)
-	{
-		g_dleafs[g_leafstarts[leafnum] + j + 1].visofs = dest - vismap;
-	}
+        for (k = 0; k < g_leafcounts[i]; k++)
+        {
+            g_dleafs[g_leafstarts[i] + k + 1].visofs = dest - vismap;
+        }
 #else
-    g_dleafs[leafnum + 1].visofs = dest - vismap;            // leaf 0 is a common solid
+        g_dleafs[i + 1].visofs = dest - vismap;            // leaf 0 is a common solid
 #endif
 
-    memcpy(dest, compressed, i);
+        memcpy(dest, lv->compressed, lv->size);
+        free(lv->compressed);
+    }
+
+    free(g_leafvis);
+    g_leafvis = NULL;
+#if defined (HLVIS_OVERVIEW) && defined (HLVIS_SKYBOXMODEL)
+    free(g_skyboxbits);
+    g_skyboxbits = NULL;
+#endif
 }
 
 // =====================================================================================
@@ -739,10 +910,22 @@ static void     CalcPortalVis()
     }
 #endif
 
+#ifdef HLVIS_NETVIS
+    if (g_netvis_ranked)
+    {
+        RankPortals();
+    }
+#endif
 #ifdef ZHLT_NETVIS
     LeafThread(0);
 #else
+#ifdef HLVIS_NETVIS
+    NetvisBeginFlow();
+#endif
     NamedRunThreadsOn(g_numportals * 2, g_estimate, LeafThread);
+#ifdef HLVIS_NETVIS
+    NetvisEndFlow();
+#endif
 #endif
 }
 
@@ -808,12 +991,7 @@ static void     CalcVis()
 
     if (g_vismode == VIS_MODE_SERVER)
     {
-        unsigned int    i;
-
-        for (i = 0; i < g_portalleafs; i++)
-        {
-            LeafFlow(i);
-        }
+        AssembleLeafVis();
 
         Log("average leafs visible: %i\n", totalvis / g_portalleafs);
     }
@@ -998,7 +1176,6 @@ void		ResetPortalStatus(void)
 // =====================================================================================
 static void     CalcVis()
 {
-    unsigned        i;
 	char visdatafile[_MAX_PATH];
 
 #ifdef ZHLT_DEFAULTEXTENSION_FIX
@@ -1043,10 +1220,7 @@ static void     CalcVis()
 		//
 		// assemble the leaf vis lists by oring and compressing the portal lists
 		//
-		for (i = 0; i < g_portalleafs; i++)
-		{
-	        LeafFlow(i);
-	    }
+		AssembleLeafVis();
 
 		Log("average leafs visible: %i\n", totalvis / g_portalleafs);
 
@@ -1064,15 +1238,18 @@ static void     CalcVis()
 			vismap_p = g_dvisdata;
 
 			// We don't need to run BasePortalVis again
+#ifdef HLVIS_MAXDIST_NEW
+			PrepareMaxDistVis();
 			NamedRunThreadsOn(g_portalleafs, g_estimate, MaxDistVis);
+			FreeMaxDistVis();
+#else
+			NamedRunThreadsOn(g_portalleafs, g_estimate, MaxDistVis);
+#endif
 
 			// No need to run this - MaxDistVis now writes directly to visbits after the initial VIS
 			//CalcPortalVis();
 
-			for (i = 0; i < g_portalleafs; i++)
-			{
-			    LeafFlow(i);
-			}
+			AssembleLeafVis();
 
 #ifndef HLVIS_MAXDIST_NEW
 			// FIX: Used to reset p->status to stat_none; now it justs frees p->visbits
@@ -1100,41 +1277,11 @@ static INLINE void FASTCALL CheckNullToken(const char*const token)
 }
 
 // =====================================================================================
-//  LoadPortals
+//  AllocPortals
+//      Sets up the portal and leaf arrays once g_portalleafs and g_numportals are known
 // =====================================================================================
-static void     LoadPortals(char* portal_image)
+static void     AllocPortals()
 {
-    int             i, j;
-    portal_t*       p;
-    leaf_t*         l;
-    int             numpoints;
-    winding_t*      w;
-    int             leafnums[2];
-    plane_t         plane;
-    const char* const seperators = " ()\r\n\t";
-    char*           token;
-
-    token = strtok(portal_image, seperators);
-    CheckNullToken(token);
-    if (strcmp(token, "PRT1-AB") != 0)
-    {
-        Error("LoadPortals: failed to read header: identifier");
-    }
-
-    token = strtok(NULL, seperators);
-    CheckNullToken(token);
-    if (!sscanf(token, "%u", &g_portalleafs))
-    {
-        Error("LoadPortals: failed to read header: number of leafs");
-    }
-
-    token = strtok(NULL, seperators);
-    CheckNullToken(token);
-    if (!sscanf(token, "%i", &g_numportals))
-    {
-        Error("LoadPortals: failed to read header: number of portals");
-    }
-
     Log("%4i portalleafs\n", g_portalleafs);
     Log("%4i numportals\n", g_numportals);
 
@@ -1162,17 +1309,22 @@ static void     LoadPortals(char* portal_image)
 	{ // this may cause hlvis to overflow, because numportalleafs can be larger than g_numleafs in some special cases
 		Error ("Too many portalleafs (g_portalleafs(%d) > MAX_MAP_LEAFS(%d)).", g_portalleafs, MAX_MAP_LEAFS);
 	}
+#endif
+}
+
+// =====================================================================================
+//  SetupLeafInfos
+//      Once g_leafcounts is read: the bsp leafs of each portal leaf and the overview points
+// =====================================================================================
+static void     SetupLeafInfos()
+{
+    unsigned        i;
+    int             j;
+
+#ifdef ZHLT_DETAILBRUSH
 	g_leafcount_all = 0;
 	for (i = 0; i < g_portalleafs; i++)
 	{
-		unsigned rval = 0;
-		token = strtok(NULL, seperators);
-		CheckNullToken(token);
-		rval += sscanf(token, "%i", &g_leafcounts[i]);
-		if (rval != 1)
-		{
-			Error("LoadPortals: read leaf %i failed", i);
-		}
 		g_leafstarts[i] = g_leafcount_all;
 		g_leafcount_all += g_leafcounts[i];
 	}
@@ -1209,7 +1361,208 @@ static void     LoadPortals(char* portal_image)
 		}
 	}
 #endif
-    for (i = 0, p = g_portals; i < g_numportals; i++)
+}
+
+// =====================================================================================
+//  AddPortal
+//      Makes the forward and backward memory portals of a file portal at p
+// =====================================================================================
+static void     AddPortal(portal_t* p, winding_t* const w, const int leafnums[2])
+{
+    leaf_t*         l;
+    plane_t         plane;
+    int             j;
+
+    // calc plane
+    PlaneFromWinding(w, &plane);
+
+    // create forward portal
+    l = &g_leafs[leafnums[0]];
+    hlassume(l->numportals < MAX_PORTALS_ON_LEAF, assume_MAX_PORTALS_ON_LEAF);
+    l->portals[l->numportals] = p;
+    l->numportals++;
+
+    p->winding = w;
+    VectorSubtract(vec3_origin, plane.normal, p->plane.normal);
+    p->plane.dist = -plane.dist;
+    p->leaf = leafnums[1];
+    p++;
+
+    // create backwards portal
+    l = &g_leafs[leafnums[1]];
+    hlassume(l->numportals < MAX_PORTALS_ON_LEAF, assume_MAX_PORTALS_ON_LEAF);
+    l->portals[l->numportals] = p;
+    l->numportals++;
+
+    p->winding = NewWinding(w->numpoints);
+    p->winding->numpoints = w->numpoints;
+    for (j = 0; j < w->numpoints; j++)
+    {
+        VectorCopy(w->points[w->numpoints - 1 - j], p->winding->points[j]);
+    }
+
+    p->plane = plane;
+    p->leaf = leafnums[0];
+}
+
+#ifdef ZHLT_BINARYPORTALS
+static bool     IsBinaryPortalImage(const char* const image, const int size)
+{
+    return size >= (int)sizeof(dprtheader_t) && !memcmp(image, PRT_BINARY_IDENT, sizeof(((dprtheader_t*)0)->ident));
+}
+
+// =====================================================================================
+//  LoadBinaryPortals
+//      Reads a PRT1-BIN image straight from its arrays, see dprtheader_t
+// =====================================================================================
+static void     LoadBinaryPortals(const byte* const image, const int size)
+{
+    const dprtheader_t* header = (const dprtheader_t*)image;
+    const dprtportal_t* portals;
+    const int*      leafcounts = NULL;
+    const float*    points[3];
+    int             numleafs, numportals, numpoints;
+    int             leafcountofs, portalofs, pointofs;
+    int             i, j, k;
+    portal_t*       p;
+
+    numleafs = LittleLong(header->numleafs);
+    numportals = LittleLong(header->numportals);
+    numpoints = LittleLong(header->numpoints);
+    leafcountofs = LittleLong(header->leafcountofs);
+    portalofs = LittleLong(header->portalofs);
+    pointofs = LittleLong(header->pointofs);
+
+    if (numleafs < 0 || numportals < 0 || numpoints < 0
+        || (leafcountofs & 3) || (portalofs & 3) || (pointofs & 3)
+        || leafcountofs < 0 || (leafcountofs && (leafcountofs < (int)sizeof(dprtheader_t) || numleafs > (size - leafcountofs) / (int)sizeof(int)))
+        || portalofs < (int)sizeof(dprtheader_t) || numportals > (size - portalofs) / (int)sizeof(dprtportal_t)
+        || pointofs < (int)sizeof(dprtheader_t) || numpoints > (size - pointofs) / (int)(3 * sizeof(float)))
+    {
+        Error("LoadPortals: Damaged or invalid .prt file\n");
+    }
+#ifdef ZHLT_DETAILBRUSH
+    if (!leafcountofs)
+    {
+        Error("LoadPortals: .prt file has no leaf counts\n");
+    }
+#endif
+
+    g_portalleafs = numleafs;
+    g_numportals = numportals;
+    AllocPortals();
+
+#ifdef ZHLT_DETAILBRUSH
+    leafcounts = (const int*)(image + leafcountofs);
+    for (i = 0; i < numleafs; i++)
+    {
+        g_leafcounts[i] = LittleLong(leafcounts[i]);
+    }
+#endif
+    SetupLeafInfos();
+
+    portals = (const dprtportal_t*)(image + portalofs);
+    for (k = 0; k < 3; k++)
+    {
+        points[k] = (const float*)(image + pointofs) + k * numpoints;
+    }
+    for (i = 0, p = g_portals; i < numportals; i++, p += 2)
+    {
+        const int       count = LittleLong(portals[i].numpoints);
+        const int       first = LittleLong(portals[i].firstpoint);
+        int             leafnums[2];
+        winding_t*      w;
+
+        leafnums[0] = LittleLong(portals[i].leafs[0]);
+        leafnums[1] = LittleLong(portals[i].leafs[1]);
+        if (count < 0 || first < 0 || first > numpoints - count)
+        {
+            Error("LoadPortals: reading portal %i", i);
+        }
+        if (count > MAX_POINTS_ON_WINDING)
+        {
+            Error("LoadPortals: portal %i has too many points", i);
+        }
+        if (((unsigned)leafnums[0] >= g_portalleafs) || ((unsigned)leafnums[1] >= g_portalleafs))
+        {
+            Error("LoadPortals: reading portal %i", i);
+        }
+
+        w = NewWinding(count);
+        w->original = true;
+        w->numpoints = count;
+        for (j = 0; j < count; j++)
+        {
+            for (k = 0; k < 3; k++)
+            {
+                w->points[j][k] = LittleFloat(points[k][first + j]);
+            }
+        }
+        AddPortal(p, w, leafnums);
+    }
+}
+#endif
+
+// =====================================================================================
+//  LoadPortals
+//      portal_image is the whole .prt file, the text format is parsed in place
+// =====================================================================================
+void            LoadPortals(char* portal_image, const int size)
+{
+    int             i, j;
+    portal_t*       p;
+    int             numpoints;
+    winding_t*      w;
+    int             leafnums[2];
+    const char* const seperators = " ()\r\n\t";
+    char*           token;
+
+#ifdef ZHLT_BINARYPORTALS
+    if (IsBinaryPortalImage(portal_image, size))
+    {
+        LoadBinaryPortals((const byte*)portal_image, size);
+        return;
+    }
+#endif
+
+    token = strtok(portal_image, seperators);
+    CheckNullToken(token);
+    if (strcmp(token, "PRT1-AB") != 0)
+    {
+        Error("LoadPortals: failed to read header: identifier");
+    }
+
+    token = strtok(NULL, seperators);
+    CheckNullToken(token);
+    if (!sscanf(token, "%u", &g_portalleafs))
+    {
+        Error("LoadPortals: failed to read header: number of leafs");
+    }
+
+    token = strtok(NULL, seperators);
+    CheckNullToken(token);
+    if (!sscanf(token, "%i", &g_numportals))
+    {
+        Error("LoadPortals: failed to read header: number of portals");
+    }
+
+    AllocPortals();
+
+#ifdef ZHLT_DETAILBRUSH
+	for (i = 0; i < g_portalleafs; i++)
+	{
+		unsigned rval = 0;
+		token = strtok(NULL, seperators);
+		CheckNullToken(token);
+		rval += sscanf(token, "%i", &g_leafcounts[i]);
+		if (rval != 1)
+		{
+			Error("LoadPortals: read leaf %i failed", i);
+		}
+	}
+#endif
+    SetupLeafInfos();
+    for (i = 0, p = g_portals; i < g_numportals; i++, p += 2)
     {
         unsigned rval = 0;
 
@@ -1236,7 +1589,7 @@ static void     LoadPortals(char* portal_image)
             Error("LoadPortals: reading portal %i", i);
         }
 
-        w = p->winding = NewWinding(numpoints);
+        w = NewWinding(numpoints);
         w->original = true;
         w->numpoints = numpoints;
 
@@ -1267,38 +1620,7 @@ static void     LoadPortals(char* portal_image)
             }
         }
 
-        // calc plane
-        PlaneFromWinding(w, &plane);
-
-        // create forward portal
-        l = &g_leafs[leafnums[0]];
-        hlassume(l->numportals < MAX_PORTALS_ON_LEAF, assume_MAX_PORTALS_ON_LEAF);
-        l->portals[l->numportals] = p;
-        l->numportals++;
-
-        p->winding = w;
-        VectorSubtract(vec3_origin, plane.normal, p->plane.normal);
-        p->plane.dist = -plane.dist;
-        p->leaf = leafnums[1];
-        p++;
-
-        // create backwards portal
-        l = &g_leafs[leafnums[1]];
-        hlassume(l->numportals < MAX_PORTALS_ON_LEAF, assume_MAX_PORTALS_ON_LEAF);
-        l->portals[l->numportals] = p;
-        l->numportals++;
-
-        p->winding = NewWinding(w->numpoints);
-        p->winding->numpoints = w->numpoints;
-        for (j = 0; j < w->numpoints; j++)
-        {
-            VectorCopy(w->points[w->numpoints - 1 - j], p->winding->points[j]);
-        }
-
-        p->plane = plane;
-        p->leaf = leafnums[0];
-        p++;
-
+        AddPortal(p, w, leafnums);
     }
 }
 
@@ -1308,13 +1630,29 @@ static void     LoadPortals(char* portal_image)
 static void     LoadPortalsByFilename(const char* const filename)
 {
     char* file_image;
+    int size;
 
     if (!q_exists(filename))
     {
         Error("Portal file '%s' does not exist, cannot vis the map\n", filename);
     }
-    LoadFile(filename, &file_image);
-    LoadPortals(file_image);
+#ifdef ZHLT_BINARYPORTALS
+    {
+        // the binary format is used in place, only text needs a writable copy for strtok
+        mappedfile_t file;
+
+        MapFile(filename, &file, false);
+        if (IsBinaryPortalImage(file.data, file.length))
+        {
+            LoadBinaryPortals((const byte*)file.data, file.length);
+            UnmapFile(&file);
+            return;
+        }
+        UnmapFile(&file);
+    }
+#endif
+    size = LoadFile(filename, &file_image);
+    LoadPortals(file_image, size);
     free(file_image);
 }
 
@@ -1386,12 +1724,19 @@ static void     Usage()
     Log("    -server          : Run as the netvis server\n");
     Log("    -port #          : Use a non-standard port for netvis\n");
     Log("    -rate #          : Alter the display update rate\n\n");
+#endif
+#ifdef HLVIS_NETVIS
+    Log("    -listen address : Let worker processes connect at address during PortalFlow\n");
+    Log("    -worker address : Flow portals for the hlvis listening at address\n\n");
 #endif
     Log("    -texdata #      : Alter maximum texture memory limit (in kb)\n");
     Log("    -lightdata #      : Alter maximum lighting memory limit (in kb)\n"); //lightdata //--vluzacn
     Log("    -chart          : display bsp statitics\n");
     Log("    -low | -high    : run program an altered priority level\n");
     Log("    -nolog          : don't generate the compile logfiles\n");
+#ifdef ZHLT_STAGECACHE
+    Log("    -stagecache dir : Reuse the outputs of an earlier run with the same inputs, kept in dir\n");
+#endif
     Log("    -threads #      : manually specify the number of threads to run\n");
 #ifdef SYSTEM_WIN32
     Log("    -estimate       : display estimated time during compile\n");
@@ -1419,6 +1764,11 @@ static void     Usage()
         "The default socket it uses is 21212 and can be changed with -port\n"
         "The default update rate is 60 seconds and can be changed with -rate\n");
 
+#endif
+#ifdef HLVIS_NETVIS
+    Log("\n"
+        "An address is a Unix socket path, host:port or port.\n"
+        "Workers need no files : hlvis -worker host:port [-threads #]\n");
 #endif
 
     exit(1);
@@ -1493,6 +1843,9 @@ static void     Settings()
     Log("netvis port         [ %7d ] [ %7d ]\n", g_port, DEFAULT_NETVIS_PORT);
     Log("netvis display rate [ %7d ] [ %7d ]\n", g_rate, DEFAULT_NETVIS_RATE);
 #endif
+#ifdef HLVIS_NETVIS
+    Log("listen              [ %7s ] [ %7s ]\n", g_netvis_listen ? g_netvis_listen : "off", "off");
+#endif
 
     Log("\n\n");
 }
@@ -1652,6 +2005,30 @@ int             main(const int argc, char** argv)
             }
         }
 #endif
+#ifdef HLVIS_NETVIS
+        else if (!strcasecmp(argv[i], "-listen"))
+        {
+            if (i + 1 < argc)
+            {
+                g_netvis_listen = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+        else if (!strcasecmp(argv[i], "-worker"))
+        {
+            if (i + 1 < argc)
+            {
+                g_netvis_worker = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
 #ifndef ZHLT_NETVIS
         else if (!strcasecmp(argv[i], "-fast"))
         {
@@ -1699,6 +2076,19 @@ int             main(const int argc, char** argv)
         {
             g_log = false;
         }
+#ifdef ZHLT_STAGECACHE
+        else if (!strcasecmp(argv[i], "-stagecache"))
+        {
+            if (i + 1 < argc)
+            {
+                g_stagecache = argv[++i];
+            }
+            else
+            {
+                Usage();
+            }
+        }
+#endif
         else if (!strcasecmp(argv[i], "-texdata"))
         {
             if (i + 1 < argc)	//added "1" .--vluzacn
@@ -1842,6 +2232,22 @@ int             main(const int argc, char** argv)
 
 #else
 
+#ifdef HLVIS_NETVIS
+    if (g_netvis_worker)
+    {
+        // a worker gets everything from the coordinator and writes no files
+        g_log = false;
+        ThreadSetDefault();
+        ThreadSetPriority(g_threadpriority);
+        dtexdata_init();
+        atexit(dtexdata_free);
+        start = I_FloatTime();
+        RunNetvisWorker();
+        end = I_FloatTime();
+        LogTimeElapsed(end - start);
+        return 0;
+    }
+#endif
     if (!mapname_from_arg)
     {
         Log("No mapfile specified\n");
@@ -1904,6 +2310,9 @@ int             main(const int argc, char** argv)
 	hlassume (CalcFaceExtents_test (), assume_first);
 #endif
 #endif
+    // vis only rebuilds the visibility lump; it edits leaf visofs in place, so the leafs are copied
+    g_bspfixedlumps = ~((1u << LUMP_VISIBILITY) | (1u << LUMP_ENTITIES));
+    g_bspmappedlumps = g_bspfixedlumps & ~(1u << LUMP_LEAFS);
     dtexdata_init();
     atexit(dtexdata_free);
     // END INIT
@@ -1975,13 +2384,25 @@ int             main(const int argc, char** argv)
             }
             NetvisSleep(100);
         }
-        LoadPortals(g_prt_image);
+        LoadPortals(g_prt_image, g_prt_size);
         free(g_prt_image);
     }
 
 #else // NOT ZHLT_NETVIS
 
     LoadBSPFile(source);
+#ifdef ZHLT_STAGECACHE
+    StageCacheBegin("hlvis", argc, argv, mapname_from_arg);
+    StageCacheInputBSP();
+    StageCacheInputFile(portalfile);
+    StageCacheOutput(".bsp");
+    if (StageCacheRestore())
+    {
+        end = I_FloatTime();
+        LogTimeElapsed(end - start);
+        return 0;
+    }
+#endif
     ParseEntities();
 #ifdef HLVIS_OVERVIEW
 	{
@@ -2006,6 +2427,16 @@ int             main(const int argc, char** argv)
 	}
 #endif
     LoadPortalsByFilename(portalfile);
+#ifdef HLVIS_NETVIS
+    if (g_netvis_listen && g_fastvis)
+    {
+        Warning("-listen has no effect with -fast");
+    }
+    else if (g_netvis_listen)
+    {
+        NetvisListen(portalfile);
+    }
+#endif
 
 #   if ZHLT_ZONES
         g_Zones = MakeZones();
@@ -2079,6 +2510,9 @@ int             main(const int argc, char** argv)
     }
 
     WriteBSPFile(source);
+#ifdef ZHLT_STAGECACHE
+    StageCacheStore();
+#endif
 
     end = I_FloatTime();
     LogTimeElapsed(end - start);
@@ -19,6 +19,7 @@
 #ifdef ZHLT_PARAMFILE
 #include "cmdlinecfg.h"
 #endif
+#include "stagecache.h"
 
 #ifdef HLVIS_MAXDIST    // AJM: MVD
 #define DEFAULT_MAXDISTANCE_RANGE   0
@@ -85,12 +86,58 @@ typedef struct
     byte*           mightsee;
     unsigned        nummightsee;
     int             numcansee;
+#ifdef HLVIS_NETVIS
+    int             rank;                                  // position in the PortalFlow order
+#endif
 #ifdef ZHLT_NETVIS
     int             fromclient;                            // which client did this come from
 #endif
     UINT32          zone;                                  // Which zone is this portal a member of
 } portal_t;
 
+// =====================================================================================
+//  GetPortalStatus / SetPortalDone
+//      stat_done is stored with release and read with acquire, so a thread that sees a
+//      portal as done also sees the visbits that were written before it. In netvis runs
+//      SetPortalDone also wakes the threads waiting for the portal.
+// =====================================================================================
+#ifdef HLVIS_NETVIS
+extern void     NetvisSignal();
+#endif
+
+#ifdef __GNUC__
+inline vstatus_t GetPortalStatus(const portal_t* const p)
+{
+    return __atomic_load_n(&p->status, __ATOMIC_ACQUIRE);
+}
+
+inline void     SetPortalDone(portal_t* const p)
+{
+    __atomic_store_n(&p->status, stat_done, __ATOMIC_RELEASE);
+#ifdef HLVIS_NETVIS
+    NetvisSignal();
+#endif
+}
+#else
+#include <atomic>
+
+inline vstatus_t GetPortalStatus(const portal_t* const p)
+{
+    const vstatus_t status = *(volatile const vstatus_t*)&p->status;
+    std::atomic_thread_fence(std::memory_order_acquire);
+    return status;
+}
+
+inline void     SetPortalDone(portal_t* const p)
+{
+    std::atomic_thread_fence(std::memory_order_release);
+    *(volatile vstatus_t*)&p->status = stat_done;
+#ifdef HLVIS_NETVIS
+    NetvisSignal();
+#endif
+}
+#endif
+
 typedef struct seperating_plane_s
 {
     struct seperating_plane_s* next;
@@ -224,6 +271,10 @@ extern void     BasePortalVis(int threadnum);
 extern visblocker_t *GetVisBlock(char *name);
 extern void		BlockVis(int unused);
 #endif
+#ifdef HLVIS_MAXDIST_NEW
+extern void		PrepareMaxDistVis();
+extern void		FreeMaxDistVis();
+#endif
 extern void		MaxDistVis(int threadnum);
 //extern void		PostMaxDistVis(int threadnum);
 #endif
@@ -231,6 +282,26 @@ extern void		MaxDistVis(int threadnum);
 extern void     PortalFlow(portal_t* p);
 extern void     CalcAmbientSounds();
 
+extern void     LoadPortals(char* portal_image, const int size);
+extern portal_t* ClaimNextPortal();
+
+#ifdef HLVIS_NETVIS
+extern const char* g_netvis_listen;
+extern const char* g_netvis_worker;
+extern bool     g_netvis_ranked;
+
+extern void     RankPortals();
+
+extern void     NetvisListen(const char* const portalfile);
+extern void     NetvisBeginFlow();
+extern void     NetvisEndFlow();
+extern bool     NetvisServe(const int threadnum);
+extern portal_t* NetvisNextPortal();
+extern void     NetvisWaitForPortal(portal_t* const p);
+extern void     NetvisPortalDone(const portal_t* const p);
+extern void     RunNetvisWorker();
+#endif
+
 #ifdef ZHLT_NETVIS
 #include "packet.h"
 #include "c2cpp.h"